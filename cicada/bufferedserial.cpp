@@ -24,9 +24,12 @@
 #include "cicada/bufferedserial.h"
 #include "cicada/irq.h"
 #include <cstdint>
+#include <cstring>
 
 using namespace Cicada;
 
+const Size WRITE_BLOCK_SIZE = 32;
+
 BufferedSerial::BufferedSerial(
     char* readBuffer, char* writeBuffer, Size readBufferSize, Size writeBufferSize) :
     _readBuffer(readBuffer, readBufferSize), _writeBuffer(writeBuffer, writeBufferSize)
@@ -84,10 +87,19 @@ Size BufferedSerial::write(const uint8_t* data, Size size)
     if (size > space)
         size = space;
 
+    // Copy whole blocks with interrupts disabled, but not so many bytes
+    // that the receive interrupt has to wait for too long
     Size writeCount = 0;
 
     while (writeCount < size) {
-        copyToBuffer(data[writeCount++]);
+        Size blockSize = size - writeCount;
+        if (blockSize > WRITE_BLOCK_SIZE)
+            blockSize = WRITE_BLOCK_SIZE;
+
+        eDisableInterrupts();
+        _writeBuffer.push((const char*)data + writeCount, blockSize);
+        eEnableInterrupts();
+        writeCount += blockSize;
     }
 
     startTransmit();
@@ -97,17 +109,7 @@ Size BufferedSerial::write(const uint8_t* data, Size size)
 
 Size BufferedSerial::write(const uint8_t* data)
 {
-    Size space = spaceAvailable();
-
-    Size writeCount = 0;
-
-    while (data[writeCount] != '\0' && writeCount < space) {
-        copyToBuffer(data[writeCount++]);
-    }
-
-    startTransmit();
-
-    return writeCount;
+    return write(data, strlen((const char*)data));
 }
 
 void BufferedSerial::write(uint8_t data)
@@ -171,7 +173,8 @@ Size BufferedSerial::writeBufferSize()
 void BufferedSerial::transferToAndFromBuffer()
 {
     uint8_t data;
-    if (rawRead(data) && !_readBuffer.isFull()) {
+    // With flow control, leave data in the device until there is space again
+    if (!(_readBuffer.isFull() && flowControl()) && rawRead(data) && !_readBuffer.isFull()) {
         _readBuffer.push(data);
     }
 
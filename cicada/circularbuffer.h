@@ -136,6 +136,51 @@ template <typename T> class CircularBuffer
         return _buffer[_readHead];
     }
 
+    /*!
+     * Copies data from the buffer without removing them.
+     * \param data Pointer where copied data will be stored
+     * \param size Maximum number of elements to copy
+     * \param offset Number of elements to skip from the read head
+     * \return Actual number of elements copied
+     */
+    virtual Size peek(T* data, Size size, Size offset = 0) const
+    {
+        if (offset >= bytesAvailable())
+            return 0;
+        if (size > bytesAvailable() - offset)
+            size = bytesAvailable() - offset;
+
+        Size head = _readHead + offset;
+        if (head >= _bufferSize)
+            head -= _bufferSize;
+
+        for (Size i = 0; i < size; i++) {
+            data[i] = _buffer[head];
+            if (++head >= _bufferSize)
+                head = 0;
+        }
+
+        return size;
+    }
+
+    /*!
+     * Removes elements from the buffer without copying them.
+     * \param num Maximum number of elements to remove
+     * \return Actual number of elements removed
+     */
+    virtual Size skip(Size num)
+    {
+        if (num > bytesAvailable())
+            num = bytesAvailable();
+
+        _readHead += num;
+        if (_readHead >= _bufferSize)
+            _readHead -= _bufferSize;
+        _availableData -= num;
+
+        return num;
+    }
+
     /*!
      * Empties the buffer by resetting all counters to zero.
      */
@@ -0,0 +1,575 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "cicada/cmux.h"
+#include <cstring>
+
+using namespace Cicada;
+
+#define CMUX_FLAG 0xF9
+#define CMUX_EA 0x01
+#define CMUX_CR 0x02
+#define CMUX_PF 0x10
+
+#define CMUX_SABM 0x2F
+#define CMUX_UA 0x63
+#define CMUX_DM 0x0F
+#define CMUX_DISC 0x43
+#define CMUX_UIH 0xEF
+#define CMUX_UI 0x03
+
+#define CMUX_MSC 0xE0
+#define CMUX_CLD 0xC0
+#define CMUX_MSC_FC 0x02
+#define CMUX_MSC_SIGNALS 0x8D
+
+#define CMUX_T1 300
+#define CMUX_AT_TIMEOUT 1000
+#define CMUX_N2 3
+
+static uint8_t cmuxCrc(uint8_t crc, const uint8_t* data, Size length)
+{
+    // Reversed CRC-8 with polynomial x^8 + x^2 + x + 1, see 3GPP TS 27.010 annex B
+    while (length--) {
+        crc ^= *data++;
+        for (uint8_t i = 0; i < 8; i++) {
+            crc = (crc & 0x01) ? (crc >> 1) ^ 0xE0 : crc >> 1;
+        }
+    }
+
+    return crc;
+}
+
+static uint8_t cmuxFcs(
+    const uint8_t* header, uint8_t headerLength, const uint8_t* info, Size length)
+{
+    // UI frames cover the information field as well, all others only the header
+    uint8_t crc = cmuxCrc(0xFF, header, headerLength);
+    if ((header[1] & ~CMUX_PF) == CMUX_UI) {
+        crc = cmuxCrc(crc, info, length);
+    }
+
+    return 0xFF - crc;
+}
+
+CmuxChannel::CmuxChannel(
+    char* readBuffer, char* writeBuffer, Size readBufferSize, Size writeBufferSize) :
+    BufferedSerial(readBuffer, writeBuffer, readBufferSize, writeBufferSize),
+    _mux(NULL),
+    _dlci(0),
+    _state(closed),
+    _retries(0),
+    _tick(0),
+    _localFlowStopped(false),
+    _remoteFlowStopped(false)
+{}
+
+CmuxChannel::CmuxChannel(char* readBuffer, char* writeBuffer, Size bufferSize) :
+    BufferedSerial(readBuffer, writeBuffer, bufferSize),
+    _mux(NULL),
+    _dlci(0),
+    _state(closed),
+    _retries(0),
+    _tick(0),
+    _localFlowStopped(false),
+    _remoteFlowStopped(false)
+{}
+
+bool CmuxChannel::open()
+{
+    if (_mux == NULL)
+        return false;
+
+    if (_state == closed) {
+        _state = openRequested;
+    }
+
+    return true;
+}
+
+bool CmuxChannel::isOpen()
+{
+    return _state == opened;
+}
+
+bool CmuxChannel::setSerialConfig(uint32_t, uint8_t)
+{
+    return true;
+}
+
+void CmuxChannel::close()
+{
+    if (_state == openRequested) {
+        _state = closed;
+    } else if (_state == opening || _state == opened) {
+        _state = closeRequested;
+    }
+}
+
+const char* CmuxChannel::portName() const
+{
+    return NULL;
+}
+
+bool CmuxChannel::writeBufferProcessed() const
+{
+    return _writeBuffer.isEmpty();
+}
+
+uint8_t CmuxChannel::dlci() const
+{
+    return _dlci;
+}
+
+bool CmuxChannel::rawRead(uint8_t&)
+{
+    // Data are passed on by the multiplexer
+    return false;
+}
+
+bool CmuxChannel::rawWrite(uint8_t)
+{
+    return false;
+}
+
+void CmuxChannel::startTransmit() {}
+
+Cmux::Cmux(IBufferedSerial& serial) :
+    _serial(serial),
+    _numChannels(0),
+    _nextChannel(0),
+    _state(idle),
+    _retries(0),
+    _parseState(parseFlag),
+    _rxHeaderLength(0),
+    _rxLength(0),
+    _rxFill(0)
+{}
+
+bool Cmux::addChannel(CmuxChannel& channel)
+{
+    if (_numChannels == E_CMUX_MAX_CHANNELS || channel._mux)
+        return false;
+
+    channel._mux = this;
+    channel._dlci = _numChannels + 1;
+    _channels[_numChannels++] = &channel;
+
+    return true;
+}
+
+void Cmux::start()
+{
+    if (_state == idle || _state == errorState) {
+        _retries = 0;
+        _state = sendCmux;
+    }
+}
+
+void Cmux::stop()
+{
+    if (_state == started) {
+        // Close down the multiplexer, which closes all channels as well
+        const uint8_t cld[] = { CMUX_CLD | CMUX_CR | CMUX_EA, CMUX_EA };
+        writeFrame(0, CMUX_UIH, true, cld, sizeof(cld));
+    }
+
+    for (uint8_t i = 0; i < _numChannels; i++) {
+        _channels[i]->_state = CmuxChannel::closed;
+    }
+    _parseState = parseFlag;
+    _state = idle;
+}
+
+bool Cmux::isStarted() const
+{
+    return _state == started;
+}
+
+bool Cmux::hasError() const
+{
+    return _state == errorState;
+}
+
+CmuxChannel* Cmux::channel(uint8_t dlci)
+{
+    for (uint8_t i = 0; i < _numChannels; i++) {
+        if (_channels[i]->_dlci == dlci)
+            return _channels[i];
+    }
+
+    return NULL;
+}
+
+bool Cmux::writeFrame(uint8_t dlci, uint8_t control, bool command, const uint8_t* info, Size length)
+{
+    if (_serial.spaceAvailable() < length + 7)
+        return false;
+
+    uint8_t header[4];
+    uint8_t headerLength = 3;
+    header[0] = (dlci << 2) | (command ? CMUX_CR : 0) | CMUX_EA;
+    header[1] = control;
+    if (length > 127) {
+        header[2] = (length & 0x7F) << 1;
+        header[3] = length >> 7;
+        headerLength = 4;
+    } else {
+        header[2] = (length << 1) | CMUX_EA;
+    }
+
+    _serial.write((uint8_t)CMUX_FLAG);
+    _serial.write(header, headerLength);
+    if (length > 0) {
+        _serial.write(info, length);
+    }
+    _serial.write(cmuxFcs(header, headerLength, info, length));
+    _serial.write((uint8_t)CMUX_FLAG);
+
+    return true;
+}
+
+bool Cmux::writeMsc(uint8_t dlci, bool flowStopped)
+{
+    const uint8_t msc[] = { CMUX_MSC | CMUX_CR | CMUX_EA, (2 << 1) | CMUX_EA,
+        (uint8_t)((dlci << 2) | CMUX_CR | CMUX_EA),
+        (uint8_t)(CMUX_MSC_SIGNALS | (flowStopped ? CMUX_MSC_FC : 0)) };
+
+    return writeFrame(0, CMUX_UIH, true, msc, sizeof(msc));
+}
+
+void Cmux::run()
+{
+    // If the serial device is not yet open, try to open it
+    if (!_serial.isOpen()) {
+        if (!_serial.open()) {
+            _state = errorState;
+        }
+        return;
+    }
+
+    switch (_state) {
+    case idle:
+    case errorState:
+        setDelay(10);
+        return;
+
+    case sendCmux:
+        _serial.flushReceiveBuffers();
+        _serial.write((const uint8_t*)"AT+CMUX=0\r\n");
+        resetTimeout();
+        startTimeout();
+        _state = waitCmux;
+        setDelay(10);
+        return;
+
+    case waitCmux:
+        while (_serial.canReadLine()) {
+            char line[16];
+            _serial.readLine((uint8_t*)line, sizeof(line));
+            if (strncmp(line, "OK", 2) == 0) {
+                _retries = 0;
+                _state = sendSabm;
+                break;
+            } else if (strncmp(line, "ERROR", 5) == 0) {
+                _state = errorState;
+                return;
+            }
+        }
+        if (_state == waitCmux) {
+            if (isTimeout(CMUX_AT_TIMEOUT)) {
+                _state = ++_retries < CMUX_N2 ? sendCmux : errorState;
+            }
+            return;
+        }
+        break;
+
+    case sendSabm:
+        // Open the control channel
+        if (writeFrame(0, CMUX_SABM | CMUX_PF, true)) {
+            resetTimeout();
+            startTimeout();
+            _state = waitUa;
+        }
+        break;
+
+    case waitUa:
+        if (isTimeout(CMUX_T1)) {
+            _state = ++_retries < CMUX_N2 ? sendSabm : errorState;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    // Pass frames on to the channels
+    while (_serial.bytesAvailable()) {
+        parse(_serial.read());
+    }
+
+    if (_state != started || _numChannels == 0)
+        return;
+
+    // Send pending data, one frame per channel in turn
+    bool sent = true;
+    while (sent && _serial.spaceAvailable() >= E_CMUX_FRAME_SIZE + 7) {
+        sent = false;
+        for (uint8_t i = 0; i < _numChannels; i++) {
+            sent |= runChannel(*_channels[(_nextChannel + i) % _numChannels]);
+        }
+        _nextChannel = (_nextChannel + 1) % _numChannels;
+    }
+
+    setDelay(0);
+}
+
+bool Cmux::runChannel(CmuxChannel& channel)
+{
+    switch (channel._state) {
+    case CmuxChannel::openRequested:
+        if (writeFrame(channel._dlci, CMUX_SABM | CMUX_PF, true)) {
+            channel._retries = 0;
+            channel._tick = lastRun();
+            channel._state = CmuxChannel::opening;
+        }
+        break;
+
+    case CmuxChannel::closeRequested:
+        if (writeFrame(channel._dlci, CMUX_DISC | CMUX_PF, true)) {
+            channel._retries = 0;
+            channel._tick = lastRun();
+            channel._state = CmuxChannel::closing;
+        }
+        break;
+
+    case CmuxChannel::opening:
+    case CmuxChannel::closing:
+        // Repeat the command if the modem didn't reply
+        if (lastRun() - channel._tick > CMUX_T1) {
+            if (++channel._retries == CMUX_N2) {
+                channel._state = CmuxChannel::closed;
+            } else {
+                uint8_t control = channel._state == CmuxChannel::opening ? CMUX_SABM : CMUX_DISC;
+                writeFrame(channel._dlci, control | CMUX_PF, true);
+                channel._tick = lastRun();
+            }
+        }
+        break;
+
+    case CmuxChannel::opened: {
+        // Ask the modem to pause while the read buffer runs low on space
+        Size size = channel._readBuffer.size();
+        Size low = 2 * E_CMUX_FRAME_SIZE < size / 4 ? 2 * E_CMUX_FRAME_SIZE : size / 4;
+        Size high = 4 * E_CMUX_FRAME_SIZE < size / 2 ? 4 * E_CMUX_FRAME_SIZE : size / 2;
+        Size space = channel._readBuffer.spaceAvailable();
+        if (!channel._localFlowStopped && space <= low) {
+            channel._localFlowStopped = writeMsc(channel._dlci, true);
+        } else if (channel._localFlowStopped && space > high) {
+            channel._localFlowStopped = !writeMsc(channel._dlci, false);
+        }
+
+        if (channel._remoteFlowStopped || channel._writeBuffer.isEmpty())
+            break;
+
+        uint8_t info[E_CMUX_FRAME_SIZE];
+        Size length = channel._writeBuffer.pull((char*)info, sizeof(info));
+        writeFrame(channel._dlci, CMUX_UIH, true, info, length);
+        return true;
+    }
+
+    default:
+        break;
+    }
+
+    return false;
+}
+
+void Cmux::parse(uint8_t data)
+{
+    switch (_parseState) {
+    case parseFlag:
+        if (data == CMUX_FLAG) {
+            _parseState = parseAddress;
+        }
+        break;
+
+    case parseAddress:
+        // Skip repeated flags
+        if (data != CMUX_FLAG) {
+            _rxHeader[0] = data;
+            _rxHeaderLength = 1;
+            _parseState = parseControl;
+        }
+        break;
+
+    case parseControl:
+        _rxHeader[_rxHeaderLength++] = data;
+        _parseState = parseLength;
+        break;
+
+    case parseLength:
+    case parseLength2:
+        _rxHeader[_rxHeaderLength++] = data;
+        if (_parseState == parseLength) {
+            _rxLength = data >> 1;
+            if (!(data & CMUX_EA)) {
+                _parseState = parseLength2;
+                break;
+            }
+        } else {
+            _rxLength |= (Size)data << 7;
+        }
+
+        _rxFill = 0;
+        if (_rxLength > E_CMUX_FRAME_SIZE) {
+            // Frame too large, search for the next one
+            _parseState = parseFlag;
+        } else if (_rxLength > 0) {
+            _parseState = parseInfo;
+        } else {
+            _parseState = parseFcs;
+        }
+        break;
+
+    case parseInfo:
+        _rxInfo[_rxFill++] = data;
+        if (_rxFill == _rxLength) {
+            _parseState = parseFcs;
+        }
+        break;
+
+    case parseFcs:
+        _parseState = data == cmuxFcs(_rxHeader, _rxHeaderLength, _rxInfo, _rxLength)
+            ? parseEndFlag
+            : parseFlag;
+        break;
+
+    case parseEndFlag:
+        if (data == CMUX_FLAG) {
+            handleFrame();
+            // The closing flag may be the opening flag of the next frame as well
+            _parseState = parseAddress;
+        } else {
+            _parseState = parseFlag;
+        }
+        break;
+    }
+}
+
+void Cmux::handleFrame()
+{
+    uint8_t dlci = _rxHeader[0] >> 2;
+    uint8_t control = _rxHeader[1] & ~CMUX_PF;
+
+    if (dlci == 0) {
+        if (control == CMUX_UA && _state == waitUa) {
+            _state = started;
+        } else if (control == CMUX_DM && _state == waitUa) {
+            _state = errorState;
+        } else if (control == CMUX_UIH || control == CMUX_UI) {
+            handleControlMessage();
+        } else if (control == CMUX_DISC) {
+            writeFrame(0, CMUX_UA | CMUX_PF, false);
+            stop();
+        }
+        return;
+    }
+
+    CmuxChannel* ch = channel(dlci);
+    if (ch == NULL) {
+        if (control == CMUX_SABM) {
+            writeFrame(dlci, CMUX_DM | CMUX_PF, false);
+        }
+        return;
+    }
+
+    switch (control) {
+    case CMUX_UA:
+        if (ch->_state == CmuxChannel::opening) {
+            // Forces sending the modem status once the channel is open
+            ch->_localFlowStopped = true;
+            ch->_remoteFlowStopped = false;
+            ch->_state = CmuxChannel::opened;
+        } else if (ch->_state == CmuxChannel::closing) {
+            ch->_state = CmuxChannel::closed;
+        }
+        break;
+
+    case CMUX_DM:
+        ch->_state = CmuxChannel::closed;
+        break;
+
+    case CMUX_SABM:
+        writeFrame(dlci, CMUX_UA | CMUX_PF, false);
+        ch->_state = CmuxChannel::opened;
+        break;
+
+    case CMUX_DISC:
+        writeFrame(dlci, CMUX_UA | CMUX_PF, false);
+        ch->_state = CmuxChannel::closed;
+        break;
+
+    case CMUX_UIH:
+    case CMUX_UI:
+        if (ch->_state == CmuxChannel::opened) {
+            ch->_readBuffer.push((const char*)_rxInfo, _rxLength);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+void Cmux::handleControlMessage()
+{
+    if (_rxLength < 2)
+        return;
+
+    // Only commands from the modem need handling, responses are not checked
+    uint8_t type = _rxInfo[0];
+    if (!(type & CMUX_CR))
+        return;
+
+    if ((type & ~(CMUX_CR | CMUX_EA)) == CMUX_MSC) {
+        if (_rxLength >= 4) {
+            CmuxChannel* ch = channel(_rxInfo[2] >> 2);
+            if (ch) {
+                ch->_remoteFlowStopped = _rxInfo[3] & CMUX_MSC_FC;
+            }
+        }
+
+        // Acknowledge with the same values
+        _rxInfo[0] &= ~CMUX_CR;
+        writeFrame(0, CMUX_UIH, true, _rxInfo, _rxLength);
+    } else if ((type & ~(CMUX_CR | CMUX_EA)) == CMUX_CLD) {
+        _rxInfo[0] &= ~CMUX_CR;
+        writeFrame(0, CMUX_UIH, true, _rxInfo, _rxLength);
+        for (uint8_t i = 0; i < _numChannels; i++) {
+            _channels[i]->_state = CmuxChannel::closed;
+        }
+        _parseState = parseFlag;
+        _state = idle;
+    }
+}
@@ -0,0 +1,197 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef CMUX_H
+#define CMUX_H
+
+#include "cicada/bufferedserial.h"
+#include "cicada/defines.h"
+#include "cicada/task.h"
+#include <cstddef>
+#include <stdint.h>
+
+#ifndef E_CMUX_MAX_CHANNELS
+#define E_CMUX_MAX_CHANNELS 3
+#endif
+
+#ifndef E_CMUX_FRAME_SIZE
+#define E_CMUX_FRAME_SIZE 31
+#endif
+
+namespace Cicada {
+
+class Cmux;
+
+/*!
+ * \class CmuxChannel
+ *
+ * Virtual serial port on top of a Cmux multiplexer. It can be used like
+ * any other serial device, for example by passing it to one of the modem
+ * drivers. open() requests the channel from the modem, isOpen() turns true
+ * as soon as the modem has accepted it. The serial configuration is the one
+ * of the underlying serial device, setSerialConfig() has no effect.
+ */
+class CmuxChannel : public BufferedSerial
+{
+  public:
+    CmuxChannel(char* readBuffer, char* writeBuffer, Size readBufferSize, Size writeBufferSize);
+    CmuxChannel(char* readBuffer, char* writeBuffer, Size bufferSize);
+
+    virtual bool open() override;
+    virtual bool isOpen() override;
+    virtual bool setSerialConfig(uint32_t baudRate, uint8_t dataBits) override;
+    virtual void close() override;
+    virtual const char* portName() const override;
+    virtual bool writeBufferProcessed() const override;
+
+    /*!
+     * \return The data link connection identifier of the channel, or 0 if the
+     * channel hasn't been added to a multiplexer.
+     */
+    uint8_t dlci() const;
+
+  protected:
+    virtual bool rawRead(uint8_t& data) override;
+    virtual bool rawWrite(uint8_t data) override;
+    virtual void startTransmit() override;
+
+  private:
+    friend class Cmux;
+
+    enum State { closed, openRequested, opening, opened, closeRequested, closing };
+
+    Cmux* _mux;
+    uint8_t _dlci;
+    State _state;
+    uint8_t _retries;
+    E_TICK_TYPE _tick;
+    bool _localFlowStopped;
+    bool _remoteFlowStopped;
+};
+
+/*!
+ * \class Cmux
+ *
+ * Multiplexer according to 3GPP TS 27.010 (GSM 07.10), basic option. It
+ * runs on top of the serial device the modem is connected to and provides
+ * several virtual serial ports, so independent users can talk to the modem
+ * at the same time. For example, a modem driver runs the data connection on
+ * one channel, while custom AT commands are sent on another one, without
+ * the need for serialLock() and without stalling the data transfer.
+ *
+ * start() switches the modem to multiplexer mode with "AT+CMUX=0" and
+ * opens the control channel. Channels are added with addChannel() before
+ * and get the DLCIs 1, 2, ... in the order they were added. Frames are sent
+ * round robin, one frame per channel at a time. When the read buffer of a
+ * channel runs low on space, the modem is asked to pause sending with
+ * the flow control bit of a modem status command.
+ *
+ * Note: Modem drivers must not restart the modem while running on a
+ * channel, as this also terminates the multiplexer.
+ */
+class Cmux : public Task
+{
+  public:
+    /*!
+     * \param serial Serial device the modem is connected to
+     */
+    Cmux(IBufferedSerial& serial);
+
+    /*!
+     * Adds a channel to the multiplexer. The number of channels is limited
+     * by E_CMUX_MAX_CHANNELS.
+     *
+     * \param channel Channel to add. Needs to be valid during the lifetime of
+     * the multiplexer.
+     * \return true if the channel was added
+     */
+    bool addChannel(CmuxChannel& channel);
+
+    /*!
+     * Switches the modem to multiplexer mode, which is performed in run().
+     */
+    void start();
+
+    /*!
+     * Closes all channels and switches the modem back to AT command mode.
+     */
+    void stop();
+
+    /*!
+     * \return true when the control channel is open and channels can be used
+     */
+    bool isStarted() const;
+
+    /*!
+     * \return true if the modem didn't switch to multiplexer mode
+     */
+    bool hasError() const;
+
+    /*!
+     * Performs the actual multiplexing. Reads frames from the serial device
+     * and passes the data on to the channels, and sends data written to the
+     * channels in frames.
+     */
+    virtual void run();
+
+  private:
+    enum State { idle, sendCmux, waitCmux, sendSabm, waitUa, started, errorState };
+
+    enum ParseState {
+        parseFlag,
+        parseAddress,
+        parseControl,
+        parseLength,
+        parseLength2,
+        parseInfo,
+        parseFcs,
+        parseEndFlag
+    };
+
+    bool runChannel(CmuxChannel& channel);
+    void parse(uint8_t data);
+    void handleFrame();
+    void handleControlMessage();
+    CmuxChannel* channel(uint8_t dlci);
+    bool writeFrame(
+        uint8_t dlci, uint8_t control, bool command, const uint8_t* info = NULL, Size length = 0);
+    bool writeMsc(uint8_t dlci, bool flowStopped);
+
+    IBufferedSerial& _serial;
+    CmuxChannel* _channels[E_CMUX_MAX_CHANNELS];
+    uint8_t _numChannels;
+    uint8_t _nextChannel;
+
+    State _state;
+    uint8_t _retries;
+
+    ParseState _parseState;
+    uint8_t _rxHeader[4];
+    uint8_t _rxHeaderLength;
+    Size _rxLength;
+    Size _rxFill;
+    uint8_t _rxInfo[E_CMUX_FRAME_SIZE];
+};
+}
+
+#endif
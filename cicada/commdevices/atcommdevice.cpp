@@ -22,28 +22,140 @@
  */
 
 #include "cicada/commdevices/atcommdevice.h"
+#include "cicada/commdevices/commandbuilder.h"
 #include "printf.h"
 #include <cinttypes>
 #include <cstddef>
 #include <cstring>
 
 #define MIN_SPACE_AVAILABLE 22
+#define CLOSED_STR_LENGTH 10
+#define CLOSE_MATCH_TIMEOUT 50
+#define RECEIVE_CHUNK_SIZE 32
+#define INITIAL_SEND_CHUNK_SIZE 256
+#define MIN_SEND_CHUNK_SIZE 64
+#define DEFAULT_MAX_SEND_CHUNK_SIZE 1024
+#define DEFAULT_RETRY_ATTEMPTS 2
+#define DEFAULT_RECOVERY_ATTEMPTS 1
+#define DEFAULT_SHORT_TIMEOUT 5000
+#define DEFAULT_DATA_TIMEOUT 30000
+#define DEFAULT_NETWORK_TIMEOUT 130000
+#define DEFAULT_RESTART_TIMEOUT 30000
 
 using namespace Cicada;
 
 const char* ATCommDevice::_okStr = "OK";
 const char* ATCommDevice::_lineEndStr = "\r\n";
 const char* ATCommDevice::_quoteEndStr = "\"\r\n";
+const char* ATCommDevice::_closedStr = "\r\nCLOSED\r\n";
 
 ATCommDevice::ATCommDevice(
     IBufferedSerial& serial, uint8_t* readBuffer, uint8_t* writeBuffer, Size bufferSize) :
-    IPCommDevice(readBuffer, writeBuffer, bufferSize), _serial(serial)
-{}
+    IPCommDevice(readBuffer, writeBuffer, bufferSize),
+    _serial(serial),
+    _options(0),
+    _guardTime(1000),
+    _closeMatch(0),
+    _caCert(NULL),
+    _caCertLength(0),
+    _caCertLoaded(false),
+    _maxSendChunkSize(DEFAULT_MAX_SEND_CHUNK_SIZE),
+    _sendChunkSize(INITIAL_SEND_CHUNK_SIZE),
+    _minChunkSize(0),
+    _flushDelay(0),
+    _maxChunksInFlight(0),
+    _chunksInFlight(0),
+    _commandStep(NULL),
+    _retryState(0),
+    _commandClass(shortCommand)
+{
+    resetSendStats();
+    resetRecoveryStats();
+    resetRecovery();
+
+    _recoveryAttempts[retryCommand] = DEFAULT_RETRY_ATTEMPTS;
+    for (uint8_t i = reopenSocket; i < hardReset; i++) {
+        _recoveryAttempts[i] = DEFAULT_RECOVERY_ATTEMPTS;
+    }
+
+    _commandTimeouts[shortCommand] = DEFAULT_SHORT_TIMEOUT;
+    _commandTimeouts[dataCommand] = DEFAULT_DATA_TIMEOUT;
+    _commandTimeouts[networkCommand] = DEFAULT_NETWORK_TIMEOUT;
+    _commandTimeouts[restartCommand] = DEFAULT_RESTART_TIMEOUT;
+}
 
 ATCommDevice::ATCommDevice(IBufferedSerial& serial, uint8_t* readBuffer, uint8_t* writeBuffer,
     Size readBufferSize, Size writeBufferSize) :
-    IPCommDevice(readBuffer, writeBuffer, readBufferSize, writeBufferSize), _serial(serial)
-{}
+    IPCommDevice(readBuffer, writeBuffer, readBufferSize, writeBufferSize),
+    _serial(serial),
+    _options(0),
+    _guardTime(1000),
+    _closeMatch(0),
+    _caCert(NULL),
+    _caCertLength(0),
+    _caCertLoaded(false),
+    _maxSendChunkSize(DEFAULT_MAX_SEND_CHUNK_SIZE),
+    _sendChunkSize(INITIAL_SEND_CHUNK_SIZE),
+    _minChunkSize(0),
+    _flushDelay(0),
+    _maxChunksInFlight(0),
+    _chunksInFlight(0),
+    _commandStep(NULL),
+    _retryState(0),
+    _commandClass(shortCommand)
+{
+    resetSendStats();
+    resetRecoveryStats();
+    resetRecovery();
+
+    _recoveryAttempts[retryCommand] = DEFAULT_RETRY_ATTEMPTS;
+    for (uint8_t i = reopenSocket; i < hardReset; i++) {
+        _recoveryAttempts[i] = DEFAULT_RECOVERY_ATTEMPTS;
+    }
+
+    _commandTimeouts[shortCommand] = DEFAULT_SHORT_TIMEOUT;
+    _commandTimeouts[dataCommand] = DEFAULT_DATA_TIMEOUT;
+    _commandTimeouts[networkCommand] = DEFAULT_NETWORK_TIMEOUT;
+    _commandTimeouts[restartCommand] = DEFAULT_RESTART_TIMEOUT;
+}
+
+void ATCommDevice::resetStates()
+{
+    _serial.flushReceiveBuffers();
+    _readBuffer.flush();
+    _writeBuffer.flush();
+    _lbFill = 0;
+    _sendState = 0;
+    _replyState = 0;
+    _commandStep = NULL;
+    _connectState = IPCommDevice::notConnected;
+    _bytesToWrite = 0;
+    _bytesToReceive = 0;
+    _bytesToRead = 0;
+    _waitForReply = NULL;
+    _stateBooleans = LINE_READ;
+    _rssi = 99;
+    _chunksInFlight = 0;
+    resetRecovery();
+}
+
+bool ATCommDevice::fillLineBuffer()
+{
+    // Buffer reply from modem in line buffer
+    // Returns true when enough data to be parsed is available.
+    if (_stateBooleans & LINE_READ) {
+        while (_serial.bytesAvailable()) {
+            char c = _serial.read();
+            _lineBuffer[_lbFill++] = c;
+            if (c == '\n' || c == '>' || _lbFill == LINE_MAX_LENGTH) {
+                _lineBuffer[_lbFill] = '\0';
+                _lbFill = 0;
+                return true;
+            }
+        }
+    }
+    return false;
+}
 
 void ATCommDevice::logStates(int8_t sendState, int8_t replyState)
 {
@@ -61,8 +173,35 @@ void ATCommDevice::logStates(int8_t sendState, int8_t replyState)
 #endif
 }
 
+Size ATCommDevice::readBufferSpace() const
+{
+    // Space for the data of the next chunk, which is a datagram with its header on UDP
+    Size space = receiveSpace();
+    if (_type == UDP) {
+        return space > DATAGRAM_HEADER_SIZE ? space - DATAGRAM_HEADER_SIZE : 0;
+    }
+
+    return space;
+}
+
+void ATCommDevice::beginReceive(Size length)
+{
+    // Datagrams keep their boundaries with a header in the read buffer,
+    // those which don't fit are dropped
+    if (_type == UDP && length > 0 && !pushDatagramHeader(length)) {
+        _stateBooleans |= DATAGRAM_DROP;
+    }
+
+    _bytesToRead += length;
+    _stateBooleans &= ~LINE_READ;
+}
+
 void ATCommDevice::flushReadBuffer()
 {
+    // A prefetched chunk is already on its way, receive it regularly first
+    if (_stateBooleans & RECEIVE_PREFETCH)
+        return;
+
     while (_bytesToRead && _serial.bytesAvailable()) {
         _serial.read();
         _bytesToRead--;
@@ -70,6 +209,7 @@ void ATCommDevice::flushReadBuffer()
     _bytesToReceive = 0;
 
     if (_bytesToRead == 0) {
+        _stateBooleans &= ~DATAGRAM_DROP;
         _stateBooleans |= LINE_READ;
     }
 }
@@ -91,59 +231,407 @@ bool ATCommDevice::handleConnect(int8_t nextState)
     if (_stateBooleans & CONNECT_PENDING) {
         _stateBooleans &= ~CONNECT_PENDING;
         _sendState = nextState;
+        _chunksInFlight = 0;
+
+        // Data of the previous connection would break the datagram headers on UDP
+        _readBuffer.flush();
+        _writeBuffer.flush();
+
+        return true;
+    }
+
+    return false;
+}
+
+bool ATCommDevice::sendPending()
+{
+    // The previous chunk has been acknowledged when the driver is back in connected state
+    if (_stateBooleans & SEND_ACTIVE) {
+        _stateBooleans &= ~SEND_ACTIVE;
+        resetRecovery();
+        _sendChunkSize *= 2;
+        if (_sendChunkSize > _maxSendChunkSize)
+            _sendChunkSize = _maxSendChunkSize;
+    }
+
+    Size bytesAvailable = _writeBuffer.bytesAvailable();
+    if (bytesAvailable == 0 || sendWindowFull())
+        return false;
+
+    // Datagrams are sent one by one anyway, holding them back doesn't save anything
+    if (_flushDelay == 0 || bytesAvailable >= _minChunkSize || bytesAvailable >= _sendChunkSize
+        || _writeBuffer.isFull() || (_stateBooleans & DISCONNECT_PENDING) || _type == UDP) {
+        _stateBooleans &= ~SEND_HELD;
+        return true;
+    }
+
+    // Hold back small amounts of data to send them together with later writes
+    if (!(_stateBooleans & SEND_HELD)) {
+        _stateBooleans |= SEND_HELD;
+        _holdTick = lastRun();
+        return false;
+    }
+
+    if (lastRun() - _holdTick >= _flushDelay) {
+        _stateBooleans &= ~SEND_HELD;
+        return true;
+    }
+
+    return false;
+}
+
+void ATCommDevice::sendFailed()
+{
+    if (_stateBooleans & SEND_ACTIVE) {
+        _stateBooleans &= ~SEND_ACTIVE;
+        _sendStats.failures++;
+        _sendChunkSize /= 2;
+        if (_sendChunkSize < MIN_SEND_CHUNK_SIZE)
+            _sendChunkSize = MIN_SEND_CHUNK_SIZE;
+    }
+}
+
+bool ATCommDevice::useQuickSend() const
+{
+    return _maxChunksInFlight > 0 && _type == TCP && !useTransparentMode();
+}
+
+bool ATCommDevice::sendWindowFull() const
+{
+    return useQuickSend() && _chunksInFlight >= _maxChunksInFlight;
+}
+
+void ATCommDevice::confirmChunks(uint8_t chunks, bool sent)
+{
+    if (chunks > _chunksInFlight)
+        chunks = _chunksInFlight;
+    _chunksInFlight -= chunks;
+
+    if (!sent)
+        _sendStats.failures += chunks;
+}
+
+ATCommDevice::RecoveryLevel ATCommDevice::escalateError(
+    RecoveryLevel minLevel, RecoveryLevel maxLevel)
+{
+    if (_recoveryLevel < minLevel) {
+        _recoveryLevel = minLevel;
+        _recoveryCount = 0;
+    }
+
+    // Move up the ladder when the attempts of the current level are used up
+    while (_recoveryLevel < hardReset && _recoveryCount >= _recoveryAttempts[_recoveryLevel]) {
+        _recoveryLevel++;
+        _recoveryCount = 0;
+    }
+
+    RecoveryLevel level = (RecoveryLevel)_recoveryLevel;
+    if (level > maxLevel) {
+        // Transient errors stay on the highest level allowed for them
+        level = maxLevel;
+    } else {
+        _recoveryCount++;
+    }
+
+    // The modem starts over after a hard reset
+    if (level == hardReset) {
+        resetRecovery();
+    }
+
+    _recoveryStats.attempts[level]++;
+
+    return level;
+}
+
+void ATCommDevice::resetRecovery()
+{
+    _recoveryLevel = retryCommand;
+    _recoveryCount = 0;
+}
+
+void ATCommDevice::handleError(RecoveryLevel, RecoveryLevel)
+{
+    // Drivers without a recovery ladder of their own reset their states
+    sendFailed();
+    _stateBooleans |= RESET_PENDING;
+    _connectState = generalError;
+    _waitForReply = NULL;
+}
+
+void ATCommDevice::setCommandClass(CommandClass commandClass)
+{
+    // A command chained while the previous reply is still pending gets a deadline of its own
+    _stateBooleans &= ~REPLY_TIMER;
+    _commandClass = commandClass;
+}
+
+bool ATCommDevice::replyPending()
+{
+    if (_waitForReply == NULL && _commandStep == NULL) {
+        _stateBooleans &= ~REPLY_TIMER;
+        _commandClass = shortCommand;
+        return false;
+    }
+
+    // The deadline starts with the first check after issuing the command
+    if (!(_stateBooleans & REPLY_TIMER)) {
+        _stateBooleans |= REPLY_TIMER;
+        _replyTick = lastRun();
+    } else if (lastRun() - _replyTick >= _commandTimeouts[_commandClass]) {
+        // Don't wait forever for a reply which got lost
+        _stateBooleans &= ~REPLY_TIMER;
+        _recoveryStats.timeouts[_commandClass]++;
+        _commandClass = shortCommand;
+        failCommand(retryCommand);
+    }
+
+    return true;
+}
+
+bool ATCommDevice::flowControlPending() const
+{
+    // The modem's flow control setting differs from the serial device's
+    return _serial.flowControl() != ((_stateBooleans & FLOW_CONTROL) != 0);
+}
+
+Size ATCommDevice::serialReceiveSpace(Size pending, Size margin) const
+{
+    // With flow control on both sides, the modem pauses while the serial buffer is full
+    if ((_stateBooleans & FLOW_CONTROL) && _serial.flowControl())
+        return useReceiveSink() ? receiveSpace() : _readBuffer.size();
+
+    Size size = _serial.readBufferSize();
+    if (pending + margin >= size)
+        return 0;
+
+    return size - pending - margin;
+}
 
+bool ATCommDevice::caCertificatePending() const
+{
+    return _type == SSL && _caCert && !_caCertLoaded;
+}
+
+bool ATCommDevice::sendCertificate()
+{
+    // Stream the certificate after the modem's prompt, _bytesToWrite holds the remaining size
+    Size bytesToWrite = _serial.spaceAvailable();
+    if (bytesToWrite > _bytesToWrite)
+        bytesToWrite = _bytesToWrite;
+
+    _serial.write((const uint8_t*)_caCert + _caCertLength - _bytesToWrite, bytesToWrite);
+    _bytesToWrite -= bytesToWrite;
+
+    if (_bytesToWrite == 0) {
+        setCommandClass(dataCommand);
         return true;
     }
 
     return false;
 }
 
-bool ATCommDevice::prepareSending(bool sendChannel)
+bool ATCommDevice::prepareSending(bool sendChannel, const char* cmd)
 {
     if (_serial.spaceAvailable() < MIN_SPACE_AVAILABLE)
         return false;
 
-    _bytesToWrite = _writeBuffer.bytesAvailable();
-    if (_bytesToWrite > _serial.spaceAvailable() - MIN_SPACE_AVAILABLE) {
-        _bytesToWrite = _serial.spaceAvailable() - MIN_SPACE_AVAILABLE;
+    if (_sendChunkSize > _maxSendChunkSize)
+        _sendChunkSize = _maxSendChunkSize;
+
+    // The payload is streamed by sendData(), so it isn't limited by the serial buffer
+    if (_type == UDP) {
+        // Each datagram is sent with a command of its own
+        _bytesToWrite = datagramSize(_writeBuffer);
+        if (_bytesToWrite == 0)
+            return false;
+        _writeBuffer.skip(DATAGRAM_HEADER_SIZE);
+    } else {
+        _bytesToWrite = _writeBuffer.bytesAvailable();
+        if (_bytesToWrite > _sendChunkSize) {
+            _bytesToWrite = _sendChunkSize;
+        }
     }
 
-    // cmd
-    _serial.write((const uint8_t*)"AT+CIPSEND=");
+    // cmd and length
+    CommandBuilder header(_serial);
+    header.append(cmd);
     if (sendChannel) {
-        _serial.write((const uint8_t*)"0,");
+        header.append("0,");
     }
+    header.appendNumber(_bytesToWrite);
+    _sendStats.overheadBytes += header.send();
 
-    // length
-    char sizeStr[6];
-    snprintf(sizeStr, sizeof(sizeStr), "%u", (int)_bytesToWrite);
-    _serial.write((const uint8_t*)sizeStr);
-
+    _sendStats.chunks++;
     _waitForReply = ">";
+    setCommandClass(dataCommand);
 
     return true;
 }
 
-void ATCommDevice::sendData()
+void ATCommDevice::writeSendHeader(const char* str)
+{
+    _sendStats.overheadBytes += _serial.write((const uint8_t*)str);
+}
+
+bool ATCommDevice::sendData()
 {
-    while (_bytesToWrite--) {
+    Size bytesToWrite = _serial.spaceAvailable();
+    if (bytesToWrite > _bytesToWrite)
+        bytesToWrite = _bytesToWrite;
+
+    _bytesToWrite -= bytesToWrite;
+    _sendStats.payloadBytes += bytesToWrite;
+    while (bytesToWrite--) {
         _serial.write(_writeBuffer.pull());
     }
+
+    if (_bytesToWrite == 0) {
+        _stateBooleans |= SEND_ACTIVE;
+        if (useQuickSend())
+            _chunksInFlight++;
+        setCommandClass(dataCommand);
+        return true;
+    }
+
+    return false;
 }
 
 bool ATCommDevice::receive()
 {
-    if (_serial.bytesAvailable() >= _bytesToRead) {
-        while (_bytesToRead) {
-            _readBuffer.push(_serial.read());
-            _bytesToRead--;
+    // Pass on data as they arrive, so the serial buffer is free for the next chunk
+    Size bytesToRead = _serial.bytesAvailable();
+    if (bytesToRead > _bytesToRead)
+        bytesToRead = _bytesToRead;
+
+    if (_stateBooleans & DATAGRAM_DROP) {
+        _bytesToRead -= bytesToRead;
+        while (bytesToRead--) {
+            _serial.read();
         }
-        _stateBooleans |= LINE_READ;
+    } else {
+        if (bytesToRead > receiveSpace())
+            bytesToRead = receiveSpace();
+
+        // Move the data in chunks, straight to the sink if there is one
+        uint8_t chunk[RECEIVE_CHUNK_SIZE];
+        while (bytesToRead) {
+            Size size = bytesToRead < RECEIVE_CHUNK_SIZE ? bytesToRead : RECEIVE_CHUNK_SIZE;
+            size = _serial.read(chunk, size);
+            if (size == 0)
+                break;
+
+            pushReceived(chunk, size);
+            _bytesToRead -= size;
+            bytesToRead -= size;
+        }
+    }
 
+    if (_bytesToRead == 0) {
+        _stateBooleans &= ~DATAGRAM_DROP;
+        _stateBooleans |= LINE_READ;
+        resetRecovery();
         return true;
-    } else {
+    }
+
+    return false;
+}
+
+bool ATCommDevice::commandModeRequested()
+{
+    return _rssi == INT16_MAX || (_stateBooleans & DISCONNECT_PENDING);
+}
+
+bool ATCommDevice::useTransparentMode() const
+{
+    return (_options & OPTION_TRANSPARENT) && _type == TCP;
+}
+
+bool ATCommDevice::usePushReceive() const
+{
+    return (_options & OPTION_PUSH_RECEIVE) && !useTransparentMode();
+}
+
+void ATCommDevice::enterDataMode()
+{
+    _closeMatch = 0;
+    _stateBooleans &= ~LINE_READ;
+    _stateBooleans |= DATA_MODE;
+}
+
+bool ATCommDevice::sendEscapeSequence()
+{
+    // Hand over any data which arrived before leaving data mode
+    if (!receiveDataMode())
         return false;
+
+    pushReceived((const uint8_t*)_closedStr, _closeMatch);
+    _closeMatch = 0;
+
+    _serial.write((const uint8_t*)"+++");
+    _stateBooleans &= ~DATA_MODE;
+    _stateBooleans |= LINE_READ;
+
+    return true;
+}
+
+bool ATCommDevice::transferDataMode()
+{
+    // Pass data from the write buffer directly to the modem
+    Size bytesToWrite = _serial.spaceAvailable();
+    if (bytesToWrite > _writeBuffer.bytesAvailable())
+        bytesToWrite = _writeBuffer.bytesAvailable();
+    while (bytesToWrite--) {
+        _serial.write(_writeBuffer.pull());
+    }
+
+    return receiveDataMode();
+}
+
+bool ATCommDevice::receiveDataMode()
+{
+    // Pass data from the modem to the read buffer. Characters which could be part
+    // of the modem's close notification are held back until they can be told apart.
+    uint8_t chunk[RECEIVE_CHUNK_SIZE];
+    Size fill = 0;
+    while (_serial.bytesAvailable() && receiveSpace() > fill + CLOSED_STR_LENGTH) {
+        if (fill + CLOSED_STR_LENGTH > RECEIVE_CHUNK_SIZE) {
+            pushReceived(chunk, fill);
+            fill = 0;
+        }
+
+        char c = _serial.read();
+        if (c == _closedStr[_closeMatch]) {
+            if (_closeMatch++ == 0) {
+                _closeMatchTick = lastRun();
+            }
+            if (_closeMatch == CLOSED_STR_LENGTH) {
+                pushReceived(chunk, fill);
+                _closeMatch = 0;
+                _stateBooleans &= ~(DATA_MODE | IP_CONNECTED);
+                _stateBooleans |= LINE_READ;
+                return false;
+            }
+        } else {
+            memcpy(chunk + fill, _closedStr, _closeMatch);
+            fill += _closeMatch;
+            if (c == _closedStr[0]) {
+                _closeMatch = 1;
+                _closeMatchTick = lastRun();
+            } else {
+                _closeMatch = 0;
+                chunk[fill++] = c;
+            }
+        }
+    }
+    pushReceived(chunk, fill);
+
+    // The notification arrives in one piece, so don't hold back data for too long
+    if (_closeMatch && lastRun() - _closeMatchTick > CLOSE_MATCH_TIMEOUT) {
+        pushReceived((const uint8_t*)_closedStr, _closeMatch);
+        _closeMatch = 0;
     }
+
+    return true;
 }
 
 void ATCommDevice::sendCommand(const char* cmd)
@@ -152,6 +640,95 @@ void ATCommDevice::sendCommand(const char* cmd)
     _serial.write((const uint8_t*)_lineEndStr);
 }
 
+bool ATCommDevice::runCommandStep(const CommandStep* steps, uint8_t numSteps)
+{
+    for (uint8_t i = 0; i < numSteps; i++) {
+        const CommandStep& step = steps[i];
+        if (step.state != _sendState)
+            continue;
+
+        _connectState = IPCommDevice::intermediate;
+        _waitForReply = step.reply ? step.reply : _okStr;
+        _sendState = step.nextState;
+        if (step.writer) {
+            // The writer may branch off to another state or skip the command
+            if (!(this->*step.writer)()) {
+                _waitForReply = NULL;
+                return true;
+            }
+        } else {
+            sendCommand(step.command);
+        }
+
+        _commandStep = &step;
+        setCommandClass((CommandClass)step.commandClass);
+        return true;
+    }
+
+    return false;
+}
+
+bool ATCommDevice::parseStepReply()
+{
+    if (_commandStep == NULL)
+        return true;
+
+    StepReply reply = replyComplete;
+    if (_commandStep->parser) {
+        reply = (this->*_commandStep->parser)();
+    }
+
+    if (reply == replyFailed) {
+        failCommand(retryCommand);
+        return false;
+    }
+
+    if (reply == replyComplete && _waitForReply == NULL) {
+        _commandStep = NULL;
+    }
+
+    return true;
+}
+
+void ATCommDevice::failCommand(RecoveryLevel minLevel, RecoveryLevel maxLevel)
+{
+    const CommandStep* step = _commandStep;
+    _commandStep = NULL;
+
+    if (step && step->failState != useRecovery) {
+        _waitForReply = NULL;
+        _sendState = step->failState;
+        return;
+    }
+
+    handleError(minLevel, maxLevel);
+}
+
+bool ATCommDevice::sendCiprcvdata(Size maxLength)
+{
+    // Make sure there is enough space in the serial buffer for the reply
+    Size bytesToReceive = serialReceiveSpace(_serial.bytesAvailable(), 30);
+    if (bytesToReceive > 0 && readBufferSpace() > 0) {
+        if (bytesToReceive > _bytesToReceive)
+            bytesToReceive = _bytesToReceive;
+        // Make sure there is enough space in the local device buffer
+        if (bytesToReceive > readBufferSpace())
+            bytesToReceive = readBufferSpace();
+        if (bytesToReceive > maxLength)
+            bytesToReceive = maxLength;
+
+        CommandBuilder(_serial)
+            .append("AT+CIPRECVDATA=")
+            .appendNumber(bytesToReceive)
+            .append(_lineEndStr)
+            .send();
+        setCommandClass(dataCommand);
+        return true;
+    } else {
+        return false;
+    }
+}
+
 Size ATCommDevice::serialWrite(char* data)
 {
     if (_stateBooleans & SERIAL_LOCKED) {
@@ -179,3 +756,96 @@ int16_t ATCommDevice::getRSSI()
 {
     return _rssi;
 }
+
+void ATCommDevice::setTransparentMode(bool enabled)
+{
+    if (enabled) {
+        _options |= OPTION_TRANSPARENT;
+    } else {
+        _options &= ~OPTION_TRANSPARENT;
+    }
+}
+
+void ATCommDevice::setPushReceive(bool enabled)
+{
+    if (enabled) {
+        _options |= OPTION_PUSH_RECEIVE;
+    } else {
+        _options &= ~OPTION_PUSH_RECEIVE;
+    }
+}
+
+void ATCommDevice::setQuickSend(uint8_t maxChunksInFlight)
+{
+    _maxChunksInFlight = maxChunksInFlight;
+}
+
+void ATCommDevice::setCaCertificate(const char* cert, Size length)
+{
+    _caCert = cert;
+    _caCertLength = length;
+    _caCertLoaded = false;
+}
+
+void ATCommDevice::setEscapeGuardTime(uint16_t guardTime)
+{
+    _guardTime = guardTime;
+}
+
+void ATCommDevice::setSendCoalescing(uint16_t flushDelay, Size minChunkSize)
+{
+    _flushDelay = flushDelay;
+    _minChunkSize = minChunkSize;
+}
+
+Size ATCommDevice::maxDatagramSize() const
+{
+    Size size = IPCommDevice::maxDatagramSize();
+
+    return size < _maxSendChunkSize ? size : _maxSendChunkSize;
+}
+
+Size ATCommDevice::sendChunkSize() const
+{
+    return _sendChunkSize;
+}
+
+const ATCommDevice::SendStats& ATCommDevice::sendStats() const
+{
+    return _sendStats;
+}
+
+uint32_t ATCommDevice::sendOverheadRatio() const
+{
+    if (_sendStats.payloadBytes == 0)
+        return 0;
+
+    return (uint64_t)_sendStats.overheadBytes * 1000 / _sendStats.payloadBytes;
+}
+
+void ATCommDevice::resetSendStats()
+{
+    memset(&_sendStats, 0, sizeof(_sendStats));
+}
+
+void ATCommDevice::setCommandTimeout(CommandClass commandClass, uint32_t timeout)
+{
+    _commandTimeouts[commandClass] = timeout;
+}
+
+void ATCommDevice::setRecoveryAttempts(RecoveryLevel level, uint8_t attempts)
+{
+    if (level < hardReset) {
+        _recoveryAttempts[level] = attempts;
+    }
+}
+
+const ATCommDevice::RecoveryStats& ATCommDevice::recoveryStats() const
+{
+    return _recoveryStats;
+}
+
+void ATCommDevice::resetRecoveryStats()
+{
+    memset(&_recoveryStats, 0, sizeof(_recoveryStats));
+}
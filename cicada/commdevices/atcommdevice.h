@@ -30,6 +30,10 @@
 
 #define LINE_MAX_LENGTH 60
 
+#define OPTION_TRANSPARENT (1 << 0)
+#define OPTION_PUSH_RECEIVE (1 << 1)
+#define OPTION_KEEP_BEARER (1 << 2)
+
 namespace Cicada {
 
 /*!
@@ -45,6 +49,13 @@ class ATCommDevice : public IPCommDevice
         Size readBufferSize, Size writeBufferSize);
     virtual ~ATCommDevice() {}
 
+    /*!
+     * Resets the states shared by all AT command drivers, which drop the
+     * connection and start over with the modem's configuration. Drivers
+     * with states of their own extend this function.
+     */
+    virtual void resetStates();
+
     /*!
      * The purpose of this function is to send custom AT commands to the modem.
      * To do so, first lock the serial device for the modem driver by calling
@@ -86,13 +97,290 @@ class ATCommDevice : public IPCommDevice
      */
     int16_t getRSSI();
 
+    /*!
+     * Enables or disables transparent (passthrough) data mode. In transparent
+     * mode, the serial line carries the raw TCP stream after the modem replied
+     * with CONNECT, without AT framing for each chunk of data. To query the
+     * RSSI or ID strings, or to disconnect, the driver temporarily escapes to
+     * command mode with the "+++" sequence and returns to data mode afterwards.
+     * Transparent mode is only used for TCP connections, other connection types
+     * fall back to normal mode. Needs to be set before connect() is called.
+     *
+     * Note: The driver detects a connection close by the peer by the "CLOSED"
+     * notification of the modem. If the payload itself contains the sequence
+     * "\r\nCLOSED\r\n", it will be mistaken for a connection close.
+     *
+     * \param enabled true to enable transparent mode, false to disable it
+     */
+    void setTransparentMode(bool enabled);
+
+    /*!
+     * Sets the guard time, which is the idle time on the serial line
+     * required before and after sending the "+++" escape sequence.
+     * The default is 1000ms.
+     *
+     * \param guardTime Guard time in milliseconds
+     */
+    void setEscapeGuardTime(uint16_t guardTime);
+
+    /*!
+     * Enables or disables push receive mode. By default, the driver polls
+     * the modem for received data with a command for each chunk. In push
+     * receive mode, the modem sends received data to the serial line on its
+     * own, and the driver passes them on to the read buffer without any
+     * commands. Needs to be set before connect() is called, and has no effect
+     * in transparent mode.
+     *
+     * Note: When the read buffer is full, the driver stops reading pushed
+     * data from the serial device. Without hardware flow control between the
+     * serial device and the modem, the serial buffer overflows and data are
+     * lost if the application does not read fast enough. Keep push receive
+     * disabled to use polling in that case, where the driver only requests
+     * as much data as fit into the buffers. If flow control is enabled on
+     * the serial device with ISerial::setFlowControl(), the SIM7x00, SIM800
+     * and Espressif drivers enable it on the modem as well when connecting.
+     *
+     * \param enabled true to enable push receive mode, false to disable it
+     */
+    void setPushReceive(bool enabled);
+
+    /*!
+     * Sets the CA certificate used by the modem to verify the server of
+     * SSL connections. The certificate is not copied, the buffer must stay
+     * valid during the lifetime of the driver. It is uploaded to the modem
+     * once, on the first SSL connection after this function has been called.
+     * Without a certificate, the server is not verified.
+     *
+     * The format of the certificate depends on the modem: PEM for SIM7x00
+     * and SIM800 modems, and an image of the client_ca partition for
+     * Espressif modules (ESP-AT 2.x).
+     *
+     * \param cert Buffer containing the certificate
+     * \param length Size of the certificate in bytes
+     */
+    void setCaCertificate(const char* cert, Size length);
+
+    /*!
+     * Statistics about data sent in normal (non-transparent) mode.
+     */
+    struct SendStats {
+        uint32_t payloadBytes;  /**< Payload bytes passed to the modem */
+        uint32_t overheadBytes; /**< AT command bytes written to send the payload */
+        uint32_t chunks;        /**< Number of send commands issued */
+        uint32_t failures;      /**< Number of sends reported as failed by the modem */
+    };
+
+    /*!
+     * Sets the write coalescing policy. Small writes are held back in the
+     * write buffer until at least minChunkSize bytes are available or the
+     * oldest byte has been waiting for flushDelay milliseconds, so they can
+     * be sent with a single send command. Data are always sent without delay
+     * when the write buffer is full or a disconnect is pending. The default
+     * flushDelay of 0 disables coalescing.
+     *
+     * \param flushDelay Maximum time in milliseconds to hold back data
+     * \param minChunkSize Number of bytes to send without waiting
+     */
+    void setSendCoalescing(uint16_t flushDelay, Size minChunkSize);
+
+    /*!
+     * Enables quick send. The driver then passes the next chunk to the modem
+     * without waiting until the previous one has been sent, so bulk uploads
+     * aren't limited to a single chunk per round trip. The modem confirms
+     * the chunks later on. While maxChunksInFlight chunks are unconfirmed,
+     * the driver holds back further data.
+     *
+     * The SIM800 driver switches the modem to AT+CIPQSEND=1 and polls the
+     * confirmation with AT+CIPACK, the SIM7x00 driver counts the +CIPSEND
+     * notifications. Espressif modules only accept one send at a time, the
+     * setting has no effect there. Quick send only applies to TCP connections
+     * in normal mode and needs to be set before connect() is called.
+     *
+     * \param maxChunksInFlight Maximum number of unconfirmed chunks, 0 disables quick send
+     */
+    void setQuickSend(uint8_t maxChunksInFlight);
+
+    /*!
+     * Returns the current send chunk size. It starts small, is doubled
+     * after each successful send up to the maximum the modem accepts and
+     * is halved when a send fails.
+     *
+     * \return Maximum number of bytes sent with the next send command
+     */
+    Size sendChunkSize() const;
+
+    /*!
+     * \return Statistics about the data sent so far
+     */
+    const SendStats& sendStats() const;
+
+    /*!
+     * \return AT command overhead in relation to the payload in permille
+     */
+    uint32_t sendOverheadRatio() const;
+
+    /*!
+     * Resets the send statistics to zero.
+     */
+    void resetSendStats();
+
+    /*!
+     * \return Largest datagram which can be sent in a single packet, which
+     * is limited by the modem's send command
+     */
+    virtual Size maxDatagramSize() const;
+
+    /*!
+     * Steps of the recovery ladder, from the cheapest to the most expensive
+     * one. When the modem reports an error, the driver first repeats the
+     * failed command. If errors persist, it re-opens the socket, then the
+     * bearer (the packet data connection or the WiFi association), restarts
+     * the radio and only as the last resort restarts the whole modem. Drivers
+     * map the levels to the nearest action their modem supports.
+     */
+    enum RecoveryLevel {
+        retryCommand,
+        reopenSocket,
+        reopenBearer,
+        softReset,
+        hardReset
+    };
+
+    /*!
+     * Classes of commands, each with a timeout of its own for the modem's reply.
+     */
+    enum CommandClass {
+        shortCommand,   /**< Configuration and queries, default 5s */
+        dataCommand,    /**< Sending and receiving data, default 30s */
+        networkCommand, /**< Opening and closing sockets and bearers, name resolution, default 130s */
+        restartCommand  /**< Restart of the modem, default 30s */
+    };
+
+    /*!
+     * Statistics about the recovery from modem errors.
+     */
+    struct RecoveryStats {
+        uint32_t attempts[hardReset + 1];      /**< Recovery actions taken, per RecoveryLevel */
+        uint32_t timeouts[restartCommand + 1]; /**< Replies not arriving in time, per CommandClass */
+    };
+
+    /*!
+     * Sets how many consecutive errors are handled on one level of the
+     * recovery ladder before moving on to the next one. A value of 0 skips
+     * the level. The hard reset is the last level, its number of attempts
+     * is not limited. By default, a failed command is repeated twice and
+     * each of the other levels is tried once.
+     *
+     * Transient errors, such as a failed name resolution, never escalate
+     * beyond re-opening the bearer. The ladder starts over when the modem
+     * confirms transferred data and after a hard reset.
+     *
+     * \param level Level of the recovery ladder
+     * \param attempts Number of errors handled on this level
+     */
+    void setRecoveryAttempts(RecoveryLevel level, uint8_t attempts);
+
+    /*!
+     * Sets the time the modem may take to reply to a command. When the reply
+     * doesn't arrive in time, the driver stops waiting and handles the timeout
+     * like an error reported by the modem. The defaults for the network commands
+     * are above the modem's own timeouts, so the modem can report a failure first.
+     *
+     * \param commandClass Class of the commands the timeout applies to
+     * \param timeout Maximum time to wait for a reply in milliseconds
+     */
+    void setCommandTimeout(CommandClass commandClass, uint32_t timeout);
+
+    /*!
+     * \return Statistics about the recovery actions taken so far
+     */
+    const RecoveryStats& recoveryStats() const;
+
+    /*!
+     * Resets the recovery statistics to zero.
+     */
+    void resetRecoveryStats();
+
   protected:
+    /*!
+     * Result of parsing a line of the reply to a command step.
+     */
+    enum StepReply {
+        replyIncomplete, /**< The parser expects further lines */
+        replyComplete,   /**< The parser doesn't need further lines */
+        replyFailed      /**< The reply reports a failure of the step */
+    };
+
+    typedef bool (ATCommDevice::*StepWriter)();
+    typedef StepReply (ATCommDevice::*StepParser)();
+
+    /*!
+     * Send state of a command step without a failure transition of its own.
+     * Its failures are handled by the recovery ladder.
+     */
+    enum { useRecovery = -1 };
+
+    /*!
+     * A step of a driver's connection state machine, which sends a single
+     * command and waits for its reply. Drivers list the steps setting up and
+     * tearing down connections in a constant table instead of cases of their
+     * own, so the connection state is intermediate while they run.
+     *
+     * A step sends either its fixed command, or calls its writer for commands
+     * depending on the settings. The writer may branch off to another send
+     * state or expect another reply, and returns false if it didn't send a
+     * command. The step is complete when the reply has arrived and the parser,
+     * if there is one, doesn't expect further lines. With an empty reply, the
+     * parser alone decides. When the modem reports an error, the reply doesn't
+     * arrive in time or the parser reports a failure, the driver goes on with
+     * the failure state.
+     */
+    struct CommandStep {
+        int8_t state;         /**< Send state issuing the command */
+        const char* command;  /**< Command without line end, NULL to call the writer */
+        StepWriter writer;    /**< Writes the command, NULL for the fixed command */
+        const char* reply;    /**< Reply completing the step, NULL for OK */
+        StepParser parser;    /**< Parses the lines of the reply, NULL if not needed */
+        uint8_t commandClass; /**< CommandClass of the command */
+        int8_t nextState;     /**< Send state after the command */
+        int8_t failState;     /**< Send state after a failure, or useRecovery */
+    };
+
+    virtual bool commandModeRequested();
+    bool useTransparentMode() const;
+    virtual bool usePushReceive() const;
+    void enterDataMode();
+    bool sendEscapeSequence();
+    bool transferDataMode();
+    bool receiveDataMode();
     void logStates(int8_t sendState, int8_t replyState);
     bool handleDisconnect(int8_t nextState);
     bool handleConnect(int8_t nextState);
     void sendCommand(const char* cmd);
-    bool prepareSending(bool sendChannel);
-    void sendData();
+    bool runCommandStep(const CommandStep* steps, uint8_t numSteps);
+    bool parseStepReply();
+    void failCommand(RecoveryLevel minLevel, RecoveryLevel maxLevel = hardReset);
+    bool fillLineBuffer();
+    bool sendPending();
+    void sendFailed();
+    bool useQuickSend() const;
+    bool sendWindowFull() const;
+    void confirmChunks(uint8_t chunks, bool sent);
+    bool flowControlPending() const;
+    Size serialReceiveSpace(Size pending, Size margin) const;
+    bool caCertificatePending() const;
+    bool sendCertificate();
+    bool prepareSending(bool sendChannel, const char* cmd = "AT+CIPSEND=");
+    void writeSendHeader(const char* str);
+    bool sendData();
+    RecoveryLevel escalateError(RecoveryLevel minLevel, RecoveryLevel maxLevel = hardReset);
+    void resetRecovery();
+    virtual void handleError(RecoveryLevel minLevel, RecoveryLevel maxLevel = hardReset);
+    void setCommandClass(CommandClass commandClass);
+    bool replyPending();
+    Size readBufferSpace() const;
+    bool sendCiprcvdata(Size maxLength);
+    void beginReceive(Size length);
     void flushReadBuffer();
     bool receive();
 
@@ -109,9 +397,39 @@ class ATCommDevice : public IPCommDevice
 
     int16_t _rssi;
 
+    uint8_t _options;
+    uint16_t _guardTime;
+    uint8_t _closeMatch;
+    E_TICK_TYPE _closeMatchTick;
+
+    const char* _caCert;
+    Size _caCertLength;
+    bool _caCertLoaded;
+
+    Size _maxSendChunkSize;
+    Size _sendChunkSize;
+    Size _minChunkSize;
+    uint16_t _flushDelay;
+    E_TICK_TYPE _holdTick;
+    SendStats _sendStats;
+    uint8_t _maxChunksInFlight;
+    uint8_t _chunksInFlight;
+
+    const CommandStep* _commandStep;
+    int8_t _retryState;
+    uint8_t _recoveryAttempts[hardReset];
+    uint8_t _recoveryLevel;
+    uint8_t _recoveryCount;
+    RecoveryStats _recoveryStats;
+
+    uint32_t _commandTimeouts[restartCommand + 1];
+    uint8_t _commandClass;
+    E_TICK_TYPE _replyTick;
+
     static const char* _okStr;
     static const char* _lineEndStr;
     static const char* _quoteEndStr;
+    static const char* _closedStr;
 };
 }
 
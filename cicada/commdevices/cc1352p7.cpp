@@ -22,8 +22,8 @@
  */
 
 #include "cicada/commdevices/cc1352p7.h"
+#include "cicada/commdevices/commandbuilder.h"
 #include "cicada/commdevices/atcommdevice.h"
-#include "printf.h"
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
@@ -32,11 +32,20 @@
 using namespace Cicada;
 
 const uint16_t CC1352P7_MAX_RX = 1220;   // Match network buffer of the modem
+const uint16_t CC1352P7_MAX_TX = 1220;
+
+const ATCommDevice::CommandStep CC1352P7CommDevice::_commandSteps[] = {
+    {sendCipstart, NULL, static_cast<StepWriter>(&CC1352P7CommDevice::writeCipstart), NULL, NULL,
+        networkCommand, finalizeConnect, useRecovery},
+    {sendCipclose, "AT+CIPCLOSE", NULL, NULL, NULL, networkCommand, finalizeDisconnect,
+        useRecovery}};
+const uint8_t CC1352P7CommDevice::_numCommandSteps = sizeof(_commandSteps) / sizeof(CommandStep);
 
 CC1352P7CommDevice::CC1352P7CommDevice(
     IBufferedSerial& serial, uint8_t* readBuffer, uint8_t* writeBuffer, Size bufferSize) :
     ATCommDevice(serial, readBuffer, writeBuffer, bufferSize)
 {
+    _maxSendChunkSize = CC1352P7_MAX_TX;
     resetStates();
 }
 
@@ -44,77 +53,23 @@ CC1352P7CommDevice::CC1352P7CommDevice(IBufferedSerial& serial, uint8_t* readBuf
     uint8_t* writeBuffer, Size readBufferSize, Size writeBufferSize) :
     ATCommDevice(serial, readBuffer, writeBuffer, readBufferSize, writeBufferSize)
 {
+    _maxSendChunkSize = CC1352P7_MAX_TX;
     resetStates();
 }
 
 void CC1352P7CommDevice::resetStates()
 {
-    _serial.flushReceiveBuffers();
-    _readBuffer.flush();
-    _writeBuffer.flush();
-    _lbFill = 0;
-    _sendState = 0;
-    _replyState = 0;
-    _connectState = IPCommDevice::notConnected;
-    _bytesToWrite = 0;
-    _bytesToReceive = 0;
-    _bytesToRead = 0;
-    _waitForReply = NULL;
-    _stateBooleans = LINE_READ;
+    ATCommDevice::resetStates();
     _rssi = 255;
 }
 
-bool CC1352P7CommDevice::fillLineBuffer()
-{
-    // Buffer reply from modem in line buffer
-    // Returns true when enough data to be parsed is available.
-    if (_stateBooleans & LINE_READ) {
-        while (_serial.bytesAvailable()) {
-            char c = _serial.read();
-            _lineBuffer[_lbFill++] = c;
-            if (c == '\n' || c == '>' || _lbFill == LINE_MAX_LENGTH) {
-                _lineBuffer[_lbFill] = '\0';
-                _lbFill = 0;
-                return true;
-            }
-        }
-    }
-    return false;
-}
-
-bool CC1352P7CommDevice::sendCiprcvdata()
-{
-    if (_serial.readBufferSize() - _serial.bytesAvailable() > 30
-        && _readBuffer.spaceAvailable() > 0) {
-        // Make sure there is enough space in the serial buffer for the reply
-        Size bytesToReceive = _serial.readBufferSize() - _serial.bytesAvailable() - 30;
-        if (bytesToReceive > _bytesToReceive)
-            bytesToReceive = _bytesToReceive;
-        // Make sure there is enough space in the local device buffer
-        if (bytesToReceive > _readBuffer.spaceAvailable())
-            bytesToReceive = _readBuffer.spaceAvailable();
-        if (bytesToReceive > CC1352P7_MAX_RX)
-            bytesToReceive = CC1352P7_MAX_RX;
-
-        char sizeStr[6];
-        sprintf(sizeStr, "%u", (unsigned int)bytesToReceive);
-        _serial.write((const uint8_t*)"AT+CIPRECVDATA=");
-        _serial.write((const uint8_t*)sizeStr);
-        _serial.write((const uint8_t*)_lineEndStr);
-        return true;
-    } else {
-        return false;
-    }
-}
-
 bool CC1352P7CommDevice::parseCiprecvdata()
 {
     if (strncmp(_lineBuffer, "+CIPRECVDATA", 12) == 0) {
         int bytesToRead;
         bytesToRead = strtol(_lineBuffer + 13, NULL, 10);
         _bytesToReceive -= bytesToRead;
-        _bytesToRead += bytesToRead;
-        _stateBooleans &= ~LINE_READ;
+        beginReceive(bytesToRead);
         return true;
     }
 
@@ -145,6 +100,20 @@ char* CC1352P7CommDevice::getMacString()
     }
 }
 
+bool CC1352P7CommDevice::writeCipstart()
+{
+    CommandBuilder cmd(_serial);
+    cmd.append("AT+CIPSTART");
+    if (_type == UDP) {
+        cmd.append("=\"UDP\",\"");
+    } else {
+        cmd.append("=\"TCP\",\"");
+    }
+    // TODO: Escape characters
+    cmd.append(_host).append("\",").appendNumber(_port).append(_lineEndStr).send();
+    return true;
+}
+
 void CC1352P7CommDevice::run()
 {
     // If the serial device is net yet open, try to open it
@@ -162,6 +131,7 @@ void CC1352P7CommDevice::run()
         _bytesToReceive = 0;
         _sendState = sendCipclose;
         _replyState = okReply;
+        _commandStep = NULL;
         _waitForReply = NULL;
         _stateBooleans &= ~RESET_PENDING;
     }
@@ -177,9 +147,7 @@ void CC1352P7CommDevice::run()
 
         // Handle error states
         if (strncmp(_lineBuffer, "ERROR", 5) == 0) {
-            _stateBooleans |= RESET_PENDING;
-            _connectState = generalError;
-            _waitForReply = NULL;
+            failCommand(retryCommand);
             return;
         }
 
@@ -190,6 +158,10 @@ void CC1352P7CommDevice::run()
             }
         }
 
+        // Process the reply to a step of the connection state machine
+        if (!parseStepReply())
+            return;
+
         // Process incoming data which need special treatment
         switch (_replyState) {
         case parseStateCiprecvdata:
@@ -227,6 +199,7 @@ void CC1352P7CommDevice::run()
                 _stateBooleans |= DATA_PENDING;
             } else if (strncmp(_lineBuffer, "CLOSED", 6) == 0
                 || strncmp(_lineBuffer, "SEND FAIL", 9) == 0) {
+                sendFailed();
                 _stateBooleans &= ~IP_CONNECTED;
             }
         }
@@ -238,7 +211,7 @@ void CC1352P7CommDevice::run()
     }
 
     // Don't go on when waiting for a reply
-    if (_waitForReply || _replyState != okReply)
+    if (replyPending())
         return;
 
     // Don't go on if space in write buffer is low
@@ -262,6 +235,10 @@ void CC1352P7CommDevice::run()
         return;
     }
 
+    // Steps setting up and tearing down the connection
+    if (runCommandStep(_commandSteps, _numCommandSteps))
+        return;
+
     // Connection state machine
     switch (_sendState) {
     case notConnected:
@@ -279,27 +256,6 @@ void CC1352P7CommDevice::run()
         sendCommand("ATE0");
         break;
 
-    case sendCipstart: {
-        char portStr[6];
-        snprintf(portStr, sizeof(portStr), "%u", _port);
-
-        _serial.write((const uint8_t*)"AT+CIPSTART");
-        if (_type == UDP) {
-            _serial.write((const uint8_t*)"=\"UDP\",\"");
-        } else {
-            _serial.write((const uint8_t*)"=\"TCP\",\"");
-        }
-        // TODO: Escape characters
-        _serial.write((const uint8_t*)_host);
-        _serial.write((const uint8_t*)"\",");
-        _serial.write((const uint8_t*)portStr);
-        _serial.write((const uint8_t*)_lineEndStr);
-
-        _waitForReply = _okStr;
-        _sendState = finalizeConnect;
-        break;
-    }
-
     case finalizeConnect:
         _connectState = IPCommDevice::connected;
         _sendState = connected;
@@ -307,9 +263,9 @@ void CC1352P7CommDevice::run()
         break;
 
     case connected:
-        if (_writeBuffer.bytesAvailable()) {
+        if (sendPending()) {
             if (prepareSending(false)) {
-                _serial.write((const uint8_t*)_lineEndStr);
+                writeSendHeader(_lineEndStr);
                 _connectState = IPCommDevice::transmitting;
                 _sendState = sendDataState;
             }
@@ -332,9 +288,10 @@ void CC1352P7CommDevice::run()
         // States after connecting
 
     case sendDataState:
-        sendData();
-        _waitForReply = _okStr;
-        _sendState = connected;
+        if (sendData()) {
+            _waitForReply = _okStr;
+            _sendState = connected;
+        }
         break;
 
     case sendCiprecvdata:
@@ -343,9 +300,10 @@ void CC1352P7CommDevice::run()
         }
 
         if (_bytesToReceive > 0) {
-            if (sendCiprcvdata()) {
+            if (sendCiprcvdata(CC1352P7_MAX_RX)) {
                 _sendState = waitReceive;
                 _replyState = parseStateCiprecvdata;
+                _waitForReply = "+CIPRECVDATA";
             }
         } else {
             _sendState = connected;
@@ -369,13 +327,6 @@ void CC1352P7CommDevice::run()
         }
         break;
 
-    case sendCipclose:
-        _connectState = IPCommDevice::intermediate;
-        _waitForReply = _okStr;
-        _sendState = finalizeDisconnect;
-        sendCommand("AT+CIPCLOSE");
-        break;
-
     case finalizeDisconnect:
         _stateBooleans &= ~IP_CONNECTED;
         _connectState = IPCommDevice::notConnected;
@@ -129,10 +129,12 @@ class CC1352P7CommDevice : public ATCommDevice
     };
 
   protected:
-    bool fillLineBuffer();
-    bool sendCiprcvdata();
     bool parseCiprecvdata();
     bool parseCsq();
+    bool writeCipstart();
+
+    static const CommandStep _commandSteps[];
+    static const uint8_t _numCommandSteps;
 
     char _macStringBuffer[MAC64STRING_MAX_LENGTH];
 };
@@ -0,0 +1,86 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "cicada/commdevices/commandbuilder.h"
+
+using namespace Cicada;
+
+const char* const HEX_DIGITS = "0123456789ABCDEF";
+
+CommandBuilder::CommandBuilder(IBufferedSerial& serial) : _serial(serial), _fill(0), _written(0) {}
+
+CommandBuilder& CommandBuilder::append(const char* str)
+{
+    while (*str) {
+        append(*str++);
+    }
+
+    return *this;
+}
+
+CommandBuilder& CommandBuilder::append(char c)
+{
+    if (_fill == E_COMMAND_BUILDER_SIZE)
+        flush();
+    _buffer[_fill++] = c;
+
+    return *this;
+}
+
+CommandBuilder& CommandBuilder::appendNumber(uint32_t number)
+{
+    // Digits come out in reverse order
+    char digits[10];
+    uint8_t count = 0;
+    do {
+        digits[count++] = '0' + number % 10;
+        number /= 10;
+    } while (number);
+
+    while (count) {
+        append(digits[--count]);
+    }
+
+    return *this;
+}
+
+CommandBuilder& CommandBuilder::appendHex(uint8_t byte)
+{
+    append(HEX_DIGITS[byte >> 4]);
+    append(HEX_DIGITS[byte & 0x0f]);
+
+    return *this;
+}
+
+Size CommandBuilder::send()
+{
+    flush();
+
+    return _written;
+}
+
+void CommandBuilder::flush()
+{
+    _written += _serial.write((const uint8_t*)_buffer, _fill);
+    _fill = 0;
+}
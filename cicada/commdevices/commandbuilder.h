@@ -0,0 +1,95 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef COMMANDBUILDER_H
+#define COMMANDBUILDER_H
+
+#include "cicada/ibufferedserial.h"
+#include "cicada/types.h"
+#include <stdint.h>
+
+#ifndef E_COMMAND_BUILDER_SIZE
+#define E_COMMAND_BUILDER_SIZE 32
+#endif
+
+namespace Cicada {
+
+/*!
+ * Assembles an AT command from string fragments and numbers without printf,
+ * and writes it to the serial device in blocks instead of byte by byte.
+ * Fragments are collected in a small buffer on the stack, which is written
+ * whenever it is full and by send(). Callers check the space available in
+ * the serial device before building the command, the same as when writing
+ * the fragments one by one.
+ *
+ * \code
+ * CommandBuilder cmd(_serial);
+ * cmd.append("AT+CIPRECVDATA=").appendNumber(length).append(_lineEndStr).send();
+ * \endcode
+ */
+class CommandBuilder
+{
+  public:
+    /*!
+     * \param serial Serial device the command is written to
+     */
+    CommandBuilder(IBufferedSerial& serial);
+
+    /*!
+     * Appends a zero-terminated string.
+     */
+    CommandBuilder& append(const char* str);
+
+    /*!
+     * Appends a single character.
+     */
+    CommandBuilder& append(char c);
+
+    /*!
+     * Appends a number in decimal notation.
+     */
+    CommandBuilder& appendNumber(uint32_t number);
+
+    /*!
+     * Appends a byte as two upper case hexadecimal digits.
+     */
+    CommandBuilder& appendHex(uint8_t byte);
+
+    /*!
+     * Writes the rest of the command to the serial device.
+     *
+     * \return Number of bytes written since the builder was created
+     */
+    Size send();
+
+  private:
+    void flush();
+
+    IBufferedSerial& _serial;
+    char _buffer[E_COMMAND_BUILDER_SIZE];
+    uint8_t _fill;
+    Size _written;
+};
+}
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "cicada/commdevices/dnscache.h"
+#include <cstring>
+
+using namespace Cicada;
+
+DnsCache::DnsCache(uint32_t ttl) : _ttl(ttl)
+{
+    clear();
+}
+
+void DnsCache::setTtl(uint32_t ttl)
+{
+    _ttl = ttl;
+}
+
+bool DnsCache::add(const char* host, const char* ip, E_TICK_TYPE now)
+{
+    return add(host, ip, now, _ttl);
+}
+
+bool DnsCache::add(const char* host, const char* ip, E_TICK_TYPE now, uint32_t ttl)
+{
+    if (strlen(host) >= E_DNS_HOST_MAX_LENGTH || strlen(ip) >= DNS_IP_MAX_LENGTH)
+        return false;
+
+    Entry* entry = find(host);
+
+    // Use a free or expired entry, otherwise replace the oldest one
+    if (entry == NULL) {
+        entry = &_entries[0];
+        for (int i = 0; i < E_DNS_CACHE_ENTRIES; i++) {
+            if (!_entries[i].valid || expired(_entries[i], now)) {
+                entry = &_entries[i];
+                break;
+            }
+            if (now - _entries[i].added > now - entry->added) {
+                entry = &_entries[i];
+            }
+        }
+        strcpy(entry->host, host);
+    }
+
+    strcpy(entry->ip, ip);
+    entry->added = now;
+    entry->ttl = ttl;
+    entry->valid = true;
+
+    return true;
+}
+
+const char* DnsCache::lookup(const char* host, E_TICK_TYPE now)
+{
+    Entry* entry = find(host);
+    if (entry == NULL)
+        return NULL;
+
+    if (expired(*entry, now)) {
+        entry->valid = false;
+        return NULL;
+    }
+
+    return entry->ip;
+}
+
+void DnsCache::remove(const char* host)
+{
+    Entry* entry = find(host);
+    if (entry) {
+        entry->valid = false;
+    }
+}
+
+void DnsCache::clear()
+{
+    for (int i = 0; i < E_DNS_CACHE_ENTRIES; i++) {
+        _entries[i].valid = false;
+    }
+}
+
+bool DnsCache::isIpLiteral(const char* host)
+{
+    int dots = 0;
+    int digits = 0;
+    int value = 0;
+
+    for (const char* c = host;; c++) {
+        if (*c >= '0' && *c <= '9') {
+            value = value * 10 + (*c - '0');
+            if (++digits > 3 || value > 255)
+                return false;
+        } else if ((*c == '.' || *c == '\0') && digits > 0) {
+            if (*c == '\0')
+                return dots == 3;
+            if (++dots > 3)
+                return false;
+            digits = 0;
+            value = 0;
+        } else {
+            return false;
+        }
+    }
+}
+
+DnsCache::Entry* DnsCache::find(const char* host)
+{
+    for (int i = 0; i < E_DNS_CACHE_ENTRIES; i++) {
+        if (_entries[i].valid && strcmp(_entries[i].host, host) == 0) {
+            return &_entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+bool DnsCache::expired(const Entry& entry, E_TICK_TYPE now) const
+{
+    return entry.ttl != 0 && now - entry.added >= entry.ttl;
+}
@@ -0,0 +1,136 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef DNSCACHE_H
+#define DNSCACHE_H
+
+#include "cicada/defines.h"
+#include <stdint.h>
+
+#ifndef E_DNS_CACHE_ENTRIES
+#define E_DNS_CACHE_ENTRIES 4
+#endif
+
+#ifndef E_DNS_HOST_MAX_LENGTH
+#define E_DNS_HOST_MAX_LENGTH 64
+#endif
+
+#define DNS_IP_MAX_LENGTH 16
+
+namespace Cicada {
+
+/*!
+ * Small fixed size cache mapping host names to IPv4 addresses. Entries
+ * expire after their time to live, measured in ticks. When the cache is
+ * full, the oldest entry is replaced. Host names are copied, names longer
+ * than E_DNS_HOST_MAX_LENGTH - 1 characters are not cached.
+ */
+class DnsCache
+{
+  public:
+    /*!
+     * \param ttl Default time to live of entries in milliseconds
+     */
+    DnsCache(uint32_t ttl = 600000);
+
+    /*!
+     * Sets the time to live for entries added with the default time to live.
+     * Doesn't change entries already in the cache.
+     *
+     * \param ttl Time to live in milliseconds
+     */
+    void setTtl(uint32_t ttl);
+
+    /*!
+     * Adds an entry with the default time to live, or updates the existing
+     * entry for the host.
+     *
+     * \param host Host name
+     * \param ip IPv4 address in dotted notation
+     * \param now Current tick
+     * \return true if the entry was added
+     */
+    bool add(const char* host, const char* ip, E_TICK_TYPE now);
+
+    /*!
+     * Adds an entry with the given time to live, or updates the existing
+     * entry for the host.
+     *
+     * \param host Host name
+     * \param ip IPv4 address in dotted notation
+     * \param now Current tick
+     * \param ttl Time to live in milliseconds, 0 for an entry which doesn't expire
+     * \return true if the entry was added
+     */
+    bool add(const char* host, const char* ip, E_TICK_TYPE now, uint32_t ttl);
+
+    /*!
+     * Looks up the IP address of a host.
+     *
+     * \param host Host name
+     * \param now Current tick
+     * \return The IP address, or NULL if the host is not in the cache or
+     * the entry has expired. The string stays valid until the cache is modified.
+     */
+    const char* lookup(const char* host, E_TICK_TYPE now);
+
+    /*!
+     * Removes the entry for a host, for example after connecting to the
+     * cached address failed.
+     *
+     * \param host Host name
+     */
+    void remove(const char* host);
+
+    /*!
+     * Removes all entries.
+     */
+    void clear();
+
+    /*!
+     * Checks if a string is an IPv4 address in dotted notation, which
+     * doesn't need to be resolved.
+     *
+     * \param host String to check
+     * \return true if host is an IPv4 address
+     */
+    static bool isIpLiteral(const char* host);
+
+  private:
+    struct Entry {
+        char host[E_DNS_HOST_MAX_LENGTH];
+        char ip[DNS_IP_MAX_LENGTH];
+        E_TICK_TYPE added;
+        uint32_t ttl;
+        bool valid;
+    };
+
+    Entry* find(const char* host);
+    bool expired(const Entry& entry, E_TICK_TYPE now) const;
+
+    Entry _entries[E_DNS_CACHE_ENTRIES];
+    uint32_t _ttl;
+};
+}
+
+#endif
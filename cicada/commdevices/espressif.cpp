@@ -22,19 +22,52 @@
  */
 
 #include "cicada/commdevices/espressif.h"
+#include "cicada/commdevices/commandbuilder.h"
 #include "cicada/commdevices/ipcommdevice.h"
-#include "printf.h"
 #include <cstdlib>
 #include <cstring>
 
 using namespace Cicada;
 
 const uint16_t ESPRESSIF_MAX_RX = 2048;
+const uint16_t ESPRESSIF_MAX_TX = 2048;
+const uint16_t ESPRESSIF_RECOVERY_DELAY = 1000;
+
+const ATCommDevice::CommandStep EspressifDevice::_commandSteps[] = {
+    // Association with the access point
+    {sendUartCurQuery, NULL, static_cast<StepWriter>(&EspressifDevice::writeUartCurQuery), NULL,
+        static_cast<StepParser>(&EspressifDevice::parseUartCur), shortCommand, sendUartCur,
+        useRecovery},
+    {sendUartCur, NULL, static_cast<StepWriter>(&EspressifDevice::writeUartCur), NULL, NULL,
+        shortCommand, sendCwmode, useRecovery},
+    {sendCwmode, "AT+CWMODE=1", NULL, NULL, NULL, shortCommand, sendCwjap, useRecovery},
+    {sendCwjap, NULL, static_cast<StepWriter>(&EspressifDevice::writeCwjap), NULL, NULL,
+        networkCommand, sendCipmux, useRecovery},
+    {sendCipmux, "AT+CIPMUX=0", NULL, NULL, NULL, shortCommand, sendCiprecvmode, useRecovery},
+    {sendCiprecvmode, NULL, static_cast<StepWriter>(&EspressifDevice::writeCiprecvmode), NULL,
+        NULL, shortCommand, sendCipmode, useRecovery},
+    {sendCipmode, NULL, static_cast<StepWriter>(&EspressifDevice::writeCipmode), NULL, NULL,
+        shortCommand, sendCipstart, useRecovery},
+    {sendSysflashErase, "AT+SYSFLASH=0,\"client_ca\"", NULL, NULL, NULL, shortCommand,
+        sendSysflashWrite, useRecovery},
+    {sendSysflashWrite, NULL, static_cast<StepWriter>(&EspressifDevice::writeSysflashWrite), ">",
+        NULL, shortCommand, sendCertData, useRecovery},
+    {sendCipsslcconf, NULL, static_cast<StepWriter>(&EspressifDevice::writeCipsslcconf), NULL,
+        NULL, shortCommand, sendCipstart, useRecovery},
+    {sendCipstart, NULL, static_cast<StepWriter>(&EspressifDevice::writeCipstart), NULL, NULL,
+        networkCommand, finalizeConnect, useRecovery},
+    // Tear down
+    {sendCipclose, NULL, static_cast<StepWriter>(&EspressifDevice::writeCipclose), NULL, NULL,
+        networkCommand, sendCwqap, useRecovery},
+    {sendCwqap, "AT+CWQAP", NULL, "WIFI DISCONNECT", NULL, networkCommand, finalizeDisconnect,
+        useRecovery}};
+const uint8_t EspressifDevice::_numCommandSteps = sizeof(_commandSteps) / sizeof(CommandStep);
 
 EspressifDevice::EspressifDevice(
     IBufferedSerial& serial, uint8_t* readBuffer, uint8_t* writeBuffer, Size bufferSize) :
     ATCommDevice(serial, readBuffer, writeBuffer, bufferSize)
 {
+    _maxSendChunkSize = ESPRESSIF_MAX_TX;
     resetStates();
 }
 
@@ -42,24 +75,16 @@ EspressifDevice::EspressifDevice(IBufferedSerial& serial, uint8_t* readBuffer, u
     Size readBufferSize, Size writeBufferSize) :
     ATCommDevice(serial, readBuffer, writeBuffer, readBufferSize, writeBufferSize)
 {
+    _maxSendChunkSize = ESPRESSIF_MAX_TX;
     resetStates();
 }
 
 void EspressifDevice::resetStates()
 {
-    _serial.flushReceiveBuffers();
-    _readBuffer.flush();
-    _writeBuffer.flush();
-    _lbFill = 0;
-    _sendState = 0;
-    _replyState = 0;
-    _connectState = IPCommDevice::notConnected;
-    _bytesToWrite = 0;
-    _bytesToReceive = 0;
-    _bytesToRead = 0;
-    _waitForReply = NULL;
-    _stateBooleans = LINE_READ;
-    _rssi = 99;
+    ATCommDevice::resetStates();
+    _uartBaudRate = 0;
+    _macStringBuffer[0] = '\0';
+    _macRequested = false;
 }
 
 void EspressifDevice::setSSID(const char* ssid)
@@ -89,9 +114,10 @@ bool EspressifDevice::fillLineBuffer()
         while (_serial.bytesAvailable()) {
             char c = _serial.read();
             _lineBuffer[_lbFill++] = c;
+            // Replies with a ':' in the middle of the line are not split like pushed data
             if (c == '\n' || c == '>'
-                || (_type != TCP && _replyState != waitCiprecvdata && _replyState != reqMac
-                    && _replyState != rssi && c == ':')
+                || (usePushReceive() && _replyState != waitCiprecvdata && _replyState != reqMac
+                    && _replyState != rssi && !uartCurPending() && c == ':')
                 || _lbFill == LINE_MAX_LENGTH) {
                 _lineBuffer[_lbFill] = '\0';
                 _lbFill = 0;
@@ -113,29 +139,9 @@ bool EspressifDevice::fillLineBuffer()
     return false;
 }
 
-bool EspressifDevice::sendCiprcvdata()
+bool EspressifDevice::uartCurPending() const
 {
-    if (_serial.readBufferSize() - _serial.bytesAvailable() > 30
-        && _readBuffer.spaceAvailable() > 0) {
-        // Make sure there is enough space in the serial buffer for the reply
-        Size bytesToReceive = _serial.readBufferSize() - _serial.bytesAvailable() - 30;
-        if (bytesToReceive > _bytesToReceive)
-            bytesToReceive = _bytesToReceive;
-        // Make sure there is enough space in the local device buffer
-        if (bytesToReceive > _readBuffer.spaceAvailable())
-            bytesToReceive = _readBuffer.spaceAvailable();
-        if (bytesToReceive > ESPRESSIF_MAX_RX)
-            bytesToReceive = ESPRESSIF_MAX_RX;
-
-        char sizeStr[6];
-        sprintf(sizeStr, "%u", (unsigned int)bytesToReceive);
-        _serial.write((const uint8_t*)"AT+CIPRECVDATA=");
-        _serial.write((const uint8_t*)sizeStr);
-        _serial.write((const uint8_t*)_lineEndStr);
-        return true;
-    } else {
-        return false;
-    }
+    return _commandStep && _commandStep->state == sendUartCurQuery;
 }
 
 bool EspressifDevice::parseCiprecvdata()
@@ -143,18 +149,28 @@ bool EspressifDevice::parseCiprecvdata()
     if (strncmp(_lineBuffer, "+CIPRECVDATA", 12) == 0) {
         int bytesToRead = strtol(_lineBuffer + 13, NULL, 10);
         _bytesToReceive -= bytesToRead;
-        _bytesToRead += bytesToRead;
-        _stateBooleans &= ~LINE_READ;
+        beginReceive(bytesToRead);
         return true;
     }
 
     return false;
 }
 
+bool EspressifDevice::usePushReceive() const
+{
+    // UDP data are always pushed by the module
+    return ATCommDevice::usePushReceive() || _type == UDP;
+}
+
+bool EspressifDevice::commandModeRequested()
+{
+    return ATCommDevice::commandModeRequested() || _macRequested;
+}
+
 void EspressifDevice::requestMac()
 {
     _macStringBuffer[0] = '\0';
-    _macStringBuffer[1] = 0xFF;
+    _macRequested = true;
 }
 
 char* EspressifDevice::getMacString()
@@ -166,6 +182,131 @@ char* EspressifDevice::getMacString()
     }
 }
 
+bool EspressifDevice::writeUartCurQuery()
+{
+    // Setting flow control requires the baud rate as well
+    if (!flowControlPending()) {
+        _sendState = sendCwmode;
+        return false;
+    }
+
+    _uartBaudRate = 0;
+    sendCommand("AT+UART_CUR?");
+    return true;
+}
+
+ATCommDevice::StepReply EspressifDevice::parseUartCur()
+{
+    // Current UART configuration: "+UART_CUR:<baudrate>,8,1,0,<flow control>"
+    if (strncmp(_lineBuffer, "+UART_CUR:", 10) == 0) {
+        _uartBaudRate = strtoul(_lineBuffer + 10, NULL, 10);
+        // Setting a rate of 0 would break the link to the module
+        return _uartBaudRate > 0 ? replyComplete : replyFailed;
+    }
+
+    // The final OK ends the step once the rate is known
+    return _uartBaudRate > 0 ? replyComplete : replyIncomplete;
+}
+
+bool EspressifDevice::writeUartCur()
+{
+    if (_serial.flowControl()) {
+        _stateBooleans |= FLOW_CONTROL;
+    } else {
+        _stateBooleans &= ~FLOW_CONTROL;
+    }
+
+    CommandBuilder(_serial)
+        .append("AT+UART_CUR=")
+        .appendNumber(_uartBaudRate)
+        .append(_serial.flowControl() ? ",8,1,0,3" : ",8,1,0,0")
+        .append(_lineEndStr)
+        .send();
+    return true;
+}
+
+bool EspressifDevice::writeCwjap()
+{
+    CommandBuilder(_serial)
+        .append("AT+CWJAP=\"")
+        .append(_ssid)
+        .append("\",\"")
+        .append(_passwd)
+        .append(_quoteEndStr)
+        .send();
+    return true;
+}
+
+bool EspressifDevice::writeCiprecvmode()
+{
+    if (!usePushReceive() && !useTransparentMode()) {
+        sendCommand("AT+CIPRECVMODE=1");
+    } else {
+        sendCommand("AT+CIPRECVMODE=0");
+    }
+    return true;
+}
+
+bool EspressifDevice::writeCipmode()
+{
+    if (caCertificatePending()) {
+        _sendState = sendSysflashErase;
+    } else if (_type == SSL && _caCert) {
+        _sendState = sendCipsslcconf;
+    }
+    sendCommand(useTransparentMode() ? "AT+CIPMODE=1" : "AT+CIPMODE=0");
+    return true;
+}
+
+bool EspressifDevice::writeSysflashWrite()
+{
+    CommandBuilder(_serial)
+        .append("AT+SYSFLASH=1,\"client_ca\",0,")
+        .appendNumber(_caCertLength)
+        .append(_lineEndStr)
+        .send();
+    _bytesToWrite = _caCertLength;
+    return true;
+}
+
+bool EspressifDevice::writeCipsslcconf()
+{
+    // The module confirmed the certificate upload, if there was one
+    _caCertLoaded = true;
+    sendCommand("AT+CIPSSLCCONF=2,0,0");
+    return true;
+}
+
+bool EspressifDevice::writeCipstart()
+{
+    CommandBuilder cmd(_serial);
+    cmd.append("AT+CIPSTART");
+    switch (_type) {
+    case TCP:
+        cmd.append("=\"TCP\",\"");
+        break;
+    case UDP:
+        cmd.append("=\"UDP\",\"");
+        break;
+    case SSL:
+        cmd.append("=\"SSL\",\"");
+        break;
+    }
+    // TODO: Escape characters
+    cmd.append(_host).append("\",").appendNumber(_port).append(_lineEndStr).send();
+    return true;
+}
+
+bool EspressifDevice::writeCipclose()
+{
+    setDelay(0);
+    if (!(_stateBooleans & IP_CONNECTED))
+        return false;
+
+    sendCommand("AT+CIPCLOSE");
+    return true;
+}
+
 void EspressifDevice::run()
 {
     // If the serial device is net yet open, try to open it
@@ -187,7 +328,10 @@ void EspressifDevice::run()
         _serial.write((const uint8_t*)"AT+RST");
         _serial.write((const uint8_t*)_lineEndStr);
         _replyState = okReply;
+        _commandStep = NULL;
         _waitForReply = "ready";
+        _retryState = notConnected;
+        setCommandClass(restartCommand);
 
         setDelay(10);
 
@@ -203,13 +347,22 @@ void EspressifDevice::run()
         // Log the current modem states
         logStates(_sendState, _replyState);
 
-        // Handle error states
-        if (strncmp(_lineBuffer, "ERROR", 5) == 0 || strncmp(_lineBuffer, "FAIL", 4) == 0) {
-            _stateBooleans |= RESET_PENDING;
-            _connectState = generalError;
-            _waitForReply = NULL;
+        // Handle error states. Failing to resolve the host name or to join the
+        // access point is transient and doesn't need the module to be reset.
+        if (strncmp(_lineBuffer, "DNS Fail", 8) == 0) {
+            _connectState = IPCommDevice::dnsError;
+        } else if (strncmp(_lineBuffer, "ERROR", 5) == 0 || strncmp(_lineBuffer, "FAIL", 4) == 0) {
+            if (_connectState == IPCommDevice::dnsError) {
+                setDelay(ESPRESSIF_RECOVERY_DELAY);
+                failCommand(retryCommand, reopenBearer);
+            } else if (_retryState == sendCwjap) {
+                failCommand(retryCommand, reopenBearer);
+            } else {
+                failCommand(retryCommand);
+            }
             return;
         } else if (_sendState == connected && strncmp(_lineBuffer, "SEND FAIL", 9) == 0) {
+            sendFailed();
             _connectState = generalError;
             _waitForReply = NULL;
         }
@@ -221,6 +374,10 @@ void EspressifDevice::run()
             }
         }
 
+        // Process the reply to a step of the connection state machine
+        if (!parseStepReply())
+            return;
+
         // Process incoming data which need special treatment
         switch (_replyState) {
         case parseStateCiprecvdata:
@@ -268,35 +425,44 @@ void EspressifDevice::run()
         if (_sendState >= connected) {
             if (strncmp(_lineBuffer, "+IPD,", 4) == 0) {
                 int bytes = strtol(_lineBuffer + 5, NULL, 10);
-                if (_type == IIPCommDevice::TCP) {
-                    _bytesToReceive = bytes;
+                if (usePushReceive()) {
+                    beginReceive(bytes);
                 } else {
-                    _bytesToRead += bytes;
-                    _stateBooleans &= ~LINE_READ;
+                    _bytesToReceive = bytes;
+                    _stateBooleans |= DATA_PENDING;
                 }
-                _stateBooleans |= DATA_PENDING;
             } else if (strncmp(_lineBuffer, "CLOSED", 6) == 0) {
                 _stateBooleans &= ~IP_CONNECTED;
             } else if (strncmp(_lineBuffer, "WIFI DISCONNECT", 15) == 0) {
                 _sendState = finalizeDisconnect;
+                _commandStep = NULL;
                 _waitForReply = NULL;
             }
         }
     }
 
     // When disconnecting was requested, flush read buffer first
-    else if ((_stateBooleans & DISCONNECT_PENDING) && _sendState == receiving) {
+    else if ((_stateBooleans & DISCONNECT_PENDING)
+        && (_sendState == receiving || usePushReceive())) {
         flushReadBuffer();
     }
 
+    // Pass pushed data on to the read buffer, independent of the current state
+    if (_bytesToRead > 0 && usePushReceive()) {
+        receive();
+    }
+
     // Don't go on when waiting for a reply
-    if (_waitForReply || _replyState != okReply)
+    if (replyPending())
         return;
 
     // Don't go on if space in write buffer is low
     if (_serial.spaceAvailable() < 20)
         return;
 
+    // Remember the state issuing the next command, to repeat it on error
+    _retryState = _sendState;
+
     // When signal strength was requested, send the command to the modem
     if (_rssi == INT16_MAX && _stateBooleans & LINE_READ) {
         _replyState = rssi;
@@ -306,14 +472,18 @@ void EspressifDevice::run()
     }
 
     // When mac address was requested, send the command to the modem
-    if (_macStringBuffer[1] == 0xFF && _macStringBuffer[0] == '\0' && _stateBooleans & LINE_READ) {
-        _macStringBuffer[1] = 0;
+    if (_macRequested && _stateBooleans & LINE_READ) {
+        _macRequested = false;
         sendCommand("AT+CIPSTAMAC?");
         _replyState = reqMac;
         _waitForReply = _okStr;
         return;
     }
 
+    // Steps setting up and tearing down the connection
+    if (runCommandStep(_commandSteps, _numCommandSteps))
+        return;
+
     // Connection state machine
     switch (_sendState) {
     case notConnected:
@@ -330,99 +500,80 @@ void EspressifDevice::run()
         _stateBooleans |= LINE_READ;
         sendCommand("ATE0");
         _waitForReply = _okStr;
-        _sendState = sendCwmode;
-        break;
-
-    case sendCwmode:
-        _serial.write((const uint8_t*)"AT+CWMODE=1");
-        _serial.write((const uint8_t*)_lineEndStr);
-
-        _waitForReply = _okStr;
-        _sendState = sendCwjap;
-        break;
-
-    case sendCwjap:
-        _serial.write((const uint8_t*)"AT+CWJAP=\"");
-        _serial.write((const uint8_t*)_ssid, strlen(_ssid));
-        _serial.write((const uint8_t*)"\",\"");
-        _serial.write((const uint8_t*)_passwd, strlen(_passwd));
-        _serial.write((const uint8_t*)_quoteEndStr);
-
-        _waitForReply = _okStr;
-        _sendState = sendCipmux;
+        _sendState = sendUartCurQuery;
         break;
 
-    case sendCipmux:
-        _waitForReply = _okStr;
-        _sendState = sendCiprecvmode;
-        sendCommand("AT+CIPMUX=0");
+    case sendCertData:
+        if (sendCertificate()) {
+            _waitForReply = _okStr;
+            _sendState = sendCipsslcconf;
+        }
         break;
 
-    case sendCiprecvmode:
-        _waitForReply = _okStr;
-        _sendState = sendCipmode;
-        if (_type == TCP) {
-            sendCommand("AT+CIPRECVMODE=1");
+    case finalizeConnect:
+        setDelay(0);
+        _connectState = IPCommDevice::connected;
+        _stateBooleans |= IP_CONNECTED;
+        if (useTransparentMode()) {
+            _waitForReply = ">";
+            _sendState = startDataMode;
+            sendCommand("AT+CIPSEND");
         } else {
-            sendCommand("AT+CIPRECVMODE=0");
+            _sendState = connected;
         }
         break;
 
-    case sendCipmode:
-        _waitForReply = _okStr;
-        _sendState = sendCipstart;
-        sendCommand("AT+CIPMODE=0");
+    case startDataMode:
+        setDelay(0);
+        enterDataMode();
+        _sendState = dataMode;
         break;
 
-    case sendCipstart: {
-        char portStr[6];
-        snprintf(portStr, sizeof(portStr), "%u", _port);
-
-        _serial.write((const uint8_t*)"AT+CIPSTART");
-        switch (_type) {
-        case TCP:
-            _serial.write((const uint8_t*)"=\"TCP\",\"");
-            break;
-        case UDP:
-            _serial.write((const uint8_t*)"=\"UDP\",\"");
-            break;
-        case SSL:
-            _serial.write((const uint8_t*)"=\"SSL\",\"");
-            break;
+    case dataMode:
+        if (commandModeRequested() && _writeBuffer.bytesAvailable() == 0
+            && _serial.writeBufferProcessed()) {
+            // Keep the line idle for the guard time before escaping
+            setDelay(_guardTime);
+            _sendState = escapeDataMode;
+        } else if (!transferDataMode()) {
+            _sendState = commandMode;
         }
-        // TODO: Escape characters
-        _serial.write((const uint8_t*)_host);
-        _serial.write((const uint8_t*)"\",");
-        _serial.write((const uint8_t*)portStr);
-        _serial.write((const uint8_t*)_lineEndStr);
+        break;
 
-        _waitForReply = _okStr;
-        _sendState = finalizeConnect;
+    case escapeDataMode:
+        // The module doesn't reply to the escape sequence, but needs
+        // the guard time before accepting the next command
+        sendEscapeSequence();
+        setDelay(_guardTime);
+        _sendState = commandMode;
         break;
-    }
 
-    case finalizeConnect:
+    case commandMode:
         setDelay(0);
-        _connectState = IPCommDevice::connected;
-        _sendState = connected;
-        _stateBooleans |= IP_CONNECTED;
+        if (handleDisconnect(sendCipclose))
+            break;
+
+        if (_stateBooleans & IP_CONNECTED) {
+            _waitForReply = ">";
+            _sendState = startDataMode;
+            sendCommand("AT+CIPSEND");
+        } else {
+            _stateBooleans &= ~DISCONNECT_PENDING;
+            _sendState = sendCwqap;
+        }
         break;
 
     case connected:
-        if (_writeBuffer.bytesAvailable()) {
+        if (sendPending()) {
             if (prepareSending(false)) {
-                _serial.write((const uint8_t*)_lineEndStr);
+                writeSendHeader(_lineEndStr);
                 _connectState = IPCommDevice::transmitting;
                 _sendState = sendDataState;
             }
         } else if (_stateBooleans & DATA_PENDING) {
             _stateBooleans &= ~DATA_PENDING;
             _connectState = IPCommDevice::receiving;
-            if (_type == IIPCommDevice::TCP) {
-                _sendState = sendCiprecvdata;
-            } else {
-                _sendState = receiving;
-            }
+            _sendState = sendCiprecvdata;
         } else {
             _connectState = IPCommDevice::connected;
             if (_stateBooleans & IP_CONNECTED) {
@@ -439,9 +590,10 @@ void EspressifDevice::run()
         // States after connecting
 
     case sendDataState:
-        sendData();
-        _waitForReply = "SEND OK";
-        _sendState = connected;
+        if (sendData()) {
+            _waitForReply = "SEND OK";
+            _sendState = connected;
+        }
         break;
 
     case sendCiprecvdata:
@@ -451,9 +603,10 @@ void EspressifDevice::run()
         }
 
         if (_bytesToReceive > 0) {
-            if (sendCiprcvdata()) {
+            if (sendCiprcvdata(ESPRESSIF_MAX_RX)) {
                 _sendState = waitReceive;
                 _replyState = waitCiprecvdata;
+                _waitForReply = "+CIPRECVDATA";
             }
         } else {
             _sendState = connected;
@@ -466,10 +619,17 @@ void EspressifDevice::run()
 
     case receiving:
         if (_bytesToRead > 0) {
-            if (receive() && _type == IIPCommDevice::TCP) {
+            if (receive()) {
                 _replyState = okReply;
                 _waitForReply = _okStr;
             }
+        } else if (_bytesToReceive > 0 && !(_stateBooleans & DISCONNECT_PENDING)
+            && sendCiprcvdata(ESPRESSIF_MAX_RX)) {
+            // The firmware rejects commands while a reply is in progress ("busy p..."),
+            // so request the next chunk right after the OK of the current one
+            _sendState = waitReceive;
+            _replyState = waitCiprecvdata;
+            _waitForReply = "+CIPRECVDATA";
         } else if (_bytesToReceive > 0) {
             _sendState = sendCiprecvdata;
         } else {
@@ -477,23 +637,6 @@ void EspressifDevice::run()
         }
         break;
 
-    case sendCipclose:
-        setDelay(0);
-        _connectState = IPCommDevice::intermediate;
-        if (_stateBooleans & IP_CONNECTED) {
-            _waitForReply = _okStr;
-            sendCommand("AT+CIPCLOSE");
-        }
-        _sendState = sendCwqap;
-        break;
-
-    case sendCwqap:
-        _connectState = IPCommDevice::intermediate;
-        _waitForReply = "WIFI DISCONNECT";
-        _sendState = finalizeDisconnect;
-        sendCommand("AT+CWQAP");
-        break;
-
     case finalizeDisconnect:
         _stateBooleans &= ~IP_CONNECTED;
         _connectState = IPCommDevice::notConnected;
@@ -504,3 +647,61 @@ void EspressifDevice::run()
         break;
     }
 }
+
+void EspressifDevice::handleError(RecoveryLevel minLevel, RecoveryLevel maxLevel)
+{
+    sendFailed();
+    _waitForReply = NULL;
+
+    // Closing fails if the connection or association is already gone, which is the goal anyway
+    if (_retryState >= sendCipclose && _retryState <= finalizeDisconnect) {
+        _replyState = okReply;
+        return;
+    }
+
+    // Data might have been lost on an open connection, so it is closed instead
+    // of being restored silently. Failed queries don't affect the connection.
+    bool connectionOpen = _retryState >= finalizeConnect && _retryState < sendCipclose;
+    if (connectionOpen && _replyState != rssi && _replyState != reqMac
+        && minLevel < reopenSocket) {
+        minLevel = reopenSocket;
+    }
+
+    bool joined = _retryState > sendCwjap && _retryState < finalizeConnect;
+
+    _replyState = okReply;
+    if (_connectState != IPCommDevice::dnsError) {
+        _connectState = IPCommDevice::generalError;
+    }
+
+    switch (escalateError(minLevel, maxLevel)) {
+    case retryCommand:
+        // A failed certificate upload starts over
+        _sendState = _retryState == sendCertData ? (int8_t)sendSysflashErase : _retryState;
+        break;
+
+    case reopenSocket:
+        if (connectionOpen) {
+            // Without keeping the bearer, closing leaves the access point as well
+            _sendState = sendCipclose;
+            break;
+        } else if (joined) {
+            _sendState = sendCipmux;
+            break;
+        }
+        // Fall through
+
+    case reopenBearer:
+        if (!connectionOpen && !(_stateBooleans & DISCONNECT_PENDING)) {
+            _stateBooleans |= CONNECT_PENDING;
+        }
+        _sendState = connectionOpen || joined ? sendCipclose : finalizeDisconnect;
+        break;
+
+    case softReset:
+    case hardReset:
+        // The module can only be restarted as a whole
+        _stateBooleans |= RESET_PENDING;
+        break;
+    }
+}
@@ -90,7 +90,8 @@ class EspressifDevice : public ATCommDevice
      * Each time, run() is called, it roughly perorms these steps:
      * -# If a reset is pending, reset device and internal states
      * -# Process any incoming data from the device, including:
-     *   - Error messages
+     *   - Error messages, recovered from with the steps of ATCommDevice::RecoveryLevel.
+     *     A soft reset restarts the whole module, like a hard reset.
      *   - Incoming data
      *   - Connection close
      * -# If the device is ready to process new commands, run() will then
@@ -100,22 +101,49 @@ class EspressifDevice : public ATCommDevice
      * [*] --> notConnected
      * notConnected --> notConnected
      * notConnected --> connecting : connection request via API
-     * connecting --> sendCwjap
+     * connecting --> sendUartCurQuery
      * connecting : ""ATE0""
+     * sendUartCurQuery --> sendUartCur : flow control changed
+     * sendUartCurQuery --> sendCwjap
+     * sendUartCurQuery : ""AT+UART_CUR?""
+     * sendUartCur --> sendCwjap
+     * sendUartCur : ""AT+UART_CUR=<baudrate>,8,1,0,<3|0>""
      * sendCwjap --> sendCiprecvmode
      * sendCwjap --> finalizeDisconnect : connection close via API
      * sendCwjap : ""AT+CWJAP="<ssid>","<password>"""
      * sendCiprecvmode --> sendCipmode
      * sendCiprecvmode : ""AT+CIPRECVMODE=1""
      * sendCipmode --> sendCipstart
-     * sendCipmode : ""AT+CIPMODE=0""
+     * sendCipmode --> sendSysflashErase : SSL & certificate not yet loaded
+     * sendCipmode --> sendCipsslcconf : SSL & certificate set
+     * sendCipmode : ""AT+CIPMODE=<transparent>""
+     * sendSysflashErase --> sendSysflashWrite
+     * sendSysflashErase : ""AT+SYSFLASH=0,"client_ca" ""
+     * sendSysflashWrite --> sendCertData
+     * sendSysflashWrite : ""AT+SYSFLASH=1,"client_ca",0,<length>""
+     * sendCertData --> sendCipsslcconf
+     * sendCertData : send certificate
+     * sendCipsslcconf --> sendCipstart
+     * sendCipsslcconf : ""AT+CIPSSLCCONF=2,0,0""
      * sendCipstart --> finalizeConnect
      * sendCipstart : ""AT+CIPSTART="UDP",<host>,<port>""
      * sendCipstart : ""AT+CIPSTART="TCP",<host>,<port>""
+     * sendCipstart : ""AT+CIPSTART="SSL",<host>,<port>""
      * finalizeConnect --> connected
+     * finalizeConnect --> startDataMode : transparent mode
+     * finalizeConnect : transparent mode: ""AT+CIPSEND""
+     * startDataMode --> dataMode
+     * dataMode --> escapeDataMode : command or disconnect requested
+     * dataMode --> commandMode : connection close by peer
+     * dataMode : pass data between buffers and module
+     * escapeDataMode --> commandMode
+     * escapeDataMode : ""+++""
+     * commandMode --> sendCipclose : connection closed via API
+     * commandMode --> sendCwqap : connection closed by peer
+     * commandMode --> startDataMode
+     * commandMode : ""AT+CIPSEND""
      * connected --> sendDataState : bytes in write buffer
-     * connected --> sendCiprecvdata : incoming data pending & TCP
-     * connected --> receiving : incoming data pending & UDP
+     * connected --> sendCiprecvdata : incoming data pending
      * connected --> sendCipclose : connection closed via API
      * connected --> sendCwqap : connection closed by peer
      * connected --> connected
@@ -129,7 +157,9 @@ class EspressifDevice : public ATCommDevice
      * waitReceive --> waitReceive : no data
      * waitReceive --> receiving : data available
      * receiving --> receiving : bytesToRead > 0
-     * receiving --> sendCiprecvdata : bytesToReceive > 0
+     * receiving --> waitReceive : bytesToReceive > 0
+     * receiving : ""AT+CIPRECVDATA=<numBytesReceive>""
+     * receiving --> sendCiprecvdata : bytesToReceive > 0 & no space in serial buffer
      * receiving --> connected : no bytes to receive/read
      * sendCipclose --> sendCwqap
      * sendCipclose : ""AT+CIPCLOSE""
@@ -140,17 +170,29 @@ class EspressifDevice : public ATCommDevice
      */
     virtual void run();
 
-    enum ReplyState { okReply = 0, waitCiprecvdata, parseStateCiprecvdata, reqMac, rssi };
+    enum ReplyState {
+        okReply = 0,
+        waitCiprecvdata,
+        parseStateCiprecvdata,
+        reqMac,
+        rssi
+    };
 
     enum SendState {
         notConnected,
         serialError,
         connecting,
+        sendUartCurQuery,
+        sendUartCur,
         sendCwmode,
         sendCwjap,
         sendCiprecvmode,
         sendCipmux,
         sendCipmode,
+        sendSysflashErase,
+        sendSysflashWrite,
+        sendCertData,
+        sendCipsslcconf,
         sendCipstart,
         finalizeConnect,
         connected,
@@ -158,20 +200,42 @@ class EspressifDevice : public ATCommDevice
         sendCiprecvdata,
         waitReceive,
         receiving,
+        startDataMode,
+        dataMode,
+        escapeDataMode,
+        commandMode,
         sendCipclose,
         sendCwqap,
         finalizeDisconnect
     };
 
   protected:
+    virtual bool usePushReceive() const;
+    virtual bool commandModeRequested();
     bool fillLineBuffer();
-    bool sendCiprcvdata();
+    bool uartCurPending() const;
     bool parseCiprecvdata();
+    bool writeUartCurQuery();
+    StepReply parseUartCur();
+    bool writeUartCur();
+    bool writeCwjap();
+    bool writeCiprecvmode();
+    bool writeCipmode();
+    bool writeSysflashWrite();
+    bool writeCipsslcconf();
+    bool writeCipstart();
+    bool writeCipclose();
+    virtual void handleError(RecoveryLevel minLevel, RecoveryLevel maxLevel = hardReset);
+
+    static const CommandStep _commandSteps[];
+    static const uint8_t _numCommandSteps;
 
     const char* _ssid;
     const char* _passwd;
 
     char _macStringBuffer[MACSTRING_MAX_LENGTH];
+    bool _macRequested;
+    uint32_t _uartBaudRate;
 };
 }
 
@@ -40,6 +40,9 @@ class IIPCommDevice : public IStatefulDevice
      * Need to be set before connect() is called.
      * \param host Host to connect to. Needs to be valid for
      * \param port port to connect to
+     * \param type Connection type. SSL connections use the TLS stack of the
+     * modem, see ATCommDevice::setCaCertificate(). On UDP connections, each
+     * write() sends a datagram and each read() returns one.
      */
     virtual void setHostPort(const char* host, uint16_t port, ConnectionType type = TCP) = 0;
 };
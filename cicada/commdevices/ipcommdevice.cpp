@@ -33,7 +33,9 @@ IPCommDevice::IPCommDevice(uint8_t* readBuffer, uint8_t* writeBuffer, Size buffe
     _port(0),
     _stateBooleans(LINE_READ),
     _connectState(notConnected),
-    _waitForReply(NULL)
+    _waitForReply(NULL),
+    _receiveSink(NULL),
+    _receiveSinkData(NULL)
 {}
 
 IPCommDevice::IPCommDevice(
@@ -44,7 +46,9 @@ IPCommDevice::IPCommDevice(
     _port(0),
     _stateBooleans(LINE_READ),
     _connectState(notConnected),
-    _waitForReply(NULL)
+    _waitForReply(NULL),
+    _receiveSink(NULL),
+    _receiveSinkData(NULL)
 {}
 
 void IPCommDevice::setHostPort(const char* host, uint16_t port, IPCommDevice::ConnectionType type)
@@ -87,6 +91,9 @@ bool IPCommDevice::isIdle()
 
 Size IPCommDevice::bytesAvailable() const
 {
+    if (_type == UDP)
+        return datagramSize(_readBuffer);
+
     return _readBuffer.bytesAvailable();
 }
 
@@ -95,11 +102,23 @@ Size IPCommDevice::spaceAvailable() const
     if (_connectState != connected)
         return 0;
 
+    if (_type == UDP) {
+        Size space = _writeBuffer.spaceAvailable();
+        if (space <= DATAGRAM_HEADER_SIZE)
+            return 0;
+        space -= DATAGRAM_HEADER_SIZE;
+
+        return space < maxDatagramSize() ? space : maxDatagramSize();
+    }
+
     return _writeBuffer.spaceAvailable();
 }
 
 Size IPCommDevice::read(uint8_t* data, Size maxSize)
 {
+    if (_type == UDP)
+        return receiveDatagram(data, maxSize);
+
     return _readBuffer.pull(data, maxSize);
 }
 
@@ -108,10 +127,134 @@ Size IPCommDevice::write(const uint8_t* data, Size size)
     if (_connectState != connected)
         return 0;
 
+    if (_type == UDP)
+        return sendDatagram(data, size) ? size : 0;
+
     return _writeBuffer.push(data, size);
 }
 
+Size IPCommDevice::writeParts(const DataPart* parts, uint8_t count)
+{
+    if (_connectState != connected)
+        return 0;
+
+    Size size = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        size += parts[i].size;
+    }
+
+    // On UDP connections, the parts make up one datagram
+    if (_type == UDP) {
+        if (size == 0 || size > maxDatagramSize()
+            || _writeBuffer.spaceAvailable() < size + DATAGRAM_HEADER_SIZE)
+            return 0;
+
+        const uint8_t header[DATAGRAM_HEADER_SIZE] = { (uint8_t)(size >> 8), (uint8_t)size };
+        _writeBuffer.push(header, DATAGRAM_HEADER_SIZE);
+    }
+
+    Size written = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        Size pushed = _writeBuffer.push(parts[i].data, parts[i].size);
+        written += pushed;
+        if (pushed < parts[i].size)
+            break;
+    }
+
+    return written;
+}
+
 bool IPCommDevice::writeBufferProcessed() const
 {
     return _writeBuffer.bytesAvailable() == 0 && _connectState != transmitting;
 }
+
+bool IPCommDevice::sendDatagram(const uint8_t* data, Size size)
+{
+    if (_connectState != connected || _type != UDP || size == 0 || size > maxDatagramSize())
+        return false;
+
+    if (_writeBuffer.spaceAvailable() < size + DATAGRAM_HEADER_SIZE)
+        return false;
+
+    const uint8_t header[DATAGRAM_HEADER_SIZE] = { (uint8_t)(size >> 8), (uint8_t)size };
+    _writeBuffer.push(header, DATAGRAM_HEADER_SIZE);
+    _writeBuffer.push(data, size);
+
+    return true;
+}
+
+Size IPCommDevice::receiveDatagram(uint8_t* data, Size maxSize)
+{
+    Size size = datagramSize(_readBuffer);
+    if (size == 0 || _type != UDP)
+        return 0;
+
+    _readBuffer.skip(DATAGRAM_HEADER_SIZE);
+    Size copied = _readBuffer.pull(data, size < maxSize ? size : maxSize);
+    _readBuffer.skip(size - copied);
+
+    return copied;
+}
+
+Size IPCommDevice::maxDatagramSize() const
+{
+    Size size = _writeBuffer.size() - DATAGRAM_HEADER_SIZE;
+
+    return size < 0xFFFF ? size : 0xFFFF;
+}
+
+void IPCommDevice::setReceiveSink(ReceiveSink sink, void* userData)
+{
+    _receiveSink = sink;
+    _receiveSinkData = userData;
+}
+
+Size IPCommDevice::datagramSize(const CircularBuffer<uint8_t>& buffer) const
+{
+    uint8_t header[DATAGRAM_HEADER_SIZE];
+    if (buffer.peek(header, DATAGRAM_HEADER_SIZE) < DATAGRAM_HEADER_SIZE)
+        return 0;
+
+    // Only the last datagram can be incomplete, while it's still being received
+    Size size = (header[0] << 8) | header[1];
+    if (buffer.bytesAvailable() < size + DATAGRAM_HEADER_SIZE)
+        return 0;
+
+    return size;
+}
+
+bool IPCommDevice::pushDatagramHeader(Size size)
+{
+    if (size > 0xFFFF || _readBuffer.spaceAvailable() < size + DATAGRAM_HEADER_SIZE)
+        return false;
+
+    const uint8_t header[DATAGRAM_HEADER_SIZE] = { (uint8_t)(size >> 8), (uint8_t)size };
+    _readBuffer.push(header, DATAGRAM_HEADER_SIZE);
+
+    return true;
+}
+
+bool IPCommDevice::useReceiveSink() const
+{
+    return _receiveSink && _type != UDP;
+}
+
+Size IPCommDevice::receiveSpace() const
+{
+    // A sink takes everything, so received data isn't limited by the read buffer
+    if (useReceiveSink())
+        return (Size)-1;
+
+    return _readBuffer.spaceAvailable();
+}
+
+Size IPCommDevice::pushReceived(const uint8_t* data, Size size)
+{
+    if (useReceiveSink()) {
+        _receiveSink(data, size, _receiveSinkData);
+        return size;
+    }
+
+    return _readBuffer.push(data, size);
+}
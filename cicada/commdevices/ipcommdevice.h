@@ -28,6 +28,7 @@
 #include "cicada/circularbuffer.h"
 #include "cicada/commdevices/iipcommdevice.h"
 #include "cicada/task.h"
+#include <cstddef>
 
 #define CONNECT_PENDING (1 << 0)
 #define RESET_PENDING (1 << 1)
@@ -36,6 +37,17 @@
 #define IP_CONNECTED (1 << 4)
 #define LINE_READ (1 << 5)
 #define SERIAL_LOCKED (1 << 6)
+#define DATA_MODE (1 << 7)
+#define SEND_ACTIVE (1 << 8)
+#define SEND_HELD (1 << 9)
+#define RECEIVE_PREFETCH (1 << 10)
+#define FLOW_CONTROL (1 << 11)
+#define DATAGRAM_DROP (1 << 12)
+#define REPLY_TIMER (1 << 13)
+
+// Each datagram in the read and write buffers of a UDP connection is preceded
+// by its size as a 16 bit value
+#define DATAGRAM_HEADER_SIZE 2
 
 namespace Cicada {
 
@@ -62,8 +74,60 @@ class IPCommDevice : public IIPCommDevice, public Task
     virtual Size spaceAvailable() const;
     virtual Size read(uint8_t* data, Size maxSize);
     virtual Size write(const uint8_t* data, Size size);
+    virtual Size writeParts(const DataPart* parts, uint8_t count);
     virtual bool writeBufferProcessed() const;
 
+    /*!
+     * Queues a datagram to be sent on a UDP connection. The datagram is
+     * queued as a whole and sent in a single packet, so its boundaries are
+     * preserved. On UDP connections, write() does the same.
+     *
+     * \param data Datagram to send
+     * \param size Size of the datagram, at most maxDatagramSize()
+     * \return true if the datagram was queued, false if it doesn't fit
+     * into the write buffer or the connection is not a connected UDP one
+     */
+    virtual bool sendDatagram(const uint8_t* data, Size size);
+
+    /*!
+     * Pulls the next datagram received on a UDP connection. If the datagram
+     * is larger than maxSize, the rest of it is discarded. On UDP connections,
+     * read() does the same, and bytesAvailable() returns the size of the
+     * next datagram.
+     *
+     * \param data Buffer to copy the datagram to
+     * \param maxSize Size of the buffer
+     * \return Number of bytes copied, 0 if no datagram has been received
+     */
+    virtual Size receiveDatagram(uint8_t* data, Size maxSize);
+
+    /*!
+     * \return Largest datagram which can be sent in a single packet
+     */
+    virtual Size maxDatagramSize() const;
+
+    /*!
+     * Function receiving the data of a TCP or SSL connection.
+     * \param data Received bytes, only valid during the call
+     * \param size Number of received bytes
+     * \param userData Pointer passed to setReceiveSink()
+     */
+    typedef void (*ReceiveSink)(const uint8_t* data, Size size, void* userData);
+
+    /*!
+     * Passes data received on TCP and SSL connections to a sink instead of
+     * the read buffer, for example to write a download to flash or feed it
+     * into a hash. Data is handed over in chunks as it arrives from the
+     * modem, without waiting for space in the read buffer, and read()
+     * returns nothing while the sink is set. The sink has to take all data
+     * it's given. Datagrams of UDP connections always go to the read buffer.
+     *
+     * \param sink Function to call with received data, NULL to use the read
+     * buffer again
+     * \param userData Pointer passed to the sink
+     */
+    void setReceiveSink(ReceiveSink sink, void* userData = NULL);
+
   protected:
     enum ConnectState {
         notConnected,
@@ -75,14 +139,22 @@ class IPCommDevice : public IIPCommDevice, public Task
         dnsError,
     };
 
+    Size datagramSize(const CircularBuffer<uint8_t>& buffer) const;
+    bool pushDatagramHeader(Size size);
+    bool useReceiveSink() const;
+    Size receiveSpace() const;
+    Size pushReceived(const uint8_t* data, Size size);
+
     CircularBuffer<uint8_t> _readBuffer;
     CircularBuffer<uint8_t> _writeBuffer;
     ConnectionType _type;
     const char* _host;
     uint16_t _port;
-    uint8_t _stateBooleans;
+    uint16_t _stateBooleans;
     ConnectState _connectState;
     const char* _waitForReply;
+    ReceiveSink _receiveSink;
+    void* _receiveSinkData;
 };
 }
 
@@ -22,13 +22,25 @@
  */
 
 #include "cicada/commdevices/modemdetect.h"
+#include "cicada/commdevices/commandbuilder.h"
 #include <cstring>
 #include <new>
 
 using namespace Cicada;
 
+#define BAUD_RATE_TIMEOUT 300
+#define BAUD_RATE_SWITCH_DELAY 50
+#define BAUD_RATE_PROBES 3
+
 ModemDetect::ModemDetect(IBufferedSerial& serial) :
-    _serial(serial), _detectState(noState), _startDetection(false), _detectedModem(NULL)
+    _serial(serial),
+    _detectState(noState),
+    _detectedType(noState),
+    _baudRate(0),
+    _targetBaudRate(0),
+    _probeCount(0),
+    _startDetection(false),
+    _detectedModem(NULL)
 {}
 
 void ModemDetect::startDetection()
@@ -36,6 +48,60 @@ void ModemDetect::startDetection()
     _startDetection = true;
 }
 
+void ModemDetect::setBaudRate(uint32_t baudRate, uint32_t initialBaudRate)
+{
+    _targetBaudRate = baudRate;
+    _baudRate = initialBaudRate;
+}
+
+uint32_t ModemDetect::baudRate() const
+{
+    return _baudRate;
+}
+
+void ModemDetect::modemFound()
+{
+    if (_targetBaudRate != 0 && _targetBaudRate != _baudRate
+        && sendBaudRateCommand(_targetBaudRate)) {
+        resetTimeout();
+        startTimeout();
+        _detectState = baudRateSent;
+    } else {
+        _detectState = _detectedType;
+    }
+}
+
+bool ModemDetect::sendBaudRateCommand(uint32_t baudRate)
+{
+    switch (_detectedType) {
+    case detectedSim800:
+    case detectedSim7x00:
+        CommandBuilder(_serial).append("AT+IPR=").appendNumber(baudRate).append("\r\n").send();
+        return true;
+    case detectedEspressif:
+        // Current rate only, not stored in the modem's flash
+        CommandBuilder(_serial)
+            .append("AT+UART_CUR=")
+            .appendNumber(baudRate)
+            .append(",8,1,0,0\r\n")
+            .send();
+        return true;
+    default:
+        return false;
+    }
+}
+
+void ModemDetect::switchBaudRate(uint32_t baudRate)
+{
+    _serial.setSerialConfig(baudRate, 8);
+    _serial.flushReceiveBuffers();
+    _probeCount = 0;
+    resetTimeout();
+
+    // Give the modem time to switch before probing
+    setDelay(BAUD_RATE_SWITCH_DELAY);
+}
+
 bool ModemDetect::modemDetected()
 {
     return _detectState > modemDetectedState;
@@ -79,8 +145,8 @@ ATCommDevice* ModemDetect::getDetectedModem()
 void ModemDetect::run()
 {
     if (_detectedModem) {
-        _detectedModem->run();
         _detectedModem->setLastRun(lastRun());
+        _detectedModem->run();
         setDelay(_detectedModem->delay());
         return;
     }
@@ -105,6 +171,38 @@ void ModemDetect::run()
         _detectState = cgmmSent;
         setDelay(10);
         break;
+    case baudRateSent:
+        // No reply, the modem may have switched anyway
+        if (isTimeout(BAUD_RATE_TIMEOUT)) {
+            _detectState = baudRateProbe;
+            switchBaudRate(_targetBaudRate);
+        }
+        break;
+    case baudRateRevert:
+        if (_serial.writeBufferProcessed()) {
+            _detectState = baudRateRollback;
+            switchBaudRate(_baudRate);
+        }
+        break;
+    case baudRateProbe:
+    case baudRateRollback:
+        if (_probeCount == 0 || isTimeout(BAUD_RATE_TIMEOUT)) {
+            if (_probeCount < BAUD_RATE_PROBES) {
+                _serial.flushReceiveBuffers();
+                _serial.write((const uint8_t*)"AT\r\n");
+                _probeCount++;
+                resetTimeout();
+                startTimeout();
+                setDelay(10);
+            } else if (_detectState == baudRateProbe) {
+                // Switch the modem back with the new rate, in case only its replies got lost
+                sendBaudRateCommand(_baudRate);
+                _detectState = baudRateRevert;
+            } else {
+                _detectState = errorState;
+            }
+        }
+        break;
     default:
         break;
     }
@@ -118,16 +216,24 @@ void ModemDetect::run()
         switch (_detectState) {
         case cgmmSent:
             if (strncmp("SIMCOM_SIM800", readBuf, 13) == 0) {
-                _detectState = detectedSim800;
+                _detectedType = detectedSim800;
+                _detectState = cgmmWaitOk;
             } else if (strncmp("SIMCOM_SIM7600", readBuf, 14) == 0) {
-                _detectState = detectedSim7x00;
+                _detectedType = detectedSim7x00;
+                _detectState = cgmmWaitOk;
             } else if (strncmp("CC1352P7", readBuf, 8) == 0) {
-                _detectState = detectedCC1352P7;
+                _detectedType = detectedCC1352P7;
+                _detectState = cgmmWaitOk;
             } else if (strncmp("ERROR", readBuf, 5) == 0) {
                 _serial.write((const uint8_t*)"AT+GMR\r\n");
                 _detectState = gmrSent;
             }
             break;
+        case cgmmWaitOk:
+            if (strncmp("OK\r\n", readBuf, 4) == 0) {
+                modemFound();
+            }
+            break;
         case gmrSent:
             if (strncmp("AT version:1.7", readBuf, 14) == 0
                 || strncmp("AT version:2.1", readBuf, 14) == 0) {
@@ -136,8 +242,30 @@ void ModemDetect::run()
             break;
         case espressifWaitOk:
             if (strncmp("OK\r\n", readBuf, 4) == 0) {
-                _detectState = detectedEspressif;
+                _detectedType = detectedEspressif;
+                modemFound();
             }
+            break;
+        case baudRateSent:
+            if (strncmp("OK\r\n", readBuf, 4) == 0) {
+                _detectState = baudRateProbe;
+                switchBaudRate(_targetBaudRate);
+            } else if (strncmp("ERROR", readBuf, 5) == 0) {
+                // Rate not supported by the modem
+                _detectState = _detectedType;
+            }
+            break;
+        case baudRateProbe:
+            if (strncmp("OK\r\n", readBuf, 4) == 0) {
+                _baudRate = _targetBaudRate;
+                _detectState = _detectedType;
+            }
+            break;
+        case baudRateRollback:
+            if (strncmp("OK\r\n", readBuf, 4) == 0) {
+                _detectState = _detectedType;
+            }
+            break;
         default:
             break;
         }
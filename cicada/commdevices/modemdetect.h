@@ -47,6 +47,32 @@ class ModemDetect : public Task
      * */
     void startDetection();
 
+    /*!
+     * Sets the baud rate the serial line is switched to after the modem has
+     * been detected. Detection itself runs with the baud rate the serial device
+     * was configured with. After detection, the modem is switched with
+     * "AT+IPR=<rate>" (SIM800, SIM7x00) or "AT+UART_CUR=<rate>,8,1,0,0"
+     * (Espressif), then the serial device with ISerial::setSerialConfig().
+     * The new rate is verified with a probe command. If the modem doesn't
+     * reply, both sides are switched back to the initial rate. If the modem
+     * doesn't reply with the initial rate either, modemDetected() stays false.
+     * Modems without a command to change the baud rate keep the initial rate.
+     * Needs to be set before startDetection() is called.
+     *
+     * Note: Simcom modems may keep the rate set with AT+IPR after a restart,
+     * so the serial device needs to start with that rate next time.
+     *
+     * \param baudRate Baud rate to switch to, 0 to keep the initial rate
+     * \param initialBaudRate Baud rate the serial device is configured with
+     */
+    void setBaudRate(uint32_t baudRate, uint32_t initialBaudRate = 115200);
+
+    /*!
+     * \return The baud rate in use, which is the initial baud rate until
+     * switching to the rate set with setBaudRate() succeeded.
+     */
+    uint32_t baudRate() const;
+
     /*!
      * Stays false until the modem is detected.
      * \return true when the modem has been detected
@@ -93,14 +119,28 @@ class ModemDetect : public Task
         beginState,
         errorState,
         cgmmSent,
+        cgmmWaitOk,
         gmrSent,
         espressifWaitOk,
+        baudRateSent,
+        baudRateProbe,
+        baudRateRevert,
+        baudRateRollback,
         modemDetectedState,
         detectedSim800,
         detectedSim7x00,
         detectedEspressif,
         detectedCC1352P7,
     } _detectState;
+    DetectState _detectedType;
+
+    void modemFound();
+    bool sendBaudRateCommand(uint32_t baudRate);
+    void switchBaudRate(uint32_t baudRate);
+
+    uint32_t _baudRate;
+    uint32_t _targetBaudRate;
+    uint8_t _probeCount;
 
     bool _startDetection;
     ATCommDevice* _detectedModem;
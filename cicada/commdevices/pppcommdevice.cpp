@@ -0,0 +1,1635 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "cicada/commdevices/pppcommdevice.h"
+#include "cicada/commdevices/commandbuilder.h"
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+using namespace Cicada;
+
+#define PPP_IP 0x0021
+#define PPP_IPCP 0x8021
+#define PPP_LCP 0xC021
+#define PPP_PAP 0xC023
+
+#define CONFIGURE_REQUEST 1
+#define CONFIGURE_ACK 2
+#define CONFIGURE_NAK 3
+#define CONFIGURE_REJECT 4
+#define TERMINATE_REQUEST 5
+#define TERMINATE_ACK 6
+#define CODE_REJECT 7
+#define PROTOCOL_REJECT 8
+#define ECHO_REQUEST 9
+#define ECHO_REPLY 10
+
+#define LCP_MRU 1
+#define LCP_ACCM 2
+#define LCP_AUTH 3
+#define LCP_MAGIC 5
+#define LCP_PFC 7
+#define LCP_ACFC 8
+
+#define IPCP_ADDRESS 3
+#define IPCP_PRIMARY_DNS 129
+#define IPCP_SECONDARY_DNS 131
+
+#define PAP_REQUEST 1
+#define PAP_ACK 2
+#define PAP_NAK 3
+
+// Flags in _pppFlags
+#define LCP_LOCAL_ACKED (1 << 0)
+#define LCP_PEER_ACKED (1 << 1)
+#define LCP_OPENED (LCP_LOCAL_ACKED | LCP_PEER_ACKED)
+#define PAP_REQUESTED (1 << 2)
+#define PAP_ACKED (1 << 3)
+#define IPCP_LOCAL_ACKED (1 << 4)
+#define IPCP_PEER_ACKED (1 << 5)
+#define IPCP_OPENED (IPCP_LOCAL_ACKED | IPCP_PEER_ACKED)
+#define LINK_TERMINATED (1 << 6)
+#define DNS_RESOLVED (1 << 7)
+#define DNS_FAILED (1 << 8)
+
+// Options in _lcpOptions and _ipcpOptions
+#define OPTION_MRU (1 << 0)
+#define OPTION_ACCM (1 << 1)
+#define OPTION_MAGIC (1 << 2)
+#define OPTION_ADDRESS (1 << 0)
+#define OPTION_PRIMARY_DNS (1 << 1)
+#define OPTION_SECONDARY_DNS (1 << 2)
+
+// Flags in _tcpFlags
+#define TCP_ACK_PENDING (1 << 0)
+#define TCP_FIN_SENT (1 << 1)
+#define TCP_FIN_RECEIVED (1 << 2)
+#define TCP_RESET (1 << 3)
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+#define TCP_PSH 0x08
+#define TCP_ACK 0x10
+
+#define IP_HEADER_LENGTH 20
+#define UDP_HEADER_LENGTH 8
+#define TCP_HEADER_LENGTH 20
+#define IP_PROTOCOL_TCP 6
+#define IP_PROTOCOL_UDP 17
+#define DNS_PORT 53
+#define DNS_HEADER_LENGTH 12
+
+#define PPP_RESTART_TIME 3000
+#define PPP_MAX_CONFIGURE 10
+#define PPP_MAX_TERMINATE 2
+#define PPP_ECHO_INTERVAL 10000
+#define PPP_MAX_ECHO 3
+#define PPP_HANGUP_TIMEOUT 3000
+#define PPP_DEFAULT_MRU 1500
+#define DNS_MAX_RETRIES 4
+#define TCP_RTO 2000
+#define TCP_MAX_RETRIES 6
+#define TCP_CLOSE_TIMEOUT 5000
+#define LOCAL_PORT_BASE 49152
+
+static inline uint16_t get16(const uint8_t* data)
+{
+    return (data[0] << 8) | data[1];
+}
+
+static inline uint32_t get32(const uint8_t* data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+static inline void put16(uint8_t* data, uint16_t value)
+{
+    data[0] = value >> 8;
+    data[1] = value;
+}
+
+static inline void put32(uint8_t* data, uint32_t value)
+{
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+static uint32_t checksumAdd(uint32_t sum, const uint8_t* data, Size length)
+{
+    // Internet checksum, see RFC 1071
+    while (length > 1) {
+        sum += get16(data);
+        data += 2;
+        length -= 2;
+    }
+    if (length > 0) {
+        sum += data[0] << 8;
+    }
+
+    return sum;
+}
+
+static uint16_t checksumFinish(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    return ~sum;
+}
+
+static uint32_t pseudoHeaderSum(uint32_t source, uint32_t destination, uint8_t protocol, Size length)
+{
+    return (source >> 16) + (source & 0xFFFF) + (destination >> 16) + (destination & 0xFFFF)
+        + protocol + length;
+}
+
+static bool parseIp(const char* str, uint32_t& ip)
+{
+    ip = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+        char* end;
+        unsigned long octet = strtoul(str, &end, 10);
+        if (end == str || octet > 255 || (i < 3 && *end != '.'))
+            return false;
+        ip = (ip << 8) | octet;
+        str = end + 1;
+    }
+
+    return true;
+}
+
+static void formatIp(char* str, const uint8_t* ip)
+{
+    for (uint8_t i = 0; i < 4; i++) {
+        uint8_t octet = ip[i];
+        if (octet >= 100)
+            *str++ = '0' + octet / 100;
+        if (octet >= 10)
+            *str++ = '0' + octet / 10 % 10;
+        *str++ = '0' + octet % 10;
+        *str++ = i < 3 ? '.' : '\0';
+    }
+}
+
+static E_TICK_TYPE tcpRto(uint8_t retries)
+{
+    return (E_TICK_TYPE)TCP_RTO << (retries < 3 ? retries : 3);
+}
+
+PppCommDevice::PppCommDevice(
+    IBufferedSerial& serial, uint8_t* readBuffer, uint8_t* writeBuffer, Size bufferSize) :
+    SimCommDevice(serial, readBuffer, writeBuffer, bufferSize),
+    _framer(_frameBuffer, sizeof(_frameBuffer)),
+    _user(""),
+    _password(""),
+    _cpId(0),
+    _localPort(LOCAL_PORT_BASE),
+    _ipId(0),
+    _dnsId(0)
+{
+    resetStates();
+}
+
+PppCommDevice::PppCommDevice(IBufferedSerial& serial, uint8_t* readBuffer, uint8_t* writeBuffer,
+    Size readBufferSize, Size writeBufferSize) :
+    SimCommDevice(serial, readBuffer, writeBuffer, readBufferSize, writeBufferSize),
+    _framer(_frameBuffer, sizeof(_frameBuffer)),
+    _user(""),
+    _password(""),
+    _cpId(0),
+    _localPort(LOCAL_PORT_BASE),
+    _ipId(0),
+    _dnsId(0)
+{
+    resetStates();
+}
+
+void PppCommDevice::resetStates()
+{
+    SimCommDevice::resetStates();
+    _framer.reset();
+    _pppFlags = 0;
+    _localIp = 0;
+    _remoteIp = 0;
+    _tcpFlags = 0;
+    _peerMru = PPP_DEFAULT_MRU;
+    _mss = 0;
+}
+
+bool PppCommDevice::connect()
+{
+    if (_type == SSL)
+        return false;
+
+    return SimCommDevice::connect();
+}
+
+bool PppCommDevice::serialLock()
+{
+    // The serial device carries PPP frames while the link is up
+    if (_sendState != notConnected)
+        return false;
+
+    return SimCommDevice::serialLock();
+}
+
+Size PppCommDevice::maxDatagramSize() const
+{
+    // Datagrams are not fragmented, so they need to fit into a single frame
+    Size size = IPCommDevice::maxDatagramSize();
+
+    return size < _mss ? size : _mss;
+}
+
+void PppCommDevice::setAuthentication(const char* user, const char* password)
+{
+    _user = user;
+    _password = password;
+}
+
+uint32_t PppCommDevice::localIp() const
+{
+    return _localIp;
+}
+
+void PppCommDevice::run()
+{
+    // If the serial device is net yet open, try to open it
+    if (!_serial.isOpen()) {
+        if (!_serial.open()) {
+            _sendState = serialError;
+        }
+        return;
+    }
+    openControlSerial();
+
+    // If the serial device is locked, don't go on
+    if (_stateBooleans & SERIAL_LOCKED)
+        return;
+
+    // If a modem reset is pending, bring the link down
+    if (_stateBooleans & RESET_PENDING) {
+        _stateBooleans &= ~(RESET_PENDING | IP_CONNECTED);
+        _waitForReply = NULL;
+        _replyState = okReply;
+        if (_sendState >= linkEstablish && _sendState < linkTerminate) {
+            _cpRetries = 0;
+            _sendState = linkTerminate;
+        } else if (_sendState < linkEstablish) {
+            _sendState = notConnected;
+        }
+    }
+
+    // In command mode, buffer and parse replies from the modem,
+    // otherwise pass PPP frames on to the protocol handlers
+    if (_stateBooleans & LINE_READ) {
+        if (fillLineBuffer()) {
+            logStates(_sendState, _replyState);
+            if (!handleLineReply())
+                return;
+        }
+    } else {
+        receiveFrames();
+    }
+
+    // Requests on the control port run independent of the main port
+    runControlPort("AT+CCID");
+
+    // Don't go on when waiting for a reply
+    if (replyPending())
+        return;
+
+    // Don't go on if space in write buffer is low
+    if (_serial.spaceAvailable() < 20)
+        return;
+
+    if (_sendState == notConnected) {
+        // When signal strength was requested, send the command to the modem
+        if (rssiRequested()) {
+            _replyState = csq;
+            _waitForReply = _okStr;
+            sendCommand("AT+CSQ");
+            return;
+        }
+
+        // When one of the identifications was requested, send the command to the modem
+        if (sendIDRequest("AT+CCID")) {
+            _replyState = requestID;
+            _waitForReply = _okStr;
+            return;
+        }
+    }
+
+    // Check the link with echo requests when the peer is silent
+    if (_sendState >= authenticate && _sendState <= bearerUp
+        && lastRun() - _rxTick > PPP_ECHO_INTERVAL) {
+        if (_echoCount == PPP_MAX_ECHO) {
+            _connectState = generalError;
+            _stateBooleans &= ~IP_CONNECTED;
+            _pppFlags |= LINK_TERMINATED;
+            _sendState = linkTerminate;
+        } else {
+            put32(_packet + 4, _magic);
+            if (sendControlPacket(PPP_LCP, ECHO_REQUEST, 0, 4)) {
+                _echoCount++;
+                _rxTick = lastRun();
+            }
+        }
+    }
+
+    // Connection state machine
+    switch (_sendState) {
+    case notConnected:
+        setDelay(10);
+        _connectState = IPCommDevice::notConnected;
+        handleConnect(connecting);
+        break;
+
+    case connecting:
+        if (handleDisconnect(notConnected))
+            break;
+        _connectState = IPCommDevice::intermediate;
+        _stateBooleans |= LINE_READ;
+        _waitForReply = _okStr;
+        _sendState = sendIfc;
+        sendCommand("ATE0");
+        break;
+
+    case sendIfc:
+        _sendState = sendCgdcont;
+        if (SimCommDevice::writeIfc()) {
+            _waitForReply = _okStr;
+        }
+        break;
+
+    case sendCgdcont:
+        if (handleDisconnect(notConnected))
+            break;
+        _waitForReply = _okStr;
+        _sendState = sendDial;
+        CommandBuilder(_serial)
+            .append("AT+CGDCONT=1,\"IP\",\"")
+            .append(_apn)
+            .append('"')
+            .append(_lineEndStr)
+            .send();
+        break;
+
+    case sendDial:
+        if (handleDisconnect(notConnected))
+            break;
+        _waitForReply = "CONNECT";
+        _replyState = expectConnect;
+        sendCommand("ATD*99#");
+        setCommandClass(networkCommand);
+        break;
+
+        // States after entering PPP mode
+
+    case linkEstablish:
+        if (handleDisconnect(linkTerminate)) {
+            _cpRetries = 0;
+            break;
+        }
+        if ((_pppFlags & LCP_OPENED) == LCP_OPENED) {
+            _cpRetries = 0;
+            _sendState = (_pppFlags & PAP_REQUESTED) ? authenticate : networkConfig;
+        } else if (restartTimeout()) {
+            if (_cpRetries == PPP_MAX_CONFIGURE) {
+                linkFailed();
+            } else if (sendLcpConfigureRequest()) {
+                _cpRetries++;
+                _cpTick = lastRun();
+            }
+        }
+        break;
+
+    case authenticate:
+        if (handleDisconnect(linkTerminate)) {
+            _cpRetries = 0;
+            break;
+        }
+        if (_pppFlags & PAP_ACKED) {
+            _cpRetries = 0;
+            _sendState = networkConfig;
+        } else if (restartTimeout()) {
+            if (_cpRetries == PPP_MAX_CONFIGURE) {
+                linkFailed();
+            } else if (sendPapRequest()) {
+                _cpRetries++;
+                _cpTick = lastRun();
+            }
+        }
+        break;
+
+    case networkConfig:
+        if (handleDisconnect(linkTerminate)) {
+            _cpRetries = 0;
+            break;
+        }
+        if ((_pppFlags & IPCP_OPENED) == IPCP_OPENED) {
+            if (_localIp == 0) {
+                linkFailed();
+            } else {
+                resolveHost();
+            }
+        } else if (restartTimeout()) {
+            if (_cpRetries == PPP_MAX_CONFIGURE) {
+                linkFailed();
+            } else if (sendIpcpConfigureRequest()) {
+                _cpRetries++;
+                _cpTick = lastRun();
+            }
+        }
+        break;
+
+    case resolving:
+        if (handleDisconnect(linkTerminate)) {
+            _cpRetries = 0;
+            break;
+        }
+        if (_pppFlags & DNS_RESOLVED) {
+            openSocket();
+        } else if (restartTimeout()) {
+            if (_cpRetries == DNS_MAX_RETRIES || (_pppFlags & DNS_FAILED)) {
+                _connectState = dnsError;
+                _sendState = keepBearer() ? bearerUp : linkTerminate;
+                _cpRetries = 0;
+            } else if (sendDnsRequest()) {
+                _cpRetries++;
+                _cpTick = lastRun();
+            }
+        }
+        break;
+
+    case tcpSynSent:
+        if (handleDisconnect(tcpSynSent)) {
+            sendTcpSegment(_sndNxt, TCP_RST, 0, 0);
+            closeSocket();
+        } else if (_tcpFlags & TCP_RESET) {
+            closeSocket();
+            _connectState = generalError;
+        } else if (_sndNxt == _sndUna) {
+            if (sendTcpSegment(_sndUna, TCP_SYN, 0, 0)) {
+                _sndNxt = _sndUna + 1;
+                _tcpTick = lastRun();
+            }
+        } else if (lastRun() - _tcpTick > tcpRto(_tcpRetries)) {
+            if (_tcpRetries == TCP_MAX_RETRIES) {
+                closeSocket();
+                _connectState = generalError;
+            } else if (sendTcpSegment(_sndUna, TCP_SYN, 0, 0)) {
+                _tcpRetries++;
+                _tcpTick = lastRun();
+            }
+        }
+        break;
+
+    case connected:
+        setDelay(0);
+        if (_type == UDP) {
+            if (handleDisconnect(connected)) {
+                closeSocket();
+            } else {
+                while (sendUdpData()) { }
+            }
+            break;
+        }
+
+        if (_tcpFlags & TCP_RESET) {
+            closeSocket();
+            break;
+        }
+
+        // Send the remaining data and close the connection in an orderly way
+        if (handleDisconnect(tcpClosing) || (_tcpFlags & TCP_FIN_RECEIVED)) {
+            _connectState = IPCommDevice::intermediate;
+            _sendState = tcpClosing;
+            _closeTick = lastRun();
+            break;
+        }
+
+        sendTcp();
+        break;
+
+    case tcpClosing:
+        if (_tcpFlags & TCP_RESET) {
+            closeSocket();
+            break;
+        }
+
+        sendTcp();
+
+        // Send FIN when all data have been sent
+        if (!(_tcpFlags & TCP_FIN_SENT) && _sndNxt - _sndUna == _writeBuffer.bytesAvailable()) {
+            if (sendTcpSegment(_sndNxt, TCP_FIN | TCP_ACK, 0, 0)) {
+                if (_sndNxt == _sndUna) {
+                    _tcpTick = lastRun();
+                }
+                _sndNxt++;
+                _tcpFlags |= TCP_FIN_SENT;
+                _closeTick = lastRun();
+            }
+        }
+
+        if ((_tcpFlags & TCP_FIN_SENT) && _sndUna == _sndNxt && (_tcpFlags & TCP_FIN_RECEIVED)) {
+            closeSocket();
+        } else if ((_tcpFlags & TCP_FIN_SENT) && lastRun() - _closeTick > TCP_CLOSE_TIMEOUT) {
+            // The peer doesn't close its side, abort the connection
+            sendTcpSegment(_sndNxt, TCP_RST | TCP_ACK, 0, 0);
+            closeSocket();
+        }
+        break;
+
+    case bearerUp:
+        setDelay(10);
+        _connectState = IPCommDevice::notConnected;
+        if (!keepBearer()) {
+            // Release the link, a pending connection request sets it up again
+            _cpRetries = 0;
+            _sendState = linkTerminate;
+        } else if (handleConnect(bearerUp)) {
+            _connectState = IPCommDevice::intermediate;
+            resolveHost();
+        }
+        break;
+
+    case linkTerminate:
+        setDelay(10);
+        _stateBooleans &= ~DISCONNECT_PENDING;
+        if ((_pppFlags & LINK_TERMINATED)
+            || (_cpRetries == PPP_MAX_TERMINATE && restartTimeout())) {
+            // The modem returns to command mode when the link is down
+            _localIp = 0;
+            _lbFill = 0;
+            _stateBooleans |= LINE_READ;
+            _cpTick = lastRun();
+            _sendState = hangup;
+        } else if (_cpRetries < PPP_MAX_TERMINATE && restartTimeout()) {
+            if (sendControlPacket(PPP_LCP, TERMINATE_REQUEST, ++_cpId, 0)) {
+                _cpRetries++;
+                _cpTick = lastRun();
+            }
+        }
+        break;
+
+    case hangup:
+        // Without "NO CARRIER", force the modem back to command mode
+        if (lastRun() - _cpTick > PPP_HANGUP_TIMEOUT) {
+            _serial.write((const uint8_t*)"+++");
+            setDelay(_guardTime);
+            _sendState = sendAth;
+        }
+        break;
+
+    case sendAth:
+        setDelay(10);
+        _replyState = errorAllowed;
+        _waitForReply = _okStr;
+        _sendState = notConnected;
+        sendCommand("ATH");
+        break;
+
+    default:
+        break;
+    }
+}
+
+bool PppCommDevice::handleLineReply()
+{
+    // Handle error states
+    if ((strncmp(_lineBuffer, "+CME ERROR", 10) == 0 || strncmp(_lineBuffer, "ERROR", 5) == 0)
+        && _replyState != errorAllowed) {
+        _connectState = generalError;
+        _waitForReply = NULL;
+        _replyState = okReply;
+        _sendState = notConnected;
+        return false;
+    }
+
+    // If sent a command, process standard reply
+    if (_waitForReply) {
+        if (strncmp(_lineBuffer, _waitForReply, strlen(_waitForReply)) == 0) {
+            _waitForReply = NULL;
+        }
+    }
+
+    // Process replies which need special treatment
+    switch (_replyState) {
+    case expectConnect:
+        if (_waitForReply == NULL) {
+            _replyState = okReply;
+            startLink();
+        } else if (strncmp(_lineBuffer, "NO CARRIER", 10) == 0
+            || strncmp(_lineBuffer, "BUSY", 4) == 0
+            || strncmp(_lineBuffer, "NO DIALTONE", 11) == 0) {
+            _connectState = generalError;
+            _waitForReply = NULL;
+            _replyState = okReply;
+            _sendState = notConnected;
+            return false;
+        }
+        break;
+
+    case errorAllowed:
+        if (_waitForReply == NULL || strncmp(_lineBuffer, "+CME ERROR", 10) == 0
+            || strncmp(_lineBuffer, "ERROR", 5) == 0) {
+            _waitForReply = NULL;
+            _replyState = okReply;
+        }
+        break;
+
+    case csq:
+        if (parseCsq(_lineBuffer)) {
+            _replyState = okReply;
+        }
+        break;
+
+    case requestID:
+        if (parseIDReply(_lineBuffer)) {
+            _replyState = okReply;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    // The modem reports the end of the PPP session
+    if (_sendState == hangup && strncmp(_lineBuffer, "NO CARRIER", 10) == 0) {
+        _sendState = notConnected;
+    }
+
+    return true;
+}
+
+void PppCommDevice::startLink()
+{
+    _stateBooleans &= ~LINE_READ;
+    _framer.reset();
+    _pppFlags = 0;
+    _lcpOptions = OPTION_MRU | OPTION_ACCM | OPTION_MAGIC;
+    _ipcpOptions = OPTION_ADDRESS | OPTION_PRIMARY_DNS | OPTION_SECONDARY_DNS;
+    _cpRetries = 0;
+    _magic = 0x43494341 ^ (lastRun() * 2654435761UL);
+    _peerMru = PPP_DEFAULT_MRU;
+    _localIp = 0;
+    _dnsServers[0] = 0;
+    _dnsServers[1] = 0;
+    _rxTick = lastRun();
+    _echoCount = 0;
+    _sendState = linkEstablish;
+}
+
+void PppCommDevice::linkFailed()
+{
+    _connectState = generalError;
+    _cpRetries = 0;
+    _sendState = linkTerminate;
+}
+
+bool PppCommDevice::restartTimeout()
+{
+    return _cpRetries == 0 || lastRun() - _cpTick > PPP_RESTART_TIME;
+}
+
+void PppCommDevice::restartNow()
+{
+    // Lets restartTimeout() expire on the next run
+    _cpTick = lastRun() - PPP_RESTART_TIME - 1;
+}
+
+void PppCommDevice::receiveFrames()
+{
+    uint8_t chunk[32];
+    Size length;
+
+    while ((length = _serial.read(chunk, sizeof(chunk))) > 0) {
+        for (Size i = 0; i < length; i++) {
+            if (_framer.decode(chunk[i])) {
+                handleFrame();
+            }
+        }
+    }
+}
+
+bool PppCommDevice::writeFrame(uint16_t protocol, const uint8_t* data, Size length)
+{
+    if (_serial.spaceAvailable() < _framer.encodedSize(protocol, data, length))
+        return false;
+
+    _framer.encode(_serial, protocol, data, length);
+    return true;
+}
+
+bool PppCommDevice::sendControlPacket(uint16_t protocol, uint8_t code, uint8_t id, Size length)
+{
+    // Data have been put behind the header by the caller
+    _packet[0] = code;
+    _packet[1] = id;
+    put16(_packet + 2, length + 4);
+
+    return writeFrame(protocol, _packet, length + 4);
+}
+
+void PppCommDevice::handleFrame()
+{
+    uint8_t* information = _framer.information();
+    Size length = _framer.informationLength();
+
+    _rxTick = lastRun();
+    _echoCount = 0;
+
+    switch (_framer.protocol()) {
+    case PPP_LCP:
+        handleLcp(information, length);
+        break;
+
+    case PPP_PAP:
+        handlePap(information, length);
+        break;
+
+    case PPP_IPCP:
+        handleIpcp(information, length);
+        break;
+
+    case PPP_IP:
+        handleIp(information, length);
+        break;
+
+    default:
+        // Reject protocols like IPv6CP or CCP once LCP is opened
+        if ((_pppFlags & LCP_OPENED) == LCP_OPENED) {
+            Size rejectLength = length + 2;
+            if (rejectLength > (Size)_peerMru - 4)
+                rejectLength = _peerMru - 4;
+            if (rejectLength > sizeof(_packet) - 4)
+                rejectLength = sizeof(_packet) - 4;
+
+            put16(_packet + 4, _framer.protocol());
+            memcpy(_packet + 6, information, rejectLength - 2);
+            sendControlPacket(PPP_LCP, PROTOCOL_REJECT, 0, rejectLength);
+        }
+        break;
+    }
+}
+
+void PppCommDevice::handleLcp(uint8_t* packet, Size length)
+{
+    if (length < 4 || get16(packet + 2) < 4 || get16(packet + 2) > length)
+        return;
+
+    uint8_t code = packet[0];
+    uint8_t id = packet[1];
+    length = get16(packet + 2);
+
+    // Replies are built from the packet, larger ones are dropped
+    if (length > sizeof(_packet))
+        return;
+
+    switch (code) {
+    case CONFIGURE_REQUEST: {
+        // A new negotiation once the link is up means it has been restarted by the peer
+        if (_sendState > linkEstablish && _sendState < linkTerminate) {
+            _stateBooleans &= ~IP_CONNECTED;
+            linkFailed();
+            return;
+        }
+
+        // Rejected options are collected in _packet
+        Size rejectLength = 0;
+        bool nak = false;
+        uint16_t peerMru = PPP_DEFAULT_MRU;
+        uint32_t accm = 0xFFFFFFFF;
+        bool pap = false;
+
+        for (Size i = 4; i < length;) {
+            uint8_t type = packet[i];
+            uint8_t optionLength = i + 1 < length ? packet[i + 1] : 0;
+            if (optionLength < 2 || i + optionLength > length)
+                return;
+
+            bool reject = false;
+            switch (type) {
+            case LCP_MRU:
+                reject = optionLength != 4;
+                peerMru = get16(packet + i + 2);
+                break;
+            case LCP_ACCM:
+                reject = optionLength != 6;
+                accm = get32(packet + i + 2);
+                break;
+            case LCP_AUTH:
+                // Only PAP is supported, suggest it instead of other protocols
+                if (optionLength >= 4 && get16(packet + i + 2) == PPP_PAP) {
+                    pap = true;
+                } else {
+                    nak = true;
+                }
+                break;
+            case LCP_MAGIC:
+                reject = optionLength != 6;
+                break;
+            case LCP_PFC:
+            case LCP_ACFC:
+                break;
+            default:
+                reject = true;
+                break;
+            }
+
+            if (reject) {
+                memcpy(_packet + 4 + rejectLength, packet + i, optionLength);
+                rejectLength += optionLength;
+            }
+            i += optionLength;
+        }
+
+        if (rejectLength > 0) {
+            sendControlPacket(PPP_LCP, CONFIGURE_REJECT, id, rejectLength);
+        } else if (nak) {
+            const uint8_t option[] = { LCP_AUTH, 4, PPP_PAP >> 8, PPP_PAP & 0xFF };
+            memcpy(_packet + 4, option, sizeof(option));
+            sendControlPacket(PPP_LCP, CONFIGURE_NAK, id, sizeof(option));
+        } else {
+            memcpy(_packet + 4, packet + 4, length - 4);
+            if (sendControlPacket(PPP_LCP, CONFIGURE_ACK, id, length - 4)) {
+                _peerMru = peerMru;
+                _framer.setTransmitAccm(accm);
+                if (pap) {
+                    _pppFlags |= PAP_REQUESTED;
+                } else {
+                    _pppFlags &= ~PAP_REQUESTED;
+                }
+                _pppFlags |= LCP_PEER_ACKED;
+            }
+        }
+    } break;
+
+    case CONFIGURE_ACK:
+        if (id == _cpId && _sendState == linkEstablish) {
+            if (_lcpOptions & OPTION_ACCM) {
+                _framer.setReceiveAccm(0);
+            }
+            _pppFlags |= LCP_LOCAL_ACKED;
+        }
+        break;
+
+    case CONFIGURE_NAK:
+    case CONFIGURE_REJECT:
+        if (id != _cpId || _sendState != linkEstablish)
+            break;
+
+        for (Size i = 4; i + 1 < length && packet[i + 1] >= 2; i += packet[i + 1]) {
+            switch (packet[i]) {
+            case LCP_MRU:
+                // Keep asking for the MRU which fits into the frame buffer
+                if (code == CONFIGURE_REJECT) {
+                    _lcpOptions &= ~OPTION_MRU;
+                }
+                break;
+            case LCP_ACCM:
+                _lcpOptions &= ~OPTION_ACCM;
+                break;
+            case LCP_MAGIC:
+                if (code == CONFIGURE_REJECT) {
+                    _lcpOptions &= ~OPTION_MAGIC;
+                } else {
+                    _magic = _magic * 1103515245 + 12345;
+                }
+                break;
+            default:
+                break;
+            }
+        }
+        restartNow();
+        break;
+
+    case TERMINATE_REQUEST:
+        sendControlPacket(PPP_LCP, TERMINATE_ACK, id, 0);
+        _pppFlags |= LINK_TERMINATED;
+        if (_sendState < linkTerminate) {
+            _stateBooleans &= ~IP_CONNECTED;
+            _connectState = IPCommDevice::intermediate;
+            _sendState = linkTerminate;
+        }
+        break;
+
+    case TERMINATE_ACK:
+        _pppFlags |= LINK_TERMINATED;
+        break;
+
+    case ECHO_REQUEST:
+        if ((_pppFlags & LCP_OPENED) == LCP_OPENED && length >= 8) {
+            memcpy(_packet + 4, packet + 4, length - 4);
+            put32(_packet + 4, _magic);
+            sendControlPacket(PPP_LCP, ECHO_REPLY, id, length - 4);
+        }
+        break;
+
+    case ECHO_REPLY:
+    case CODE_REJECT:
+    case PROTOCOL_REJECT:
+        break;
+
+    default:
+        // Discard-Request needs no reply, other unknown codes are rejected
+        if (code > ECHO_REPLY + 1) {
+            if (length > sizeof(_packet) - 4)
+                length = sizeof(_packet) - 4;
+            memcpy(_packet + 4, packet, length);
+            sendControlPacket(PPP_LCP, CODE_REJECT, 0, length);
+        }
+        break;
+    }
+}
+
+bool PppCommDevice::sendLcpConfigureRequest()
+{
+    uint8_t* option = _packet + 4;
+
+    if (_lcpOptions & OPTION_MRU) {
+        option[0] = LCP_MRU;
+        option[1] = 4;
+        put16(option + 2, E_PPP_MRU);
+        option += 4;
+    }
+    if (_lcpOptions & OPTION_ACCM) {
+        // Control characters don't need to be escaped
+        option[0] = LCP_ACCM;
+        option[1] = 6;
+        put32(option + 2, 0);
+        option += 6;
+    }
+    if (_lcpOptions & OPTION_MAGIC) {
+        option[0] = LCP_MAGIC;
+        option[1] = 6;
+        put32(option + 2, _magic);
+        option += 6;
+    }
+
+    return sendControlPacket(PPP_LCP, CONFIGURE_REQUEST, ++_cpId, option - (_packet + 4));
+}
+
+void PppCommDevice::handlePap(uint8_t* packet, Size length)
+{
+    if (length < 4 || packet[1] != _cpId || _sendState != authenticate)
+        return;
+
+    if (packet[0] == PAP_ACK) {
+        _pppFlags |= PAP_ACKED;
+    } else if (packet[0] == PAP_NAK) {
+        linkFailed();
+    }
+}
+
+bool PppCommDevice::sendPapRequest()
+{
+    Size userLength = strlen(_user);
+    Size passwordLength = strlen(_password);
+    if (userLength > 255)
+        userLength = 255;
+    if (passwordLength > 255)
+        passwordLength = 255;
+
+    uint8_t* data = _packet + 4;
+    *data++ = userLength;
+    memcpy(data, _user, userLength);
+    data += userLength;
+    *data++ = passwordLength;
+    memcpy(data, _password, passwordLength);
+
+    return sendControlPacket(PPP_PAP, PAP_REQUEST, ++_cpId, userLength + passwordLength + 2);
+}
+
+void PppCommDevice::handleIpcp(uint8_t* packet, Size length)
+{
+    if ((_pppFlags & LCP_OPENED) != LCP_OPENED)
+        return;
+
+    if (length < 4 || get16(packet + 2) < 4 || get16(packet + 2) > length)
+        return;
+
+    uint8_t code = packet[0];
+    uint8_t id = packet[1];
+    length = get16(packet + 2);
+
+    // Replies are built from the packet, larger ones are dropped
+    if (length > sizeof(_packet))
+        return;
+
+    switch (code) {
+    case CONFIGURE_REQUEST: {
+        // Accept the peer's address, reject everything else, like header compression
+        Size rejectLength = 0;
+        for (Size i = 4; i < length;) {
+            uint8_t optionLength = i + 1 < length ? packet[i + 1] : 0;
+            if (optionLength < 2 || i + optionLength > length)
+                return;
+
+            if (packet[i] != IPCP_ADDRESS || optionLength != 6) {
+                memcpy(_packet + 4 + rejectLength, packet + i, optionLength);
+                rejectLength += optionLength;
+            }
+            i += optionLength;
+        }
+
+        if (rejectLength > 0) {
+            sendControlPacket(PPP_IPCP, CONFIGURE_REJECT, id, rejectLength);
+        } else {
+            memcpy(_packet + 4, packet + 4, length - 4);
+            if (sendControlPacket(PPP_IPCP, CONFIGURE_ACK, id, length - 4)) {
+                _pppFlags |= IPCP_PEER_ACKED;
+            }
+        }
+    } break;
+
+    case CONFIGURE_ACK:
+        if (id == _cpId && _sendState == networkConfig) {
+            _pppFlags |= IPCP_LOCAL_ACKED;
+        }
+        break;
+
+    case CONFIGURE_NAK:
+    case CONFIGURE_REJECT:
+        if (id != _cpId || _sendState != networkConfig)
+            break;
+
+        // The network assigns the address and DNS servers with a Configure-Nak
+        for (Size i = 4; i + 1 < length && packet[i + 1] >= 2; i += packet[i + 1]) {
+            uint8_t option = 0;
+            uint32_t* value = NULL;
+            switch (packet[i]) {
+            case IPCP_ADDRESS:
+                option = OPTION_ADDRESS;
+                value = &_localIp;
+                break;
+            case IPCP_PRIMARY_DNS:
+                option = OPTION_PRIMARY_DNS;
+                value = &_dnsServers[0];
+                break;
+            case IPCP_SECONDARY_DNS:
+                option = OPTION_SECONDARY_DNS;
+                value = &_dnsServers[1];
+                break;
+            default:
+                break;
+            }
+
+            if (code == CONFIGURE_REJECT) {
+                _ipcpOptions &= ~option;
+            } else if (value && packet[i + 1] == 6 && i + 6 <= length) {
+                *value = get32(packet + i + 2);
+            }
+        }
+        restartNow();
+        break;
+
+    case TERMINATE_REQUEST:
+        sendControlPacket(PPP_IPCP, TERMINATE_ACK, id, 0);
+        if (_sendState > networkConfig && _sendState < linkTerminate) {
+            _stateBooleans &= ~IP_CONNECTED;
+            linkFailed();
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+bool PppCommDevice::sendIpcpConfigureRequest()
+{
+    uint8_t* option = _packet + 4;
+
+    const uint8_t types[] = { IPCP_ADDRESS, IPCP_PRIMARY_DNS, IPCP_SECONDARY_DNS };
+    const uint32_t values[] = { _localIp, _dnsServers[0], _dnsServers[1] };
+    for (uint8_t i = 0; i < 3; i++) {
+        if (_ipcpOptions & (1 << i)) {
+            option[0] = types[i];
+            option[1] = 6;
+            put32(option + 2, values[i]);
+            option += 6;
+        }
+    }
+
+    return sendControlPacket(PPP_IPCP, CONFIGURE_REQUEST, ++_cpId, option - (_packet + 4));
+}
+
+void PppCommDevice::handleIp(uint8_t* packet, Size length)
+{
+    if (length < IP_HEADER_LENGTH || (packet[0] >> 4) != 4)
+        return;
+
+    Size headerLength = (packet[0] & 0x0F) * 4;
+    Size totalLength = get16(packet + 2);
+    if (headerLength < IP_HEADER_LENGTH || totalLength < headerLength || totalLength > length)
+        return;
+
+    if (checksumFinish(checksumAdd(0, packet, headerLength)) != 0)
+        return;
+
+    // Fragments are not supported, the MRU keeps packets small
+    if (get16(packet + 6) & 0x3FFF)
+        return;
+
+    if (get32(packet + 16) != _localIp)
+        return;
+
+    uint32_t source = get32(packet + 12);
+    uint8_t protocol = packet[9];
+    const uint8_t* payload = packet + headerLength;
+    Size payloadLength = totalLength - headerLength;
+    uint32_t sum = pseudoHeaderSum(source, _localIp, protocol, payloadLength);
+
+    if (protocol == IP_PROTOCOL_TCP) {
+        if (source == _remoteIp && checksumFinish(checksumAdd(sum, payload, payloadLength)) == 0) {
+            handleTcp(payload, payloadLength);
+        }
+    } else if (protocol == IP_PROTOCOL_UDP && payloadLength >= UDP_HEADER_LENGTH) {
+        // The UDP checksum is optional
+        if (get16(payload + 6) == 0
+            || checksumFinish(checksumAdd(sum, payload, payloadLength)) == 0) {
+            handleUdp(source, payload, payloadLength);
+        }
+    }
+}
+
+bool PppCommDevice::sendIpPacket(uint8_t protocol, uint32_t ip, Size length)
+{
+    // The transport header and payload have been put behind the IP header by the caller
+    _packet[0] = 0x45;
+    _packet[1] = 0;
+    put16(_packet + 2, length);
+    put16(_packet + 4, _ipId++);
+    put16(_packet + 6, 0x4000);
+    _packet[8] = 64;
+    _packet[9] = protocol;
+    put16(_packet + 10, 0);
+    put32(_packet + 12, _localIp);
+    put32(_packet + 16, ip);
+    put16(_packet + 10, checksumFinish(checksumAdd(0, _packet, IP_HEADER_LENGTH)));
+
+    return writeFrame(PPP_IP, _packet, length);
+}
+
+void PppCommDevice::handleUdp(uint32_t source, const uint8_t* datagram, Size length)
+{
+    uint16_t sourcePort = get16(datagram);
+    Size udpLength = get16(datagram + 4);
+    if (get16(datagram + 2) != _localPort || udpLength < UDP_HEADER_LENGTH || udpLength > length)
+        return;
+
+    const uint8_t* data = datagram + UDP_HEADER_LENGTH;
+    Size dataLength = udpLength - UDP_HEADER_LENGTH;
+
+    if (_sendState == resolving && sourcePort == DNS_PORT
+        && (source == _dnsServers[0] || source == _dnsServers[1])) {
+        handleDnsReply(data, dataLength);
+    } else if (_type == UDP && _sendState == connected && source == _remoteIp
+        && sourcePort == _port) {
+        // Datagrams which don't fit into the read buffer are dropped
+        if (dataLength > 0 && pushDatagramHeader(dataLength)) {
+            _readBuffer.push(data, dataLength);
+        }
+    }
+}
+
+bool PppCommDevice::sendUdp(uint32_t ip, uint16_t port, Size length)
+{
+    // The payload has been put behind the UDP header by the caller
+    uint8_t* udp = _packet + IP_HEADER_LENGTH;
+    length += UDP_HEADER_LENGTH;
+    put16(udp, _localPort);
+    put16(udp + 2, port);
+    put16(udp + 4, length);
+    put16(udp + 6, 0);
+
+    uint16_t sum = checksumFinish(
+        checksumAdd(pseudoHeaderSum(_localIp, ip, IP_PROTOCOL_UDP, length), udp, length));
+    put16(udp + 6, sum == 0 ? 0xFFFF : sum);
+
+    return sendIpPacket(IP_PROTOCOL_UDP, ip, length + IP_HEADER_LENGTH);
+}
+
+bool PppCommDevice::sendUdpData()
+{
+    Size length = datagramSize(_writeBuffer);
+    if (length == 0)
+        return false;
+
+    _writeBuffer.peek(
+        _packet + IP_HEADER_LENGTH + UDP_HEADER_LENGTH, length, DATAGRAM_HEADER_SIZE);
+    if (!sendUdp(_remoteIp, _port, length))
+        return false;
+
+    _writeBuffer.skip(DATAGRAM_HEADER_SIZE + length);
+    return true;
+}
+
+void PppCommDevice::resolveHost()
+{
+    // Use a new local port for each connection, so late segments of the
+    // previous one are not mistaken for the new one, and vary it with time
+    // so it differs from the connections before a reboot
+    _localPort = LOCAL_PORT_BASE + ((_localPort + 1 + lastRun()) & 0x3FFF);
+    _pppFlags &= ~(DNS_RESOLVED | DNS_FAILED);
+    _cpRetries = 0;
+    _dnsId++;
+
+    if (resolveFromCache() && parseIp(_ip, _remoteIp)) {
+        openSocket();
+    } else {
+        _sendState = resolving;
+    }
+}
+
+bool PppCommDevice::sendDnsRequest()
+{
+    // Alternate between the DNS servers on retries
+    uint32_t server = _dnsServers[0];
+    if (server == 0 || ((_cpRetries & 1) && _dnsServers[1] != 0)) {
+        server = _dnsServers[1];
+    }
+    if (server == 0) {
+        _pppFlags |= DNS_FAILED;
+        return false;
+    }
+
+    uint8_t* message = _packet + IP_HEADER_LENGTH + UDP_HEADER_LENGTH;
+    Size maxLength = sizeof(_packet) - IP_HEADER_LENGTH - UDP_HEADER_LENGTH;
+    put16(message, _dnsId);
+    put16(message + 2, 0x0100);
+    put16(message + 4, 1);
+    memset(message + 6, 0, 6);
+    Size length = DNS_HEADER_LENGTH;
+
+    // Encode the host name as a sequence of labels
+    const char* label = _host;
+    while (*label) {
+        const char* end = strchr(label, '.');
+        if (end == NULL) {
+            end = label + strlen(label);
+        }
+        Size labelLength = end - label;
+        if (labelLength == 0 || labelLength > 63 || length + labelLength + 6 > maxLength) {
+            _pppFlags |= DNS_FAILED;
+            return false;
+        }
+        message[length++] = labelLength;
+        memcpy(message + length, label, labelLength);
+        length += labelLength;
+        label = *end ? end + 1 : end;
+    }
+    message[length++] = 0;
+    put16(message + length, 1);
+    put16(message + length + 2, 1);
+    length += 4;
+
+    return sendUdp(server, DNS_PORT, length);
+}
+
+static Size skipDnsName(const uint8_t* message, Size length, Size offset)
+{
+    while (offset < length) {
+        uint8_t labelLength = message[offset];
+        if (labelLength == 0)
+            return offset + 1;
+        if ((labelLength & 0xC0) == 0xC0)
+            return offset + 2;
+        offset += labelLength + 1;
+    }
+
+    return 0;
+}
+
+void PppCommDevice::handleDnsReply(const uint8_t* message, Size length)
+{
+    if (length < DNS_HEADER_LENGTH || get16(message) != _dnsId || !(message[2] & 0x80))
+        return;
+
+    if ((message[3] & 0x0F) != 0) {
+        _pppFlags |= DNS_FAILED;
+        return;
+    }
+
+    Size offset = DNS_HEADER_LENGTH;
+    for (uint16_t questions = get16(message + 4); questions > 0; questions--) {
+        offset = skipDnsName(message, length, offset);
+        if (offset == 0)
+            return;
+        offset += 4;
+    }
+
+    // Use the first address record, skipping CNAME records
+    for (uint16_t answers = get16(message + 6); answers > 0; answers--) {
+        offset = skipDnsName(message, length, offset);
+        if (offset == 0 || offset + 10 > length)
+            return;
+
+        uint16_t type = get16(message + offset);
+        Size dataLength = get16(message + offset + 8);
+        offset += 10;
+        if (offset + dataLength > length)
+            return;
+
+        if (type == 1 && dataLength == 4) {
+            _remoteIp = get32(message + offset);
+            formatIp(_ip, message + offset);
+            _dnsCache.add(_host, _ip, lastRun());
+            _pppFlags |= DNS_RESOLVED;
+            return;
+        }
+        offset += dataLength;
+    }
+
+    _pppFlags |= DNS_FAILED;
+}
+
+void PppCommDevice::openSocket()
+{
+    // Packets need to fit into the peer's MRU, and encoded into the serial write buffer
+    Size maxLength = (_serial.writeBufferSize() - 14) / 2;
+    if (maxLength > _peerMru)
+        maxLength = _peerMru;
+    if (maxLength > sizeof(_packet))
+        maxLength = sizeof(_packet);
+
+    _stateBooleans |= IP_CONNECTED;
+    _tcpFlags = 0;
+
+    if (_type == UDP) {
+        _mss = maxLength - IP_HEADER_LENGTH - UDP_HEADER_LENGTH;
+        _connectState = IPCommDevice::connected;
+        _sendState = connected;
+        return;
+    }
+
+    _mss = maxLength - IP_HEADER_LENGTH - TCP_HEADER_LENGTH;
+    _sndUna = lastRun() * 250 + _localPort;
+    _sndNxt = _sndUna;
+    _rcvNxt = 0;
+    _sndWnd = 0;
+    _rcvWnd = 0;
+    _tcpRetries = 0;
+    _dupAcks = 0;
+    _sendState = tcpSynSent;
+}
+
+void PppCommDevice::closeSocket()
+{
+    _stateBooleans &= ~IP_CONNECTED;
+    _tcpFlags = 0;
+    _writeBuffer.flush();
+    _connectState = IPCommDevice::intermediate;
+    _cpRetries = 0;
+    _sendState = keepBearer() ? bearerUp : linkTerminate;
+}
+
+void PppCommDevice::handleTcp(const uint8_t* segment, Size length)
+{
+    if (length < TCP_HEADER_LENGTH || get16(segment) != _port || get16(segment + 2) != _localPort)
+        return;
+
+    if (_sendState != tcpSynSent && _sendState != connected && _sendState != tcpClosing)
+        return;
+
+    uint32_t seq = get32(segment + 4);
+    uint32_t ack = get32(segment + 8);
+    Size headerLength = (segment[12] >> 4) * 4;
+    uint8_t flags = segment[13];
+    uint16_t window = get16(segment + 14);
+    if (headerLength < TCP_HEADER_LENGTH || headerLength > length)
+        return;
+
+    if (_sendState == tcpSynSent) {
+        // Reset a stale connection of the peer, e.g. after a reboot with the same port
+        if ((flags & TCP_ACK) && ack != _sndNxt) {
+            if (!(flags & TCP_RST)) {
+                sendTcpSegment(ack, TCP_RST, 0, 0);
+            }
+            return;
+        }
+
+        if (flags & TCP_RST) {
+            // Connection refused
+            if (flags & TCP_ACK) {
+                _tcpFlags |= TCP_RESET;
+            }
+        } else if ((flags & TCP_SYN) && (flags & TCP_ACK)) {
+            // Use the maximum segment size of the peer if it's smaller
+            for (Size i = TCP_HEADER_LENGTH; i < headerLength && segment[i] != 0;) {
+                if (segment[i] == 1) {
+                    i++;
+                } else if (i + 1 < headerLength && segment[i + 1] >= 2) {
+                    if (segment[i] == 2 && segment[i + 1] == 4 && get16(segment + i + 2) < _mss) {
+                        _mss = get16(segment + i + 2);
+                    }
+                    i += segment[i + 1];
+                } else {
+                    break;
+                }
+            }
+
+            _rcvNxt = seq + 1;
+            _sndUna = ack;
+            _sndWnd = window;
+            _tcpRetries = 0;
+            _tcpFlags |= TCP_ACK_PENDING;
+            _connectState = IPCommDevice::connected;
+            _sendState = connected;
+        }
+        return;
+    }
+
+    if (flags & TCP_RST) {
+        if (seq - _rcvNxt <= _rcvWnd) {
+            _tcpFlags |= TCP_RESET;
+        }
+        return;
+    }
+
+    // A repeated SYN means our ACK got lost
+    if (flags & TCP_SYN) {
+        _tcpFlags |= TCP_ACK_PENDING;
+        return;
+    }
+
+    Size dataLength = length - headerLength;
+
+    // Remove acknowledged data from the write buffer
+    if (flags & TCP_ACK) {
+        uint32_t acked = ack - _sndUna;
+        if (acked <= _sndNxt - _sndUna) {
+            if (acked > 0) {
+                _writeBuffer.skip(acked);
+                _sndUna = ack;
+                _tcpRetries = 0;
+                _dupAcks = 0;
+                _tcpTick = lastRun();
+            } else if (dataLength == 0 && _sndNxt != _sndUna && ++_dupAcks == 3) {
+                // Three duplicate acknowledgements mean a segment got lost,
+                // send again without waiting for the timeout
+                _sndNxt = _sndUna;
+                _tcpFlags &= ~TCP_FIN_SENT;
+                _tcpTick = lastRun();
+            }
+            _sndWnd = window;
+        }
+    }
+
+    // Only accept data in sequence, the peer sends the rest again
+    if (dataLength > 0 || (flags & TCP_FIN)) {
+        if (seq == _rcvNxt && !(_tcpFlags & TCP_FIN_RECEIVED)) {
+            Size accepted = pushReceived(segment + headerLength, dataLength);
+            _rcvNxt += accepted;
+            if ((flags & TCP_FIN) && accepted == dataLength) {
+                _rcvNxt++;
+                _tcpFlags |= TCP_FIN_RECEIVED;
+            }
+        }
+        _tcpFlags |= TCP_ACK_PENDING;
+    }
+}
+
+bool PppCommDevice::sendTcpSegment(uint32_t seq, uint8_t flags, Size offset, Size length)
+{
+    uint8_t* tcp = _packet + IP_HEADER_LENGTH;
+    Size headerLength = (flags & TCP_SYN) ? TCP_HEADER_LENGTH + 4 : TCP_HEADER_LENGTH;
+    if (length > 0) {
+        length = _writeBuffer.peek(tcp + headerLength, length, offset);
+    }
+
+    Size window = receiveSpace();
+    if (window > 0xFFFF)
+        window = 0xFFFF;
+
+    put16(tcp, _localPort);
+    put16(tcp + 2, _port);
+    put32(tcp + 4, seq);
+    put32(tcp + 8, (flags & TCP_ACK) ? _rcvNxt : 0);
+    tcp[12] = (headerLength / 4) << 4;
+    tcp[13] = flags;
+    put16(tcp + 14, window);
+    put16(tcp + 16, 0);
+    put16(tcp + 18, 0);
+    if (flags & TCP_SYN) {
+        // Maximum segment size option
+        tcp[20] = 2;
+        tcp[21] = 4;
+        put16(tcp + 22, E_PPP_MRU - IP_HEADER_LENGTH - TCP_HEADER_LENGTH);
+    }
+
+    Size tcpLength = headerLength + length;
+    put16(tcp + 16,
+        checksumFinish(checksumAdd(
+            pseudoHeaderSum(_localIp, _remoteIp, IP_PROTOCOL_TCP, tcpLength), tcp, tcpLength)));
+
+    if (!sendIpPacket(IP_PROTOCOL_TCP, _remoteIp, tcpLength + IP_HEADER_LENGTH))
+        return false;
+
+    _rcvWnd = window;
+    if (flags & TCP_ACK) {
+        _tcpFlags &= ~TCP_ACK_PENDING;
+    }
+
+    return true;
+}
+
+bool PppCommDevice::sendTcpData()
+{
+    if (_tcpFlags & TCP_FIN_SENT)
+        return false;
+
+    Size inFlight = _sndNxt - _sndUna;
+    Size available = _writeBuffer.bytesAvailable();
+    if (inFlight >= available || inFlight >= _sndWnd)
+        return false;
+
+    Size length = available - inFlight;
+    bool push = true;
+    if (length > _sndWnd - inFlight) {
+        length = _sndWnd - inFlight;
+        push = false;
+    }
+    if (length > _mss) {
+        length = _mss;
+        push = false;
+    }
+
+    if (!sendTcpSegment(_sndNxt, push ? TCP_ACK | TCP_PSH : TCP_ACK, inFlight, length))
+        return false;
+
+    if (inFlight == 0) {
+        _tcpTick = lastRun();
+    }
+    _sndNxt += length;
+
+    return true;
+}
+
+void PppCommDevice::sendTcp()
+{
+    if (_sndNxt != _sndUna) {
+        if (lastRun() - _tcpTick > tcpRto(_tcpRetries)) {
+            if (_tcpRetries == TCP_MAX_RETRIES) {
+                _tcpFlags |= TCP_RESET;
+                _connectState = generalError;
+                return;
+            }
+
+            // Go back and send everything again from the oldest unacknowledged byte
+            _tcpRetries++;
+            _dupAcks = 0;
+            _tcpTick = lastRun();
+            _sndNxt = _sndUna;
+            _tcpFlags &= ~TCP_FIN_SENT;
+        }
+    } else if (_sndWnd == 0 && !_writeBuffer.isEmpty() && lastRun() - _tcpTick > TCP_RTO) {
+        // Probe a zero window with a single byte
+        if (sendTcpSegment(_sndNxt, TCP_ACK, 0, 1)) {
+            _sndNxt++;
+            _tcpTick = lastRun();
+        }
+    }
+
+    while (sendTcpData()) { }
+
+    // Tell the peer when there's space in the read buffer again
+    Size space = receiveSpace();
+    if (space > 0xFFFF)
+        space = 0xFFFF;
+    Size update = _readBuffer.size() / 2 < _mss ? _readBuffer.size() / 2 : _mss;
+    if (space > _rcvWnd && space - _rcvWnd >= update) {
+        _tcpFlags |= TCP_ACK_PENDING;
+    }
+
+    if (_tcpFlags & TCP_ACK_PENDING) {
+        sendTcpSegment(_sndNxt, TCP_ACK, 0, 0);
+    }
+}
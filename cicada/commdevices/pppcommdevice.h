@@ -0,0 +1,245 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef PPPCOMMDEVICE_H
+#define PPPCOMMDEVICE_H
+
+#include "cicada/commdevices/pppframer.h"
+#include "cicada/commdevices/simcommdevice.h"
+#include <stdint.h>
+
+#ifndef E_PPP_MRU
+#define E_PPP_MRU 576
+#endif
+
+namespace Cicada {
+
+/*!
+ * Driver for cellular modems in PPP data mode. Instead of the modem's
+ * socket commands, it dials into the packet data network with "ATD*99#"
+ * and runs PPP and a minimal IPv4 stack with TCP, UDP and DNS over the
+ * serial device. There's no AT framing for each chunk of data, and TCP
+ * sends as many segments as the peer's window allows, so throughput is
+ * close to the serial line rate. It works with any modem implementing
+ * 3GPP TS 27.007, like the SIM800 and SIM7x00 series.
+ *
+ * The driver provides a single connection at a time, of type TCP or UDP.
+ * SSL is not supported. The maximum receive unit is E_PPP_MRU, which also
+ * limits the size of TCP segments and UDP datagrams. The write buffer of
+ * the serial device needs space for at least one encoded frame, which can
+ * take up to twice its size.
+ *
+ * The signal strength and identification strings can only be requested
+ * while the link is down, requests are processed when the link is closed.
+ */
+class PppCommDevice : public SimCommDevice
+{
+  public:
+    /*!
+     * \param serial Serial driver for the port the modem is connected to.
+     */
+    PppCommDevice(
+        IBufferedSerial& serial, uint8_t* readBuffer, uint8_t* writeBuffer, Size bufferSize);
+
+    PppCommDevice(IBufferedSerial& serial, uint8_t* readBuffer, uint8_t* writeBuffer,
+        Size readBufferSize, Size writeBufferSize);
+
+    virtual void resetStates();
+    virtual bool connect();
+
+    /*!
+     * The serial device can only be locked while the link is down,
+     * otherwise it carries PPP frames.
+     */
+    virtual bool serialLock();
+
+    /*!
+     * \return Largest datagram which fits into a single frame, which
+     * is known once the UDP connection is established
+     */
+    virtual Size maxDatagramSize() const;
+
+    /*!
+     * Sets the credentials for PAP authentication, if the modem asks for it.
+     * By default, empty strings are sent, which most modems accept. The
+     * strings are not copied and need to stay valid.
+     *
+     * \param user User name
+     * \param password Password
+     */
+    void setAuthentication(const char* user, const char* password);
+
+    /*!
+     * \return Local IPv4 address assigned by the network in host byte order,
+     * or 0 when the link is down
+     */
+    uint32_t localIp() const;
+
+    /*!
+     * Actually performs communication with the modem.
+     * \startuml
+     * top to bottom direction
+     * [*] --> notConnected
+     * notConnected --> notConnected
+     * notConnected --> connecting : connection request via API
+     * connecting --> sendIfc
+     * connecting : ""ATE0""
+     * sendIfc --> sendCgdcont
+     * sendIfc : flow control changed: ""AT+IFC=<2,2|0,0>""
+     * sendCgdcont --> sendDial
+     * sendCgdcont : ""AT+CGDCONT=1,"IP",<apn>""
+     * sendDial --> linkEstablish : ""CONNECT""
+     * sendDial : ""ATD*99#""
+     * linkEstablish --> authenticate : LCP opened, PAP requested
+     * linkEstablish --> networkConfig : LCP opened
+     * linkEstablish : LCP Configure-Request
+     * authenticate --> networkConfig
+     * authenticate : PAP Authenticate-Request
+     * networkConfig --> resolving : IPCP opened
+     * networkConfig --> tcpSynSent : IPCP opened, TCP, cached host name
+     * networkConfig --> connected : IPCP opened, UDP, cached host name
+     * networkConfig : IPCP Configure-Request
+     * resolving --> tcpSynSent : TCP
+     * resolving --> connected : UDP
+     * resolving --> bearerUp : DNS error, keep bearer
+     * resolving --> linkTerminate : DNS error
+     * resolving : DNS query
+     * tcpSynSent --> connected
+     * tcpSynSent --> bearerUp : refused, keep bearer
+     * tcpSynSent --> linkTerminate : refused
+     * tcpSynSent : SYN
+     * connected --> connected : pass data
+     * connected --> tcpClosing : connection closed via API or by peer
+     * connected --> bearerUp : UDP, connection closed via API, keep bearer
+     * connected --> linkTerminate : UDP, connection closed via API
+     * tcpClosing --> bearerUp : keep bearer
+     * tcpClosing --> linkTerminate
+     * tcpClosing : send remaining data, FIN
+     * bearerUp --> resolving : connection request via API
+     * bearerUp --> tcpSynSent : connection request via API, TCP, cached host name
+     * bearerUp --> connected : connection request via API, UDP, cached host name
+     * bearerUp --> linkTerminate : keep bearer disabled
+     * linkTerminate --> hangup
+     * linkTerminate : LCP Terminate-Request
+     * hangup --> sendAth : no ""NO CARRIER""
+     * hangup --> notConnected : ""NO CARRIER""
+     * hangup : ""+++""
+     * sendAth --> notConnected
+     * sendAth : ""ATH""
+     * \enduml
+     */
+    virtual void run();
+
+  protected:
+    bool handleLineReply();
+    void startLink();
+    void linkFailed();
+    bool restartTimeout();
+    void restartNow();
+    void receiveFrames();
+    bool writeFrame(uint16_t protocol, const uint8_t* data, Size length);
+    bool sendControlPacket(uint16_t protocol, uint8_t code, uint8_t id, Size length);
+    void handleFrame();
+    void handleLcp(uint8_t* packet, Size length);
+    bool sendLcpConfigureRequest();
+    void handlePap(uint8_t* packet, Size length);
+    bool sendPapRequest();
+    void handleIpcp(uint8_t* packet, Size length);
+    bool sendIpcpConfigureRequest();
+    void handleIp(uint8_t* packet, Size length);
+    bool sendIpPacket(uint8_t protocol, uint32_t ip, Size length);
+    void handleUdp(uint32_t source, const uint8_t* datagram, Size length);
+    bool sendUdp(uint32_t ip, uint16_t port, Size length);
+    bool sendUdpData();
+    void resolveHost();
+    bool sendDnsRequest();
+    void handleDnsReply(const uint8_t* message, Size length);
+    void openSocket();
+    void closeSocket();
+    void handleTcp(const uint8_t* segment, Size length);
+    bool sendTcpSegment(uint32_t seq, uint8_t flags, Size offset, Size length);
+    bool sendTcpData();
+    void sendTcp();
+
+    enum SendState {
+        serialError = -1,
+        notConnected = 0,
+        connecting,
+        sendIfc,
+        sendCgdcont,
+        sendDial,
+        linkEstablish,
+        authenticate,
+        networkConfig,
+        resolving,
+        tcpSynSent,
+        connected,
+        tcpClosing,
+        bearerUp,
+        linkTerminate,
+        hangup,
+        sendAth
+    };
+
+    enum ReplyState { okReply = 0, expectConnect, errorAllowed, csq, requestID };
+
+    uint8_t _frameBuffer[E_PPP_MRU + 8];
+    uint8_t _packet[E_PPP_MRU];
+    PppFramer _framer;
+
+    const char* _user;
+    const char* _password;
+
+    uint16_t _pppFlags;
+    uint8_t _lcpOptions;
+    uint8_t _ipcpOptions;
+    uint8_t _cpId;
+    uint8_t _cpRetries;
+    E_TICK_TYPE _cpTick;
+    uint32_t _magic;
+    uint16_t _peerMru;
+    E_TICK_TYPE _rxTick;
+    uint8_t _echoCount;
+
+    uint32_t _localIp;
+    uint32_t _dnsServers[2];
+    uint32_t _remoteIp;
+    uint16_t _localPort;
+    uint16_t _ipId;
+    uint16_t _dnsId;
+
+    uint8_t _tcpFlags;
+    uint8_t _tcpRetries;
+    uint8_t _dupAcks;
+    E_TICK_TYPE _tcpTick;
+    E_TICK_TYPE _closeTick;
+    uint32_t _sndUna;
+    uint32_t _sndNxt;
+    uint32_t _rcvNxt;
+    uint16_t _sndWnd;
+    uint16_t _rcvWnd;
+    uint16_t _mss;
+};
+}
+
+#endif
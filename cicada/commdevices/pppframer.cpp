@@ -0,0 +1,239 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "cicada/commdevices/pppframer.h"
+
+using namespace Cicada;
+
+#define PPP_FLAG 0x7E
+#define PPP_ESCAPE 0x7D
+#define PPP_ESCAPE_BIT 0x20
+#define PPP_ADDRESS 0xFF
+#define PPP_CONTROL 0x03
+#define PPP_LCP 0xC021
+#define PPP_DEFAULT_ACCM 0xFFFFFFFF
+
+PppFramer::PppFramer(uint8_t* buffer, Size bufferSize) :
+    _buffer(buffer),
+    _bufferSize(bufferSize),
+    _protocol(0),
+    _informationOffset(0),
+    _informationLength(0),
+    _errors(0)
+{
+    reset();
+}
+
+void PppFramer::reset()
+{
+    _fill = 0;
+    _escape = false;
+    _overflow = false;
+    _txAccm = PPP_DEFAULT_ACCM;
+    _rxAccm = PPP_DEFAULT_ACCM;
+}
+
+uint16_t PppFramer::fcs16(uint16_t fcs, const uint8_t* data, Size length)
+{
+    // CRC-CCITT, reflected polynomial 0x8408, see RFC 1662 appendix C
+    while (length--) {
+        fcs ^= *data++;
+        for (uint8_t i = 0; i < 8; i++) {
+            fcs = (fcs & 0x0001) ? (fcs >> 1) ^ 0x8408 : fcs >> 1;
+        }
+    }
+
+    return fcs;
+}
+
+bool PppFramer::decode(uint8_t data)
+{
+    if (data == PPP_FLAG) {
+        bool valid = false;
+        if (_escape || _overflow) {
+            // Aborted or oversized frame
+            _errors++;
+        } else if (_fill > 0) {
+            valid = completeFrame();
+        }
+        _fill = 0;
+        _escape = false;
+        _overflow = false;
+        return valid;
+    }
+
+    if (data < 0x20 && (_rxAccm & (1UL << data)))
+        return false;
+
+    if (data == PPP_ESCAPE) {
+        _escape = true;
+        return false;
+    }
+
+    if (_escape) {
+        data ^= PPP_ESCAPE_BIT;
+        _escape = false;
+    }
+
+    if (_fill < _bufferSize) {
+        _buffer[_fill++] = data;
+    } else {
+        _overflow = true;
+    }
+
+    return false;
+}
+
+bool PppFramer::completeFrame()
+{
+    if (_fill < 4 || fcs16(PPP_INITIAL_FCS, _buffer, _fill) != PPP_GOOD_FCS) {
+        _errors++;
+        return false;
+    }
+
+    // Address and control field may be compressed
+    Size offset = 0;
+    Size length = _fill - 2;
+    if (_buffer[0] == PPP_ADDRESS && _buffer[1] == PPP_CONTROL) {
+        offset = 2;
+    }
+
+    // Protocol field may be compressed to a single, odd byte
+    if (offset < length && (_buffer[offset] & 0x01)) {
+        _protocol = _buffer[offset];
+        offset += 1;
+    } else if (offset + 1 < length) {
+        _protocol = (_buffer[offset] << 8) | _buffer[offset + 1];
+        offset += 2;
+    } else {
+        _errors++;
+        return false;
+    }
+
+    _informationOffset = offset;
+    _informationLength = length - offset;
+
+    return true;
+}
+
+uint16_t PppFramer::protocol() const
+{
+    return _protocol;
+}
+
+uint8_t* PppFramer::information()
+{
+    return _buffer + _informationOffset;
+}
+
+Size PppFramer::informationLength() const
+{
+    return _informationLength;
+}
+
+uint32_t PppFramer::errors() const
+{
+    return _errors;
+}
+
+void PppFramer::setTransmitAccm(uint32_t accm)
+{
+    _txAccm = accm;
+}
+
+void PppFramer::setReceiveAccm(uint32_t accm)
+{
+    _rxAccm = accm;
+}
+
+bool PppFramer::needsEscape(uint8_t data, uint32_t accm) const
+{
+    return data == PPP_FLAG || data == PPP_ESCAPE || (data < 0x20 && (accm & (1UL << data)));
+}
+
+Size PppFramer::escapedLength(const uint8_t* data, Size length, uint32_t accm) const
+{
+    Size escapedLength = length;
+    for (Size i = 0; i < length; i++) {
+        if (needsEscape(data[i], accm))
+            escapedLength++;
+    }
+
+    return escapedLength;
+}
+
+Size PppFramer::encodedSize(uint16_t protocol, const uint8_t* data, Size length) const
+{
+    uint32_t accm = protocol == PPP_LCP ? PPP_DEFAULT_ACCM : _txAccm;
+    const uint8_t header[] = { PPP_ADDRESS, PPP_CONTROL, (uint8_t)(protocol >> 8),
+        (uint8_t)protocol };
+
+    uint16_t fcs = fcs16(PPP_INITIAL_FCS, header, sizeof(header));
+    fcs = ~fcs16(fcs, data, length);
+    const uint8_t trailer[] = { (uint8_t)fcs, (uint8_t)(fcs >> 8) };
+
+    return escapedLength(header, sizeof(header), accm) + escapedLength(data, length, accm)
+        + escapedLength(trailer, sizeof(trailer), accm) + 2;
+}
+
+void PppFramer::writeEscaped(
+    IBufferedSerial& serial, const uint8_t* data, Size length, uint32_t accm)
+{
+    // Escape in small chunks instead of writing byte by byte
+    uint8_t chunk[32];
+    uint8_t fill = 0;
+
+    for (Size i = 0; i < length; i++) {
+        if (needsEscape(data[i], accm)) {
+            chunk[fill++] = PPP_ESCAPE;
+            chunk[fill++] = data[i] ^ PPP_ESCAPE_BIT;
+        } else {
+            chunk[fill++] = data[i];
+        }
+        if (fill >= sizeof(chunk) - 1) {
+            serial.write(chunk, fill);
+            fill = 0;
+        }
+    }
+
+    if (fill > 0) {
+        serial.write(chunk, fill);
+    }
+}
+
+void PppFramer::encode(IBufferedSerial& serial, uint16_t protocol, const uint8_t* data, Size length)
+{
+    uint32_t accm = protocol == PPP_LCP ? PPP_DEFAULT_ACCM : _txAccm;
+    const uint8_t header[] = { PPP_ADDRESS, PPP_CONTROL, (uint8_t)(protocol >> 8),
+        (uint8_t)protocol };
+
+    uint16_t fcs = fcs16(PPP_INITIAL_FCS, header, sizeof(header));
+    fcs = ~fcs16(fcs, data, length);
+    const uint8_t trailer[] = { (uint8_t)fcs, (uint8_t)(fcs >> 8) };
+
+    serial.write((uint8_t)PPP_FLAG);
+    writeEscaped(serial, header, sizeof(header), accm);
+    writeEscaped(serial, data, length, accm);
+    writeEscaped(serial, trailer, sizeof(trailer), accm);
+    serial.write((uint8_t)PPP_FLAG);
+}
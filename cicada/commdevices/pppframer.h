@@ -0,0 +1,160 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef PPPFRAMER_H
+#define PPPFRAMER_H
+
+#include "cicada/ibufferedserial.h"
+#include <stdint.h>
+
+#define PPP_INITIAL_FCS 0xFFFF
+#define PPP_GOOD_FCS 0xF0B8
+
+namespace Cicada {
+
+/*!
+ * \class PppFramer
+ *
+ * HDLC-like framing for PPP according to RFC 1662. Decodes the byte
+ * stream from the serial device into frames, and encodes frames to be
+ * sent. Received frames with an invalid frame check sequence are dropped.
+ * Compressed address, control and protocol fields are accepted on
+ * receive, sent frames always carry the full fields.
+ */
+class PppFramer
+{
+  public:
+    /*!
+     * \param buffer Buffer to store a received frame, including the
+     * address, control, protocol and FCS fields
+     * \param bufferSize Size of the buffer, frames not fitting into it
+     * are dropped
+     */
+    PppFramer(uint8_t* buffer, Size bufferSize);
+
+    /*!
+     * Drops a partially received frame and resets the async control
+     * character maps to their defaults.
+     */
+    void reset();
+
+    /*!
+     * Passes a byte received from the serial device to the decoder.
+     *
+     * \param data Received byte
+     * \return true if a valid frame has been completed. Its contents are
+     * available with protocol() and information() until the next call.
+     */
+    bool decode(uint8_t data);
+
+    /*!
+     * \return Protocol of the last received frame
+     */
+    uint16_t protocol() const;
+
+    /*!
+     * \return Information field of the last received frame
+     */
+    uint8_t* information();
+
+    /*!
+     * \return Length of the information field of the last received frame
+     */
+    Size informationLength() const;
+
+    /*!
+     * \return Number of frames dropped because of an invalid FCS or
+     * because they didn't fit into the buffer
+     */
+    uint32_t errors() const;
+
+    /*!
+     * Sets the async control character map for sending. Control characters
+     * in the map are escaped in all frames except LCP frames, which always
+     * use the default map with all control characters escaped.
+     *
+     * \param accm Character map, bit n stands for character n
+     */
+    void setTransmitAccm(uint32_t accm);
+
+    /*!
+     * Sets the async control character map for receiving. Unescaped control
+     * characters in the map are dropped, as they were inserted on the line.
+     *
+     * \param accm Character map, bit n stands for character n
+     */
+    void setReceiveAccm(uint32_t accm);
+
+    /*!
+     * \param protocol Protocol of the frame
+     * \param data Information field
+     * \param length Length of the information field
+     * \return Number of bytes the encoded frame takes on the serial line
+     */
+    Size encodedSize(uint16_t protocol, const uint8_t* data, Size length) const;
+
+    /*!
+     * Encodes a frame and writes it to the serial device. The caller needs
+     * to make sure there is enough space, see encodedSize().
+     *
+     * \param serial Serial device to write the frame to
+     * \param protocol Protocol of the frame
+     * \param data Information field
+     * \param length Length of the information field
+     */
+    void encode(IBufferedSerial& serial, uint16_t protocol, const uint8_t* data, Size length);
+
+    /*!
+     * Calculates the 16 bit frame check sequence.
+     *
+     * \param fcs Initial value, PPP_INITIAL_FCS or the result of a previous call
+     * \param data Data to calculate the FCS for
+     * \param length Length of the data
+     * \return FCS before complementing it. Calculated over a frame including
+     * its FCS field, the result is PPP_GOOD_FCS.
+     */
+    static uint16_t fcs16(uint16_t fcs, const uint8_t* data, Size length);
+
+  private:
+    bool needsEscape(uint8_t data, uint32_t accm) const;
+    Size escapedLength(const uint8_t* data, Size length, uint32_t accm) const;
+    void writeEscaped(IBufferedSerial& serial, const uint8_t* data, Size length, uint32_t accm);
+    bool completeFrame();
+
+    uint8_t* _buffer;
+    Size _bufferSize;
+    Size _fill;
+    bool _escape;
+    bool _overflow;
+
+    uint16_t _protocol;
+    Size _informationOffset;
+    Size _informationLength;
+    uint32_t _errors;
+
+    uint32_t _txAccm;
+    uint32_t _rxAccm;
+};
+}
+
+#endif
@@ -22,6 +22,7 @@
  */
 
 #include "cicada/commdevices/rakrui3.h"
+#include "cicada/commdevices/commandbuilder.h"
 #include <cinttypes>
 #include <cstdio>
 #include <cstring>
@@ -86,7 +87,7 @@ void RakDevice::setAppKey(const char* key)
 
 void RakDevice::setPort(uint8_t port)
 {
-    snprintf(_portStr, sizeof(_portStr), "%u", port);
+    _port = port;
 }
 
 bool RakDevice::connect()
@@ -280,9 +281,7 @@ void RakDevice::run()
 
     case sendDevEUI:
         if (_devEui) {
-            _serial.write((const uint8_t*)"AT+DEVEUI=");
-            _serial.write((const uint8_t*)_devEui);
-            _serial.write((const uint8_t*)_lineEndStr);
+            CommandBuilder(_serial).append("AT+DEVEUI=").append(_devEui).append(_lineEndStr).send();
             _waitForReply = _okStr;
         }
         _sendState = sendAppEUI;
@@ -290,18 +289,14 @@ void RakDevice::run()
 
     case sendAppEUI:
         if (_appEui) {
-            _serial.write((const uint8_t*)"AT+APPEUI=");
-            _serial.write((const uint8_t*)_appEui);
-            _serial.write((const uint8_t*)_lineEndStr);
+            CommandBuilder(_serial).append("AT+APPEUI=").append(_appEui).append(_lineEndStr).send();
             _waitForReply = _okStr;
         }
         _sendState = sendAppKey;
         break;
 
     case sendAppKey:
-        _serial.write((const uint8_t*)"AT+APPKEY=");
-        _serial.write((const uint8_t*)_appKey);
-        _serial.write((const uint8_t*)_lineEndStr);
+        CommandBuilder(_serial).append("AT+APPKEY=").append(_appKey).append(_lineEndStr).send();
         _waitForReply = _okStr;
         _sendState = sendClass;
         break;
@@ -344,18 +339,14 @@ void RakDevice::run()
         //_waitForReply = _okStr;
         _sendState = waitForSend;
         _replyState = sendConfirm;
-        _serial.write((const uint8_t*)"AT+SEND=");
-        _serial.write((const uint8_t*)_portStr);
-        _serial.write((const uint8_t*)":");
+        CommandBuilder cmd(_serial);
+        cmd.append("AT+SEND=").appendNumber(_port).append(':');
         int i;
         for (i = 0; i < _currentPacketSize && _writeBuffer.bytesAvailable(); i++) {
-            char hexStr[3];
-            char c = _writeBuffer.pull();
-            sprintf(hexStr, "%02X", c);
-            _serial.write((const uint8_t*)hexStr);
+            cmd.appendHex(_writeBuffer.pull());
         }
         _bytesToResend = i;
-        _serial.write((const uint8_t*)_lineEndStr);
+        cmd.append(_lineEndStr).send();
         break;
     }
 
@@ -152,7 +152,7 @@ class RakDevice : public IStatefulDevice, public Task
     const char* _devEui = nullptr;
     const char* _appEui = nullptr;
     const char* _appKey = nullptr;
-    char _portStr[4];
+    uint8_t _port;
 
     uint8_t _stateBooleans;
     int8_t _sendState;
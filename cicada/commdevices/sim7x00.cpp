@@ -22,21 +22,68 @@
  */
 
 #include "cicada/commdevices/sim7x00.h"
+#include "cicada/commdevices/commandbuilder.h"
 #include "cicada/commdevices/ipcommdevice.h"
-#include "printf.h"
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 
 using namespace Cicada;
 
 const uint16_t SIM7x00_MAX_RX = 1500;
+const uint16_t SIM7x00_MAX_TX = 1500;
+const char* const SIM7x00_CA_FILE = "cicada_ca.pem";
+const uint16_t SIM7x00_RECOVERY_DELAY = 1000;
+
+const ATCommDevice::CommandStep Sim7x00CommDevice::_commandSteps[] = {
+    // Bearer set up
+    {sendIfc, NULL, static_cast<StepWriter>(&Sim7x00CommDevice::writeIfc), NULL, NULL,
+        shortCommand, sendCgsockcont, useRecovery},
+    {sendCgsockcont, NULL, static_cast<StepWriter>(&Sim7x00CommDevice::writeCgsockcont), NULL,
+        NULL, shortCommand, sendCsocksetpn, useRecovery},
+    {sendCsocksetpn, "AT+CSOCKSETPN=1", NULL, NULL, NULL, shortCommand, sendCipmode, useRecovery},
+    {sendCipmode, NULL, static_cast<StepWriter>(&Sim7x00CommDevice::writeCipmode), NULL, NULL,
+        shortCommand, sendNetopen, useRecovery},
+    {sendCcertdown, NULL, static_cast<StepWriter>(&Sim7x00CommDevice::writeCcertdown), ">", NULL,
+        shortCommand, sendCertData, useRecovery},
+    {sendCsslcfgVersion, NULL, static_cast<StepWriter>(&Sim7x00CommDevice::writeCsslcfgVersion),
+        NULL, NULL, shortCommand, sendCsslcfgAuth, useRecovery},
+    {sendCsslcfgAuth, NULL, static_cast<StepWriter>(&Sim7x00CommDevice::writeCsslcfgAuth), NULL,
+        NULL, shortCommand, sendCsslcfgSni, useRecovery},
+    {sendCsslcfgCacert, NULL, static_cast<StepWriter>(&Sim7x00CommDevice::writeCsslcfgCacert),
+        NULL, NULL, shortCommand, sendCsslcfgSni, useRecovery},
+    {sendCsslcfgSni, "AT+CSSLCFG=\"enableSNI\",0,1", NULL, NULL, NULL, shortCommand, sendCchset,
+        useRecovery},
+    {sendCchset, NULL, static_cast<StepWriter>(&Sim7x00CommDevice::writeCchset), NULL, NULL,
+        shortCommand, sendCchstart, useRecovery},
+    {sendCchstart, NULL, static_cast<StepWriter>(&Sim7x00CommDevice::writeCchstart),
+        "+CCHSTART: 0", static_cast<StepParser>(&Sim7x00CommDevice::parseCchstart),
+        networkCommand, sendCchsslcfg, useRecovery},
+    {sendCchsslcfg, "AT+CCHSSLCFG=0,0", NULL, NULL, NULL, shortCommand, sendCchopen, useRecovery},
+    {sendNetopen, NULL, static_cast<StepWriter>(&Sim7x00CommDevice::writeNetopen), "+NETOPEN: 0",
+        static_cast<StepParser>(&Sim7x00CommDevice::parseNetopen), networkCommand, sendCiprxget,
+        useRecovery},
+    {sendCiprxget, NULL, static_cast<StepWriter>(&Sim7x00CommDevice::writeCiprxget), NULL, NULL,
+        shortCommand, sendDnsQuery, useRecovery},
+    // Tear down
+    {sendCipclose, NULL, static_cast<StepWriter>(&Sim7x00CommDevice::writeCipclose),
+        "+CIPCLOSE: 0,", NULL, networkCommand, sendNetclose, useRecovery},
+    {sendNetclose, NULL, static_cast<StepWriter>(&Sim7x00CommDevice::writeNetclose),
+        "+NETCLOSE: 0", NULL, networkCommand, finalizeDisconnect, useRecovery},
+    {sendCchstop, "AT+CCHSTOP", NULL, "+CCHSTOP: 0", NULL, networkCommand, finalizeDisconnect,
+        useRecovery},
+    // Radio restart to recover from errors, the modem registers with the network again
+    {sendCfunOff, "AT+CFUN=0", NULL, NULL, NULL, networkCommand, sendCfunOn, useRecovery},
+    {sendCfunOn, "AT+CFUN=1", NULL, NULL, NULL, networkCommand, finalizeDisconnect, useRecovery}};
+const uint8_t Sim7x00CommDevice::_numCommandSteps = sizeof(_commandSteps) / sizeof(CommandStep);
 
 Sim7x00CommDevice::Sim7x00CommDevice(
     IBufferedSerial& serial, uint8_t* readBuffer, uint8_t* writeBuffer, Size bufferSize) :
     SimCommDevice(serial, readBuffer, writeBuffer, bufferSize)
 {
     _modemMaxReceiveSize = SIM7x00_MAX_RX;
+    _maxSendChunkSize = SIM7x00_MAX_TX;
 }
 
 Sim7x00CommDevice::Sim7x00CommDevice(IBufferedSerial& serial, uint8_t* readBuffer,
@@ -44,6 +91,164 @@ Sim7x00CommDevice::Sim7x00CommDevice(IBufferedSerial& serial, uint8_t* readBuffe
     SimCommDevice(serial, readBuffer, writeBuffer, readBufferSize, writeBufferSize)
 {
     _modemMaxReceiveSize = SIM7x00_MAX_RX;
+    _maxSendChunkSize = SIM7x00_MAX_TX;
+}
+
+bool Sim7x00CommDevice::writeCgsockcont()
+{
+    CommandBuilder(_serial)
+        .append("AT+CGSOCKCONT=1,\"IP\",\"")
+        .append(_apn)
+        .append(_quoteEndStr)
+        .send();
+    return true;
+}
+
+bool Sim7x00CommDevice::writeCipmode()
+{
+    // SSL connections use the modem's own SSL stack, which handles DNS as well
+    if (_type == SSL) {
+        _sendState = sendCcertdown;
+    }
+    sendCommand(useTransparentMode() ? "AT+CIPMODE=1" : "AT+CIPMODE=0");
+    return true;
+}
+
+bool Sim7x00CommDevice::writeCcertdown()
+{
+    if (!caCertificatePending()) {
+        _sendState = sendCsslcfgVersion;
+        return false;
+    }
+
+    CommandBuilder(_serial)
+        .append("AT+CCERTDOWN=\"")
+        .append(SIM7x00_CA_FILE)
+        .append("\",")
+        .appendNumber(_caCertLength)
+        .append(_lineEndStr)
+        .send();
+    _bytesToWrite = _caCertLength;
+    return true;
+}
+
+bool Sim7x00CommDevice::writeCsslcfgVersion()
+{
+    // The modem confirmed the certificate upload, if there was one
+    if (_caCert) {
+        _caCertLoaded = true;
+    }
+    sendCommand("AT+CSSLCFG=\"sslversion\",0,4");
+    return true;
+}
+
+bool Sim7x00CommDevice::writeCsslcfgAuth()
+{
+    if (_caCert) {
+        _sendState = sendCsslcfgCacert;
+        sendCommand("AT+CSSLCFG=\"authmode\",0,1");
+    } else {
+        sendCommand("AT+CSSLCFG=\"authmode\",0,0");
+    }
+    return true;
+}
+
+bool Sim7x00CommDevice::writeCsslcfgCacert()
+{
+    CommandBuilder(_serial)
+        .append("AT+CSSLCFG=\"cacert\",0,\"")
+        .append(SIM7x00_CA_FILE)
+        .append(_quoteEndStr)
+        .send();
+    return true;
+}
+
+bool Sim7x00CommDevice::writeCchset()
+{
+    sendCommand(usePushReceive() ? "AT+CCHSET=0,0" : "AT+CCHSET=0,1");
+    return true;
+}
+
+bool Sim7x00CommDevice::writeCchstart()
+{
+    if (handleDisconnect(finalizeDisconnect))
+        return false;
+
+    sendCommand("AT+CCHSTART");
+    return true;
+}
+
+ATCommDevice::StepReply Sim7x00CommDevice::parseCchstart()
+{
+    if (_waitForReply && strncmp(_lineBuffer, "+CCHSTART: ", 11) == 0)
+        return replyFailed;
+
+    return replyComplete;
+}
+
+bool Sim7x00CommDevice::writeNetopen()
+{
+    if (handleDisconnect(finalizeDisconnect))
+        return false;
+
+    setDelay(10);
+    sendCommand("AT+NETOPEN");
+    return true;
+}
+
+ATCommDevice::StepReply Sim7x00CommDevice::parseNetopen()
+{
+    if (_waitForReply && strncmp(_lineBuffer, "+NETOPEN: 1", 11) == 0) {
+        // Give the network time before the next attempt
+        setDelay(2000);
+        return replyFailed;
+    }
+
+    return replyComplete;
+}
+
+bool Sim7x00CommDevice::writeCiprxget()
+{
+    // Skip the DNS query for IP addresses and cached host names
+    if (resolveFromCache()) {
+        _sendState = sendCipopen;
+    }
+    return SimCommDevice::writeCiprxget();
+}
+
+bool Sim7x00CommDevice::writeCipclose()
+{
+    if (!keepBearer())
+        return false;
+
+    _sendState = bearerUp;
+    if (!(_stateBooleans & IP_CONNECTED))
+        return false;
+
+    _stateBooleans &= ~IP_CONNECTED;
+    if (_type == SSL) {
+        _waitForReply = "+CCHCLOSE: 0,";
+        sendCommand("AT+CCHCLOSE=0");
+    } else {
+        sendCommand("AT+CIPCLOSE=0");
+    }
+    return true;
+}
+
+bool Sim7x00CommDevice::writeNetclose()
+{
+    if (!(_bearerConfig & BEARER_SSL)) {
+        sendCommand("AT+NETCLOSE");
+        return true;
+    }
+
+    _sendState = sendCchstop;
+    if (!(_stateBooleans & IP_CONNECTED))
+        return false;
+
+    _waitForReply = "+CCHCLOSE: 0,";
+    sendCommand("AT+CCHCLOSE=0");
+    return true;
 }
 
 void Sim7x00CommDevice::run()
@@ -55,6 +260,7 @@ void Sim7x00CommDevice::run()
         }
         return;
     }
+    openControlSerial();
 
     // If the serial device is locked, don't go on
     if (_stateBooleans & SERIAL_LOCKED)
@@ -72,7 +278,10 @@ void Sim7x00CommDevice::run()
         _serial.write((const uint8_t*)str, sizeof(str) - 1);
         _serial.write((const uint8_t*)_lineEndStr);
         _replyState = okReply;
+        _commandStep = NULL;
         _waitForReply = "RDY";
+        _retryState = notConnected;
+        setCommandClass(restartCommand);
 
         setDelay(4000);
 
@@ -93,40 +302,59 @@ void Sim7x00CommDevice::run()
             if (strncmp(_lineBuffer, _waitForReply, strlen(_waitForReply)) == 0) {
                 _waitForReply = NULL;
             } else if (strncmp(_lineBuffer, "ERROR", 5) == 0) {
-                _stateBooleans |= RESET_PENDING;
-                _connectState = generalError;
-                _waitForReply = NULL;
+                failCommand(retryCommand);
                 return;
             }
         }
 
+        // Process the reply to a step of the connection state machine
+        if (!parseStepReply())
+            return;
+
+        // The network released the bearer while no connection was open
+        if (_sendState == bearerUp
+            && strncmp(_lineBuffer, "+CIPEVENT: NETWORK CLOSED", 25) == 0) {
+            _sendState = finalizeDisconnect;
+        }
+
         // Process replies which need special treatment
         switch (_replyState) {
-        case netopen:
+        case expectConnect:
             if (_waitForReply == NULL) {
                 _replyState = okReply;
-            } else if (strncmp(_lineBuffer, "+NETOPEN: 1", 11) == 0) {
-                setDelay(2000);
-                _sendState = sendNetopen;
+            } else if (strncmp(_lineBuffer, "NO CARRIER", 10) == 0) {
+                _stateBooleans &= ~IP_CONNECTED;
                 _waitForReply = NULL;
                 _replyState = okReply;
-                return;
+                _sendState = ipUnconnected;
             }
             break;
 
         case cdnsgip:
             if (parseDnsReply()) {
                 _replyState = okReply;
+            } else if (_connectState == IPCommDevice::dnsError) {
+                // Give the rest of the reply time to arrive before querying again
+                setDelay(SIM7x00_RECOVERY_DELAY);
+                handleError(retryCommand, reopenBearer);
+                return;
             }
             break;
 
         case cipopen:
-            if (_waitForReply == NULL) {
+            if (strncmp(_lineBuffer, "CONNECT FAIL", 12) == 0) {
+                // Resolve the host name again when re-opening the socket
+                _dnsCache.remove(_host);
+                handleError(reopenSocket);
+                return;
+            } else if (_waitForReply == NULL) {
                 _replyState = okReply;
             } else {
-                if (strncmp(_lineBuffer, "+CIPOPEN: 0,", 12) == 0) {
-                    _stateBooleans |= RESET_PENDING;
-                    _connectState = generalError;
+                if (strncmp(_lineBuffer, "+CIPOPEN: 0,", 12) == 0
+                    || strncmp(_lineBuffer, "+CCHOPEN: 0,", 12) == 0) {
+                    _dnsCache.remove(_host);
+                    handleError(reopenSocket);
+                    return;
                 }
             }
             break;
@@ -145,13 +373,13 @@ void Sim7x00CommDevice::run()
             break;
 
         case csq:
-            if (parseCsq()) {
+            if (parseCsq(_lineBuffer)) {
                 _replyState = okReply;
             }
             break;
 
         case requestID:
-            if (parseIDReply()) {
+            if (parseIDReply(_lineBuffer)) {
                 _replyState = okReply;
             }
             break;
@@ -160,27 +388,45 @@ void Sim7x00CommDevice::run()
             break;
         }
 
+        // The modem reports each chunk once it has been sent, or -1 if that failed
+        if (strncmp(_lineBuffer, "+CIPSEND: 0,", 12) == 0) {
+            const char* sentLength = strrchr(_lineBuffer, ',');
+            confirmChunks(1, strtol(sentLength + 1, NULL, 10) > 0);
+        }
+
         // In connected state, check for new data or IP connection close
         if (_sendState >= connected) {
-            checkConnectionState("+IPCLOSE: 0,");
+            checkConnectionState(_type == SSL ? "+CCH_PEER_CLOSED: 0" : "+IPCLOSE: 0,");
         }
     }
 
     // When disconnecting was requested, flush read buffer first
-    else if ((_stateBooleans & DISCONNECT_PENDING) && _sendState == receiving) {
+    else if ((_stateBooleans & DISCONNECT_PENDING)
+        && (_sendState == receiving || usePushReceive())) {
         flushReadBuffer();
     }
 
+    // Pass pushed data on to the read buffer, independent of the current state
+    if (_bytesToRead > 0 && usePushReceive()) {
+        receive();
+    }
+
+    // Requests on the control port run independent of the main port
+    runControlPort(iccidCommand);
+
     // Don't go on when waiting for a reply
-    if (_waitForReply || _replyState != okReply)
+    if (replyPending())
         return;
 
     // Don't go on if space in write buffer is low
     if (_serial.spaceAvailable() < 20)
         return;
 
+    // Remember the state issuing the next command, to repeat it on error
+    _retryState = _sendState;
+
     // When signal strength was requested, send the command to the modem
-    if (_rssi == INT16_MAX && _stateBooleans & LINE_READ) {
+    if (rssiRequested() && _stateBooleans & LINE_READ) {
         _replyState = csq;
         _waitForReply = _okStr;
         sendCommand("AT+CSQ");
@@ -194,6 +440,10 @@ void Sim7x00CommDevice::run()
         return;
     }
 
+    // Steps setting up and tearing down the connection
+    if (runCommandStep(_commandSteps, _numCommandSteps))
+        return;
+
     // Connection state machine
     switch (_sendState) {
     case notConnected:
@@ -208,53 +458,42 @@ void Sim7x00CommDevice::run()
         setDelay(10);
         _connectState = IPCommDevice::intermediate;
         _stateBooleans |= LINE_READ;
+        _bearerConfig = bearerConfig();
         _waitForReply = _okStr;
-        _sendState = sendCgsockcont;
+        _sendState = sendIfc;
         sendCommand("ATE0");
         break;
 
-    case sendCgsockcont: {
-        const char str[] = "AT+CGSOCKCONT=1,\"IP\",\"";
-        _serial.write((const uint8_t*)str, sizeof(str) - 1);
-        _serial.write((const uint8_t*)_apn, strlen(_apn));
-        _serial.write((const uint8_t*)_quoteEndStr);
-
-        _waitForReply = _okStr;
-        _sendState = sendCsocksetpn;
-        break;
-    }
-
-    case sendCsocksetpn:
-        _waitForReply = _okStr;
-        _sendState = sendCipmode;
-        sendCommand("AT+CSOCKSETPN=1");
-        break;
-
-    case sendCipmode:
-        _waitForReply = _okStr;
-        _sendState = sendNetopen;
-        sendCommand("AT+CIPMODE=0");
+    case sendCertData:
+        if (sendCertificate()) {
+            _waitForReply = _okStr;
+            _sendState = sendCsslcfgVersion;
+        }
         break;
 
-    case sendNetopen:
-        if (handleDisconnect(finalizeDisconnect))
+    case sendCchopen: {
+        if (_serial.spaceAvailable() < strlen(_host) + 30)
             break;
 
-        setDelay(10);
-        _waitForReply = "+NETOPEN: 0";
-        _sendState = sendCiprxget;
-        _replyState = netopen;
-        sendCommand("AT+NETOPEN");
-        break;
+        CommandBuilder(_serial)
+            .append("AT+CCHOPEN=0,\"")
+            .append(_host)
+            .append("\",")
+            .appendNumber(_port)
+            .append(",2")
+            .append(_lineEndStr)
+            .send();
 
-    case sendCiprxget:
-        _waitForReply = _okStr;
-        _sendState = sendDnsQuery;
-        sendCommand("AT+CIPRXGET=1");
+        _replyState = cipopen;
+        _waitForReply = "+CCHOPEN: 0,0";
+        setCommandClass(networkCommand);
+        _sendState = finalizeConnect;
         break;
+    }
 
     case sendDnsQuery:
         if (SimCommDevice::sendDnsQuery()) {
+            _connectState = IPCommDevice::intermediate;
             _replyState = cdnsgip;
             _waitForReply = _okStr;
             _sendState = sendCipopen;
@@ -262,22 +501,22 @@ void Sim7x00CommDevice::run()
         break;
 
     case sendCipopen: {
-        char portStr[6];
-        snprintf(portStr, sizeof(portStr), "%u", _port);
-
-        _serial.write((const uint8_t*)"AT+CIPOPEN");
+        CommandBuilder cmd(_serial);
+        cmd.append("AT+CIPOPEN");
         if (_type == UDP) {
-            _serial.write((const uint8_t*)"=0,\"UDP\",,,");
+            cmd.append("=0,\"UDP\",,,");
         } else {
-            _serial.write((const uint8_t*)"=0,\"TCP\",\"");
-            _serial.write((const uint8_t*)_ip);
-            _serial.write((const uint8_t*)"\",");
+            cmd.append("=0,\"TCP\",\"").append(_ip).append("\",");
         }
-        _serial.write((const uint8_t*)portStr);
-        _serial.write((const uint8_t*)_lineEndStr);
+        cmd.appendNumber(_port).append(_lineEndStr).send();
 
         _replyState = cipopen;
-        _waitForReply = "+CIPOPEN: 0,0";
+        if (useTransparentMode()) {
+            _waitForReply = "CONNECT";
+        } else {
+            _waitForReply = "+CIPOPEN: 0,0";
+        }
+        setCommandClass(networkCommand);
         _sendState = finalizeConnect;
         break;
     }
@@ -286,25 +525,25 @@ void Sim7x00CommDevice::run()
         setDelay(0);
         _connectState = IPCommDevice::connected;
         _replyState = okReply;
-        _sendState = connected;
         _stateBooleans |= IP_CONNECTED;
+        if (useTransparentMode()) {
+            enterDataMode();
+            _sendState = dataMode;
+        } else {
+            _sendState = connected;
+        }
         break;
 
     case connected:
-        if (_writeBuffer.bytesAvailable()) {
-            if (prepareSending(true)) {
+        if (sendPending()) {
+            if (prepareSending(true, _type == SSL ? "AT+CCHSEND=" : "AT+CIPSEND=")) {
+                // IP address and port
+                CommandBuilder header(_serial);
                 if (_type == UDP) {
-                    // IP address
-                    _serial.write((const uint8_t*)",\"");
-                    _serial.write((const uint8_t*)_ip);
-                    _serial.write((const uint8_t*)"\",");
-
-                    // Port
-                    char portStr[6];
-                    snprintf(portStr, sizeof(portStr), "%u", _port);
-                    _serial.write((const uint8_t*)portStr);
+                    header.append(",\"").append(_ip).append("\",").appendNumber(_port);
                 }
-                _serial.write((const uint8_t*)_lineEndStr);
+                header.append(_lineEndStr);
+                _sendStats.overheadBytes += header.send();
 
                 _connectState = IPCommDevice::transmitting;
                 _sendState = sendData;
@@ -315,33 +554,40 @@ void Sim7x00CommDevice::run()
             _sendState = sendCiprxget4;
         } else {
             _connectState = IPCommDevice::connected;
-            handleDisconnect(sendNetclose);
+            handleDisconnect(sendCipclose);
         }
         break;
 
         // States after connecting
 
     case sendData:
-        SimCommDevice::sendData();
-        _waitForReply = _okStr;
-        _sendState = connected;
+        if (SimCommDevice::sendData()) {
+            _waitForReply = _okStr;
+            _sendState = connected;
+        }
         break;
 
     case sendCiprxget4:
         _waitForReply = _okStr;
         _sendState = sendCiprxget2;
         _replyState = ciprxget4;
-        sendCommand("AT+CIPRXGET=4,0");
+        if (_type == SSL) {
+            sendCommand("AT+CCHRECV?");
+        } else {
+            sendCommand("AT+CIPRXGET=4,0");
+        }
         break;
 
     case sendCiprxget2:
-        if (handleDisconnect(sendNetclose))
+        if (handleDisconnect(sendCipclose))
             break;
 
         if (_bytesToReceive > 0) {
-            if (SimCommDevice::sendCiprxget2()) {
+            if (SimCommDevice::sendCiprxget2(
+                    _type == SSL ? "AT+CCHRECV=0," : "AT+CIPRXGET=2,0,")) {
                 _sendState = waitReceive;
                 _replyState = ciprxget2;
+                _waitForReply = _type == SSL ? "+CCHRECV: DATA," : "+CIPRXGET: 2,";
             }
         } else if (_stateBooleans & IP_CONNECTED) {
             _sendState = connected;
@@ -356,30 +602,98 @@ void Sim7x00CommDevice::run()
 
     case receiving:
         if (_bytesToRead > 0) {
+            // Request the next chunk while the current one is still arriving. With SSL,
+            // the OK precedes the data, so the replies would not be in the expected order.
+            if (!(_stateBooleans & (RECEIVE_PREFETCH | DISCONNECT_PENDING)) && _type != SSL
+                && _bytesToReceive > 0 && SimCommDevice::sendCiprxget2()) {
+                _stateBooleans |= RECEIVE_PREFETCH;
+            }
+
             if (receive()) {
-                _replyState = okReply;
-                _waitForReply = _okStr;
+                if (_stateBooleans & RECEIVE_PREFETCH) {
+                    // The OK of this chunk precedes the header of the prefetched one
+                    _stateBooleans &= ~RECEIVE_PREFETCH;
+                    _waitForReply = "+CIPRXGET: 2,";
+                    _replyState = ciprxget2;
+                    _sendState = waitReceive;
+                } else {
+                    _waitForReply = _type == SSL ? "+CCHRECV: 0," : _okStr;
+                    _replyState = okReply;
+                }
             }
         } else if (_bytesToReceive > 0) {
             _sendState = sendCiprxget2;
-        } else {
+        } else if (_type == SSL) {
+            // No remaining length in the SSL reply, query it again
             _sendState = sendCiprxget4;
+        } else if (_stateBooleans & IP_CONNECTED) {
+            _sendState = connected;
+        } else {
+            _sendState = ipUnconnected;
+        }
+        break;
+
+    case dataMode:
+        if (commandModeRequested() && _writeBuffer.bytesAvailable() == 0
+            && _serial.writeBufferProcessed()) {
+            // Keep the line idle for the guard time before escaping
+            setDelay(_guardTime);
+            _sendState = escapeDataMode;
+        } else if (!transferDataMode()) {
+            _sendState = ipUnconnected;
+        }
+        break;
+
+    case escapeDataMode:
+        if (sendEscapeSequence()) {
+            setDelay(_guardTime);
+            _waitForReply = _okStr;
+            _sendState = commandMode;
+        } else {
+            setDelay(0);
+            _sendState = ipUnconnected;
+        }
+        break;
+
+    case commandMode:
+        setDelay(0);
+        if (handleDisconnect(sendCipclose))
+            break;
+
+        if (_stateBooleans & IP_CONNECTED) {
+            _replyState = expectConnect;
+            _waitForReply = "CONNECT";
+            _sendState = finalizeConnect;
+            sendCommand("ATO");
+            setCommandClass(networkCommand);
+        } else {
+            _sendState = ipUnconnected;
         }
         break;
 
     case ipUnconnected:
         _connectState = IPCommDevice::intermediate;
-        if (handleDisconnect(sendNetclose))
+        if (handleDisconnect(sendCipclose))
             break;
 
-        handleConnect(sendCipopen);
+        if (handleConnect(sendCchopen) && _type != SSL) {
+            _sendState = resolveFromCache() ? sendCipopen : sendDnsQuery;
+        }
         break;
 
-    case sendNetclose:
-        _connectState = IPCommDevice::intermediate;
-        _waitForReply = "+NETCLOSE: 0";
-        _sendState = finalizeDisconnect;
-        sendCommand("AT+NETCLOSE");
+    case bearerUp:
+        setDelay(10);
+        _connectState = IPCommDevice::notConnected;
+        if (!keepBearer() || ((_stateBooleans & CONNECT_PENDING) && !bearerMatches())) {
+            // Release the bearer, a pending connection request sets it up again
+            _sendState = sendNetclose;
+        } else if (handleConnect(sendCchopen)) {
+            _connectState = IPCommDevice::intermediate;
+            _stateBooleans &= ~DATA_PENDING;
+            if (_type != SSL) {
+                _sendState = resolveFromCache() ? sendCipopen : sendDnsQuery;
+            }
+        }
         break;
 
     case finalizeDisconnect:
@@ -392,3 +706,69 @@ void Sim7x00CommDevice::run()
         break;
     }
 }
+
+void Sim7x00CommDevice::handleError(RecoveryLevel minLevel, RecoveryLevel maxLevel)
+{
+    sendFailed();
+    _waitForReply = NULL;
+
+    // Closing fails if the socket or bearer is already gone, which is the goal anyway
+    if (_retryState >= sendCipclose && _retryState <= finalizeDisconnect) {
+        _replyState = okReply;
+        return;
+    }
+
+    // Data might have been lost on an open connection, so it is closed instead
+    // of being restored silently. Failed queries don't affect the connection.
+    bool connectionOpen = _retryState >= finalizeConnect && _retryState < sendCipclose;
+    if (connectionOpen && _replyState != csq && _replyState != requestID
+        && minLevel < reopenSocket) {
+        minLevel = reopenSocket;
+    }
+
+    // The socket can only be re-opened on an open bearer
+    bool bearerOpen = (_retryState > sendCchstart && _retryState < sendNetopen)
+        || (_retryState > sendNetopen && _retryState < finalizeConnect);
+
+    _replyState = okReply;
+    if (_connectState != IPCommDevice::dnsError) {
+        _connectState = IPCommDevice::generalError;
+    }
+
+    RecoveryLevel level = escalateError(minLevel, maxLevel);
+
+    // Re-opening goes through the regular connection request
+    if (!connectionOpen && level > retryCommand && level < hardReset
+        && !(_stateBooleans & DISCONNECT_PENDING)) {
+        _stateBooleans |= CONNECT_PENDING;
+    }
+
+    switch (level) {
+    case retryCommand:
+        // A failed certificate upload starts over
+        _sendState = _retryState == sendCertData ? (int8_t)sendCcertdown : _retryState;
+        break;
+
+    case reopenSocket:
+        if (connectionOpen) {
+            _sendState = sendCipclose;
+        } else if (bearerOpen) {
+            _sendState = ipUnconnected;
+        } else {
+            _sendState = finalizeDisconnect;
+        }
+        break;
+
+    case reopenBearer:
+        _sendState = connectionOpen || bearerOpen ? sendNetclose : finalizeDisconnect;
+        break;
+
+    case softReset:
+        _sendState = sendCfunOff;
+        break;
+
+    case hardReset:
+        _stateBooleans |= RESET_PENDING;
+        break;
+    }
+}
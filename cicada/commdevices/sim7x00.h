@@ -51,7 +51,7 @@ class Sim7x00CommDevice : public SimCommDevice
      * Each time, run() is called, it roughly perorms these steps:
      * -# If a reset is pending, reset modem and internal states
      * -# Process any incoming data from the device, including:
-     *   - Error messages
+     *   - Error messages, recovered from with the steps of ATCommDevice::RecoveryLevel
      *   - Incoming data
      *   - Connection close
      * -# If the modem is ready to process new commands, run() will then
@@ -61,17 +61,44 @@ class Sim7x00CommDevice : public SimCommDevice
      * [*] --> notConnected
      * notConnected --> notConnected
      * notConnected --> connecting : connection request via API
-     * connecting --> sendCgsockcont
+     * connecting --> sendIfc
      * connecting : ""ATE0""
+     * sendIfc --> sendCgsockcont
+     * sendIfc : flow control changed: ""AT+IFC=<2,2|0,0>""
      * sendCgsockcont --> sendCsocksetpn
      * sendCgsockcont : ""AT+CGSOCKCONT=1,"IP",<apn>""
      * sendCsocksetpn --> sendCipmode
      * sendCsocksetpn : ""AT+CSOCKSETPN=1""
      * sendCipmode --> sendNetopen
-     * sendCipmode : ""AT+CIPMODE=0""
+     * sendCipmode --> sendCcertdown : SSL
+     * sendCipmode : ""AT+CIPMODE=<transparent>""
+     * sendCcertdown --> sendCertData : certificate not yet loaded
+     * sendCcertdown --> sendCsslcfgVersion
+     * sendCcertdown : ""AT+CCERTDOWN="cicada_ca.pem",<length>""
+     * sendCertData --> sendCsslcfgVersion
+     * sendCertData : send certificate
+     * sendCsslcfgVersion --> sendCsslcfgAuth
+     * sendCsslcfgVersion : ""AT+CSSLCFG="sslversion",0,4""
+     * sendCsslcfgAuth --> sendCsslcfgCacert : certificate set
+     * sendCsslcfgAuth --> sendCsslcfgSni
+     * sendCsslcfgAuth : ""AT+CSSLCFG="authmode",0,<certificate set>""
+     * sendCsslcfgCacert --> sendCsslcfgSni
+     * sendCsslcfgCacert : ""AT+CSSLCFG="cacert",0,"cicada_ca.pem" ""
+     * sendCsslcfgSni --> sendCchset
+     * sendCsslcfgSni : ""AT+CSSLCFG="enableSNI",0,1""
+     * sendCchset --> sendCchstart
+     * sendCchset : ""AT+CCHSET=0,<manual receive>""
+     * sendCchstart --> sendCchsslcfg
+     * sendCchstart --> finalizeDisconnect : connection closed via API
+     * sendCchstart : ""AT+CCHSTART""
+     * sendCchsslcfg --> sendCchopen
+     * sendCchsslcfg : ""AT+CCHSSLCFG=0,0""
+     * sendCchopen --> finalizeConnect
+     * sendCchopen : ""AT+CCHOPEN=0,<host>,<port>,2""
      * sendNetopen --> sendCiprxget
      * sendNetopen : ""AT+NETOPEN""
      * sendCiprxget --> sendDnsQuery
+     * sendCiprxget --> sendCipopen : IP address or cached host name
      * sendCiprxget : ""AT+CIPRXGET=1""
      * sendDnsQuery --> sendDnsQuery
      * sendDnsQuery --> sendCipopen : can send DNS query
@@ -80,30 +107,66 @@ class Sim7x00CommDevice : public SimCommDevice
      * sendCipopen : ""AT+CIPOPEN=0,"UDP",,,""
      * sendCipopen : ""AT+CIPOPEN=0,"TCP",<ip>,""
      * finalizeConnect --> connected
+     * finalizeConnect --> dataMode : transparent mode
+     * dataMode --> escapeDataMode : command or disconnect requested
+     * dataMode --> ipUnconnected : connection close by peer
+     * dataMode : pass data between buffers and modem
+     * escapeDataMode --> commandMode
+     * escapeDataMode : ""+++""
+     * commandMode --> sendCipclose : connection closed via API
+     * commandMode --> finalizeConnect
+     * commandMode : ""ATO""
      * connected --> sendData : bytes in write buffer
      * connected --> sendCiprxget4 : incoming data pending
-     * connected --> sendNetclose : connection closed via API
+     * connected --> sendCipclose : connection closed via API
      * connected --> connected
      * connected : bytes in write buffer: ""AT+CIPSEND=0,<numOfBytes>""
+     * connected : SSL: ""AT+CCHSEND=0,<numOfBytes>""
      * sendData --> connected
      * sendData : send data
      * sendCiprxget4 --> sendCiprxget2
      * sendCiprxget4 : ""AT+CIPRXGET=4,0""
-     * sendCiprxget2 --> sendNetclose : connection closed via API
+     * sendCiprxget4 : SSL: ""AT+CCHRECV?""
+     * sendCiprxget2 --> sendCipclose : connection closed via API
      * sendCiprxget2 --> waitReceive : bytesToReceive > 0
      * sendCiprxget2 --> connected
      * sendCiprxget2 --> ipUnconnected : connection close by peer
      * sendCiprxget2 : ""AT+CIPRXGET=2,0,<numBytesReceive>""
+     * sendCiprxget2 : SSL: ""AT+CCHRECV=0,<numBytesReceive>""
      * waitReceive --> waitReceive : no data
      * waitReceive --> receiving : data available
      * receiving --> receiving : bytesToRead > 0
+     * receiving : ""AT+CIPRXGET=2,0,<numBytesReceive>"" (prefetch next chunk)
+     * receiving --> waitReceive : chunk complete & next chunk prefetched
      * receiving --> sendCiprxget2 : bytesToReceive > 0
-     * receiving --> sendCiprxget4 : no bytes to receive/read
-     * ipUnconnected --> sendNetclose : connection closed via API
-     * ipUnconnected --> sendCipopen : connection close by peer
+     * receiving --> sendCiprxget4 : SSL & no bytes to receive/read
+     * receiving --> connected : no bytes to receive/read
+     * receiving --> ipUnconnected : connection close by peer
+     * ipUnconnected --> sendCipclose : connection closed via API
+     * ipUnconnected --> sendDnsQuery : connection request via API
+     * ipUnconnected --> sendCipopen : IP address or cached host name
+     * ipUnconnected --> sendCchopen : SSL
+     * sendCipclose --> sendNetclose
+     * sendCipclose --> bearerUp : keep bearer
+     * sendCipclose : keep bearer: ""AT+CIPCLOSE=0""
+     * sendCipclose : keep bearer & SSL: ""AT+CCHCLOSE=0""
+     * bearerUp --> bearerUp
+     * bearerUp --> sendDnsQuery : connection request via API
+     * bearerUp --> sendCipopen : IP address or cached host name
+     * bearerUp --> sendCchopen : SSL
+     * bearerUp --> sendNetclose : keep bearer disabled or settings changed
+     * bearerUp --> finalizeDisconnect : network closed
      * sendNetclose --> finalizeDisconnect
+     * sendNetclose --> sendCchstop : SSL
      * sendNetclose : ""AT+NETCLOSE=0""
+     * sendNetclose : SSL: ""AT+CCHCLOSE=0""
+     * sendCchstop --> finalizeDisconnect
+     * sendCchstop : ""AT+CCHSTOP""
      * finalizeDisconnect --> notConnected
+     * sendCfunOff --> sendCfunOn
+     * sendCfunOff : soft reset on errors: ""AT+CFUN=0""
+     * sendCfunOn --> finalizeDisconnect
+     * sendCfunOn : ""AT+CFUN=1""
      * \enduml
      */
     virtual void run();
@@ -114,7 +177,6 @@ class Sim7x00CommDevice : public SimCommDevice
         csq,
         requestID,
         expectConnect,
-        netopen,
         cdnsgip,
         cipopen,
         ciprxget4,
@@ -126,9 +188,20 @@ class Sim7x00CommDevice : public SimCommDevice
         serialError,
         dnsError,
         connecting,
+        sendIfc,
         sendCgsockcont,
         sendCsocksetpn,
         sendCipmode,
+        sendCcertdown,
+        sendCertData,
+        sendCsslcfgVersion,
+        sendCsslcfgAuth,
+        sendCsslcfgCacert,
+        sendCsslcfgSni,
+        sendCchset,
+        sendCchstart,
+        sendCchsslcfg,
+        sendCchopen,
         sendNetopen,
         sendCiprxget,
         sendDnsQuery,
@@ -140,11 +213,38 @@ class Sim7x00CommDevice : public SimCommDevice
         sendCiprxget2,
         waitReceive,
         receiving,
+        dataMode,
+        escapeDataMode,
+        commandMode,
         ipUnconnected,
+        sendCipclose,
+        bearerUp,
         sendNetclose,
-        finalizeDisconnect
+        sendCchstop,
+        finalizeDisconnect,
+        sendCfunOff,
+        sendCfunOn
     };
 
+    bool writeCgsockcont();
+    bool writeCipmode();
+    bool writeCcertdown();
+    bool writeCsslcfgVersion();
+    bool writeCsslcfgAuth();
+    bool writeCsslcfgCacert();
+    bool writeCchset();
+    bool writeCchstart();
+    StepReply parseCchstart();
+    bool writeNetopen();
+    StepReply parseNetopen();
+    bool writeCiprxget();
+    bool writeCipclose();
+    bool writeNetclose();
+    virtual void handleError(RecoveryLevel minLevel, RecoveryLevel maxLevel = hardReset);
+
+    static const CommandStep _commandSteps[];
+    static const uint8_t _numCommandSteps;
+
     const char* iccidCommand = "AT+CICCID";
 };
 }
@@ -0,0 +1,648 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "cicada/commdevices/sim7x00offload.h"
+#include "cicada/commdevices/commandbuilder.h"
+#include <cstdlib>
+#include <cstring>
+
+using namespace Cicada;
+
+#define OFFLOAD_TIMEOUT 60000
+#define OFFLOAD_RECONNECT_DELAY 10000
+#define OFFLOAD_HTTP_READ_SIZE 512
+#define OFFLOAD_RAW_CHUNK_SIZE 32
+
+const char* const LINE_END = "\r\n";
+
+Sim7x00Offload::Sim7x00Offload(IBufferedSerial& serial) :
+    _serial(serial),
+    _messageCallback(NULL),
+    _bodyCallback(NULL),
+    _doneCallback(NULL),
+    _userData(NULL),
+    _host(NULL),
+    _port(0),
+    _clientId(NULL),
+    _ssl(false),
+    _keepAlive(60),
+    _mqttWanted(false),
+    _mqttState(serviceStopped),
+    _mqttTick(0),
+    _first(0),
+    _numOperations(0),
+    _nextId(1),
+    _operationActive(false),
+    _httpStatus(0),
+    _httpLength(0),
+    _httpRead(0),
+    _state(idle),
+    _wait(waitNone),
+    _urc(NULL),
+    _tick(0),
+    _data(NULL),
+    _dataSize(0),
+    _dataSent(0),
+    _lineFill(0),
+    _rawTarget(rawTopic),
+    _rawRemaining(0),
+    _topicFill(0),
+    _payloadRemaining(0)
+{
+    _topic[0] = '\0';
+}
+
+void Sim7x00Offload::setCallbacks(MessageCallback messageCallback, BodyCallback bodyCallback,
+    DoneCallback doneCallback, void* userData)
+{
+    _messageCallback = messageCallback;
+    _bodyCallback = bodyCallback;
+    _doneCallback = doneCallback;
+    _userData = userData;
+}
+
+void Sim7x00Offload::setBroker(
+    const char* host, uint16_t port, const char* clientId, bool ssl, uint16_t keepAlive)
+{
+    _host = host;
+    _port = port;
+    _clientId = clientId;
+    _ssl = ssl;
+    _keepAlive = keepAlive;
+}
+
+void Sim7x00Offload::mqttConnect()
+{
+    _mqttWanted = _host != NULL && _clientId != NULL;
+}
+
+void Sim7x00Offload::mqttDisconnect()
+{
+    _mqttWanted = false;
+}
+
+bool Sim7x00Offload::mqttConnected() const
+{
+    return _mqttState == brokerConnected;
+}
+
+uint16_t Sim7x00Offload::subscribe(const char* topic, uint8_t qos)
+{
+    uint16_t id = queue(subscribeOperation, topic);
+    if (id) {
+        _operations[(_first + _numOperations - 1) % E_OFFLOAD_MAX_OPERATIONS].qos = qos;
+    }
+
+    return id;
+}
+
+uint16_t Sim7x00Offload::publish(const char* topic, const uint8_t* payload, Size size, uint8_t qos)
+{
+    uint16_t id = queue(publishOperation, topic);
+    if (id) {
+        Operation& op = _operations[(_first + _numOperations - 1) % E_OFFLOAD_MAX_OPERATIONS];
+        op.data = payload;
+        op.size = size;
+        op.qos = qos;
+    }
+
+    return id;
+}
+
+uint16_t Sim7x00Offload::httpGet(const char* url)
+{
+    return queue(httpGetOperation, url);
+}
+
+bool Sim7x00Offload::isIdle() const
+{
+    return _numOperations == 0 && _state == idle;
+}
+
+void Sim7x00Offload::run()
+{
+    readInput();
+
+    if (_wait == waitData) {
+        writeData();
+    }
+
+    if (_wait != waitNone) {
+        if (lastRun() - _tick > OFFLOAD_TIMEOUT) {
+            handleResult(false);
+        }
+        return;
+    }
+
+    switch (_state) {
+    case idle:
+        startNext();
+        break;
+
+    case sendStart:
+        sendCommand("AT+CMQTTSTART");
+        expect(waitOk, "+CMQTTSTART: ");
+        break;
+
+    case sendAccq:
+        CommandBuilder(_serial)
+            .append("AT+CMQTTACCQ=0,\"")
+            .append(_clientId)
+            .append("\",")
+            .append(_ssl ? '1' : '0')
+            .append(LINE_END)
+            .send();
+        expect(waitOk);
+        break;
+
+    case sendConnect:
+        CommandBuilder(_serial)
+            .append("AT+CMQTTCONNECT=0,\"tcp://")
+            .append(_host)
+            .append(':')
+            .appendNumber(_port)
+            .append("\",")
+            .appendNumber(_keepAlive)
+            .append(",1")
+            .append(LINE_END)
+            .send();
+        expect(waitOk, "+CMQTTCONNECT: 0,");
+        break;
+
+    case sendDisc:
+        sendCommand("AT+CMQTTDISC=0,60");
+        expect(waitOk, "+CMQTTDISC: 0,");
+        break;
+
+    case sendRel:
+        sendCommand("AT+CMQTTREL=0");
+        expect(waitOk);
+        break;
+
+    case sendStop:
+        sendCommand("AT+CMQTTSTOP");
+        expect(waitOk, "+CMQTTSTOP: ");
+        break;
+
+    case sendSubTopic: {
+        Operation& op = operation();
+        Size length = strlen(op.text);
+        CommandBuilder(_serial)
+            .append("AT+CMQTTSUBTOPIC=0,")
+            .appendNumber(length)
+            .append(',')
+            .appendNumber(op.qos)
+            .append(LINE_END)
+            .send();
+        expectPrompt((const uint8_t*)op.text, length);
+        break;
+    }
+
+    case sendSub:
+        sendCommand("AT+CMQTTSUB=0");
+        expect(waitOk, "+CMQTTSUB: 0,");
+        break;
+
+    case sendTopic: {
+        Operation& op = operation();
+        Size length = strlen(op.text);
+        CommandBuilder(_serial)
+            .append("AT+CMQTTTOPIC=0,")
+            .appendNumber(length)
+            .append(LINE_END)
+            .send();
+        expectPrompt((const uint8_t*)op.text, length);
+        break;
+    }
+
+    case sendPayload: {
+        Operation& op = operation();
+        CommandBuilder(_serial)
+            .append("AT+CMQTTPAYLOAD=0,")
+            .appendNumber(op.size)
+            .append(LINE_END)
+            .send();
+        expectPrompt(op.data, op.size);
+        break;
+    }
+
+    case sendPub:
+        CommandBuilder(_serial)
+            .append("AT+CMQTTPUB=0,")
+            .appendNumber(operation().qos)
+            .append(",60")
+            .append(LINE_END)
+            .send();
+        expect(waitOk, "+CMQTTPUB: 0,");
+        break;
+
+    case sendHttpInit:
+        sendCommand("AT+HTTPINIT");
+        expect(waitOk);
+        break;
+
+    case sendHttpUrl:
+        CommandBuilder(_serial)
+            .append("AT+HTTPPARA=\"URL\",\"")
+            .append(operation().text)
+            .append('"')
+            .append(LINE_END)
+            .send();
+        expect(waitOk);
+        break;
+
+    case sendHttpAction:
+        sendCommand("AT+HTTPACTION=0");
+        expect(waitOk, "+HTTPACTION: 0,");
+        break;
+
+    case sendHttpRead: {
+        // Read in pieces, which are passed on while they arrive
+        uint32_t size = _httpLength - _httpRead;
+        if (size > OFFLOAD_HTTP_READ_SIZE)
+            size = OFFLOAD_HTTP_READ_SIZE;
+        CommandBuilder(_serial)
+            .append("AT+HTTPREAD=")
+            .appendNumber(_httpRead)
+            .append(',')
+            .appendNumber(size)
+            .append(LINE_END)
+            .send();
+        expect(waitOk, "+HTTPREAD: 0");
+        break;
+    }
+
+    case sendHttpTerm:
+        sendCommand("AT+HTTPTERM");
+        expect(waitOk);
+        break;
+    }
+}
+
+uint16_t Sim7x00Offload::queue(OperationType type, const char* text)
+{
+    if (_numOperations == E_OFFLOAD_MAX_OPERATIONS)
+        return 0;
+
+    Operation& op = _operations[(_first + _numOperations++) % E_OFFLOAD_MAX_OPERATIONS];
+    op.id = _nextId;
+    op.type = type;
+    op.text = text;
+    op.data = NULL;
+    op.size = 0;
+    op.qos = 0;
+
+    if (++_nextId == 0)
+        _nextId = 1;
+
+    return op.id;
+}
+
+Sim7x00Offload::Operation& Sim7x00Offload::operation()
+{
+    return _operations[_first];
+}
+
+void Sim7x00Offload::startNext()
+{
+    // The MQTT connection comes first, it's needed by the queued operations
+    if (_mqttWanted) {
+        if (_mqttState == serviceStopped) {
+            _state = sendStart;
+            return;
+        }
+        if (_mqttState == clientAcquired && lastRun() - _mqttTick >= OFFLOAD_RECONNECT_DELAY) {
+            _state = sendConnect;
+            return;
+        }
+    } else if (_mqttState != serviceStopped) {
+        _state = _mqttState == brokerConnected ? sendDisc : sendRel;
+        return;
+    }
+
+    if (_numOperations == 0)
+        return;
+
+    Operation& op = operation();
+    if (op.type != httpGetOperation && _mqttState != brokerConnected) {
+        // Wait for the broker, unless no connection has been asked for
+        if (!_mqttWanted)
+            finishOperation(false);
+        return;
+    }
+
+    _operationActive = true;
+    switch (op.type) {
+    case subscribeOperation:
+        _state = sendSubTopic;
+        break;
+    case publishOperation:
+        _state = sendTopic;
+        break;
+    case httpGetOperation:
+        _httpStatus = 0;
+        _httpLength = 0;
+        _httpRead = 0;
+        _state = sendHttpInit;
+        break;
+    }
+}
+
+void Sim7x00Offload::expect(Wait wait, const char* urc)
+{
+    _wait = wait;
+    _urc = urc;
+    _tick = lastRun();
+}
+
+void Sim7x00Offload::expectPrompt(const uint8_t* data, Size size)
+{
+    _data = data;
+    _dataSize = size;
+    _dataSent = 0;
+    expect(waitPrompt);
+}
+
+void Sim7x00Offload::sendCommand(const char* command)
+{
+    CommandBuilder(_serial).append(command).append(LINE_END).send();
+}
+
+void Sim7x00Offload::writeData()
+{
+    // Data larger than the serial write buffer goes out over several runs
+    Size size = _serial.spaceAvailable();
+    if (size > _dataSize - _dataSent)
+        size = _dataSize - _dataSent;
+    _dataSent += _serial.write(_data + _dataSent, size);
+
+    if (_dataSent == _dataSize) {
+        _wait = waitOk;
+    }
+}
+
+void Sim7x00Offload::readInput()
+{
+    while (_serial.bytesAvailable()) {
+        if (_rawRemaining) {
+            readRaw();
+            continue;
+        }
+
+        char c = _serial.read();
+        if (_wait == waitPrompt && _lineFill == 0 && c == '>') {
+            _wait = waitData;
+            writeData();
+        } else if (c == '\n') {
+            _line[_lineFill] = '\0';
+            if (_lineFill) {
+                handleLine();
+            }
+            _lineFill = 0;
+        } else if (c != '\r' && (c != ' ' || _lineFill) && _lineFill < E_OFFLOAD_LINE_SIZE - 1) {
+            _line[_lineFill++] = c;
+        }
+    }
+}
+
+void Sim7x00Offload::readRaw()
+{
+    uint8_t chunk[OFFLOAD_RAW_CHUNK_SIZE];
+    Size size = _rawRemaining < sizeof(chunk) ? _rawRemaining : sizeof(chunk);
+    size = _serial.read(chunk, size);
+    _rawRemaining -= size;
+
+    switch (_rawTarget) {
+    case rawTopic:
+        // Long topics are cut off
+        for (Size i = 0; i < size && _topicFill < E_OFFLOAD_TOPIC_SIZE - 1; i++) {
+            _topic[_topicFill++] = chunk[i];
+        }
+        _topic[_topicFill] = '\0';
+        break;
+
+    case rawPayload:
+        _payloadRemaining = _payloadRemaining > size ? _payloadRemaining - size : 0;
+        if (_messageCallback) {
+            _messageCallback(_topic, chunk, size, _payloadRemaining == 0, _userData);
+        }
+        break;
+
+    case rawBody:
+        if (_bodyCallback && _operationActive) {
+            _bodyCallback(operation().id, chunk, size, _userData);
+        }
+        break;
+    }
+}
+
+void Sim7x00Offload::handleLine()
+{
+    // Received messages, announced with the lengths of topic and payload
+    if (strncmp(_line, "+CMQTTRXSTART: 0,", 17) == 0) {
+        const char* payloadLength = strchr(_line + 17, ',');
+        _payloadRemaining = payloadLength ? strtoul(payloadLength + 1, NULL, 10) : 0;
+        _topicFill = 0;
+        _topic[0] = '\0';
+        return;
+    }
+    if (strncmp(_line, "+CMQTTRXTOPIC: 0,", 17) == 0) {
+        _rawTarget = rawTopic;
+        _rawRemaining = strtoul(_line + 17, NULL, 10);
+        return;
+    }
+    if (strncmp(_line, "+CMQTTRXPAYLOAD: 0,", 19) == 0) {
+        _rawTarget = rawPayload;
+        _rawRemaining = strtoul(_line + 19, NULL, 10);
+        return;
+    }
+    if (strncmp(_line, "+CMQTTRXEND: 0", 14) == 0)
+        return;
+
+    // A lost connection is set up again after a delay, without network the
+    // service has stopped
+    if (strncmp(_line, "+CMQTTCONNLOST: 0,", 18) == 0) {
+        if (_mqttState == brokerConnected) {
+            _mqttState = clientAcquired;
+            _mqttTick = lastRun();
+        }
+        return;
+    }
+    if (strncmp(_line, "+CMQTTNONET", 11) == 0) {
+        _mqttState = serviceStopped;
+        return;
+    }
+
+    // "+HTTPREAD: DATA,<length>" precedes the data, "+HTTPREAD: 0" ends the reply
+    if (strncmp(_line, "+HTTPREAD:", 10) == 0) {
+        const char* length = _line + 10;
+        while (*length == ' ') {
+            length++;
+        }
+        if (strncmp(length, "DATA,", 5) == 0)
+            length += 5;
+
+        Size size = strtoul(length, NULL, 10);
+        if (size) {
+            _rawTarget = rawBody;
+            _rawRemaining = size;
+            _httpRead += size;
+        } else if (_state == sendHttpRead && _wait != waitNone) {
+            handleResult(true);
+        }
+        return;
+    }
+
+    if (_wait == waitNone)
+        return;
+
+    if (strcmp(_line, "OK") == 0) {
+        if (_wait == waitOk) {
+            if (_urc) {
+                _wait = waitUrc;
+            } else {
+                handleResult(true);
+            }
+        }
+    } else if (strcmp(_line, "ERROR") == 0 || strncmp(_line, "+CME ERROR", 10) == 0) {
+        handleResult(false);
+    } else if (_wait == waitUrc && strncmp(_line, _urc, strlen(_urc)) == 0) {
+        const char* result = _line + strlen(_urc);
+        if (_state == sendHttpAction) {
+            // "<status>,<length>", status codes from 600 on are errors of the modem
+            _httpStatus = strtoul(result, NULL, 10);
+            const char* length = strchr(result, ',');
+            _httpLength = length ? strtoul(length + 1, NULL, 10) : 0;
+            handleResult(_httpStatus < 600);
+        } else {
+            handleResult(atoi(result) == 0);
+        }
+    }
+}
+
+void Sim7x00Offload::handleResult(bool success)
+{
+    _wait = waitNone;
+
+    switch (_state) {
+    case idle:
+        break;
+
+    case sendStart:
+        // The service may still be running, which is fine
+        _state = sendAccq;
+        break;
+
+    case sendAccq:
+        // Fails if the client is still acquired from before, which is fine as well
+        _mqttState = clientAcquired;
+        _state = sendConnect;
+        break;
+
+    case sendConnect:
+        if (success) {
+            _mqttState = brokerConnected;
+        } else {
+            _mqttTick = lastRun();
+        }
+        _state = idle;
+        break;
+
+    case sendDisc:
+        _state = sendRel;
+        break;
+
+    case sendRel:
+        _state = sendStop;
+        break;
+
+    case sendStop:
+        _mqttState = serviceStopped;
+        _state = idle;
+        break;
+
+    case sendSubTopic:
+        if (success) {
+            _state = sendSub;
+        } else {
+            finishOperation(false);
+        }
+        break;
+
+    case sendTopic:
+        if (success) {
+            _state = operation().size ? sendPayload : sendPub;
+        } else {
+            finishOperation(false);
+        }
+        break;
+
+    case sendPayload:
+        if (success) {
+            _state = sendPub;
+        } else {
+            finishOperation(false);
+        }
+        break;
+
+    case sendSub:
+    case sendPub:
+        finishOperation(success);
+        break;
+
+    case sendHttpInit:
+    case sendHttpUrl:
+        // HTTPINIT fails if the service is still running, terminate it in any case
+        if (!success) {
+            _state = sendHttpTerm;
+        } else {
+            _state = _state == sendHttpInit ? sendHttpUrl : sendHttpAction;
+        }
+        break;
+
+    case sendHttpAction:
+    case sendHttpRead:
+        _state = success && _httpRead < _httpLength ? sendHttpRead : sendHttpTerm;
+        break;
+
+    case sendHttpTerm:
+        finishOperation(_httpStatus && _httpStatus < 600 && _httpRead >= _httpLength);
+        break;
+    }
+}
+
+void Sim7x00Offload::finishOperation(bool success)
+{
+    Operation& op = operation();
+    uint16_t id = op.id;
+    uint16_t status = op.type == httpGetOperation ? _httpStatus : 0;
+
+    _first = (_first + 1) % E_OFFLOAD_MAX_OPERATIONS;
+    _numOperations--;
+    _operationActive = false;
+    _state = idle;
+
+    if (_doneCallback) {
+        _doneCallback(id, status, success, _userData);
+    }
+}
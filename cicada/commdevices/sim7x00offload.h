@@ -0,0 +1,255 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef E_SIM7x00OFFLOAD_H
+#define E_SIM7x00OFFLOAD_H
+
+#include "cicada/ibufferedserial.h"
+#include "cicada/defines.h"
+#include "cicada/task.h"
+#include <cstddef>
+#include <stdint.h>
+
+#ifndef E_OFFLOAD_MAX_OPERATIONS
+#define E_OFFLOAD_MAX_OPERATIONS 4
+#endif
+
+#ifndef E_OFFLOAD_TOPIC_SIZE
+#define E_OFFLOAD_TOPIC_SIZE 64
+#endif
+
+#ifndef E_OFFLOAD_LINE_SIZE
+#define E_OFFLOAD_LINE_SIZE 48
+#endif
+
+namespace Cicada {
+
+/*!
+ * \class Sim7x00Offload
+ *
+ * Uses the MQTT and HTTP clients built into the SIM7600 firmware, so the
+ * protocols don't run on the host. Only the topics and payloads of MQTT
+ * messages and the bodies of HTTP responses are transferred over the
+ * serial port, the modem reports results and received messages with URCs.
+ *
+ * The offload runs on an AT command port of its own, for example a
+ * CmuxChannel or the second USB port of the modem, while the
+ * Sim7x00CommDevice on the main port registers the modem in the network.
+ * Operations are queued and performed one after the other. Their
+ * arguments need to stay valid until the done callback has been called.
+ *
+ * - MQTT: ""AT+CMQTTSTART"", ""AT+CMQTTACCQ"" and ""AT+CMQTTCONNECT"" on
+ *   mqttConnect(), ""AT+CMQTTSUBTOPIC"" and ""AT+CMQTTSUB"" to subscribe,
+ *   ""AT+CMQTTTOPIC"", ""AT+CMQTTPAYLOAD"" and ""AT+CMQTTPUB"" to publish.
+ *   Messages arrive with the ""+CMQTTRX"" URCs.
+ * - HTTP: ""AT+HTTPINIT"", ""AT+HTTPPARA="URL""", ""AT+HTTPACTION=0"",
+ *   ""AT+HTTPREAD"" in pieces until the whole body is read, ""AT+HTTPTERM"".
+ */
+class Sim7x00Offload : public Task
+{
+  public:
+    /*!
+     * Called with the next piece of a received MQTT message.
+     * \param topic Topic of the message, cut off at E_OFFLOAD_TOPIC_SIZE - 1
+     * \param data Payload data, only valid during the call
+     * \param size Number of bytes
+     * \param last true for the last piece of the message
+     * \param userData Pointer passed to setCallbacks()
+     */
+    typedef void (*MessageCallback)(
+        const char* topic, const uint8_t* data, Size size, bool last, void* userData);
+
+    /*!
+     * Called with the next piece of the body of an HTTP response.
+     * \param id Operation ID returned by httpGet()
+     */
+    typedef void (*BodyCallback)(uint16_t id, const uint8_t* data, Size size, void* userData);
+
+    /*!
+     * Called when an operation is finished.
+     * \param id Operation ID returned by publish(), subscribe() or httpGet()
+     * \param status HTTP status code for httpGet(), 0 otherwise
+     * \param success true if the modem performed the operation
+     * \param userData Pointer passed to setCallbacks()
+     */
+    typedef void (*DoneCallback)(uint16_t id, uint16_t status, bool success, void* userData);
+
+    /*!
+     * \param serial AT command port of the modem
+     */
+    Sim7x00Offload(IBufferedSerial& serial);
+
+    void setCallbacks(MessageCallback messageCallback, BodyCallback bodyCallback,
+        DoneCallback doneCallback, void* userData = NULL);
+
+    /*!
+     * \param host Host name of the broker, needs to be valid during the
+     * lifetime of the object, like the other strings
+     * \param port Port of the broker
+     * \param clientId MQTT client identifier
+     * \param ssl true to connect with TLS, as configured with ""AT+CSSLCFG""
+     * \param keepAlive Keep alive interval in seconds
+     */
+    void setBroker(const char* host, uint16_t port, const char* clientId, bool ssl = false,
+        uint16_t keepAlive = 60);
+
+    /*!
+     * Connects to the broker, and again after the connection has been lost.
+     */
+    void mqttConnect();
+
+    /*!
+     * Disconnects from the broker and stops the MQTT service of the modem.
+     */
+    void mqttDisconnect();
+
+    /*!
+     * \return true if the modem is connected to the broker
+     */
+    bool mqttConnected() const;
+
+    /*!
+     * Queues a subscription. It's performed once connected to the broker.
+     * \return Operation ID, 0 if the queue is full
+     */
+    uint16_t subscribe(const char* topic, uint8_t qos);
+
+    /*!
+     * Queues a message to publish. It's performed once connected to the broker.
+     * \return Operation ID, 0 if the queue is full
+     */
+    uint16_t publish(const char* topic, const uint8_t* payload, Size size, uint8_t qos);
+
+    /*!
+     * Queues an HTTP GET request.
+     * \param url URL starting with http:// or https://
+     * \return Operation ID, 0 if the queue is full
+     */
+    uint16_t httpGet(const char* url);
+
+    /*!
+     * \return true if no operation is pending
+     */
+    bool isIdle() const;
+
+    /*!
+     * Sends the commands and processes replies and URCs.
+     */
+    virtual void run();
+
+  private:
+    enum State {
+        idle,
+        sendStart,
+        sendAccq,
+        sendConnect,
+        sendDisc,
+        sendRel,
+        sendStop,
+        sendSubTopic,
+        sendSub,
+        sendTopic,
+        sendPayload,
+        sendPub,
+        sendHttpInit,
+        sendHttpUrl,
+        sendHttpAction,
+        sendHttpRead,
+        sendHttpTerm
+    };
+
+    enum Wait { waitNone, waitOk, waitPrompt, waitData, waitUrc };
+
+    enum MqttState { serviceStopped, clientAcquired, brokerConnected };
+
+    enum OperationType { subscribeOperation, publishOperation, httpGetOperation };
+
+    enum RawTarget { rawTopic, rawPayload, rawBody };
+
+    struct Operation
+    {
+        uint16_t id;
+        OperationType type;
+        const char* text;
+        const uint8_t* data;
+        Size size;
+        uint8_t qos;
+    };
+
+    uint16_t queue(OperationType type, const char* text);
+    Operation& operation();
+    void startNext();
+    void expect(Wait wait, const char* urc = NULL);
+    void expectPrompt(const uint8_t* data, Size size);
+    void sendCommand(const char* command);
+    void writeData();
+    void readInput();
+    void readRaw();
+    void handleLine();
+    void handleResult(bool success);
+    void finishOperation(bool success);
+
+    IBufferedSerial& _serial;
+
+    MessageCallback _messageCallback;
+    BodyCallback _bodyCallback;
+    DoneCallback _doneCallback;
+    void* _userData;
+
+    const char* _host;
+    uint16_t _port;
+    const char* _clientId;
+    bool _ssl;
+    uint16_t _keepAlive;
+    bool _mqttWanted;
+    MqttState _mqttState;
+    E_TICK_TYPE _mqttTick;
+
+    Operation _operations[E_OFFLOAD_MAX_OPERATIONS];
+    uint8_t _first;
+    uint8_t _numOperations;
+    uint16_t _nextId;
+    bool _operationActive;
+    uint16_t _httpStatus;
+    uint32_t _httpLength;
+    uint32_t _httpRead;
+
+    State _state;
+    Wait _wait;
+    const char* _urc;
+    E_TICK_TYPE _tick;
+    const uint8_t* _data;
+    Size _dataSize;
+    Size _dataSent;
+
+    char _line[E_OFFLOAD_LINE_SIZE];
+    Size _lineFill;
+    RawTarget _rawTarget;
+    Size _rawRemaining;
+    char _topic[E_OFFLOAD_TOPIC_SIZE];
+    Size _topicFill;
+    Size _payloadRemaining;
+};
+}
+
+#endif
@@ -22,20 +22,63 @@
  */
 
 #include "cicada/commdevices/sim800.h"
-#include "printf.h"
+#include "cicada/commdevices/commandbuilder.h"
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 
 using namespace Cicada;
 
 const uint16_t SIM800_MAX_RX = 1460;
+const uint16_t SIM800_MAX_TX = 1460;
+const char* const SIM800_CA_FILE = "C:\\USER\\cicada_ca.crt";
+const uint16_t SIM800_ACK_POLL_DELAY = 50;
+
+const ATCommDevice::CommandStep Sim800CommDevice::_commandSteps[] = {
+    // Bearer set up
+    {sendIfc, NULL, static_cast<StepWriter>(&Sim800CommDevice::writeIfc), NULL, NULL, shortCommand,
+        sendCiprxget, useRecovery},
+    {sendCiprxget, NULL, static_cast<StepWriter>(&Sim800CommDevice::writeCiprxget), NULL, NULL,
+        shortCommand, sendCipmux, useRecovery},
+    {sendCipmux, NULL, static_cast<StepWriter>(&Sim800CommDevice::writeCipmux), NULL, NULL,
+        shortCommand, sendCipqsend, useRecovery},
+    {sendCipqsend, NULL, static_cast<StepWriter>(&Sim800CommDevice::writeCipqsend), NULL, NULL,
+        shortCommand, sendCipmode, useRecovery},
+    {sendCipmode, NULL, static_cast<StepWriter>(&Sim800CommDevice::writeCipmode), NULL, NULL,
+        shortCommand, sendCstt, useRecovery},
+    {sendCipssl, NULL, static_cast<StepWriter>(&Sim800CommDevice::writeCipssl), NULL, NULL,
+        shortCommand, sendCstt, useRecovery},
+    // Fails if the file doesn't exist yet
+    {sendFsdel, NULL, static_cast<StepWriter>(&Sim800CommDevice::writeFsdel), NULL, NULL,
+        shortCommand, sendFscreate, sendFscreate},
+    {sendFscreate, NULL, static_cast<StepWriter>(&Sim800CommDevice::writeFscreate), NULL, NULL,
+        shortCommand, sendFswrite, useRecovery},
+    {sendFswrite, NULL, static_cast<StepWriter>(&Sim800CommDevice::writeFswrite), ">", NULL,
+        shortCommand, sendCertData, useRecovery},
+    {sendSslsetcert, NULL, static_cast<StepWriter>(&Sim800CommDevice::writeSslsetcert),
+        "+SSLSETCERT: 0", static_cast<StepParser>(&Sim800CommDevice::parseSslsetcert),
+        shortCommand, sendCstt, useRecovery},
+    {sendCstt, NULL, static_cast<StepWriter>(&Sim800CommDevice::writeCstt), NULL, NULL,
+        shortCommand, sendCiicr, useRecovery},
+    {sendCiicr, "AT+CIICR", NULL, NULL, NULL, networkCommand, sendCifsr, useRecovery},
+    // The reply is the IP address only, without OK
+    {sendCifsr, NULL, static_cast<StepWriter>(&Sim800CommDevice::writeCifsr), "",
+        static_cast<StepParser>(&Sim800CommDevice::parseCifsr), shortCommand, sendDnsQuery,
+        useRecovery},
+    // Tear down
+    {sendCipclose, NULL, static_cast<StepWriter>(&Sim800CommDevice::writeCipclose), NULL, NULL,
+        networkCommand, sendCipshut, useRecovery},
+    {sendCipshut, "AT+CIPSHUT", NULL, "SHUT OK", NULL, networkCommand, finalizeDisconnect,
+        useRecovery}};
+const uint8_t Sim800CommDevice::_numCommandSteps = sizeof(_commandSteps) / sizeof(CommandStep);
 
 Sim800CommDevice::Sim800CommDevice(
     IBufferedSerial& serial, uint8_t* readBuffer, uint8_t* writeBuffer, Size bufferSize) :
     SimCommDevice(serial, readBuffer, writeBuffer, bufferSize)
 {
     _modemMaxReceiveSize = SIM800_MAX_RX;
+    _maxSendChunkSize = SIM800_MAX_TX;
 }
 
 Sim800CommDevice::Sim800CommDevice(IBufferedSerial& serial, uint8_t* readBuffer,
@@ -43,6 +86,159 @@ Sim800CommDevice::Sim800CommDevice(IBufferedSerial& serial, uint8_t* readBuffer,
     SimCommDevice(serial, readBuffer, writeBuffer, readBufferSize, writeBufferSize)
 {
     _modemMaxReceiveSize = SIM800_MAX_RX;
+    _maxSendChunkSize = SIM800_MAX_TX;
+}
+
+bool Sim800CommDevice::singleConnection() const
+{
+    return useTransparentMode() || _type == SSL;
+}
+
+bool Sim800CommDevice::usePushReceive() const
+{
+    // Pushed data don't have a header in single connection mode
+    return ATCommDevice::usePushReceive() && !singleConnection();
+}
+
+const char* Sim800CommDevice::ciprxget2Command() const
+{
+    return singleConnection() ? "AT+CIPRXGET=2," : "AT+CIPRXGET=2,0,";
+}
+
+bool Sim800CommDevice::writeCipmux()
+{
+    // Transparent mode and SSL only work with a single connection
+    sendCommand(singleConnection() ? "AT+CIPMUX=0" : "AT+CIPMUX=1");
+    return true;
+}
+
+bool Sim800CommDevice::writeCipqsend()
+{
+    // In quick send mode, the modem accepts data without waiting for the peer
+    sendCommand(useQuickSend() ? "AT+CIPQSEND=1" : "AT+CIPQSEND=0");
+    return true;
+}
+
+bool Sim800CommDevice::writeCipmode()
+{
+    if (_type == SSL) {
+        _sendState = sendCipssl;
+    }
+    sendCommand(useTransparentMode() ? "AT+CIPMODE=1" : "AT+CIPMODE=0");
+    return true;
+}
+
+bool Sim800CommDevice::writeCipssl()
+{
+    if (caCertificatePending()) {
+        _sendState = sendFsdel;
+    } else if (_caCert) {
+        _sendState = sendSslsetcert;
+    }
+    sendCommand("AT+CIPSSL=1");
+    return true;
+}
+
+bool Sim800CommDevice::writeFsdel()
+{
+    CommandBuilder(_serial)
+        .append("AT+FSDEL=")
+        .append(SIM800_CA_FILE)
+        .append(_lineEndStr)
+        .send();
+    return true;
+}
+
+bool Sim800CommDevice::writeFscreate()
+{
+    CommandBuilder(_serial)
+        .append("AT+FSCREATE=")
+        .append(SIM800_CA_FILE)
+        .append(_lineEndStr)
+        .send();
+    return true;
+}
+
+bool Sim800CommDevice::writeFswrite()
+{
+    CommandBuilder(_serial)
+        .append("AT+FSWRITE=")
+        .append(SIM800_CA_FILE)
+        .append(",0,")
+        .appendNumber(_caCertLength)
+        .append(",10")
+        .append(_lineEndStr)
+        .send();
+    _bytesToWrite = _caCertLength;
+    return true;
+}
+
+bool Sim800CommDevice::writeSslsetcert()
+{
+    // The modem confirmed the certificate upload, if there was one
+    _caCertLoaded = true;
+    CommandBuilder(_serial)
+        .append("AT+SSLSETCERT=\"")
+        .append(SIM800_CA_FILE)
+        .append(_quoteEndStr)
+        .send();
+    return true;
+}
+
+ATCommDevice::StepReply Sim800CommDevice::parseSslsetcert()
+{
+    if (_waitForReply && strncmp(_lineBuffer, "+SSLSETCERT: ", 13) == 0)
+        return replyFailed;
+
+    return replyComplete;
+}
+
+bool Sim800CommDevice::writeCstt()
+{
+    CommandBuilder(_serial).append("AT+CSTT=\"").append(_apn).append(_quoteEndStr).send();
+    return true;
+}
+
+bool Sim800CommDevice::writeCifsr()
+{
+    if (handleDisconnect(sendCipshut))
+        return false;
+
+    // Skip the DNS query for IP addresses and cached host names
+    if (resolveFromCache()) {
+        _sendState = sendCipstart;
+    }
+    sendCommand("AT+CIFSR");
+    return true;
+}
+
+ATCommDevice::StepReply Sim800CommDevice::parseCifsr()
+{
+    // Validate IP address by checking for three dots
+    uint8_t i = 0, p = 0;
+    while (_lineBuffer[i]) {
+        if (_lineBuffer[i++] == '.')
+            p++;
+    }
+
+    return p == 3 ? replyComplete : replyIncomplete;
+}
+
+bool Sim800CommDevice::writeCipclose()
+{
+    _sendState = keepBearer() ? bearerUp : sendCipshut;
+    if (!(_stateBooleans & IP_CONNECTED))
+        return false;
+
+    _stateBooleans &= ~IP_CONNECTED;
+    if (singleConnection()) {
+        _waitForReply = "CLOSE OK";
+        sendCommand("AT+CIPCLOSE");
+    } else {
+        _waitForReply = "0, CLOSE OK";
+        sendCommand("AT+CIPCLOSE=0");
+    }
+    return true;
 }
 
 void Sim800CommDevice::run()
@@ -54,6 +250,7 @@ void Sim800CommDevice::run()
         }
         return;
     }
+    openControlSerial();
 
     // If the serial device is locked, don't go on
     if (_stateBooleans & SERIAL_LOCKED)
@@ -71,6 +268,7 @@ void Sim800CommDevice::run()
             _sendState = sendCipshut;
         }
         _replyState = okReply;
+        _commandStep = NULL;
         _waitForReply = NULL;
         _stateBooleans &= ~RESET_PENDING;
     }
@@ -84,13 +282,19 @@ void Sim800CommDevice::run()
         logStates(_sendState, _replyState);
 
         // Handle deactivated or error states
-        if (strncmp(_lineBuffer, "+PDP: DEACT", 11) == 0
-            || strncmp(_lineBuffer, "+CME ERROR", 10) == 0
+        if (strncmp(_lineBuffer, "+PDP: DEACT", 11) == 0) {
+            handleError(retryCommand);
+            return;
+        } else if (strncmp(_lineBuffer, "+CME ERROR", 10) == 0
             || strncmp(_lineBuffer, "ERROR", 5) == 0) {
-            _stateBooleans |= RESET_PENDING;
+            failCommand(retryCommand);
+            return;
+        } else if (_sendState == connected
+            && (strncmp(_lineBuffer, "0, SEND FAIL", 12) == 0
+                || strncmp(_lineBuffer, "SEND FAIL", 9) == 0)) {
+            sendFailed();
             _connectState = generalError;
             _waitForReply = NULL;
-            return;
         }
 
         // If sent a command, process standard reply
@@ -100,34 +304,44 @@ void Sim800CommDevice::run()
             }
         }
 
+        // Process the reply to a step of the connection state machine
+        if (!parseStepReply())
+            return;
+
         // Process replies which need special treatment
         switch (_replyState) {
-        case cifsr: {
-            // Validate IP address by checking for three dots
-            uint8_t i = 0, p = 0;
-            while (_lineBuffer[i]) {
-                if (_lineBuffer[i++] == '.')
-                    p++;
-            }
-            if (p == 3) {
-                _replyState = okReply;
-            }
-        } break;
-
         case cdnsgip:
             if (parseDnsReply()) {
                 _replyState = okReply;
+            } else if (_connectState == dnsError) {
+                _stateBooleans |= RESET_PENDING;
+                _waitForReply = NULL;
+                return;
             }
             break;
 
         case cipstart:
             if (handleDisconnect(sendCipshut)) {
                 _replyState = okReply;
-            } else if (_waitForReply == NULL) {
-                _replyState = okReply;
-            } else if (strncmp(_lineBuffer, "0, CONNECT FAIL", 15) == 0) {
+            } else if (strncmp(_lineBuffer, "0, CONNECT FAIL", 15) == 0
+                || strncmp(_lineBuffer, "CONNECT FAIL", 12) == 0) {
+                _dnsCache.remove(_host);
                 _stateBooleans |= RESET_PENDING;
                 _connectState = generalError;
+                _waitForReply = NULL;
+            } else if (_waitForReply == NULL) {
+                _replyState = okReply;
+            }
+            break;
+
+        case expectConnect:
+            if (_waitForReply == NULL) {
+                _replyState = okReply;
+            } else if (strncmp(_lineBuffer, "NO CARRIER", 10) == 0) {
+                _stateBooleans &= ~IP_CONNECTED;
+                _waitForReply = NULL;
+                _replyState = okReply;
+                _sendState = ipUnconnected;
             }
             break;
 
@@ -144,13 +358,26 @@ void Sim800CommDevice::run()
             }
             break;
 
+        case cipack:
+            if (strncmp(_lineBuffer, "+CIPACK: ", 9) == 0) {
+                // The last number counts the bytes not yet acknowledged by the peer
+                const char* nackLength = strrchr(_lineBuffer, ',');
+                if (nackLength && strtol(nackLength + 1, NULL, 10) == 0) {
+                    confirmChunks(_maxChunksInFlight, true);
+                    setDelay(0);
+                }
+            } else if (_waitForReply == NULL) {
+                _replyState = okReply;
+            }
+            break;
+
         case csq:
-            if (parseCsq()) {
+            if (parseCsq(_lineBuffer)) {
                 _replyState = okReply;
             }
 
         case requestID:
-            if (parseIDReply()) {
+            if (parseIDReply(_lineBuffer)) {
                 _replyState = okReply;
             }
             break;
@@ -166,12 +393,21 @@ void Sim800CommDevice::run()
     }
 
     // When disconnecting was requested, flush read buffer
-    else if ((_stateBooleans & DISCONNECT_PENDING) && _sendState == receiving) {
+    else if ((_stateBooleans & DISCONNECT_PENDING)
+        && (_sendState == receiving || usePushReceive())) {
         flushReadBuffer();
     }
 
+    // Pass pushed data on to the read buffer, independent of the current state
+    if (_bytesToRead > 0 && usePushReceive()) {
+        receive();
+    }
+
+    // Requests on the control port run independent of the main port
+    runControlPort(iccidCommand);
+
     // Don't go on when waiting for a reply
-    if (_waitForReply || _replyState != okReply)
+    if (replyPending())
         return;
 
     // Don't go on if space in write buffer is low
@@ -179,7 +415,7 @@ void Sim800CommDevice::run()
         return;
 
     // When signal strength was requested, send the command to the modem
-    if (_rssi == INT16_MAX && _stateBooleans & LINE_READ) {
+    if (rssiRequested() && _stateBooleans & LINE_READ) {
         _replyState = csq;
         _waitForReply = _okStr;
         sendCommand("AT+CSQ");
@@ -193,6 +429,10 @@ void Sim800CommDevice::run()
         return;
     }
 
+    // Steps setting up and tearing down the connection
+    if (runCommandStep(_commandSteps, _numCommandSteps))
+        return;
+
     // Connection state machine
     switch (_sendState) {
     case notConnected:
@@ -207,79 +447,51 @@ void Sim800CommDevice::run()
         setDelay(10);
         _connectState = IPCommDevice::intermediate;
         _stateBooleans |= LINE_READ;
+        _bearerConfig = bearerConfig();
         _waitForReply = _okStr;
-        _sendState = sendCiprxget;
+        _sendState = sendIfc;
         sendCommand("ATE0");
         break;
 
-    case sendCiprxget:
-        _waitForReply = _okStr;
-        _sendState = sendCipmux;
-        sendCommand("AT+CIPRXGET=1");
-        break;
-
-    case sendCipmux:
-        _waitForReply = _okStr;
-        _sendState = sendCstt;
-        sendCommand("AT+CIPMUX=1");
-        break;
-
-    case sendCstt: {
-        const char str[] = "AT+CSTT=\"";
-        _serial.write((const uint8_t*)str, sizeof(str) - 1);
-        _serial.write((const uint8_t*)_apn);
-        _serial.write((const uint8_t*)_quoteEndStr);
-
-        _waitForReply = _okStr;
-        _sendState = sendCiicr;
-        break;
-    }
-
-    case sendCiicr:
-        _waitForReply = _okStr;
-        _sendState = sendCifsr;
-        sendCommand("AT+CIICR");
-        break;
-
-    case sendCifsr: {
-        if (handleDisconnect(sendCipshut))
-            break;
-
-        const char str[] = "AT+CIFSR";
-        _serial.write((const uint8_t*)str, sizeof(str) - 1);
-        _serial.write((const uint8_t*)_lineEndStr);
-
-        _replyState = cifsr;
-        _sendState = sendDnsQuery;
+    case sendCertData:
+        if (sendCertificate()) {
+            _waitForReply = _okStr;
+            _sendState = sendSslsetcert;
+        }
         break;
-    }
 
     case sendDnsQuery:
         if (SimCommDevice::sendDnsQuery()) {
+            // The result is reported after the OK
             _replyState = cdnsgip;
-            _waitForReply = _okStr;
+            _waitForReply = "+CDNSGIP:";
             _sendState = sendCipstart;
         }
         break;
 
     case sendCipstart: {
-        char portStr[6];
-        snprintf(portStr, sizeof(portStr), "%u", _port);
-
-        _serial.write((const uint8_t*)"AT+CIPSTART");
+        CommandBuilder cmd(_serial);
+        cmd.append("AT+CIPSTART=");
+        if (!singleConnection()) {
+            cmd.append("0,");
+        }
         if (_type == UDP) {
-            _serial.write((const uint8_t*)"=0,\"UDP\",\"");
+            cmd.append("\"UDP\",\"");
         } else {
-            _serial.write((const uint8_t*)"=0,\"TCP\",\"");
+            cmd.append("\"TCP\",\"");
         }
-        _serial.write((const uint8_t*)_ip);
-        _serial.write((const uint8_t*)"\",");
-        _serial.write((const uint8_t*)portStr);
-        _serial.write((const uint8_t*)_lineEndStr);
+        cmd.append(_ip).append("\",").appendNumber(_port).append(_lineEndStr).send();
 
         _replyState = cipstart;
-        _waitForReply = "0, CONNECT OK";
+        if (useTransparentMode()) {
+            _waitForReply = "CONNECT";
+        } else if (singleConnection()) {
+            _waitForReply = "CONNECT OK";
+        } else {
+            _waitForReply = "0, CONNECT OK";
+        }
         _sendState = finalizeConnect;
+        setCommandClass(networkCommand);
         break;
     }
 
@@ -287,14 +499,19 @@ void Sim800CommDevice::run()
         setDelay(0);
         _connectState = IPCommDevice::connected;
         _replyState = okReply;
-        _sendState = connected;
         _stateBooleans |= IP_CONNECTED;
+        if (useTransparentMode()) {
+            enterDataMode();
+            _sendState = dataMode;
+        } else {
+            _sendState = connected;
+        }
         break;
 
     case connected:
-        if (_writeBuffer.bytesAvailable()) {
-            if (prepareSending(true)) {
-                _serial.write((const uint8_t*)_lineEndStr);
+        if (sendPending()) {
+            if (prepareSending(!singleConnection())) {
+                writeSendHeader(_lineEndStr);
                 _connectState = IPCommDevice::transmitting;
                 _sendState = sendData;
             }
@@ -302,13 +519,19 @@ void Sim800CommDevice::run()
             _stateBooleans &= ~DATA_PENDING;
             _connectState = IPCommDevice::receiving;
             _sendState = sendCiprxget4;
+        } else if (sendWindowFull() && _writeBuffer.bytesAvailable()) {
+            // Wait until the peer acknowledged the chunks in flight
+            setDelay(SIM800_ACK_POLL_DELAY);
+            _replyState = cipack;
+            _waitForReply = _okStr;
+            sendCommand(singleConnection() ? "AT+CIPACK" : "AT+CIPACK=0");
         } else {
             _connectState = IPCommDevice::connected;
             if (_stateBooleans & IP_CONNECTED) {
                 handleDisconnect(sendCipclose);
             } else {
                 _stateBooleans &= ~DISCONNECT_PENDING;
-                _sendState = sendCipshut;
+                _sendState = keepBearer() ? bearerUp : sendCipshut;
             }
         }
         break;
@@ -316,9 +539,14 @@ void Sim800CommDevice::run()
         // States after connecting
 
     case sendData:
-        SimCommDevice::sendData();
-        _waitForReply = "0, SEND OK";
-        _sendState = connected;
+        if (SimCommDevice::sendData()) {
+            if (useQuickSend()) {
+                _waitForReply = "DATA ACCEPT";
+            } else {
+                _waitForReply = singleConnection() ? "SEND OK" : "0, SEND OK";
+            }
+            _sendState = connected;
+        }
         break;
 
     case sendCiprxget4:
@@ -326,7 +554,11 @@ void Sim800CommDevice::run()
         _waitForReply = _okStr;
         _sendState = sendCiprxget2;
         _replyState = ciprxget4;
-        sendCommand("AT+CIPRXGET=4,0");
+        if (singleConnection()) {
+            sendCommand("AT+CIPRXGET=4");
+        } else {
+            sendCommand("AT+CIPRXGET=4,0");
+        }
         break;
 
     case sendCiprxget2:
@@ -334,9 +566,10 @@ void Sim800CommDevice::run()
             break;
 
         if (_bytesToReceive > 0) {
-            if (SimCommDevice::sendCiprxget2()) {
+            if (SimCommDevice::sendCiprxget2(ciprxget2Command())) {
                 _sendState = waitReceive;
                 _replyState = ciprxget2;
+                _waitForReply = "+CIPRXGET: 2,";
             }
         } else if (_stateBooleans & IP_CONNECTED) {
             _sendState = connected;
@@ -351,42 +584,94 @@ void Sim800CommDevice::run()
 
     case receiving:
         if (_bytesToRead > 0) {
+            // Request the next chunk while the current one is still arriving
+            if (!(_stateBooleans & (RECEIVE_PREFETCH | DISCONNECT_PENDING))
+                && _bytesToReceive > 0 && SimCommDevice::sendCiprxget2(ciprxget2Command())) {
+                _stateBooleans |= RECEIVE_PREFETCH;
+            }
+
             if (receive()) {
-                _replyState = okReply;
-                _waitForReply = _okStr;
+                if (_stateBooleans & RECEIVE_PREFETCH) {
+                    // The OK of this chunk precedes the header of the prefetched one
+                    _stateBooleans &= ~RECEIVE_PREFETCH;
+                    _waitForReply = "+CIPRXGET: 2,";
+                    _replyState = ciprxget2;
+                    _sendState = waitReceive;
+                } else {
+                    _waitForReply = _okStr;
+                    _replyState = okReply;
+                }
             }
         } else if (_bytesToReceive > 0) {
             _sendState = sendCiprxget2;
+        } else if (_stateBooleans & IP_CONNECTED) {
+            _sendState = connected;
         } else {
-            setDelay(10);
-            _sendState = sendCiprxget4;
+            _sendState = ipUnconnected;
         }
         break;
 
-    case ipUnconnected:
-        _connectState = IPCommDevice::intermediate;
-        if (handleDisconnect(finalizeDisconnect))
-            break;
+    case dataMode:
+        if (commandModeRequested() && _writeBuffer.bytesAvailable() == 0
+            && _serial.writeBufferProcessed()) {
+            // Keep the line idle for the guard time before escaping
+            setDelay(_guardTime);
+            _sendState = escapeDataMode;
+        } else if (!transferDataMode()) {
+            _sendState = ipUnconnected;
+        }
+        break;
 
-        handleConnect(sendCipstart);
+    case escapeDataMode:
+        if (sendEscapeSequence()) {
+            setDelay(_guardTime);
+            _waitForReply = _okStr;
+            _sendState = commandMode;
+        } else {
+            setDelay(0);
+            _sendState = ipUnconnected;
+        }
         break;
 
-    case sendCipclose:
-        _connectState = IPCommDevice::intermediate;
+    case commandMode:
+        setDelay(0);
+        if (handleDisconnect(sendCipclose))
+            break;
+
         if (_stateBooleans & IP_CONNECTED) {
-            _waitForReply = "0, CLOSE OK";
-            _sendState = sendCipshut;
-            sendCommand("AT+CIPCLOSE=0");
+            _replyState = expectConnect;
+            _waitForReply = "CONNECT";
+            _sendState = finalizeConnect;
+            sendCommand("ATO");
+            setCommandClass(networkCommand);
         } else {
-            _sendState = sendCipshut;
+            _sendState = ipUnconnected;
         }
         break;
 
-    case sendCipshut:
+    case ipUnconnected:
         _connectState = IPCommDevice::intermediate;
-        _waitForReply = "SHUT OK";
-        _sendState = finalizeDisconnect;
-        sendCommand("AT+CIPSHUT");
+        if (handleDisconnect(sendCipclose))
+            break;
+
+        if (handleConnect(sendCipstart) && !resolveFromCache()) {
+            _sendState = sendDnsQuery;
+        }
+        break;
+
+    case bearerUp:
+        setDelay(10);
+        _connectState = IPCommDevice::notConnected;
+        if (!keepBearer() || ((_stateBooleans & CONNECT_PENDING) && !bearerMatches())) {
+            // Release the bearer, a pending connection request sets it up again
+            _sendState = sendCipshut;
+        } else if (handleConnect(sendCipstart)) {
+            _connectState = IPCommDevice::intermediate;
+            _stateBooleans &= ~DATA_PENDING;
+            if (!resolveFromCache()) {
+                _sendState = sendDnsQuery;
+            }
+        }
         break;
 
     case finalizeDisconnect:
@@ -61,18 +61,41 @@ class Sim800CommDevice : public SimCommDevice
      * [*] --> notConnected
      * notConnected --> notConnected
      * notConnected --> connecting : connection request via API
-     * connecting --> sendCiprxget
+     * connecting --> sendIfc
      * connecting : ""ATE0""
+     * sendIfc --> sendCiprxget
+     * sendIfc : flow control changed: ""AT+IFC=<2,2|0,0>""
      * sendCiprxget --> sendCipmux
      * sendCiprxget : ""AT+CIPRXGET=1""
-     * sendCipmux --> sendCstt
+     * sendCipmux --> sendCipqsend
      * sendCipmux : ""AT+CIPMUX=1""
+     * sendCipmux : ""AT+CIPMUX=0"" (transparent mode or SSL)
+     * sendCipqsend --> sendCipmode
+     * sendCipqsend : ""AT+CIPQSEND=<quick send>""
+     * sendCipmode --> sendCstt
+     * sendCipmode --> sendCipssl : SSL
+     * sendCipmode : ""AT+CIPMODE=<transparent>""
+     * sendCipssl --> sendFsdel : certificate not yet loaded
+     * sendCipssl --> sendSslsetcert : certificate set
+     * sendCipssl --> sendCstt
+     * sendCipssl : ""AT+CIPSSL=1""
+     * sendFsdel --> sendFscreate
+     * sendFsdel : ""AT+FSDEL=C:\USER\cicada_ca.crt""
+     * sendFscreate --> sendFswrite
+     * sendFscreate : ""AT+FSCREATE=C:\USER\cicada_ca.crt""
+     * sendFswrite --> sendCertData
+     * sendFswrite : ""AT+FSWRITE=C:\USER\cicada_ca.crt,0,<length>,10""
+     * sendCertData --> sendSslsetcert
+     * sendCertData : send certificate
+     * sendSslsetcert --> sendCstt
+     * sendSslsetcert : ""AT+SSLSETCERT="C:\USER\cicada_ca.crt" ""
      * sendCstt --> sendCiicr
      * sendCstt : ""AT+CSTT=<apn>""
      * sendCiicr --> sendCifsr
      * sendCiicr : AT+CIICR
      * sendCifsr --> sendCipshut : connection closed via API
      * sendCifsr --> sendDnsQuery
+     * sendCifsr --> sendCipstart : IP address or cached host name
      * sendCifsr : AT+CIFSR
      * sendDnsQuery --> sendDnsQuery
      * sendDnsQuery --> sendCipstart : can send DNS query
@@ -81,11 +104,21 @@ class Sim800CommDevice : public SimCommDevice
      * sendCipstart : ""AT+CIPSTART=0,"UDP",<ip>""
      * sendCipstart : ""AT+CIPSTART=0,"TCP",<ip>""
      * finalizeConnect --> connected
+     * finalizeConnect --> dataMode : transparent mode
+     * dataMode --> escapeDataMode : command or disconnect requested
+     * dataMode --> ipUnconnected : connection close by peer
+     * dataMode : pass data between buffers and modem
+     * escapeDataMode --> commandMode
+     * escapeDataMode : ""+++""
+     * commandMode --> sendCipclose : connection closed via API
+     * commandMode --> finalizeConnect
+     * commandMode : ""ATO""
      * connected --> sendData : bytes in write buffer
      * connected --> sendCiprxget4 : incoming data pending
      * connected --> sendCipclose : connection closed via API
      * connected --> connected
      * connected : bytes in write buffer: ""AT+CIPSEND=0,<numOfBytes>""
+     * connected : quick send window full: ""AT+CIPACK=0""
      * sendData --> connected
      * sendData : send data
      * sendCiprxget4 --> sendCiprxget2
@@ -98,12 +131,21 @@ class Sim800CommDevice : public SimCommDevice
      * waitReceive --> waitReceive : no data
      * waitReceive --> receiving : data available
      * receiving --> receiving : bytesToRead > 0
+     * receiving : ""AT+CIPRXGET=2,0,<numBytesReceive>"" (prefetch next chunk)
+     * receiving --> waitReceive : chunk complete & next chunk prefetched
      * receiving --> sendCiprxget2 : bytesToReceive > 0
-     * receiving --> sendCiprxget4 : no bytes to receive/read
-     * ipUnconnected --> finalizeDisconnect : connection closed via API
-     * ipUnconnected --> sendCipstart : connection close by peer
+     * receiving --> connected : no bytes to receive/read
+     * receiving --> ipUnconnected : connection close by peer
+     * ipUnconnected --> sendCipclose : connection closed via API
+     * ipUnconnected --> sendDnsQuery : connection request via API
+     * ipUnconnected --> sendCipstart : IP address or cached host name
      * sendCipclose --> sendCipshut
+     * sendCipclose --> bearerUp : keep bearer
      * sendCipclose : ""AT+CIPCLOSE=0""
+     * bearerUp --> bearerUp
+     * bearerUp --> sendDnsQuery : connection request via API
+     * bearerUp --> sendCipstart : IP address or cached host name
+     * bearerUp --> sendCipshut : keep bearer disabled or settings changed
      * sendCipshut --> finalizeDisconnect
      * sendCipshut : ""AT+CIPSHUT""
      * finalizeDisconnect --> notConnected
@@ -111,16 +153,39 @@ class Sim800CommDevice : public SimCommDevice
      */
     virtual void run();
 
+  protected:
+    virtual bool singleConnection() const;
+    virtual bool usePushReceive() const;
+    const char* ciprxget2Command() const;
+
   private:
-    enum ReplyState { okReply = 0, csq, requestID, cifsr, cdnsgip, cipstart, ciprxget4, ciprxget2 };
+    enum ReplyState {
+        okReply = 0,
+        csq,
+        requestID,
+        expectConnect,
+        cdnsgip,
+        cipstart,
+        ciprxget4,
+        ciprxget2,
+        cipack
+    };
 
     enum SendState {
         notConnected,
         serialError,
         connecting,
+        sendIfc,
         sendCiprxget,
         sendCipmux,
-        sendCipsprt,
+        sendCipqsend,
+        sendCipmode,
+        sendCipssl,
+        sendFsdel,
+        sendFscreate,
+        sendFswrite,
+        sendCertData,
+        sendSslsetcert,
         sendCstt,
         sendCiicr,
         sendCifsr,
@@ -133,12 +198,33 @@ class Sim800CommDevice : public SimCommDevice
         sendCiprxget2,
         waitReceive,
         receiving,
+        dataMode,
+        escapeDataMode,
+        commandMode,
         ipUnconnected,
         sendCipclose,
+        bearerUp,
         sendCipshut,
         finalizeDisconnect
     };
 
+    bool writeCipmux();
+    bool writeCipqsend();
+    bool writeCipmode();
+    bool writeCipssl();
+    bool writeFsdel();
+    bool writeFscreate();
+    bool writeFswrite();
+    bool writeSslsetcert();
+    StepReply parseSslsetcert();
+    bool writeCstt();
+    bool writeCifsr();
+    StepReply parseCifsr();
+    bool writeCipclose();
+
+    static const CommandStep _commandSteps[];
+    static const uint8_t _numCommandSteps;
+
     const char* iccidCommand = "AT+CCID";
 };
 }
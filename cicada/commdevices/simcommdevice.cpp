@@ -22,63 +22,46 @@
  */
 
 #include "cicada/commdevices/simcommdevice.h"
-#include "printf.h"
+#include "cicada/commdevices/commandbuilder.h"
 #include <cinttypes>
 #include <cstddef>
 #include <cstdlib>
 #include <cstring>
 
+#define RECEIVE_MARGIN 40
+#define CONTROL_PORT_TIMEOUT 1000
+
 using namespace Cicada;
 
 SimCommDevice::SimCommDevice(
     IBufferedSerial& serial, uint8_t* readBuffer, uint8_t* writeBuffer, Size bufferSize) :
-    ATCommDevice(serial, readBuffer, writeBuffer, bufferSize), _apn(NULL)
+    ATCommDevice(serial, readBuffer, writeBuffer, bufferSize),
+    _apn(NULL),
+    _controlSerial(NULL),
+    _controlOpen(false)
 {
     resetStates();
 }
 
 SimCommDevice::SimCommDevice(IBufferedSerial& serial, uint8_t* readBuffer, uint8_t* writeBuffer,
     Size readBufferSize, Size writeBufferSize) :
-    ATCommDevice(serial, readBuffer, writeBuffer, readBufferSize, writeBufferSize), _apn(NULL)
+    ATCommDevice(serial, readBuffer, writeBuffer, readBufferSize, writeBufferSize),
+    _apn(NULL),
+    _controlSerial(NULL),
+    _controlOpen(false)
 {
     resetStates();
 }
 
 void SimCommDevice::resetStates()
 {
-    _serial.flushReceiveBuffers();
-    _readBuffer.flush();
-    _writeBuffer.flush();
-    _lbFill = 0;
-    _sendState = 0;
-    _replyState = 0;
-    _connectState = IPCommDevice::notConnected;
-    _bytesToWrite = 0;
-    _bytesToReceive = 0;
-    _bytesToRead = 0;
-    _waitForReply = NULL;
-    _stateBooleans = LINE_READ;
-    _rssi = 99;
+    ATCommDevice::resetStates();
+    _bearerConfig = 0;
     _idStringBuffer[0] = '\0';
     _idStringBuffer[1] = noRequest;
-}
-
-bool SimCommDevice::fillLineBuffer()
-{
-    // Buffer reply from modem in line buffer
-    // Returns true when enough data to be parsed is available.
-    if (_stateBooleans & LINE_READ) {
-        while (_serial.bytesAvailable()) {
-            char c = _serial.read();
-            _lineBuffer[_lbFill++] = c;
-            if (c == '\n' || c == '>' || _lbFill == LINE_MAX_LENGTH) {
-                _lineBuffer[_lbFill] = '\0';
-                _lbFill = 0;
-                return true;
-            }
-        }
-    }
-    return false;
+    _controlState = controlIdle;
+    if (_controlSerial)
+        _controlSerial->flushReceiveBuffers();
 }
 
 void SimCommDevice::setApn(const char* apn)
@@ -108,6 +91,15 @@ void SimCommDevice::serialUnlock()
     _stateBooleans &= ~SERIAL_LOCKED;
 }
 
+bool SimCommDevice::commandModeRequested()
+{
+    // Requests on the control port don't need command mode
+    if (_controlOpen)
+        return _stateBooleans & DISCONNECT_PENDING;
+
+    return ATCommDevice::commandModeRequested() || _idStringBuffer[1] != noRequest;
+}
+
 bool SimCommDevice::parseDnsReply()
 {
     if (strncmp(_lineBuffer, "+CDNSGIP: 1", 11) == 0) {
@@ -137,18 +129,43 @@ bool SimCommDevice::parseDnsReply()
             i++;
         }
         strcpy(_ip, tmpStr);
+        _dnsCache.add(_host, _ip, lastRun());
         return true;
     } else if (strncmp(_lineBuffer, "+CDNSGIP: 0", 11) == 0) {
-        _stateBooleans |= RESET_PENDING;
+        // Name resolution failed, the driver decides how to recover
+        _connectState = dnsError;
     }
 
     return false;
 }
 
+const char* SimCommDevice::skipConnectionNumber(const char* str) const
+{
+    // In multiple connection mode, the modem reports the connection number first
+    if (singleConnection())
+        return str;
+    if (strncmp(str, "0,", 2) == 0)
+        return str + 2;
+    return NULL;
+}
+
+bool SimCommDevice::singleConnection() const
+{
+    return false;
+}
+
 bool SimCommDevice::parseCiprxget4()
 {
-    if (strncmp(_lineBuffer, "+CIPRXGET: 4,0,", 15) == 0) {
-        int bytesToReceive = strtol(_lineBuffer + 15, NULL, 10);
+    const char* lengthStr = NULL;
+    if (strncmp(_lineBuffer, "+CIPRXGET: 4,", 13) == 0) {
+        lengthStr = skipConnectionNumber(_lineBuffer + 13);
+    } else if (strncmp(_lineBuffer, "+CCHRECV: LEN,", 14) == 0) {
+        // Sim7x00 SSL: "+CCHRECV: LEN,<cache_len_0>,<cache_len_1>"
+        lengthStr = _lineBuffer + 14;
+    }
+
+    if (lengthStr) {
+        int bytesToReceive = strtol(lengthStr, NULL, 10);
         _bytesToReceive += bytesToReceive;
         return true;
     }
@@ -157,20 +174,34 @@ bool SimCommDevice::parseCiprxget4()
 
 bool SimCommDevice::parseCiprxget2()
 {
-    if (strncmp(_lineBuffer, "+CIPRXGET: 2,0,", 15) == 0) {
-        int bytesToReceive = strtol(_lineBuffer + 15, NULL, 10);
-        _bytesToReceive -= bytesToReceive;
-        _bytesToRead += bytesToReceive;
-        _stateBooleans &= ~LINE_READ;
+    const char* lengthStr = NULL;
+    if (strncmp(_lineBuffer, "+CIPRXGET: 2,", 13) == 0) {
+        lengthStr = skipConnectionNumber(_lineBuffer + 13);
+    } else if (strncmp(_lineBuffer, "+CCHRECV: DATA,0,", 17) == 0) {
+        // Sim7x00 SSL: "+CCHRECV: DATA,0,<len>"
+        lengthStr = _lineBuffer + 17;
+    }
+
+    if (lengthStr) {
+        char* restStr;
+        int bytesToReceive = strtol(lengthStr, &restStr, 10);
+        beginReceive(bytesToReceive);
+
+        // The modem reports the number of bytes left in its buffer after the current chunk
+        if (*restStr == ',') {
+            _bytesToReceive = strtol(restStr + 1, NULL, 10);
+        } else {
+            _bytesToReceive -= bytesToReceive;
+        }
         return true;
     }
     return false;
 }
 
-bool SimCommDevice::parseCsq()
+bool SimCommDevice::parseCsq(const char* line)
 {
-    if (strncmp(_lineBuffer, "+CSQ: ", 6) == 0) {
-        unsigned int rssi = strtol(_lineBuffer + 6, NULL, 10);
+    if (strncmp(line, "+CSQ: ", 6) == 0) {
+        unsigned int rssi = strtol(line + 6, NULL, 10);
         // Convert raw rssi to dBm
         if (rssi >= 0 && rssi <= 31) {
             // Conversion according to 3GPP TS 27.007
@@ -186,20 +217,20 @@ bool SimCommDevice::parseCsq()
     return false;
 }
 
-bool SimCommDevice::parseIDReply()
+bool SimCommDevice::parseIDReply(char* line)
 {
     // Avoid parsing command echo in case it's turned on
-    if (strncmp(_lineBuffer, "AT", 2) == 0 || _lineBuffer[0] == '\r') {
+    if (strncmp(line, "AT", 2) == 0 || line[0] == '\r') {
         return false;
     }
 
-    char* src = _lineBuffer;
+    char* src = line;
 
     // For Sim7x00: "AT+CICCID" replys with "+ICCID: <ICCID>"
-    if (strncmp(_lineBuffer, "+ICCID: ", 8) == 0) {
-        src = _lineBuffer + 8;
+    if (strncmp(line, "+ICCID: ", 8) == 0) {
+        src = line + 8;
         // Avoid handling other messages from the modem here
-    } else if (strncmp(_lineBuffer, "+", 1) == 0) {
+    } else if (strncmp(line, "+", 1) == 0) {
         return false;
     }
 
@@ -252,36 +283,135 @@ bool SimCommDevice::parseIDReply()
     return false;
 }
 
+void SimCommDevice::setKeepBearer(bool enabled)
+{
+    if (enabled) {
+        _options |= OPTION_KEEP_BEARER;
+    } else {
+        _options &= ~OPTION_KEEP_BEARER;
+    }
+}
+
+bool SimCommDevice::keepBearer() const
+{
+    return _options & OPTION_KEEP_BEARER;
+}
+
+uint8_t SimCommDevice::bearerConfig() const
+{
+    // Settings which can't be changed while the bearer is up
+    uint8_t config = 0;
+    if (useTransparentMode())
+        config |= BEARER_TRANSPARENT;
+    if (usePushReceive())
+        config |= BEARER_PUSH_RECEIVE;
+    if (_type == SSL)
+        config |= BEARER_SSL;
+    if (useQuickSend())
+        config |= BEARER_QUICK_SEND;
+
+    return config;
+}
+
+bool SimCommDevice::bearerMatches() const
+{
+    return _bearerConfig == bearerConfig();
+}
+
+bool SimCommDevice::addDnsEntry(const char* host, const char* ip, uint32_t ttl)
+{
+    return _dnsCache.add(host, ip, lastRun(), ttl);
+}
+
+void SimCommDevice::setDnsCacheTtl(uint32_t ttl)
+{
+    _dnsCache.setTtl(ttl);
+}
+
+void SimCommDevice::clearDnsCache()
+{
+    _dnsCache.clear();
+}
+
+bool SimCommDevice::resolveFromCache()
+{
+    const char* ip = _host;
+    if (!DnsCache::isIpLiteral(_host)) {
+        ip = _dnsCache.lookup(_host, lastRun());
+    }
+
+    if (ip == NULL || strlen(ip) >= sizeof(_ip))
+        return false;
+
+    strcpy(_ip, ip);
+    return true;
+}
+
 bool SimCommDevice::sendDnsQuery()
 {
     if (_serial.spaceAvailable() < strlen(_host) + 20)
         return false;
 
-    _serial.write((const uint8_t*)"AT+CDNSGIP=\"");
-    _serial.write((const uint8_t*)_host);
-    _serial.write((const uint8_t*)_quoteEndStr);
+    CommandBuilder(_serial)
+        .append("AT+CDNSGIP=\"")
+        .append(_host)
+        .append('"')
+        .append(_lineEndStr)
+        .send();
+    setCommandClass(networkCommand);
+
+    return true;
+}
+
+bool SimCommDevice::writeIfc()
+{
+    if (!flowControlPending())
+        return false;
+
+    if (_serial.flowControl()) {
+        _stateBooleans |= FLOW_CONTROL;
+        sendCommand("AT+IFC=2,2");
+    } else {
+        _stateBooleans &= ~FLOW_CONTROL;
+        sendCommand("AT+IFC=0,0");
+    }
+
+    return true;
+}
+
+bool SimCommDevice::writeCiprxget()
+{
+    // Transparent mode has no receive commands
+    if (usePushReceive()) {
+        sendCommand("AT+CIPRXGET=0");
+    } else if (!useTransparentMode()) {
+        sendCommand("AT+CIPRXGET=1");
+    } else {
+        return false;
+    }
 
     return true;
 }
 
-bool SimCommDevice::sendCiprxget2()
+bool SimCommDevice::sendCiprxget2(const char* cmd)
 {
-    if (_serial.readBufferSize() - _serial.bytesAvailable() > 8
-        && _readBuffer.spaceAvailable() > 0) {
-        Size bytesToReceive = _serial.readBufferSize() - _serial.bytesAvailable() - 8;
+    // Bytes of the current chunk which are still in or on the way to the serial buffer.
+    // The next chunk must fit in behind them, including the OK and the reply header.
+    Size pending = _serial.bytesAvailable();
+    if (pending < _bytesToRead)
+        pending = _bytesToRead;
+
+    Size bytesToReceive = serialReceiveSpace(pending, RECEIVE_MARGIN);
+    if (bytesToReceive > 0 && readBufferSpace() > _bytesToRead) {
         if (bytesToReceive > _bytesToReceive)
             bytesToReceive = _bytesToReceive;
-        if (bytesToReceive > _readBuffer.spaceAvailable())
-            bytesToReceive = _readBuffer.spaceAvailable();
+        if (bytesToReceive > readBufferSpace() - _bytesToRead)
+            bytesToReceive = readBufferSpace() - _bytesToRead;
         if (bytesToReceive > _modemMaxReceiveSize)
             bytesToReceive = _modemMaxReceiveSize;
 
-        const char str[] = "AT+CIPRXGET=2,0,";
-        char sizeStr[6];
-        sprintf(sizeStr, "%u", (unsigned int)bytesToReceive);
-        _serial.write((const uint8_t*)str, sizeof(str) - 1);
-        _serial.write((const uint8_t*)sizeStr);
-        _serial.write((const uint8_t*)_lineEndStr);
+        CommandBuilder(_serial).append(cmd).appendNumber(bytesToReceive).append(_lineEndStr).send();
+        setCommandClass(dataCommand);
         return true;
     } else {
         return false;
@@ -290,9 +420,20 @@ bool SimCommDevice::sendCiprxget2()
 
 void SimCommDevice::checkConnectionState(const char* closeVariant)
 {
-    if (strncmp(_lineBuffer, "+CIPRXGET: 1,0", 14) == 0) {
+    if (strncmp(_lineBuffer, "+CIPRXGET: 1", 12) == 0
+        || strncmp(_lineBuffer, "+CCHEVENT: 0,RECV EVENT", 23) == 0) {
         _stateBooleans |= DATA_PENDING;
-    } else if (strncmp(_lineBuffer, closeVariant, strlen(closeVariant)) == 0) {
+    } else if (usePushReceive() && strncmp(_lineBuffer, "+IPD", 4) == 0) {
+        // Sim7x00 push receive header: "+IPD<len>"
+        beginReceive(strtol(_lineBuffer + 4, NULL, 10));
+    } else if (usePushReceive() && strncmp(_lineBuffer, "+RECEIVE,0,", 11) == 0) {
+        // Sim800 push receive header: "+RECEIVE,0,<len>:"
+        beginReceive(strtol(_lineBuffer + 11, NULL, 10));
+    } else if (usePushReceive() && strncmp(_lineBuffer, "+CCHRECV: DATA,0,", 17) == 0) {
+        // Sim7x00 SSL push receive header: "+CCHRECV: DATA,0,<len>"
+        beginReceive(strtol(_lineBuffer + 17, NULL, 10));
+    } else if (strncmp(_lineBuffer, closeVariant, strlen(closeVariant)) == 0
+        || strncmp(_lineBuffer, "CLOSED", 6) == 0) {
         _waitForReply = NULL;
         _stateBooleans &= ~IP_CONNECTED;
     }
@@ -300,34 +441,108 @@ void SimCommDevice::checkConnectionState(const char* closeVariant)
 
 bool SimCommDevice::sendIDRequest(const char* modemSpecificICCIDCommand)
 {
-    if (_idStringBuffer[1] != noRequest && _idStringBuffer[0] == 0 && _stateBooleans & LINE_READ) {
+    if (_controlOpen || !(_stateBooleans & LINE_READ))
+        return false;
+
+    const char* cmd = nextIDCommand(modemSpecificICCIDCommand);
+    if (cmd) {
+        sendCommand(cmd);
+        return true;
+    }
+    return false;
+}
+
+const char* SimCommDevice::nextIDCommand(const char* modemSpecificICCIDCommand)
+{
+    if (_idStringBuffer[1] != noRequest && _idStringBuffer[0] == 0) {
         RequestIDType type = (RequestIDType)_idStringBuffer[1];
         _idStringBuffer[1] = noRequest;
 
         switch (type) {
         // ID Requests according to 3GPP TS 27.007
         case manufacturer:
-            sendCommand("AT+CGMI");
-            return true;
+            return "AT+CGMI";
         case model:
-            sendCommand("AT+CGMM");
-            return true;
+            return "AT+CGMM";
         case imei:
-            sendCommand("AT+CGSN");
-            return true;
+            return "AT+CGSN";
         case imsi:
-            sendCommand("AT+CIMI");
-            return true;
+            return "AT+CIMI";
 
         // Modem specific ID requests
         case iccid:
-            sendCommand(modemSpecificICCIDCommand);
-            return true;
+            return modemSpecificICCIDCommand;
         default:
             break;
         }
     }
-    return false;
+    return NULL;
+}
+
+bool SimCommDevice::rssiRequested() const
+{
+    return _rssi == INT16_MAX && !_controlOpen;
+}
+
+void SimCommDevice::openControlSerial()
+{
+    // Until the control port opens, the requests go to the main one
+    _controlOpen = _controlSerial && (_controlSerial->isOpen() || _controlSerial->open());
+    if (!_controlOpen)
+        _controlState = controlIdle;
+}
+
+void SimCommDevice::runControlPort(const char* modemSpecificICCIDCommand)
+{
+    if (!_controlOpen)
+        return;
+
+    // Replies have a line buffer of their own, the main port may be in the middle of a line
+    while (_controlSerial->canReadLine()) {
+        _controlSerial->readLine((uint8_t*)_controlLine, sizeof(_controlLine));
+        if (strncmp(_controlLine, "ERROR", 5) == 0 || strncmp(_controlLine, "+CME ERROR", 10) == 0) {
+            if (_controlState == controlCsq)
+                _rssi = 0;
+            _controlState = controlIdle;
+        } else if (strncmp(_controlLine, _okStr, 2) == 0) {
+            _controlState = controlIdle;
+        } else if (_controlState == controlCsq) {
+            parseCsq(_controlLine);
+        } else if (_controlState == controlID) {
+            parseIDReply(_controlLine);
+        }
+    }
+
+    if (_controlState != controlIdle) {
+        // Don't wait forever for a reply which got lost
+        if (lastRun() - _controlTick >= CONTROL_PORT_TIMEOUT) {
+            if (_controlState == controlCsq)
+                _rssi = 0;
+            _controlState = controlIdle;
+        }
+        return;
+    }
+
+    const char* cmd = NULL;
+    if (_rssi == INT16_MAX) {
+        cmd = "AT+CSQ";
+        _controlState = controlCsq;
+    } else {
+        cmd = nextIDCommand(modemSpecificICCIDCommand);
+        _controlState = cmd ? controlID : controlIdle;
+    }
+
+    if (cmd) {
+        CommandBuilder(*_controlSerial).append(cmd).append(_lineEndStr).send();
+        _controlTick = lastRun();
+    }
+}
+
+void SimCommDevice::setControlSerial(IBufferedSerial* serial)
+{
+    _controlSerial = serial;
+    _controlOpen = false;
+    _controlState = controlIdle;
 }
 
 void SimCommDevice::requestIDString(RequestIDType type)
@@ -339,7 +554,8 @@ void SimCommDevice::requestIDString(RequestIDType type)
 
 char* SimCommDevice::getIDString()
 {
-    if (_waitForReply == NULL && _idStringBuffer[0] != '\0') {
+    bool replied = _controlOpen ? _controlState == controlIdle : _waitForReply == NULL;
+    if (replied && _idStringBuffer[0] != '\0') {
         return _idStringBuffer;
     } else {
         return NULL;
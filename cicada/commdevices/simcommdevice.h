@@ -25,9 +25,15 @@
 #define SIMCOMMDEVICE_H
 
 #include "cicada/commdevices/atcommdevice.h"
+#include "cicada/commdevices/dnscache.h"
 
 #define IDSTRING_MAX_LENGTH 24
 
+#define BEARER_TRANSPARENT (1 << 0)
+#define BEARER_PUSH_RECEIVE (1 << 1)
+#define BEARER_SSL (1 << 2)
+#define BEARER_QUICK_SEND (1 << 3)
+
 namespace Cicada {
 
 class SimCommDevice : public ATCommDevice
@@ -55,6 +61,61 @@ class SimCommDevice : public ATCommDevice
 
     virtual bool connect();
 
+    /*!
+     * Enables or disables keeping the bearer up between connections. When
+     * enabled, disconnect() and a connection close by the peer only close the
+     * socket, while the packet data context, the APN and the other modem
+     * settings stay active. A following connect() to the same or another host
+     * then only opens a new socket, which takes a single command if the host
+     * is an IP address or its name is in the DNS cache. If the connection type,
+     * transparent or push receive mode have changed in the meantime, the bearer
+     * is set up again. Disabling the option releases a bearer which is up
+     * without a connection.
+     *
+     * \param enabled true to keep the bearer up, false to release it on disconnect
+     */
+    void setKeepBearer(bool enabled);
+
+    /*!
+     * Adds an entry to the DNS cache, so connecting to the host doesn't
+     * need a DNS query. Host names which are IP addresses are never
+     * resolved and don't need to be added.
+     *
+     * \param host Host name
+     * \param ip IPv4 address in dotted notation
+     * \param ttl Time to live in milliseconds, 0 for an entry which doesn't expire
+     * \return true if the entry was added
+     */
+    bool addDnsEntry(const char* host, const char* ip, uint32_t ttl = 0);
+
+    /*!
+     * Sets how long the results of DNS queries are cached.
+     * The default is 10 minutes.
+     *
+     * \param ttl Time to live in milliseconds
+     */
+    void setDnsCacheTtl(uint32_t ttl);
+
+    /*!
+     * Removes all entries from the DNS cache.
+     */
+    void clearDnsCache();
+
+    /*!
+     * Sets a second serial device for USB modems with several serial
+     * interfaces. Signal strength and identification requests then go to this
+     * control port. The connection is still set up and the data are still
+     * transferred on the serial device passed to the constructor. This way,
+     * the requests don't interrupt transparent or PPP data mode with an
+     * escape sequence. Both serial devices need to be serviced by the
+     * application, the same as a single one. The control port is opened
+     * together with the main one; while it can't be opened, the requests are
+     * sent on the main one.
+     *
+     * \param serial Serial device of the control port, NULL to send all commands to the main one
+     */
+    void setControlSerial(IBufferedSerial* serial);
+
     /*!
      * Locks the serial device for the modem driver, so that it can be used by
      * the serialWrite() / serialRead() methods.
@@ -88,25 +149,47 @@ class SimCommDevice : public ATCommDevice
     char* getIDString();
 
   protected:
-    bool fillLineBuffer();
+    enum ControlState { controlIdle, controlCsq, controlID };
+
+    virtual bool commandModeRequested();
     bool parseDnsReply();
+    virtual bool singleConnection() const;
+    const char* skipConnectionNumber(const char* str) const;
     bool parseCiprxget4();
     bool parseCiprxget2();
-    bool parseCsq();
-    bool parseIDReply();
+    bool parseCsq(const char* line);
+    bool parseIDReply(char* line);
     void checkConnectionState(const char* closeVariant);
+    bool keepBearer() const;
+    uint8_t bearerConfig() const;
+    bool bearerMatches() const;
+    bool resolveFromCache();
     bool sendDnsQuery();
     void sendCipstart(const char* openVariant);
-    bool sendCiprxget2();
+    bool writeIfc();
+    bool writeCiprxget();
+    bool sendCiprxget2(const char* cmd = "AT+CIPRXGET=2,0,");
     bool sendIDRequest(const char* modemSpecificICCIDCommand);
+    const char* nextIDCommand(const char* modemSpecificICCIDCommand);
+    bool rssiRequested() const;
+    void openControlSerial();
+    void runControlPort(const char* modemSpecificICCIDCommand);
 
     const char* _apn;
+    uint8_t _bearerConfig;
 
-    char _ip[16];
+    char _ip[DNS_IP_MAX_LENGTH];
+    DnsCache _dnsCache;
 
     char _idStringBuffer[IDSTRING_MAX_LENGTH];
 
     uint16_t _modemMaxReceiveSize;
+
+    IBufferedSerial* _controlSerial;
+    bool _controlOpen;
+    uint8_t _controlState;
+    E_TICK_TYPE _controlTick;
+    char _controlLine[LINE_MAX_LENGTH + 1];
 };
 }
 
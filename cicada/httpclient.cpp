@@ -0,0 +1,613 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "cicada/httpclient.h"
+#include <cstring>
+
+using namespace Cicada;
+
+#define HTTP_DEFAULT_PORT 80
+#define HTTPS_DEFAULT_PORT 443
+#define DEFAULT_KEEP_ALIVE 30000
+#define DEFAULT_TIMEOUT 60000
+
+static bool equalsIgnoreCase(const char* a, const char* b)
+{
+    while (*a && *b) {
+        char ca = (*a >= 'A' && *a <= 'Z') ? *a + ('a' - 'A') : *a;
+        char cb = (*b >= 'A' && *b <= 'Z') ? *b + ('a' - 'A') : *b;
+        if (ca != cb)
+            return false;
+        a++;
+        b++;
+    }
+
+    return *a == *b;
+}
+
+static int8_t hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+
+    return -1;
+}
+
+HttpClient::HttpClient(IIPCommDevice& device) :
+    _device(device),
+    _host(NULL),
+    _port(HTTP_DEFAULT_PORT),
+    _type(IIPCommDevice::TCP),
+    _headers(NULL),
+    _headerCallback(NULL),
+    _bodyCallback(NULL),
+    _doneCallback(NULL),
+    _userData(NULL),
+    _first(0),
+    _numRequests(0),
+    _numSent(0),
+    _pipelineDepth(1),
+    _bodySent(0),
+    _nextId(1),
+    _state(idle),
+    _tick(0),
+    _keepAlive(DEFAULT_KEEP_ALIVE),
+    _timeout(DEFAULT_TIMEOUT),
+    _parseState(parseStatus),
+    _lineFill(0),
+    _status(0),
+    _chunked(false),
+    _keepConnection(true),
+    _hasLength(false),
+    _remaining(0)
+{}
+
+void HttpClient::setHost(const char* host, uint16_t port, IIPCommDevice::ConnectionType type)
+{
+    _host = host;
+    _port = port;
+    _type = type;
+}
+
+void HttpClient::setCallbacks(HeaderCallback headerCallback, BodyCallback bodyCallback,
+    DoneCallback doneCallback, void* userData)
+{
+    _headerCallback = headerCallback;
+    _bodyCallback = bodyCallback;
+    _doneCallback = doneCallback;
+    _userData = userData;
+}
+
+void HttpClient::setHeaders(const char* headers)
+{
+    _headers = headers;
+}
+
+void HttpClient::setPipelineDepth(uint8_t depth)
+{
+    if (depth < 1)
+        depth = 1;
+    if (depth > E_HTTP_MAX_REQUESTS)
+        depth = E_HTTP_MAX_REQUESTS;
+
+    _pipelineDepth = depth;
+}
+
+void HttpClient::setTimeouts(uint32_t keepAlive, uint32_t timeout)
+{
+    _keepAlive = keepAlive;
+    _timeout = timeout;
+}
+
+uint16_t HttpClient::get(const char* path, uint32_t rangeStart)
+{
+    uint16_t id = queue("GET", path);
+    if (id) {
+        request(_numRequests - 1).rangeStart = rangeStart;
+    }
+
+    return id;
+}
+
+uint16_t HttpClient::post(
+    const char* path, const char* contentType, const uint8_t* body, Size length)
+{
+    uint16_t id = queue("POST", path);
+    if (id) {
+        Request& r = request(_numRequests - 1);
+        r.contentType = contentType;
+        r.body = body;
+        r.length = length;
+        r.idempotent = false;
+    }
+
+    return id;
+}
+
+uint8_t HttpClient::pendingRequests() const
+{
+    return _numRequests;
+}
+
+void HttpClient::close()
+{
+    failAll();
+    if (_state != idle) {
+        _device.disconnect();
+        _state = closing;
+    }
+}
+
+void HttpClient::run()
+{
+    switch (_state) {
+    case idle:
+        if (_numRequests == 0 || _host == NULL)
+            break;
+
+        _device.setHostPort(_host, _port, _type);
+        if (!_device.connect()) {
+            failAll();
+            break;
+        }
+        _tick = lastRun();
+        _state = connecting;
+        break;
+
+    case connecting:
+        if (_device.isConnected()) {
+            _numSent = 0;
+            _bodySent = 0;
+            _tick = lastRun();
+            _state = connected;
+        } else if (lastRun() - _tick > _timeout) {
+            failAll();
+            _device.disconnect();
+            _state = closing;
+        }
+        break;
+
+    case connected: {
+        // The last data may arrive together with the close, it's read first
+        uint8_t buffer[E_HTTP_READ_CHUNK_SIZE];
+        Size size;
+        while (_state == connected && (size = _device.read(buffer, sizeof(buffer))) > 0) {
+            _tick = lastRun();
+            parse(buffer, size);
+        }
+        if (_state != connected)
+            break;
+
+        if (!_device.isConnected()) {
+            closeConnection();
+            break;
+        }
+
+        sendRequests();
+
+        // Close unused connections after a while, and those with a server
+        // which stopped responding
+        if (_numRequests == 0) {
+            if (lastRun() - _tick > _keepAlive) {
+                _device.disconnect();
+                _state = closing;
+            }
+        } else if (_numSent && lastRun() - _tick > _timeout) {
+            closeConnection();
+        }
+        break;
+    }
+
+    case closing:
+        if (_device.isIdle()) {
+            _state = idle;
+        }
+        break;
+    }
+}
+
+uint16_t HttpClient::queue(const char* method, const char* path)
+{
+    if (_numRequests == E_HTTP_MAX_REQUESTS)
+        return 0;
+
+    Request& r = request(_numRequests++);
+    r.id = _nextId;
+    r.method = method;
+    r.path = path;
+    r.contentType = NULL;
+    r.body = NULL;
+    r.length = 0;
+    r.rangeStart = 0;
+    r.idempotent = true;
+    r.retried = false;
+
+    if (++_nextId == 0)
+        _nextId = 1;
+
+    return r.id;
+}
+
+HttpClient::Request& HttpClient::request(uint8_t index)
+{
+    return _requests[(_first + index) % E_HTTP_MAX_REQUESTS];
+}
+
+const HttpClient::Request& HttpClient::request(uint8_t index) const
+{
+    return _requests[(_first + index) % E_HTTP_MAX_REQUESTS];
+}
+
+bool HttpClient::canSend() const
+{
+    if (_numSent >= _numRequests || _numSent >= _pipelineDepth)
+        return false;
+
+    // Requests which aren't safe to repeat aren't pipelined
+    return _numSent == 0 || (request(_numSent).idempotent && request(_numSent - 1).idempotent);
+}
+
+Size HttpClient::put(const char* str, bool send)
+{
+    Size length = strlen(str);
+    if (send) {
+        _device.write((const uint8_t*)str, length);
+    }
+
+    return length;
+}
+
+Size HttpClient::putNumber(uint32_t number, bool send)
+{
+    // Digits are filled in from the end
+    char digits[11];
+    char* start = digits + sizeof(digits) - 1;
+    *start = '\0';
+    do {
+        *--start = '0' + number % 10;
+        number /= 10;
+    } while (number);
+
+    return put(start, send);
+}
+
+Size HttpClient::writeRequest(const Request& request, bool send)
+{
+    Size length = put(request.method, send);
+    length += put(" ", send);
+    length += put(request.path, send);
+    length += put(" HTTP/1.1\r\nHost: ", send);
+    length += put(_host, send);
+    if (_port != (_type == IIPCommDevice::SSL ? HTTPS_DEFAULT_PORT : HTTP_DEFAULT_PORT)) {
+        length += put(":", send);
+        length += putNumber(_port, send);
+    }
+    length += put("\r\n", send);
+
+    if (request.rangeStart) {
+        length += put("Range: bytes=", send);
+        length += putNumber(request.rangeStart, send);
+        length += put("-\r\n", send);
+    }
+    if (!request.idempotent) {
+        if (request.contentType) {
+            length += put("Content-Type: ", send);
+            length += put(request.contentType, send);
+            length += put("\r\n", send);
+        }
+        length += put("Content-Length: ", send);
+        length += putNumber(request.length, send);
+        length += put("\r\n", send);
+    }
+    if (_headers) {
+        length += put(_headers, send);
+    }
+    length += put("\r\n", send);
+
+    return length;
+}
+
+void HttpClient::sendRequests()
+{
+    while (true) {
+        // The body of the last request goes out before the next one
+        if (_numSent) {
+            const Request& last = request(_numSent - 1);
+            if (_bodySent < last.length) {
+                _bodySent += _device.write(last.body + _bodySent, last.length - _bodySent);
+                if (_bodySent < last.length)
+                    return;
+            }
+        }
+
+        if (!canSend())
+            return;
+
+        // The header is written as a whole, so requests aren't mixed up
+        const Request& next = request(_numSent);
+        if (_device.spaceAvailable() < writeRequest(next, false))
+            return;
+
+        writeRequest(next, true);
+        _numSent++;
+        _bodySent = 0;
+        _tick = lastRun();
+    }
+}
+
+void HttpClient::parse(const uint8_t* data, Size size)
+{
+    Size pos = 0;
+    while (pos < size) {
+        // Data without a request waiting for it is dropped
+        if (_numSent == 0)
+            return;
+
+        if (_parseState == parseBody || _parseState == parseChunkData
+            || _parseState == parseUntilClose) {
+            Size length = size - pos;
+            if (_parseState != parseUntilClose && length > _remaining)
+                length = _remaining;
+
+            if (_bodyCallback) {
+                _bodyCallback(request(0).id, data + pos, length, _userData);
+            }
+            pos += length;
+
+            if (_parseState == parseUntilClose)
+                continue;
+
+            _remaining -= length;
+            if (_remaining == 0) {
+                if (_parseState == parseChunkData) {
+                    _parseState = parseChunkEnd;
+                } else if (!completeResponse()) {
+                    return;
+                }
+            }
+        } else if (readLine(data[pos++]) && !handleLine()) {
+            return;
+        }
+    }
+}
+
+bool HttpClient::readLine(uint8_t c)
+{
+    if (c == '\n') {
+        if (_lineFill && _line[_lineFill - 1] == '\r')
+            _lineFill--;
+        _line[_lineFill] = '\0';
+        _lineFill = 0;
+        return true;
+    }
+
+    // Lines too long for the buffer are cut off
+    if (_lineFill < E_HTTP_LINE_SIZE - 1) {
+        _line[_lineFill++] = c;
+    }
+
+    return false;
+}
+
+bool HttpClient::handleLine()
+{
+    switch (_parseState) {
+    case parseStatus:
+        // For example "HTTP/1.1 200 OK"
+        if (_line[0] == '\0')
+            return true;
+
+        if (strncmp(_line, "HTTP/1.", 7) != 0 || _line[8] != ' ' || _line[9] < '0'
+            || _line[9] > '9') {
+            closeConnection();
+            return false;
+        }
+        _status = 0;
+        for (const char* c = _line + 9; *c >= '0' && *c <= '9'; c++) {
+            _status = _status * 10 + (*c - '0');
+        }
+        _keepConnection = _line[7] != '0';
+        _chunked = false;
+        _hasLength = false;
+        _parseState = parseHeader;
+        return true;
+
+    case parseHeader:
+        if (_line[0] == '\0')
+            return beginBody();
+
+        handleHeader();
+        return true;
+
+    case parseChunkSize: {
+        // Chunk extensions after the size are ignored
+        if (hexValue(_line[0]) < 0) {
+            closeConnection();
+            return false;
+        }
+        _remaining = 0;
+        for (const char* c = _line; hexValue(*c) >= 0; c++) {
+            _remaining = (_remaining << 4) | hexValue(*c);
+        }
+        _parseState = _remaining ? parseChunkData : parseTrailer;
+        return true;
+    }
+
+    case parseChunkEnd:
+        _parseState = parseChunkSize;
+        return true;
+
+    case parseTrailer:
+        if (_line[0] == '\0')
+            return completeResponse();
+        return true;
+
+    default:
+        return true;
+    }
+}
+
+void HttpClient::handleHeader()
+{
+    char* value = strchr(_line, ':');
+    if (value == NULL)
+        return;
+
+    *value++ = '\0';
+    while (*value == ' ' || *value == '\t') {
+        value++;
+    }
+    char* end = value + strlen(value);
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+        *--end = '\0';
+    }
+
+    if (equalsIgnoreCase(_line, "Content-Length")) {
+        _remaining = 0;
+        for (const char* c = value; *c >= '0' && *c <= '9'; c++) {
+            _remaining = _remaining * 10 + (*c - '0');
+        }
+        _hasLength = true;
+    } else if (equalsIgnoreCase(_line, "Transfer-Encoding")) {
+        // Chunked is always the last encoding applied
+        Size length = end - value;
+        _chunked = length >= 7 && equalsIgnoreCase(end - 7, "chunked");
+    } else if (equalsIgnoreCase(_line, "Connection")) {
+        if (equalsIgnoreCase(value, "close")) {
+            _keepConnection = false;
+        } else if (equalsIgnoreCase(value, "keep-alive")) {
+            _keepConnection = true;
+        }
+    }
+
+    if (_headerCallback) {
+        _headerCallback(request(0).id, _status, _line, value, _userData);
+    }
+}
+
+bool HttpClient::beginBody()
+{
+    // Interim responses are followed by the actual one
+    if (_status < 200) {
+        _parseState = parseStatus;
+        return true;
+    }
+
+    if (_status == 204 || _status == 304)
+        return completeResponse();
+
+    if (_chunked) {
+        _parseState = parseChunkSize;
+    } else if (_hasLength) {
+        if (_remaining == 0)
+            return completeResponse();
+        _parseState = parseBody;
+    } else {
+        // The body ends when the server closes the connection
+        _keepConnection = false;
+        _parseState = parseUntilClose;
+    }
+
+    return true;
+}
+
+bool HttpClient::completeResponse()
+{
+    bool keepConnection = _keepConnection;
+    finishResponse(true);
+    _tick = lastRun();
+
+    // Requests sent after this one are answered on a new connection
+    if (!keepConnection && _state == connected) {
+        closeConnection();
+    }
+
+    return _state == connected;
+}
+
+void HttpClient::finishResponse(bool complete)
+{
+    uint16_t id = request(0).id;
+    uint16_t status = _status;
+
+    _first = (_first + 1) % E_HTTP_MAX_REQUESTS;
+    _numRequests--;
+    if (_numSent)
+        _numSent--;
+    _parseState = parseStatus;
+    _lineFill = 0;
+    _status = 0;
+
+    // Last, so the callback can queue the next request
+    if (_doneCallback) {
+        _doneCallback(id, status, complete, _userData);
+    }
+}
+
+void HttpClient::closeConnection()
+{
+    connectionClosed();
+    _device.disconnect();
+    _state = closing;
+}
+
+void HttpClient::connectionClosed()
+{
+    if (_numSent) {
+        // A response without length is complete when the connection closes,
+        // any other one which has started is cut off
+        if (_parseState == parseUntilClose) {
+            finishResponse(true);
+        } else if (_status) {
+            finishResponse(false);
+        }
+    }
+
+    // Requests without a response are sent once more, unless they aren't
+    // safe to repeat
+    while (_numSent && (!request(0).idempotent || request(0).retried)) {
+        finishResponse(false);
+    }
+    for (uint8_t i = 0; i < _numSent; i++) {
+        request(i).retried = true;
+    }
+
+    _numSent = 0;
+    _bodySent = 0;
+    _parseState = parseStatus;
+    _lineFill = 0;
+    _status = 0;
+}
+
+void HttpClient::failAll()
+{
+    while (_numRequests) {
+        finishResponse(false);
+    }
+    _numSent = 0;
+    _bodySent = 0;
+}
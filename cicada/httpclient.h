@@ -0,0 +1,265 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef HTTPCLIENT_H
+#define HTTPCLIENT_H
+
+#include "cicada/commdevices/iipcommdevice.h"
+#include "cicada/defines.h"
+#include "cicada/task.h"
+#include <cstddef>
+#include <stdint.h>
+
+#ifndef E_HTTP_MAX_REQUESTS
+#define E_HTTP_MAX_REQUESTS 4
+#endif
+
+#ifndef E_HTTP_LINE_SIZE
+#define E_HTTP_LINE_SIZE 128
+#endif
+
+#ifndef E_HTTP_READ_CHUNK_SIZE
+#define E_HTTP_READ_CHUNK_SIZE 64
+#endif
+
+namespace Cicada {
+
+/*!
+ * \class HttpClient
+ *
+ * Non-blocking HTTP/1.1 client running on any IIPCommDevice. Requests are
+ * queued with get() or post() and performed in run(), which needs to be
+ * called by the Scheduler like the one of the device.
+ *
+ * The client opens the connection when there is a request and keeps it open
+ * for the following ones, so they don't pay for another TCP and TLS setup.
+ * GET requests are pipelined, up to setPipelineDepth() are sent before the
+ * first response arrives. POST requests are only sent on their own, as it's
+ * not safe to send them again when the connection is lost. GET requests
+ * which didn't get a response are sent again on a new connection.
+ *
+ * Responses are parsed as they arrive and handed over in pieces: each
+ * header to the header callback, the payload, with chunked transfer
+ * encoding already removed, to the body callback, and finally the done
+ * callback. Nothing is buffered except the current header line, so
+ * responses can be of any size. An interrupted download can be resumed
+ * with a Range request, see get().
+ */
+class HttpClient : public Task
+{
+  public:
+    /*!
+     * Called for each header of a response.
+     * \param id Request ID returned by get() or post()
+     * \param status Status code of the response
+     * \param name Header name
+     * \param value Header value without surrounding white space
+     * \param userData Pointer passed to setCallbacks()
+     */
+    typedef void (*HeaderCallback)(
+        uint16_t id, uint16_t status, const char* name, const char* value, void* userData);
+
+    /*!
+     * Called with the next piece of a response's payload.
+     * \param id Request ID returned by get() or post()
+     * \param data Payload data, only valid during the call
+     * \param size Number of bytes
+     * \param userData Pointer passed to setCallbacks()
+     */
+    typedef void (*BodyCallback)(uint16_t id, const uint8_t* data, Size size, void* userData);
+
+    /*!
+     * Called when a request is finished.
+     * \param id Request ID returned by get() or post()
+     * \param status Status code of the response, 0 if there was none
+     * \param complete true if the whole response has been received, false if
+     * the request failed or the connection was lost in the middle of it
+     * \param userData Pointer passed to setCallbacks()
+     */
+    typedef void (*DoneCallback)(uint16_t id, uint16_t status, bool complete, void* userData);
+
+    /*!
+     * \param device Device to connect with. The client controls connect() and
+     * disconnect() of the device, it must not be used for anything else.
+     */
+    HttpClient(IIPCommDevice& device);
+
+    /*!
+     * Sets the server to send requests to. Takes effect with the next
+     * connection.
+     * \param host Host name, needs to be valid during the lifetime of the client
+     * \param port Port to connect to
+     * \param type TCP for http, SSL for https
+     */
+    void setHost(const char* host, uint16_t port = 80,
+        IIPCommDevice::ConnectionType type = IIPCommDevice::TCP);
+
+    /*!
+     * Sets the functions which receive the responses.
+     */
+    void setCallbacks(HeaderCallback headerCallback, BodyCallback bodyCallback,
+        DoneCallback doneCallback, void* userData = NULL);
+
+    /*!
+     * Sets additional header lines sent with every request, for example
+     * for authorization.
+     * \param headers Header lines, each terminated with "\r\n". Needs to be
+     * valid as long as requests are sent.
+     */
+    void setHeaders(const char* headers);
+
+    /*!
+     * \param depth Maximum number of requests sent before their responses
+     * arrive, between 1 and E_HTTP_MAX_REQUESTS. The default is 1.
+     */
+    void setPipelineDepth(uint8_t depth);
+
+    /*!
+     * \param keepAlive Time in ms an unused connection is kept open
+     * \param timeout Time in ms to wait for the connection or the next data of
+     * a response
+     */
+    void setTimeouts(uint32_t keepAlive, uint32_t timeout);
+
+    /*!
+     * Queues a GET request. With rangeStart, only the part of the resource
+     * starting at this offset is requested, for example to resume a download
+     * after the last byte received. The server then replies with status 206,
+     * or with 200 and the whole resource if it doesn't support ranges.
+     *
+     * \param path Path of the resource, needs to be valid until the request
+     * is finished
+     * \param rangeStart Offset of the first byte to get
+     * \return Request ID passed to the callbacks, 0 if the queue is full
+     */
+    uint16_t get(const char* path, uint32_t rangeStart = 0);
+
+    /*!
+     * Queues a POST request.
+     *
+     * \param path Path of the resource
+     * \param contentType Media type of the body
+     * \param body Body to send, written to the device as space is available
+     * \param length Size of the body
+     * \return Request ID passed to the callbacks, 0 if the queue is full.
+     * All arguments need to be valid until the request is finished.
+     */
+    uint16_t post(const char* path, const char* contentType, const uint8_t* body, Size length);
+
+    /*!
+     * \return Number of requests which aren't finished yet
+     */
+    uint8_t pendingRequests() const;
+
+    /*!
+     * Closes the connection. Pending requests are finished as failed.
+     */
+    void close();
+
+    /*!
+     * Connects, sends the requests and parses the responses.
+     */
+    virtual void run();
+
+  private:
+    enum State { idle, connecting, connected, closing };
+
+    enum ParseState {
+        parseStatus,
+        parseHeader,
+        parseBody,
+        parseChunkSize,
+        parseChunkData,
+        parseChunkEnd,
+        parseTrailer,
+        parseUntilClose
+    };
+
+    struct Request
+    {
+        uint16_t id;
+        const char* method;
+        const char* path;
+        const char* contentType;
+        const uint8_t* body;
+        Size length;
+        uint32_t rangeStart;
+        bool idempotent;
+        bool retried;
+    };
+
+    uint16_t queue(const char* method, const char* path);
+    Request& request(uint8_t index);
+    const Request& request(uint8_t index) const;
+    bool canSend() const;
+    Size put(const char* str, bool send);
+    Size putNumber(uint32_t number, bool send);
+    Size writeRequest(const Request& request, bool send);
+    void sendRequests();
+    void parse(const uint8_t* data, Size size);
+    bool readLine(uint8_t c);
+    bool handleLine();
+    void handleHeader();
+    bool beginBody();
+    bool completeResponse();
+    void finishResponse(bool complete);
+    void closeConnection();
+    void connectionClosed();
+    void failAll();
+
+    IIPCommDevice& _device;
+    const char* _host;
+    uint16_t _port;
+    IIPCommDevice::ConnectionType _type;
+    const char* _headers;
+
+    HeaderCallback _headerCallback;
+    BodyCallback _bodyCallback;
+    DoneCallback _doneCallback;
+    void* _userData;
+
+    Request _requests[E_HTTP_MAX_REQUESTS];
+    uint8_t _first;
+    uint8_t _numRequests;
+    uint8_t _numSent;
+    uint8_t _pipelineDepth;
+    Size _bodySent;
+    uint16_t _nextId;
+
+    State _state;
+    E_TICK_TYPE _tick;
+    uint32_t _keepAlive;
+    uint32_t _timeout;
+
+    ParseState _parseState;
+    char _line[E_HTTP_LINE_SIZE];
+    Size _lineFill;
+    uint16_t _status;
+    bool _chunked;
+    bool _keepConnection;
+    bool _hasLength;
+    uint32_t _remaining;
+};
+}
+
+#endif
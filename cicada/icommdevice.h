@@ -43,6 +43,15 @@ namespace Cicada {
 class ICommDevice
 {
   public:
+    /*!
+     * One piece of data for writeParts().
+     */
+    struct DataPart
+    {
+        const uint8_t* data;
+        Size size;
+    };
+
     virtual ~ICommDevice() {}
 
     /*!
@@ -96,6 +105,28 @@ class ICommDevice
      * \return Actual number of bytes copied into the transmit buffer.
      */
     virtual Size write(const uint8_t* data, Size size) = 0;
+
+    /*!
+     * Writes several pieces of data, like a header and a payload in
+     * different places, as if they were one block passed to write(). This
+     * saves assembling them in an extra buffer first. Devices which can copy
+     * the pieces straight into their send buffer override this method.
+     * \param parts Pieces of data to write, in this order
+     * \param count Number of pieces
+     * \return Actual number of bytes copied into the transmit buffer.
+     */
+    virtual Size writeParts(const DataPart* parts, uint8_t count)
+    {
+        Size written = 0;
+        for (uint8_t i = 0; i < count; i++) {
+            Size size = write(parts[i].data, parts[i].size);
+            written += size;
+            if (size < parts[i].size)
+                break;
+        }
+
+        return written;
+    }
 };
 
 }
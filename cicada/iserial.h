@@ -52,13 +52,35 @@ class ISerial
     virtual bool isOpen() = 0;
 
     /*!
-     * Sets the serial device parameters.
+     * Sets the serial device parameters. If the device is already open,
+     * the new parameters are applied immediately.
      * \param baudRate One of the valid serial baud rates
      * \param dataBits Bit depth, usually 5, 6, 7, or 8
      * \return true if configuration could be applied sucessfully, false otherwise
      */
     virtual bool setSerialConfig(uint32_t baudRate, uint8_t dataBits) = 0;
 
+    /*!
+     * Enables or disables hardware flow control (RTS/CTS). With flow control,
+     * data arriving while the read buffer is full are held back by the remote
+     * side instead of being dropped. The default implementation is for devices
+     * without flow control support.
+     * \param enabled true to enable flow control, false to disable it
+     * \return true if the setting could be applied, false otherwise
+     */
+    virtual bool setFlowControl(bool enabled)
+    {
+        return !enabled;
+    }
+
+    /*!
+     * \return true if hardware flow control is enabled, false otherwise
+     */
+    virtual bool flowControl() const
+    {
+        return false;
+    }
+
     /*!
      * Closes the device
      */
@@ -0,0 +1,84 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef ISPOOLSTORAGE_H
+#define ISPOOLSTORAGE_H
+
+#include "cicada/types.h"
+#include <stdint.h>
+
+namespace Cicada {
+
+/*!
+ * \class ISpoolStorage
+ *
+ * Storage for the records of MqttSpool, kept in the order they were
+ * appended. Records are read one after the other from the oldest one and
+ * removed from the oldest one once they have been delivered. Implementations
+ * must keep appending and removing in constant time and find their records
+ * again after a restart without reading all of them.
+ */
+class ISpoolStorage
+{
+  public:
+    virtual ~ISpoolStorage() {}
+
+    /*!
+     * Appends a record made of two parts, like a header and a payload.
+     * \param head First part of the record
+     * \param headSize Size of the first part
+     * \param data Second part of the record
+     * \param size Size of the second part
+     * \return true if the record was stored, false if there was no space
+     */
+    virtual bool append(const uint8_t* head, Size headSize, const uint8_t* data, Size size) = 0;
+
+    /*!
+     * Reads the record after the one read last, or the oldest one after
+     * rewind(). Records don't get removed by reading them.
+     * \param data Buffer to copy the record to
+     * \param maxSize Size of the buffer, the rest of larger records is skipped
+     * \return Number of bytes copied, 0 if there are no more records
+     */
+    virtual Size readNext(uint8_t* data, Size maxSize) = 0;
+
+    /*!
+     * Lets readNext() start over with the oldest record.
+     */
+    virtual void rewind() = 0;
+
+    /*!
+     * Removes the oldest record.
+     * \return false if there was no record
+     */
+    virtual bool remove() = 0;
+
+    /*!
+     * \return true if there are no records
+     */
+    virtual bool isEmpty() const = 0;
+};
+
+}
+
+#endif
@@ -90,6 +90,18 @@ class LineCircularBuffer : public CircularBuffer<char>
         return data;
     }
 
+    Size skip(Size num) override
+    {
+        if (num > CircularBuffer<char>::bytesAvailable())
+            num = CircularBuffer<char>::bytesAvailable();
+
+        for (Size i = 0; i < num; i++) {
+            pull();
+        }
+
+        return num;
+    }
+
     /*!
      * \return Number of lines currently in the buffer
      */
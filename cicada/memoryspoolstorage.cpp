@@ -0,0 +1,173 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "cicada/memoryspoolstorage.h"
+#include <cstring>
+
+using namespace Cicada;
+
+#define SPOOL_MAGIC 0x53504F4C
+#define SPOOL_MAGIC_OFFSET 0
+#define SPOOL_HEAD_OFFSET 4
+#define SPOOL_TAIL_OFFSET 8
+#define SPOOL_HEADER_SIZE 12
+#define SPOOL_LENGTH_SIZE 2
+
+MemorySpoolStorage::MemorySpoolStorage(uint8_t* memory, Size size) :
+    _memory(memory),
+    _ring(memory + SPOOL_HEADER_SIZE),
+    _capacity(size - SPOOL_HEADER_SIZE),
+    _head(0),
+    _tail(0),
+    _read(0)
+{
+    // Only the positions are checked, the records aren't read
+    _head = loadPosition(SPOOL_HEAD_OFFSET);
+    _tail = loadPosition(SPOOL_TAIL_OFFSET);
+    if (loadPosition(SPOOL_MAGIC_OFFSET) != SPOOL_MAGIC || _head >= _capacity
+        || _tail >= _capacity) {
+        clear();
+    }
+    _read = _head;
+}
+
+void MemorySpoolStorage::clear()
+{
+    _head = 0;
+    _tail = 0;
+    _read = 0;
+    storePosition(SPOOL_HEAD_OFFSET, 0);
+    storePosition(SPOOL_TAIL_OFFSET, 0);
+    storePosition(SPOOL_MAGIC_OFFSET, SPOOL_MAGIC);
+}
+
+bool MemorySpoolStorage::append(
+    const uint8_t* head, Size headSize, const uint8_t* data, Size size)
+{
+    Size length = headSize + size;
+    if (length == 0 || length > 0xFFFF)
+        return false;
+
+    // One byte stays free to tell a full ring from an empty one
+    if (used() + SPOOL_LENGTH_SIZE + length >= _capacity)
+        return false;
+
+    const uint8_t lengthBytes[SPOOL_LENGTH_SIZE] = { (uint8_t)(length >> 8), (uint8_t)length };
+    uint32_t position = copyIn(_tail, lengthBytes, SPOOL_LENGTH_SIZE);
+    position = copyIn(position, head, headSize);
+    position = copyIn(position, data, size);
+
+    // The record only counts once it's complete
+    _tail = position;
+    storePosition(SPOOL_TAIL_OFFSET, _tail);
+
+    return true;
+}
+
+Size MemorySpoolStorage::readNext(uint8_t* data, Size maxSize)
+{
+    if (_read == _tail)
+        return 0;
+
+    Size length = recordSize(_read);
+    Size size = length < maxSize ? length : maxSize;
+    copyOut(_read + SPOOL_LENGTH_SIZE, data, size);
+    _read = (_read + SPOOL_LENGTH_SIZE + length) % _capacity;
+
+    return size;
+}
+
+void MemorySpoolStorage::rewind()
+{
+    _read = _head;
+}
+
+bool MemorySpoolStorage::remove()
+{
+    if (_head == _tail)
+        return false;
+
+    bool reading = _read != _head;
+    _head = (_head + SPOOL_LENGTH_SIZE + recordSize(_head)) % _capacity;
+    storePosition(SPOOL_HEAD_OFFSET, _head);
+    if (!reading) {
+        _read = _head;
+    }
+
+    return true;
+}
+
+bool MemorySpoolStorage::isEmpty() const
+{
+    return _head == _tail;
+}
+
+uint32_t MemorySpoolStorage::loadPosition(Size offset) const
+{
+    uint32_t position;
+    memcpy(&position, _memory + offset, sizeof(position));
+
+    return position;
+}
+
+void MemorySpoolStorage::storePosition(Size offset, uint32_t position)
+{
+    memcpy(_memory + offset, &position, sizeof(position));
+}
+
+Size MemorySpoolStorage::used() const
+{
+    return _tail >= _head ? _tail - _head : _capacity - _head + _tail;
+}
+
+uint32_t MemorySpoolStorage::copyIn(uint32_t position, const uint8_t* data, Size size)
+{
+    // At most two pieces, before and after the end of the ring
+    Size first = _capacity - position;
+    if (first > size)
+        first = size;
+    memcpy(_ring + position, data, first);
+    memcpy(_ring, data + first, size - first);
+
+    return (position + size) % _capacity;
+}
+
+uint32_t MemorySpoolStorage::copyOut(uint32_t position, uint8_t* data, Size size) const
+{
+    position %= _capacity;
+    Size first = _capacity - position;
+    if (first > size)
+        first = size;
+    memcpy(data, _ring + position, first);
+    memcpy(data + first, _ring, size - first);
+
+    return (position + size) % _capacity;
+}
+
+Size MemorySpoolStorage::recordSize(uint32_t position) const
+{
+    uint8_t lengthBytes[SPOOL_LENGTH_SIZE];
+    copyOut(position, lengthBytes, SPOOL_LENGTH_SIZE);
+
+    return (lengthBytes[0] << 8) | lengthBytes[1];
+}
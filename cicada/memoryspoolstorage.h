@@ -0,0 +1,82 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef MEMORYSPOOLSTORAGE_H
+#define MEMORYSPOOLSTORAGE_H
+
+#include "cicada/ispoolstorage.h"
+
+namespace Cicada {
+
+/*!
+ * \class MemorySpoolStorage
+ *
+ * Spool storage in a ring of raw memory, for microcontrollers. The
+ * positions of the oldest and the newest record are kept at the start of
+ * the memory and updated after a record has been written, so a reset in
+ * between loses the record but nothing else. If the memory survives a
+ * reset, like battery backed or a RAM section which isn't initialized at
+ * startup, the records are found again right away.
+ */
+class MemorySpoolStorage : public ISpoolStorage
+{
+  public:
+    /*!
+     * Uses the records already in the memory if it has been used by a
+     * MemorySpoolStorage before, otherwise starts empty.
+     * \param memory Memory to store the records in, must be valid during the
+     * lifetime of the storage
+     * \param size Size of the memory, including 12 bytes for the positions
+     */
+    MemorySpoolStorage(uint8_t* memory, Size size);
+
+    /*!
+     * Removes all records.
+     */
+    void clear();
+
+    virtual bool append(const uint8_t* head, Size headSize, const uint8_t* data, Size size);
+    virtual Size readNext(uint8_t* data, Size maxSize);
+    virtual void rewind();
+    virtual bool remove();
+    virtual bool isEmpty() const;
+
+  private:
+    uint32_t loadPosition(Size offset) const;
+    void storePosition(Size offset, uint32_t position);
+    Size used() const;
+    uint32_t copyIn(uint32_t position, const uint8_t* data, Size size);
+    uint32_t copyOut(uint32_t position, uint8_t* data, Size size) const;
+    Size recordSize(uint32_t position) const;
+
+    uint8_t* _memory;
+    uint8_t* _ring;
+    Size _capacity;
+    uint32_t _head;
+    uint32_t _tail;
+    uint32_t _read;
+};
+
+}
+
+#endif
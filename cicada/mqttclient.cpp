@@ -0,0 +1,898 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "cicada/mqttclient.h"
+#include <cstring>
+
+using namespace Cicada;
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_PUBREC 0x50
+#define MQTT_PUBREL 0x60
+#define MQTT_PUBCOMP 0x70
+#define MQTT_SUBSCRIBE 0x80
+#define MQTT_SUBACK 0x90
+#define MQTT_UNSUBSCRIBE 0xA0
+#define MQTT_UNSUBACK 0xB0
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DISCONNECT 0xE0
+
+// SUBSCRIBE, UNSUBSCRIBE and PUBREL have a fixed flag in their first byte
+#define MQTT_FLAG_REQUIRED 0x02
+#define MQTT_PUBLISH_DUP 0x08
+#define MQTT_CONNECT_CLEAN_SESSION 0x02
+#define MQTT_CONNECT_PASSWORD 0x40
+#define MQTT_CONNECT_USERNAME 0x80
+#define MQTT_SUBACK_FAILURE 0x80
+
+#define MQTT_DEFAULT_PORT 1883
+#define MQTT_DEFAULT_KEEP_ALIVE 60
+#define MQTT_CONNECT_TIMEOUT 60000
+#define MQTT_RECONNECT_DELAY 5000
+
+static void addPart(ICommDevice::DataPart* parts, uint8_t& count, const void* data, Size size)
+{
+    parts[count].data = (const uint8_t*)data;
+    parts[count].size = size;
+    count++;
+}
+
+MqttClient::MqttClient(IIPCommDevice& device) :
+    _device(device),
+    _host(NULL),
+    _port(MQTT_DEFAULT_PORT),
+    _type(IIPCommDevice::TCP),
+    _clientId(NULL),
+    _username(NULL),
+    _password(NULL),
+    _keepAlive(MQTT_DEFAULT_KEEP_ALIVE),
+    _cleanSession(true),
+    _window(1),
+    _messageCallback(NULL),
+    _doneCallback(NULL),
+    _userData(NULL),
+    _wanted(false),
+    _state(idle),
+    _tick(0),
+    _sendTick(0),
+    _pingPending(false),
+    _first(0),
+    _numEntries(0),
+    _numSent(0),
+    _payloadSent(0),
+    _nextId(1),
+    _packetId(0),
+    _firstAck(0),
+    _numAcks(0),
+    _parseState(parseType),
+    _rxHeader(0),
+    _rxLength(0),
+    _rxShift(0),
+    _rxFill(0),
+    _topicLength(0),
+    _topicFill(0)
+{
+    _topic[0] = '\0';
+}
+
+void MqttClient::setBroker(const char* host, uint16_t port, IIPCommDevice::ConnectionType type)
+{
+    _host = host;
+    _port = port;
+    _type = type;
+}
+
+void MqttClient::setClientId(const char* clientId, const char* username, const char* password)
+{
+    _clientId = clientId;
+    _username = username;
+    _password = password;
+}
+
+void MqttClient::setSessionOptions(uint16_t keepAlive, bool cleanSession)
+{
+    _keepAlive = keepAlive;
+    _cleanSession = cleanSession;
+}
+
+void MqttClient::setInFlightWindow(uint8_t window)
+{
+    if (window == 0)
+        window = 1;
+    else if (window > E_MQTT_MAX_MESSAGES)
+        window = E_MQTT_MAX_MESSAGES;
+
+    _window = window;
+}
+
+void MqttClient::setCallbacks(
+    MessageCallback messageCallback, DoneCallback doneCallback, void* userData)
+{
+    _messageCallback = messageCallback;
+    _doneCallback = doneCallback;
+    _userData = userData;
+}
+
+void MqttClient::connect()
+{
+    if (!_wanted && _state == idle) {
+        // Connect right away the first time
+        _tick = lastRun() - MQTT_RECONNECT_DELAY;
+    }
+    _wanted = true;
+}
+
+void MqttClient::disconnect()
+{
+    _wanted = false;
+    bool canSend = _state == connected && _device.spaceAvailable() >= 2 && !payloadPending();
+    failAll();
+
+    if (canSend) {
+        writeShort(MQTT_DISCONNECT);
+        _state = closing;
+        _tick = lastRun();
+    } else if (_state != idle) {
+        _device.disconnect();
+        _state = disconnecting;
+    }
+}
+
+bool MqttClient::isConnected() const
+{
+    return _state == connected;
+}
+
+uint16_t MqttClient::publish(
+    const char* topic, const uint8_t* payload, Size size, uint8_t qos, bool retain)
+{
+    if (qos > 2)
+        return 0;
+
+    uint16_t id = queue(MQTT_PUBLISH, topic, qos);
+    if (id) {
+        Entry& e = entry(_numEntries - 1);
+        e.payload = payload;
+        e.size = size;
+        e.retain = retain;
+    }
+
+    return id;
+}
+
+uint16_t MqttClient::subscribe(const char* topic, uint8_t qos)
+{
+    return qos > 2 ? 0 : queue(MQTT_SUBSCRIBE, topic, qos);
+}
+
+uint16_t MqttClient::unsubscribe(const char* topic)
+{
+    return queue(MQTT_UNSUBSCRIBE, topic, 0);
+}
+
+uint8_t MqttClient::pendingRequests() const
+{
+    return _numEntries;
+}
+
+void MqttClient::run()
+{
+    switch (_state) {
+    case idle:
+        if (!_wanted || _host == NULL || _clientId == NULL)
+            break;
+
+        // Don't hammer a broker which refused the connection
+        if (lastRun() - _tick < MQTT_RECONNECT_DELAY)
+            break;
+
+        _device.setHostPort(_host, _port, _type);
+        if (_device.connect()) {
+            _tick = lastRun();
+            _state = connecting;
+        }
+        break;
+
+    case connecting:
+        if (_device.isConnected()) {
+            if (sendConnect()) {
+                _parseState = parseType;
+                _tick = lastRun();
+                _state = waitConnack;
+            }
+        } else if (lastRun() - _tick > MQTT_CONNECT_TIMEOUT) {
+            _device.disconnect();
+            _tick = lastRun();
+            _state = disconnecting;
+        }
+        break;
+
+    case waitConnack:
+    case connected: {
+        if (!_device.isConnected()) {
+            connectionLost();
+            break;
+        }
+
+        uint8_t buffer[E_MQTT_READ_CHUNK_SIZE];
+        Size size;
+        while ((_state == waitConnack || _state == connected)
+            && (size = _device.read(buffer, sizeof(buffer))) > 0) {
+            parse(buffer, size);
+        }
+
+        if (_state == waitConnack) {
+            if (lastRun() - _tick > MQTT_CONNECT_TIMEOUT) {
+                connectionLost();
+            }
+            break;
+        }
+        if (_state != connected)
+            break;
+
+        sendRequests();
+
+        // Without a reply to the ping, the connection is gone
+        uint32_t keepAlive = (uint32_t)_keepAlive * 1000;
+        if (_pingPending) {
+            if (lastRun() - _tick > keepAlive) {
+                connectionLost();
+            }
+        } else if (keepAlive && lastRun() - _sendTick >= keepAlive
+            && _device.spaceAvailable() >= 2 && !payloadPending()) {
+            writeShort(MQTT_PINGREQ);
+            _pingPending = true;
+            _tick = lastRun();
+        }
+        break;
+    }
+
+    case closing:
+        // Let DISCONNECT reach the broker first
+        if (_device.writeBufferProcessed() || lastRun() - _tick > MQTT_CONNECT_TIMEOUT) {
+            _device.disconnect();
+            _state = disconnecting;
+        }
+        break;
+
+    case disconnecting:
+        if (_device.isIdle()) {
+            _state = idle;
+        }
+        break;
+    }
+}
+
+uint16_t MqttClient::queue(uint8_t type, const char* topic, uint8_t qos)
+{
+    if (_numEntries == E_MQTT_MAX_MESSAGES || topic == NULL)
+        return 0;
+
+    Entry& e = entry(_numEntries++);
+    e.id = _nextId;
+    e.type = type;
+    e.topic = topic;
+    e.payload = NULL;
+    e.size = 0;
+    e.qos = qos;
+    e.retain = false;
+    e.packetId = 0;
+    e.dup = false;
+    e.state = queued;
+    e.success = false;
+
+    if (++_nextId == 0)
+        _nextId = 1;
+
+    return e.id;
+}
+
+MqttClient::Entry& MqttClient::entry(uint8_t index)
+{
+    return _entries[(_first + index) % E_MQTT_MAX_MESSAGES];
+}
+
+uint8_t MqttClient::inFlight() const
+{
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < _numSent; i++) {
+        EntryState state = _entries[(_first + i) % E_MQTT_MAX_MESSAGES].state;
+        if (state == sent || state == released)
+            count++;
+    }
+
+    return count;
+}
+
+uint16_t MqttClient::nextPacketId()
+{
+    // IDs of messages waiting to be sent again must not be reused
+    do {
+        if (++_packetId == 0)
+            _packetId = 1;
+    } while (packetIdInUse(_packetId));
+
+    return _packetId;
+}
+
+bool MqttClient::packetIdInUse(uint16_t packetId)
+{
+    for (uint8_t i = 0; i < _numEntries; i++) {
+        const Entry& e = entry(i);
+        if (e.packetId == packetId && e.state != finished)
+            return true;
+    }
+
+    return false;
+}
+
+uint32_t MqttClient::packetLength(const Entry& entry) const
+{
+    uint32_t length = 2 + strlen(entry.topic);
+
+    switch (entry.type) {
+    case MQTT_PUBLISH:
+        return length + (entry.qos ? 2 : 0) + entry.size;
+    case MQTT_SUBSCRIBE:
+        return length + 3;
+    default:
+        return length + 2;
+    }
+}
+
+uint8_t MqttClient::encodeHeader(uint8_t* bytes, uint8_t header, uint32_t length)
+{
+    // The remaining length is encoded with 7 bits per byte
+    uint8_t count = 0;
+    bytes[count++] = header;
+    do {
+        uint8_t digit = length & 0x7F;
+        length >>= 7;
+        bytes[count++] = length ? digit | 0x80 : digit;
+    } while (length);
+
+    return count;
+}
+
+uint8_t MqttClient::encodeUint16(uint8_t* bytes, uint16_t value)
+{
+    bytes[0] = value >> 8;
+    bytes[1] = value;
+
+    return 2;
+}
+
+Size MqttClient::writeParts(const ICommDevice::DataPart* parts, uint8_t count)
+{
+    _sendTick = lastRun();
+    return _device.writeParts(parts, count);
+}
+
+void MqttClient::writeShort(uint8_t header, uint16_t packetId)
+{
+    // PINGREQ and DISCONNECT have no packet ID, acknowledgements nothing else
+    uint8_t bytes[4] = { header, 0 };
+    Size size = 2;
+    if (packetId) {
+        bytes[1] = 2;
+        size += encodeUint16(bytes + 2, packetId);
+    }
+
+    _device.write(bytes, size);
+    _sendTick = lastRun();
+}
+
+bool MqttClient::sendConnect()
+{
+    uint16_t clientIdLength = strlen(_clientId);
+    uint16_t usernameLength = _username ? strlen(_username) : 0;
+    uint16_t passwordLength = _password ? strlen(_password) : 0;
+    uint32_t length = 10 + 2 + clientIdLength;
+    uint8_t flags = _cleanSession ? MQTT_CONNECT_CLEAN_SESSION : 0;
+    if (_username) {
+        length += 2 + usernameLength;
+        flags |= MQTT_CONNECT_USERNAME;
+    }
+    if (_password) {
+        length += 2 + passwordLength;
+        flags |= MQTT_CONNECT_PASSWORD;
+    }
+
+    if (_device.spaceAvailable() < length + 5)
+        return false;
+
+    // The strings are copied into the write buffer straight from where they are
+    const uint8_t variableHeader[] = { 0, 4, 'M', 'Q', 'T', 'T', 4, flags };
+    uint8_t head[5 + sizeof(variableHeader) + 4];
+    uint8_t size = encodeHeader(head, MQTT_CONNECT, length);
+    memcpy(head + size, variableHeader, sizeof(variableHeader));
+    size += sizeof(variableHeader);
+    size += encodeUint16(head + size, _keepAlive);
+    size += encodeUint16(head + size, clientIdLength);
+
+    uint8_t usernameHead[2];
+    uint8_t passwordHead[2];
+    ICommDevice::DataPart parts[6];
+    uint8_t count = 0;
+    addPart(parts, count, head, size);
+    addPart(parts, count, _clientId, clientIdLength);
+    if (_username) {
+        addPart(parts, count, usernameHead, encodeUint16(usernameHead, usernameLength));
+        addPart(parts, count, _username, usernameLength);
+    }
+    if (_password) {
+        addPart(parts, count, passwordHead, encodeUint16(passwordHead, passwordLength));
+        addPart(parts, count, _password, passwordLength);
+    }
+    writeParts(parts, count);
+
+    return true;
+}
+
+bool MqttClient::sendEntry(Entry& entry)
+{
+    // The payload may follow in pieces, everything else is written at once
+    uint32_t length = packetLength(entry);
+    uint32_t headerLength = length - entry.size + 5;
+    if (_device.spaceAvailable() < headerLength)
+        return false;
+
+    // A message sent again keeps its packet ID
+    if (!entry.dup && (entry.type != MQTT_PUBLISH || entry.qos)) {
+        entry.packetId = nextPacketId();
+    }
+
+    // Topic and payload are copied into the write buffer without being
+    // assembled into a packet first, only the fields around them are encoded
+    uint16_t topicLength = strlen(entry.topic);
+    uint8_t head[5 + 2 + 2];
+    uint8_t packetId[2];
+    ICommDevice::DataPart parts[4];
+    uint8_t count = 0;
+    uint8_t size;
+
+    switch (entry.type) {
+    case MQTT_PUBLISH: {
+        uint8_t header = MQTT_PUBLISH | (entry.dup ? MQTT_PUBLISH_DUP : 0) | (entry.qos << 1)
+            | (entry.retain ? 1 : 0);
+        size = encodeHeader(head, header, length);
+        size += encodeUint16(head + size, topicLength);
+        addPart(parts, count, head, size);
+        addPart(parts, count, entry.topic, topicLength);
+        if (entry.qos) {
+            addPart(parts, count, packetId, encodeUint16(packetId, entry.packetId));
+        }
+        addPart(parts, count, entry.payload, entry.size);
+        Size written = writeParts(parts, count);
+        Size headSize = size + topicLength + (entry.qos ? 2 : 0);
+        _payloadSent = written > headSize ? written - headSize : 0;
+        break;
+    }
+
+    case MQTT_SUBSCRIBE:
+        size = encodeHeader(head, MQTT_SUBSCRIBE | MQTT_FLAG_REQUIRED, length);
+        size += encodeUint16(head + size, entry.packetId);
+        size += encodeUint16(head + size, topicLength);
+        addPart(parts, count, head, size);
+        addPart(parts, count, entry.topic, topicLength);
+        addPart(parts, count, &entry.qos, 1);
+        writeParts(parts, count);
+        _payloadSent = 0;
+        break;
+
+    default:
+        size = encodeHeader(head, MQTT_UNSUBSCRIBE | MQTT_FLAG_REQUIRED, length);
+        size += encodeUint16(head + size, entry.packetId);
+        size += encodeUint16(head + size, topicLength);
+        addPart(parts, count, head, size);
+        addPart(parts, count, entry.topic, topicLength);
+        writeParts(parts, count);
+        _payloadSent = 0;
+        break;
+    }
+
+    entry.state = sent;
+    return true;
+}
+
+bool MqttClient::sendRelease(const Entry& entry)
+{
+    if (_device.spaceAvailable() < 4)
+        return false;
+
+    writeShort(MQTT_PUBREL | MQTT_FLAG_REQUIRED, entry.packetId);
+    return true;
+}
+
+bool MqttClient::payloadPending()
+{
+    if (_numSent == 0)
+        return false;
+
+    const Entry& last = entry(_numSent - 1);
+    return last.type == MQTT_PUBLISH && _payloadSent < last.size;
+}
+
+bool MqttClient::sendAcks()
+{
+    while (_numAcks) {
+        if (_device.spaceAvailable() < 4)
+            return false;
+
+        const Ack& ack = _acks[_firstAck];
+        writeShort(ack.header, ack.packetId);
+        _firstAck = (_firstAck + 1) % E_MQTT_MAX_ACKS;
+        _numAcks--;
+    }
+
+    return true;
+}
+
+void MqttClient::sendRequests()
+{
+    // The rest of a large payload comes first, no other packet may go in between
+    if (_numSent) {
+        Entry& last = entry(_numSent - 1);
+        if (payloadPending()) {
+            _payloadSent += _device.write(last.payload + _payloadSent, last.size - _payloadSent);
+            if (_payloadSent < last.size)
+                return;
+
+            _sendTick = lastRun();
+            if (last.qos == 0) {
+                finishEntry(last, true);
+            }
+        }
+    }
+
+    if (sendAcks()) {
+        while (_numSent < _numEntries) {
+            Entry& next = entry(_numSent);
+
+            // Acknowledged before the connection was lost
+            if (next.state == finished) {
+                _numSent++;
+                continue;
+            }
+
+            bool acknowledged = next.type != MQTT_PUBLISH || next.qos;
+            if (acknowledged && inFlight() >= _window)
+                break;
+
+            // The broker got the message, but maybe not PUBREL
+            if (next.state == released) {
+                if (!sendRelease(next))
+                    break;
+                _numSent++;
+                continue;
+            }
+
+            if (!sendEntry(next))
+                break;
+            _numSent++;
+
+            if (payloadPending())
+                break;
+            if (!acknowledged) {
+                finishEntry(next, true);
+            }
+        }
+    }
+
+    popFinished();
+}
+
+void MqttClient::queueAck(uint8_t header, uint16_t packetId)
+{
+    // Without space, the broker sends its packet again later
+    if (_numAcks == E_MQTT_MAX_ACKS)
+        return;
+
+    Ack& ack = _acks[(_firstAck + _numAcks++) % E_MQTT_MAX_ACKS];
+    ack.header = header;
+    ack.packetId = packetId;
+}
+
+void MqttClient::parse(const uint8_t* data, Size size)
+{
+    Size pos = 0;
+    while (pos < size && (_state == waitConnack || _state == connected)) {
+        if (_parseState == parsePayload) {
+            Size length = size - pos;
+            if (length > _rxLength)
+                length = _rxLength;
+            _rxLength -= length;
+
+            if (_messageCallback) {
+                _messageCallback(_topic, data + pos, length, _rxLength == 0, _userData);
+            }
+            pos += length;
+
+            if (_rxLength == 0) {
+                handlePacket();
+            }
+            continue;
+        }
+
+        uint8_t c = data[pos++];
+        switch (_parseState) {
+        case parseType:
+            _rxHeader = c;
+            _rxLength = 0;
+            _rxShift = 0;
+            _parseState = parseLength;
+            break;
+
+        case parseLength:
+            _rxLength |= (uint32_t)(c & 0x7F) << _rxShift;
+            _rxShift += 7;
+            if (!(c & 0x80)) {
+                beginPacket();
+            } else if (_rxShift > 21) {
+                connectionLost();
+                return;
+            }
+            break;
+
+        case parseTopicLength:
+            _topicLength = (_topicLength << 8) | c;
+            _rxLength--;
+            if (++_rxFill == 2) {
+                _rxFill = 0;
+                _topicFill = 0;
+                _topic[0] = '\0';
+                if (_topicLength > _rxLength) {
+                    connectionLost();
+                    return;
+                }
+                if (_topicLength) {
+                    _parseState = parseTopic;
+                } else {
+                    beginPayload();
+                }
+            }
+            break;
+
+        case parseTopic:
+            // Long topics are cut off
+            if (_topicFill < E_MQTT_TOPIC_SIZE - 1) {
+                _topic[_topicFill++] = c;
+                _topic[_topicFill] = '\0';
+            }
+            _rxLength--;
+            if (--_topicLength == 0) {
+                beginPayload();
+            }
+            break;
+
+        case parsePacketId:
+        case parseBody:
+            if (_rxFill < sizeof(_rxBody)) {
+                _rxBody[_rxFill++] = c;
+            }
+            if (--_rxLength == 0) {
+                if (_parseState == parsePacketId) {
+                    beginPayload();
+                } else {
+                    handlePacket();
+                }
+            } else if (_parseState == parsePacketId && _rxFill == 2) {
+                _parseState = parsePayload;
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+void MqttClient::beginPacket()
+{
+    _rxFill = 0;
+
+    if ((_rxHeader & 0xF0) == MQTT_PUBLISH) {
+        if (_rxLength < 2) {
+            connectionLost();
+            return;
+        }
+        _topicLength = 0;
+        _parseState = parseTopicLength;
+    } else if (_rxLength == 0) {
+        handlePacket();
+    } else {
+        _parseState = parseBody;
+    }
+}
+
+void MqttClient::beginPayload()
+{
+    // The packet ID comes before the payload with QoS 1 and 2
+    if ((_rxHeader & 0x06) && _parseState != parsePacketId) {
+        if (_rxLength < 2) {
+            connectionLost();
+            return;
+        }
+        _parseState = parsePacketId;
+        return;
+    }
+
+    if (_rxLength) {
+        _parseState = parsePayload;
+        return;
+    }
+
+    if (_messageCallback) {
+        _messageCallback(_topic, NULL, 0, true, _userData);
+    }
+    handlePacket();
+}
+
+void MqttClient::handlePacket()
+{
+    _parseState = parseType;
+    uint16_t packetId = _rxFill >= 2 ? (_rxBody[0] << 8) | _rxBody[1] : 0;
+
+    switch (_rxHeader & 0xF0) {
+    case MQTT_CONNACK:
+        if (_state != waitConnack)
+            break;
+
+        if (_rxFill >= 2 && _rxBody[1] == 0) {
+            _state = connected;
+            _pingPending = false;
+            _sendTick = lastRun();
+        } else {
+            // Refused, try again later
+            connectionLost();
+        }
+        break;
+
+    case MQTT_PUBLISH: {
+        // QoS 2 messages are passed on when they arrive, a copy sent again
+        // before PUBREL would be passed on twice
+        uint8_t qos = (_rxHeader >> 1) & 0x03;
+        if (qos == 1) {
+            queueAck(MQTT_PUBACK, packetId);
+        } else if (qos == 2) {
+            queueAck(MQTT_PUBREC, packetId);
+        }
+        break;
+    }
+
+    case MQTT_PUBREL:
+        queueAck(MQTT_PUBCOMP, packetId);
+        break;
+
+    case MQTT_PINGRESP:
+        _pingPending = false;
+        break;
+
+    case MQTT_PUBACK:
+    case MQTT_PUBREC:
+    case MQTT_PUBCOMP:
+    case MQTT_SUBACK:
+    case MQTT_UNSUBACK:
+        acknowledge(_rxHeader & 0xF0, packetId);
+        break;
+    }
+}
+
+void MqttClient::acknowledge(uint8_t type, uint16_t packetId)
+{
+    for (uint8_t i = 0; i < _numSent; i++) {
+        Entry& e = entry(i);
+        if (e.packetId != packetId || (e.state != sent && e.state != released))
+            continue;
+
+        if (type == MQTT_PUBACK && e.type == MQTT_PUBLISH && e.qos == 1) {
+            finishEntry(e, true);
+        } else if (type == MQTT_PUBREC && e.type == MQTT_PUBLISH && e.qos == 2) {
+            e.state = released;
+            queueAck(MQTT_PUBREL | MQTT_FLAG_REQUIRED, packetId);
+        } else if (type == MQTT_PUBCOMP && e.state == released) {
+            finishEntry(e, true);
+        } else if (type == MQTT_SUBACK && e.type == MQTT_SUBSCRIBE) {
+            finishEntry(e, _rxFill >= 3 && _rxBody[2] != MQTT_SUBACK_FAILURE);
+        } else if (type == MQTT_UNSUBACK && e.type == MQTT_UNSUBSCRIBE) {
+            finishEntry(e, true);
+        }
+        break;
+    }
+
+    popFinished();
+}
+
+void MqttClient::finishEntry(Entry& entry, bool success)
+{
+    entry.state = finished;
+    entry.success = success;
+}
+
+void MqttClient::popFinished()
+{
+    // Completion is reported in order, even if acknowledgements are not
+    while (_numEntries && entry(0).state == finished) {
+        uint16_t id = entry(0).id;
+        bool success = entry(0).success;
+        _first = (_first + 1) % E_MQTT_MAX_MESSAGES;
+        _numEntries--;
+        if (_numSent)
+            _numSent--;
+
+        if (_doneCallback) {
+            _doneCallback(id, success, _userData);
+        }
+    }
+}
+
+void MqttClient::connectionLost()
+{
+    // Requests waiting for the broker fail, queued ones are sent after
+    // reconnecting. A persistent session lets the broker recognize messages
+    // sent again, so they are kept.
+    for (uint8_t i = 0; i < _numSent; i++) {
+        Entry& e = entry(i);
+        if (e.state == finished)
+            continue;
+
+        if (_cleanSession || (e.type == MQTT_PUBLISH && e.qos == 0)) {
+            finishEntry(e, false);
+        } else if (e.type == MQTT_PUBLISH) {
+            if (e.state == sent) {
+                e.dup = true;
+                e.state = queued;
+            }
+        } else {
+            e.packetId = 0;
+            e.state = queued;
+        }
+    }
+    popFinished();
+
+    _numSent = 0;
+    _payloadSent = 0;
+    _numAcks = 0;
+    _pingPending = false;
+    _parseState = parseType;
+
+    _device.disconnect();
+    _tick = lastRun();
+    _state = disconnecting;
+}
+
+void MqttClient::failAll()
+{
+    for (uint8_t i = 0; i < _numEntries; i++) {
+        finishEntry(entry(i), false);
+    }
+    popFinished();
+
+    _numSent = 0;
+    _payloadSent = 0;
+    _numAcks = 0;
+}
@@ -0,0 +1,294 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef MQTTCLIENT_H
+#define MQTTCLIENT_H
+
+#include "cicada/commdevices/iipcommdevice.h"
+#include "cicada/defines.h"
+#include "cicada/task.h"
+#include <cstddef>
+#include <stdint.h>
+
+#ifndef E_MQTT_MAX_MESSAGES
+#define E_MQTT_MAX_MESSAGES 8
+#endif
+
+#ifndef E_MQTT_MAX_ACKS
+#define E_MQTT_MAX_ACKS 8
+#endif
+
+#ifndef E_MQTT_TOPIC_SIZE
+#define E_MQTT_TOPIC_SIZE 64
+#endif
+
+#ifndef E_MQTT_READ_CHUNK_SIZE
+#define E_MQTT_READ_CHUNK_SIZE 64
+#endif
+
+namespace Cicada {
+
+/*!
+ * \class MqttClient
+ *
+ * Non-blocking MQTT 3.1.1 client running on any IIPCommDevice. It's a Task
+ * which needs to be called by the Scheduler like the one of the device, no
+ * blocking wrapper like BlockingCommDevice is needed.
+ *
+ * Publish, subscribe and unsubscribe requests are queued and encoded into
+ * the write buffer of the device as space becomes available, payloads
+ * larger than the write buffer are written in pieces. Their completion is
+ * reported in the order they were queued, even if the broker acknowledges
+ * them in a different order. Up to setInFlightWindow() acknowledged requests
+ * are sent without waiting for the broker, which keeps a link with a long
+ * round trip time busy. Received packets are parsed as
+ * they arrive, the payload of a message is passed on in pieces without
+ * being buffered. Keep alive pings are sent when nothing else has been
+ * sent for the keep alive interval.
+ *
+ * The client connects with connect() and reconnects when the connection is
+ * lost. Requests queued while not connected are sent after connecting. With
+ * a persistent session, messages the broker hasn't acknowledged are sent
+ * again with the DUP flag after reconnecting, otherwise they fail.
+ */
+class MqttClient : public Task
+{
+  public:
+    /*!
+     * Called with the next piece of a received message.
+     * \param topic Topic of the message, cut off at E_MQTT_TOPIC_SIZE - 1
+     * \param data Payload data, only valid during the call
+     * \param size Number of bytes
+     * \param last true for the last piece of the message
+     * \param userData Pointer passed to setCallbacks()
+     */
+    typedef void (*MessageCallback)(
+        const char* topic, const uint8_t* data, Size size, bool last, void* userData);
+
+    /*!
+     * Called when a request is finished, in the order the requests were queued.
+     * \param id Request ID returned by publish(), subscribe() or unsubscribe()
+     * \param success true if the broker acknowledged the request, or for
+     * QoS 0 messages, if it has been sent
+     * \param userData Pointer passed to setCallbacks()
+     */
+    typedef void (*DoneCallback)(uint16_t id, bool success, void* userData);
+
+    /*!
+     * \param device Device to connect with. The client controls connect() and
+     * disconnect() of the device, it must not be used for anything else.
+     */
+    MqttClient(IIPCommDevice& device);
+
+    /*!
+     * \param host Host name of the broker, needs to be valid during the
+     * lifetime of the client, like the other strings
+     * \param port Port of the broker
+     * \param type TCP, or SSL for MQTT over TLS
+     */
+    void setBroker(const char* host, uint16_t port = 1883,
+        IIPCommDevice::ConnectionType type = IIPCommDevice::TCP);
+
+    /*!
+     * \param clientId Client identifier
+     * \param username User name, NULL for none
+     * \param password Password, NULL for none
+     */
+    void setClientId(const char* clientId, const char* username = NULL, const char* password = NULL);
+
+    /*!
+     * \param keepAlive Keep alive interval in seconds, 0 to disable pings
+     * \param cleanSession true to start a new session on each connection
+     */
+    void setSessionOptions(uint16_t keepAlive, bool cleanSession = true);
+
+    /*!
+     * Sets the number of requests which may wait for their acknowledgement at
+     * the same time. QoS 0 messages don't count. The default of 1 waits for
+     * each acknowledgement before sending the next request.
+     * \param window Number of requests, 1 to E_MQTT_MAX_MESSAGES
+     */
+    void setInFlightWindow(uint8_t window);
+
+    void setCallbacks(
+        MessageCallback messageCallback, DoneCallback doneCallback, void* userData = NULL);
+
+    /*!
+     * Connects to the broker, and again whenever the connection is lost.
+     */
+    void connect();
+
+    /*!
+     * Disconnects from the broker. Unfinished requests fail.
+     */
+    void disconnect();
+
+    /*!
+     * \return true if the broker accepted the connection
+     */
+    bool isConnected() const;
+
+    /*!
+     * Queues a message.
+     * \param topic Topic to publish to
+     * \param payload Payload of the message
+     * \param size Size of the payload
+     * \param qos Quality of service, 0 to 2
+     * \param retain true if the broker should retain the message
+     * \return Request ID passed to the done callback, 0 if the queue is full.
+     * Topic and payload need to be valid until then.
+     */
+    uint16_t publish(const char* topic, const uint8_t* payload, Size size, uint8_t qos = 0,
+        bool retain = false);
+
+    /*!
+     * Queues a subscription.
+     * \return Request ID passed to the done callback, 0 if the queue is full
+     */
+    uint16_t subscribe(const char* topic, uint8_t qos = 0);
+
+    /*!
+     * Queues the removal of a subscription.
+     * \return Request ID passed to the done callback, 0 if the queue is full
+     */
+    uint16_t unsubscribe(const char* topic);
+
+    /*!
+     * \return Number of requests which aren't finished yet
+     */
+    uint8_t pendingRequests() const;
+
+    /*!
+     * Connects, sends the queued requests and parses received packets.
+     */
+    virtual void run();
+
+  private:
+    enum State { idle, connecting, waitConnack, connected, closing, disconnecting };
+
+    enum ParseState {
+        parseType,
+        parseLength,
+        parseTopicLength,
+        parseTopic,
+        parsePacketId,
+        parsePayload,
+        parseBody
+    };
+
+    enum EntryState { queued, sent, released, finished };
+
+    struct Entry
+    {
+        uint16_t id;
+        uint8_t type;
+        const char* topic;
+        const uint8_t* payload;
+        Size size;
+        uint8_t qos;
+        bool retain;
+        uint16_t packetId;
+        bool dup;
+        EntryState state;
+        bool success;
+    };
+
+    struct Ack
+    {
+        uint8_t header;
+        uint16_t packetId;
+    };
+
+    uint16_t queue(uint8_t type, const char* topic, uint8_t qos);
+    Entry& entry(uint8_t index);
+    uint8_t inFlight() const;
+    uint16_t nextPacketId();
+    bool packetIdInUse(uint16_t packetId);
+    uint32_t packetLength(const Entry& entry) const;
+    uint8_t encodeHeader(uint8_t* bytes, uint8_t header, uint32_t length);
+    uint8_t encodeUint16(uint8_t* bytes, uint16_t value);
+    Size writeParts(const ICommDevice::DataPart* parts, uint8_t count);
+    void writeShort(uint8_t header, uint16_t packetId = 0);
+    bool sendConnect();
+    bool sendEntry(Entry& entry);
+    bool sendRelease(const Entry& entry);
+    bool payloadPending();
+    bool sendAcks();
+    void sendRequests();
+    void queueAck(uint8_t header, uint16_t packetId);
+    void parse(const uint8_t* data, Size size);
+    void beginPacket();
+    void beginPayload();
+    void handlePacket();
+    void acknowledge(uint8_t type, uint16_t packetId);
+    void finishEntry(Entry& entry, bool success);
+    void popFinished();
+    void connectionLost();
+    void failAll();
+
+    IIPCommDevice& _device;
+    const char* _host;
+    uint16_t _port;
+    IIPCommDevice::ConnectionType _type;
+    const char* _clientId;
+    const char* _username;
+    const char* _password;
+    uint16_t _keepAlive;
+    bool _cleanSession;
+    uint8_t _window;
+
+    MessageCallback _messageCallback;
+    DoneCallback _doneCallback;
+    void* _userData;
+
+    bool _wanted;
+    State _state;
+    E_TICK_TYPE _tick;
+    E_TICK_TYPE _sendTick;
+    bool _pingPending;
+
+    Entry _entries[E_MQTT_MAX_MESSAGES];
+    uint8_t _first;
+    uint8_t _numEntries;
+    uint8_t _numSent;
+    Size _payloadSent;
+    uint16_t _nextId;
+    uint16_t _packetId;
+
+    Ack _acks[E_MQTT_MAX_ACKS];
+    uint8_t _firstAck;
+    uint8_t _numAcks;
+
+    ParseState _parseState;
+    uint8_t _rxHeader;
+    uint32_t _rxLength;
+    uint8_t _rxShift;
+    uint8_t _rxBody[4];
+    uint8_t _rxFill;
+    uint16_t _topicLength;
+    char _topic[E_MQTT_TOPIC_SIZE];
+    uint16_t _topicFill;
+};
+}
+
+#endif
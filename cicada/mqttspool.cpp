@@ -0,0 +1,149 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "cicada/mqttspool.h"
+#include <cstring>
+
+using namespace Cicada;
+
+// Each record holds the flags, the topic with its terminating zero and the payload
+#define SPOOL_FLAG_RETAIN 0x04
+#define SPOOL_QOS_MASK 0x03
+
+MqttSpool::MqttSpool(MqttClient& client, ISpoolStorage& storage) :
+    _client(client), _storage(storage), _first(0), _numSlots(0), _nextLoaded(false), _rewind(false)
+{}
+
+bool MqttSpool::publish(
+    const char* topic, const uint8_t* payload, Size size, uint8_t qos, bool retain)
+{
+    Size topicLength = strlen(topic);
+    if (qos > 2 || topicLength >= E_MQTT_TOPIC_SIZE
+        || 1 + topicLength + 1 + size > E_SPOOL_RECORD_SIZE)
+        return false;
+
+    uint8_t head[1 + E_MQTT_TOPIC_SIZE];
+    head[0] = qos | (retain ? SPOOL_FLAG_RETAIN : 0);
+    memcpy(head + 1, topic, topicLength + 1);
+
+    return _storage.append(head, 1 + topicLength + 1, payload, size);
+}
+
+bool MqttSpool::requestDone(uint16_t id, bool success)
+{
+    uint8_t i;
+    for (i = 0; i < _numSlots; i++) {
+        if (slot(i).id == id && !slot(i).done)
+            break;
+    }
+    if (i == _numSlots)
+        return false;
+
+    slot(i).done = true;
+    slot(i).success = success;
+    popDone();
+
+    return true;
+}
+
+void MqttSpool::popDone()
+{
+    // The client finishes requests in order, so do the records
+    while (_numSlots && slot(0).done) {
+        if (slot(0).success && !_rewind) {
+            _storage.remove();
+        } else {
+            _rewind = true;
+        }
+        _first = (_first + 1) % E_SPOOL_SLOTS;
+        _numSlots--;
+    }
+}
+
+uint8_t MqttSpool::messagesInFlight() const
+{
+    return _numSlots;
+}
+
+void MqttSpool::run()
+{
+    // After a failure, all messages from the failed one on are sent again
+    if (_rewind) {
+        if (_numSlots)
+            return;
+
+        _storage.rewind();
+        _nextLoaded = false;
+        _rewind = false;
+    }
+
+    while (_client.isConnected() && _numSlots < E_SPOOL_SLOTS) {
+        Slot& next = slot(_numSlots);
+        if (!_nextLoaded) {
+            next.size = _storage.readNext(next.data, sizeof(next.data));
+            if (next.size == 0)
+                break;
+            _nextLoaded = true;
+        }
+
+        // The record stays loaded while the queue of the client is full
+        if (!publishSlot(next))
+            break;
+        _nextLoaded = false;
+        _numSlots++;
+    }
+    popDone();
+}
+
+MqttSpool::Slot& MqttSpool::slot(uint8_t index)
+{
+    return _slots[(_first + index) % E_SPOOL_SLOTS];
+}
+
+bool MqttSpool::publishSlot(Slot& slot)
+{
+    // Not a record of the spool, it's removed in turn without being sent
+    const uint8_t* end = slot.size > 1 ? (const uint8_t*)memchr(slot.data + 1, 0, slot.size - 1)
+                                       : NULL;
+    if (end == NULL) {
+        slot.id = 0;
+        slot.done = true;
+        slot.success = true;
+        return true;
+    }
+
+    // The client reads topic and payload straight from the slot
+    const char* topic = (const char*)slot.data + 1;
+    const uint8_t* payload = end + 1;
+    Size size = slot.data + slot.size - payload;
+    uint16_t id = _client.publish(topic, payload, size, slot.data[0] & SPOOL_QOS_MASK,
+        slot.data[0] & SPOOL_FLAG_RETAIN);
+    if (id == 0)
+        return false;
+
+    slot.id = id;
+    slot.done = false;
+    slot.success = false;
+
+    return true;
+}
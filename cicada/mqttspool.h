@@ -0,0 +1,122 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef MQTTSPOOL_H
+#define MQTTSPOOL_H
+
+#include "cicada/ispoolstorage.h"
+#include "cicada/mqttclient.h"
+#include "cicada/task.h"
+
+#ifndef E_SPOOL_SLOTS
+#define E_SPOOL_SLOTS 4
+#endif
+
+#ifndef E_SPOOL_RECORD_SIZE
+#define E_SPOOL_RECORD_SIZE 256
+#endif
+
+namespace Cicada {
+
+/*!
+ * \class MqttSpool
+ *
+ * Store and forward for messages published with a MqttClient. Messages are
+ * appended to an ISpoolStorage right away, whether the client is connected
+ * or not, and passed to the client from there while it's connected. A
+ * message is removed from the storage once the client reports it as done,
+ * so messages survive connection losses and, with a storage which keeps
+ * its contents, restarts.
+ *
+ * Up to E_SPOOL_SLOTS messages are read into RAM and handed to the client
+ * at the same time. To send them without waiting for each acknowledgement,
+ * the in-flight window of the client should be as large. If the client
+ * reports a message as failed, all messages from that one on are sent
+ * again, so a message can be delivered twice, like with QoS 1.
+ */
+class MqttSpool : public Task
+{
+  public:
+    /*!
+     * \param client Client to publish the messages with
+     * \param storage Storage for the messages
+     */
+    MqttSpool(MqttClient& client, ISpoolStorage& storage);
+
+    /*!
+     * Appends a message to the storage. The data is copied, unlike with
+     * MqttClient::publish().
+     * \param topic Topic to publish to
+     * \param payload Payload of the message
+     * \param size Size of the payload
+     * \param qos Quality of service, 0 to 2
+     * \param retain true if the broker should retain the message
+     * \return false if the message is larger than E_SPOOL_RECORD_SIZE
+     * together with its topic, or the storage is full
+     */
+    bool publish(const char* topic, const uint8_t* payload, Size size, uint8_t qos = 1,
+        bool retain = false);
+
+    /*!
+     * Needs to be called from the done callback of the client.
+     * \param id Request ID passed to the done callback
+     * \param success Result passed to the done callback
+     * \return true if the request was a message of the spool
+     */
+    bool requestDone(uint16_t id, bool success);
+
+    /*!
+     * \return Number of messages handed to the client and not done yet
+     */
+    uint8_t messagesInFlight() const;
+
+    /*!
+     * Hands stored messages to the client while it's connected.
+     */
+    virtual void run();
+
+  private:
+    struct Slot
+    {
+        uint8_t data[E_SPOOL_RECORD_SIZE];
+        Size size;
+        uint16_t id;
+        bool done;
+        bool success;
+    };
+
+    Slot& slot(uint8_t index);
+    bool publishSlot(Slot& slot);
+    void popDone();
+
+    MqttClient& _client;
+    ISpoolStorage& _storage;
+    Slot _slots[E_SPOOL_SLOTS];
+    uint8_t _first;
+    uint8_t _numSlots;
+    bool _nextLoaded;
+    bool _rewind;
+};
+}
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "filespoolstorage.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace Cicada;
+
+#define SPOOL_SEGMENT_SUFFIX ".seg"
+#define SPOOL_STATE_FILE "head"
+#define SPOOL_LENGTH_SIZE 2
+
+FileSpoolStorage::FileSpoolStorage(const char* directory, Size segmentSize, uint32_t maxSegments) :
+    _directory(directory),
+    _segmentSize(segmentSize),
+    _maxSegments(maxSegments),
+    _stateFd(-1),
+    _tailFd(-1),
+    _readFd(-1),
+    _readFdSegment(0),
+    _headSegment(0),
+    _headOffset(0),
+    _tailSegment(0),
+    _tailOffset(0),
+    _readSegment(0),
+    _readOffset(0)
+{}
+
+FileSpoolStorage::~FileSpoolStorage()
+{
+    close();
+}
+
+bool FileSpoolStorage::open()
+{
+    close();
+    mkdir(_directory, 0755);
+
+    // Only the names of the segments are needed, not their contents
+    DIR* dir = opendir(_directory);
+    if (dir == NULL)
+        return false;
+
+    bool found = false;
+    uint32_t first = 0;
+    uint32_t last = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char* end;
+        uint32_t segment = strtoul(entry->d_name, &end, 16);
+        if (end == entry->d_name || strcmp(end, SPOOL_SEGMENT_SUFFIX) != 0)
+            continue;
+
+        if (!found || segment < first)
+            first = segment;
+        if (!found || segment > last)
+            last = segment;
+        found = true;
+    }
+    closedir(dir);
+
+    char path[E_SPOOL_PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/" SPOOL_STATE_FILE, _directory);
+    _stateFd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (_stateFd == -1)
+        return false;
+
+    _tailSegment = last;
+    _tailFd = openSegment(_tailSegment, O_WRONLY | O_CREAT | O_APPEND);
+    struct stat status;
+    if (_tailFd == -1 || fstat(_tailFd, &status) != 0) {
+        close();
+        return false;
+    }
+    _tailOffset = status.st_size;
+    if (!truncateTail()) {
+        close();
+        return false;
+    }
+
+    uint32_t head[2];
+    if (pread(_stateFd, head, sizeof(head), 0) == sizeof(head) && head[0] >= first
+        && head[0] <= last) {
+        _headSegment = head[0];
+        _headOffset = head[1];
+    } else {
+        _headSegment = first;
+        _headOffset = 0;
+    }
+    if (_headSegment == _tailSegment && _headOffset > _tailOffset) {
+        _headOffset = _tailOffset;
+    }
+    skipFinishedSegment();
+    rewind();
+
+    return true;
+}
+
+void FileSpoolStorage::close()
+{
+    if (_stateFd != -1) {
+        ::close(_stateFd);
+        _stateFd = -1;
+    }
+    if (_tailFd != -1) {
+        ::close(_tailFd);
+        _tailFd = -1;
+    }
+    if (_readFd != -1) {
+        ::close(_readFd);
+        _readFd = -1;
+    }
+}
+
+bool FileSpoolStorage::append(const uint8_t* head, Size headSize, const uint8_t* data, Size size)
+{
+    Size length = headSize + size;
+    if (!isOpen() || length == 0 || length > 0xFFFF)
+        return false;
+
+    if (_tailOffset > 0 && _tailOffset + SPOOL_LENGTH_SIZE + length > _segmentSize) {
+        if (_tailSegment - _headSegment + 1 >= _maxSegments)
+            return false;
+
+        int fd = openSegment(_tailSegment + 1, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND);
+        if (fd == -1)
+            return false;
+        ::close(_tailFd);
+        _tailFd = fd;
+        _tailSegment++;
+        _tailOffset = 0;
+    }
+
+    // One write for the whole record, open() cuts off what a crash leaves of it
+    uint8_t lengthBytes[SPOOL_LENGTH_SIZE] = { (uint8_t)(length >> 8), (uint8_t)length };
+    struct iovec parts[3];
+    parts[0].iov_base = lengthBytes;
+    parts[0].iov_len = SPOOL_LENGTH_SIZE;
+    parts[1].iov_base = (void*)head;
+    parts[1].iov_len = headSize;
+    parts[2].iov_base = (void*)data;
+    parts[2].iov_len = size;
+
+    ssize_t written = writev(_tailFd, parts, 3);
+    if (written != (ssize_t)(SPOOL_LENGTH_SIZE + length)) {
+        // Drop a partly written record, like after running out of disk space
+        if (written > 0 && ftruncate(_tailFd, _tailOffset) != 0) {
+            close();
+        }
+        return false;
+    }
+    _tailOffset += written;
+
+    return true;
+}
+
+Size FileSpoolStorage::readNext(uint8_t* data, Size maxSize)
+{
+    if (!isOpen())
+        return 0;
+
+    while (_readSegment != _tailSegment && _readOffset >= segmentLength(_readSegment)) {
+        _readSegment++;
+        _readOffset = 0;
+    }
+    if (_readSegment == _tailSegment && _readOffset >= _tailOffset)
+        return 0;
+
+    uint8_t lengthBytes[SPOOL_LENGTH_SIZE];
+    if (!readAt(_readSegment, _readOffset, lengthBytes, SPOOL_LENGTH_SIZE))
+        return 0;
+
+    Size length = (lengthBytes[0] << 8) | lengthBytes[1];
+    Size size = length < maxSize ? length : maxSize;
+    if (!readAt(_readSegment, _readOffset + SPOOL_LENGTH_SIZE, data, size))
+        return 0;
+    _readOffset += SPOOL_LENGTH_SIZE + length;
+
+    return size;
+}
+
+void FileSpoolStorage::rewind()
+{
+    _readSegment = _headSegment;
+    _readOffset = _headOffset;
+}
+
+bool FileSpoolStorage::remove()
+{
+    if (!isOpen() || isEmpty())
+        return false;
+
+    uint8_t lengthBytes[SPOOL_LENGTH_SIZE];
+    if (!readAt(_headSegment, _headOffset, lengthBytes, SPOOL_LENGTH_SIZE))
+        return false;
+
+    bool reading = _readSegment != _headSegment || _readOffset != _headOffset;
+    _headOffset += SPOOL_LENGTH_SIZE + ((lengthBytes[0] << 8) | lengthBytes[1]);
+    skipFinishedSegment();
+    if (!reading) {
+        rewind();
+    }
+
+    // Without the new position, the record is only read again after a restart
+    storeHead();
+
+    return true;
+}
+
+bool FileSpoolStorage::isEmpty() const
+{
+    return _headSegment == _tailSegment && _headOffset >= _tailOffset;
+}
+
+void FileSpoolStorage::segmentPath(char* path, uint32_t segment) const
+{
+    snprintf(path, E_SPOOL_PATH_SIZE, "%s/%08x" SPOOL_SEGMENT_SUFFIX, _directory, segment);
+}
+
+int FileSpoolStorage::openSegment(uint32_t segment, int flags) const
+{
+    char path[E_SPOOL_PATH_SIZE];
+    segmentPath(path, segment);
+
+    return ::open(path, flags, 0644);
+}
+
+bool FileSpoolStorage::readAt(uint32_t segment, uint32_t offset, uint8_t* data, Size size)
+{
+    if (_readFd == -1 || _readFdSegment != segment) {
+        if (_readFd != -1) {
+            ::close(_readFd);
+        }
+        _readFd = openSegment(segment, O_RDONLY);
+        _readFdSegment = segment;
+        if (_readFd == -1)
+            return false;
+    }
+
+    return pread(_readFd, data, size, offset) == (ssize_t)size;
+}
+
+uint32_t FileSpoolStorage::segmentLength(uint32_t segment)
+{
+    if (segment == _tailSegment)
+        return _tailOffset;
+
+    char path[E_SPOOL_PATH_SIZE];
+    segmentPath(path, segment);
+    struct stat status;
+
+    return stat(path, &status) == 0 ? status.st_size : 0;
+}
+
+bool FileSpoolStorage::truncateTail()
+{
+    // Walk the records of the newest segment up to the last complete one
+    uint32_t offset = 0;
+    uint8_t lengthBytes[SPOOL_LENGTH_SIZE];
+    while (offset + SPOOL_LENGTH_SIZE <= _tailOffset
+        && readAt(_tailSegment, offset, lengthBytes, SPOOL_LENGTH_SIZE)) {
+        uint32_t next = offset + SPOOL_LENGTH_SIZE + ((lengthBytes[0] << 8) | lengthBytes[1]);
+        if (next > _tailOffset)
+            break;
+        offset = next;
+    }
+
+    if (offset != _tailOffset) {
+        if (ftruncate(_tailFd, offset) != 0)
+            return false;
+        _tailOffset = offset;
+    }
+
+    return true;
+}
+
+void FileSpoolStorage::skipFinishedSegment()
+{
+    // The newest segment stays, even when all its records are gone
+    while (_headSegment != _tailSegment && _headOffset >= segmentLength(_headSegment)) {
+        char path[E_SPOOL_PATH_SIZE];
+        segmentPath(path, _headSegment);
+        unlink(path);
+        _headSegment++;
+        _headOffset = 0;
+    }
+}
+
+bool FileSpoolStorage::storeHead()
+{
+    uint32_t head[2] = { _headSegment, _headOffset };
+
+    return pwrite(_stateFd, head, sizeof(head), 0) == sizeof(head);
+}
@@ -0,0 +1,113 @@
+/*
+ * Cicada communication library
+ * Copyright (C) 2021 Okrasolar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef FILESPOOLSTORAGE_H
+#define FILESPOOLSTORAGE_H
+
+#include "cicada/ispoolstorage.h"
+
+#ifndef E_SPOOL_SEGMENT_SIZE
+#define E_SPOOL_SEGMENT_SIZE 65536
+#endif
+
+#ifndef E_SPOOL_MAX_SEGMENTS
+#define E_SPOOL_MAX_SEGMENTS 64
+#endif
+
+#ifndef E_SPOOL_PATH_SIZE
+#define E_SPOOL_PATH_SIZE 256
+#endif
+
+namespace Cicada {
+
+/*!
+ * \class FileSpoolStorage
+ *
+ * Spool storage in a directory, as a log split into numbered segment files.
+ * Records are appended to the newest segment with a single write, a
+ * segment is deleted once all its records have been removed. The position
+ * of the oldest record is kept in a small file next to the segments, so
+ * open() only needs to list the directory and walk the records of the
+ * newest segment to pick up where the last process stopped. A record cut
+ * short by a crash is removed from the end of that segment.
+ */
+class FileSpoolStorage : public ISpoolStorage
+{
+  public:
+    /*!
+     * \param directory Directory for the files, created by open() if it
+     * doesn't exist. The string is not copied and must be valid for the
+     * object's lifetime.
+     * \param segmentSize Size at which a new segment is started
+     * \param maxSegments Maximum number of segments, limiting the disk space
+     */
+    FileSpoolStorage(const char* directory, Size segmentSize = E_SPOOL_SEGMENT_SIZE,
+        uint32_t maxSegments = E_SPOOL_MAX_SEGMENTS);
+    virtual ~FileSpoolStorage();
+
+    /*!
+     * Opens the storage with the records left in the directory.
+     * \return false if the directory or its files can't be opened
+     */
+    bool open();
+
+    void close();
+
+    inline bool isOpen() const
+    {
+        return _stateFd != -1;
+    }
+
+    virtual bool append(const uint8_t* head, Size headSize, const uint8_t* data, Size size);
+    virtual Size readNext(uint8_t* data, Size maxSize);
+    virtual void rewind();
+    virtual bool remove();
+    virtual bool isEmpty() const;
+
+  private:
+    void segmentPath(char* path, uint32_t segment) const;
+    int openSegment(uint32_t segment, int flags) const;
+    bool readAt(uint32_t segment, uint32_t offset, uint8_t* data, Size size);
+    uint32_t segmentLength(uint32_t segment);
+    bool truncateTail();
+    void skipFinishedSegment();
+    bool storeHead();
+
+    const char* _directory;
+    Size _segmentSize;
+    uint32_t _maxSegments;
+    int _stateFd;
+    int _tailFd;
+    int _readFd;
+    uint32_t _readFdSegment;
+    uint32_t _headSegment;
+    uint32_t _headOffset;
+    uint32_t _tailSegment;
+    uint32_t _tailOffset;
+    uint32_t _readSegment;
+    uint32_t _readOffset;
+};
+
+}
+
+#endif
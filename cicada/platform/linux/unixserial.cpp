@@ -35,7 +35,8 @@ UnixSerial::UnixSerial(char* readBuffer, char* writeBuffer, Size bufferSize, con
     _port(port),
     _fd(-1),
     _speed(B115200),
-    _dataBits(CS8)
+    _dataBits(CS8),
+    _flowControl(false)
 {}
 
 UnixSerial::UnixSerial(char* readBuffer, char* writeBuffer, Size readBufferSize,
@@ -45,7 +46,8 @@ UnixSerial::UnixSerial(char* readBuffer, char* writeBuffer, Size readBufferSize,
     _port(port),
     _fd(-1),
     _speed(B115200),
-    _dataBits(CS8)
+    _dataBits(CS8),
+    _flowControl(false)
 {}
 
 bool UnixSerial::open()
@@ -71,8 +73,10 @@ bool UnixSerial::open()
     config.c_iflag &= ~(IGNBRK | BRKINT | ICRNL | INLCR | PARMRK | INPCK | ISTRIP | IXON);
     config.c_oflag = 0;
     config.c_lflag &= ~(ECHO | ECHONL | ICANON | IEXTEN | ISIG);
-    config.c_cflag &= ~(CSIZE | PARENB);
+    config.c_cflag &= ~(CSIZE | PARENB | CRTSCTS);
     config.c_cflag |= _dataBits;
+    if (_flowControl)
+        config.c_cflag |= CRTSCTS;
     config.c_cc[VMIN] = 1;
     config.c_cc[VTIME] = 0;
 
@@ -204,6 +208,50 @@ bool UnixSerial::setSerialConfig(uint32_t baudRate, uint8_t dataBits)
         return false;
     }
 
+    if (_isOpen) {
+        struct termios config;
+
+        if (tcgetattr(_fd, &config) < 0) {
+            return false;
+        }
+
+        config.c_cflag &= ~CSIZE;
+        config.c_cflag |= _dataBits;
+
+        if (cfsetispeed(&config, _speed) < 0 || cfsetospeed(&config, _speed) < 0) {
+            return false;
+        }
+
+        if (tcsetattr(_fd, TCSADRAIN, &config) < 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool UnixSerial::setFlowControl(bool enabled)
+{
+    _flowControl = enabled;
+
+    if (_isOpen) {
+        struct termios config;
+
+        if (tcgetattr(_fd, &config) < 0) {
+            return false;
+        }
+
+        if (enabled) {
+            config.c_cflag |= CRTSCTS;
+        } else {
+            config.c_cflag &= ~CRTSCTS;
+        }
+
+        if (tcsetattr(_fd, TCSADRAIN, &config) < 0) {
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -67,6 +67,13 @@ class UnixSerial : public BufferedSerialTask
 
     virtual bool setSerialConfig(uint32_t baudRate, uint8_t dataBits);
 
+    virtual bool setFlowControl(bool enabled);
+
+    inline virtual bool flowControl() const
+    {
+        return _flowControl;
+    }
+
     virtual void close();
 
     inline const char* portName() const
@@ -89,6 +96,7 @@ class UnixSerial : public BufferedSerialTask
     int _fd;
     speed_t _speed;
     tcflag_t _dataBits;
+    bool _flowControl;
 };
 }
 
@@ -106,6 +106,13 @@ bool Stm32Uart::setSerialConfig(uint32_t baudRate, uint8_t dataBits)
         return false;
     }
 
+    if (isOpen()) {
+        if (HAL_UART_Init(&_handle) != HAL_OK)
+            return false;
+
+        SET_BIT(_handle.Instance->CR1, USART_CR1_RXNEIE);
+    }
+
     return true;
 }
 
@@ -0,0 +1,574 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/commdevices/atcommdevice.h"
+#include <cstring>
+
+using namespace Cicada;
+
+TEST_GROUP(ATCommDeviceTest)
+{
+    class SerialMock : public BufferedSerial
+    {
+      public:
+        SerialMock() : BufferedSerial(_rawReadBuffer, _rawWriteBuffer, 64) {}
+
+        bool open()
+        {
+            return true;
+        }
+        void close() {}
+
+        bool isOpen()
+        {
+            return true;
+        }
+
+        bool setSerialConfig(uint32_t baudRate, uint8_t dataBits)
+        {
+            return true;
+        }
+
+        const char* portName() const
+        {
+            return NULL;
+        }
+
+        bool rawRead(uint8_t & data)
+        {
+            return false;
+        }
+
+        virtual bool rawWrite(uint8_t data)
+        {
+            return true;
+        }
+
+        virtual void startTransmit() {}
+
+        virtual bool writeBufferProcessed() const
+        {
+            return true;
+        }
+
+        // Data arriving from the modem
+        void receive(const char* data)
+        {
+            _readBuffer.push(data, strlen(data));
+        }
+
+        char _rawReadBuffer[64];
+        char _rawWriteBuffer[64];
+    };
+
+    // Exposes the recovery ladder, like a driver handling modem errors
+    class ATCommDeviceMock : public ATCommDevice
+    {
+      public:
+        ATCommDeviceMock(IBufferedSerial & serial) :
+            ATCommDevice(serial, _rawReadBuffer, _rawWriteBuffer, 64)
+        {
+            ATCommDevice::resetStates();
+        }
+
+        void run() {}
+        void resetStates() {}
+
+        RecoveryLevel error(
+            RecoveryLevel minLevel = retryCommand, RecoveryLevel maxLevel = hardReset)
+        {
+            return escalateError(minLevel, maxLevel);
+        }
+
+        void success()
+        {
+            resetRecovery();
+        }
+
+        void issueCommand(CommandClass commandClass)
+        {
+            _waitForReply = _okStr;
+            setCommandClass(commandClass);
+        }
+
+        bool waiting()
+        {
+            return replyPending();
+        }
+
+        void replyReceived()
+        {
+            _waitForReply = NULL;
+        }
+
+        void setReplyState(int8_t replyState)
+        {
+            _replyState = replyState;
+        }
+
+        bool resetPending()
+        {
+            return _stateBooleans & RESET_PENDING;
+        }
+
+        bool step()
+        {
+            static const CommandStep steps[] = {
+                {1, "AT+FIRST", NULL, NULL, NULL, shortCommand, 2, useRecovery},
+                {2, "AT+SECOND", NULL, "+SECOND: 0", NULL, networkCommand, 5, useRecovery},
+                {3, NULL, static_cast<StepWriter>(&ATCommDeviceMock::writeThird), NULL, NULL,
+                    shortCommand, 4, useRecovery},
+                {4, "AT+FOURTH", NULL, "", static_cast<StepParser>(&ATCommDeviceMock::parseFourth),
+                    shortCommand, 5, 7},
+                {8, "AT+EIGHTH", NULL, NULL, NULL, shortCommand, 5, 7}};
+            return runCommandStep(steps, sizeof(steps) / sizeof(CommandStep));
+        }
+
+        bool writeThird()
+        {
+            if (_skipThird)
+                return false;
+
+            if (_branchThird) {
+                _sendState = 6;
+            }
+            sendCommand("AT+THIRD");
+            return true;
+        }
+
+        StepReply parseFourth()
+        {
+            if (strncmp(_lineBuffer, "+FOURTH: 1", 10) == 0)
+                return replyComplete;
+            if (strncmp(_lineBuffer, "+FOURTH: 0", 10) == 0)
+                return replyFailed;
+            return replyIncomplete;
+        }
+
+        // A line from the modem, as the drivers process it
+        bool line(const char* str)
+        {
+            strcpy(_lineBuffer, str);
+            if (_waitForReply && strncmp(_lineBuffer, _waitForReply, strlen(_waitForReply)) == 0) {
+                _waitForReply = NULL;
+            }
+            return parseStepReply();
+        }
+
+        void fail()
+        {
+            failCommand(retryCommand);
+        }
+
+        int8_t& sendState()
+        {
+            return _sendState;
+        }
+
+        const char* expectedReply()
+        {
+            return _waitForReply;
+        }
+
+        bool connecting()
+        {
+            return _connectState == intermediate;
+        }
+
+        void connectTcp()
+        {
+            _type = TCP;
+            _connectState = connected;
+        }
+
+        void confirm(uint8_t chunks, bool sent)
+        {
+            confirmChunks(chunks, sent);
+        }
+
+        bool sendNextChunk()
+        {
+            if (!sendPending())
+                return false;
+
+            // The chunk is passed to the modem right away
+            _bytesToWrite = 0;
+            return sendData();
+        }
+
+        void chunkFailed()
+        {
+            sendFailed();
+        }
+
+        bool receiveChunk(Size length)
+        {
+            beginReceive(length);
+            return receive();
+        }
+
+        Size receiveSpace() const
+        {
+            return readBufferSpace();
+        }
+
+        bool _skipThird = false;
+        bool _branchThird = false;
+        uint8_t _rawReadBuffer[64];
+        uint8_t _rawWriteBuffer[64];
+    };
+
+    struct Sink
+    {
+        char data[128];
+        Size size;
+        int calls;
+    };
+
+    static void collect(const uint8_t* data, Size size, void* userData)
+    {
+        Sink* sink = (Sink*)userData;
+        memcpy(sink->data + sink->size, data, size);
+        sink->size += size;
+        sink->calls++;
+    }
+};
+
+TEST(ATCommDeviceTest, ShouldEscalateStepByStep)
+{
+    SerialMock serial;
+    ATCommDeviceMock device(serial);
+
+    CHECK_EQUAL(ATCommDevice::retryCommand, device.error());
+    CHECK_EQUAL(ATCommDevice::retryCommand, device.error());
+    CHECK_EQUAL(ATCommDevice::reopenSocket, device.error());
+    CHECK_EQUAL(ATCommDevice::reopenBearer, device.error());
+    CHECK_EQUAL(ATCommDevice::softReset, device.error());
+    CHECK_EQUAL(ATCommDevice::hardReset, device.error());
+
+    // The modem starts over after a hard reset
+    CHECK_EQUAL(ATCommDevice::retryCommand, device.error());
+
+    const ATCommDevice::RecoveryStats& stats = device.recoveryStats();
+    CHECK_EQUAL(3, stats.attempts[ATCommDevice::retryCommand]);
+    CHECK_EQUAL(1, stats.attempts[ATCommDevice::reopenSocket]);
+    CHECK_EQUAL(1, stats.attempts[ATCommDevice::reopenBearer]);
+    CHECK_EQUAL(1, stats.attempts[ATCommDevice::softReset]);
+    CHECK_EQUAL(1, stats.attempts[ATCommDevice::hardReset]);
+
+    device.resetRecoveryStats();
+    CHECK_EQUAL(0, stats.attempts[ATCommDevice::retryCommand]);
+}
+
+TEST(ATCommDeviceTest, ShouldStartOverAfterSuccess)
+{
+    SerialMock serial;
+    ATCommDeviceMock device(serial);
+
+    CHECK_EQUAL(ATCommDevice::reopenSocket, device.error(ATCommDevice::reopenSocket));
+    CHECK_EQUAL(ATCommDevice::reopenBearer, device.error());
+    device.success();
+    CHECK_EQUAL(ATCommDevice::retryCommand, device.error());
+}
+
+TEST(ATCommDeviceTest, ShouldSkipLevelsWithoutAttempts)
+{
+    SerialMock serial;
+    ATCommDeviceMock device(serial);
+    device.setRecoveryAttempts(ATCommDevice::retryCommand, 0);
+    device.setRecoveryAttempts(ATCommDevice::reopenBearer, 0);
+    device.setRecoveryAttempts(ATCommDevice::softReset, 2);
+
+    CHECK_EQUAL(ATCommDevice::reopenSocket, device.error());
+    CHECK_EQUAL(ATCommDevice::softReset, device.error());
+    CHECK_EQUAL(ATCommDevice::softReset, device.error());
+    CHECK_EQUAL(ATCommDevice::hardReset, device.error());
+}
+
+TEST(ATCommDeviceTest, ShouldLimitTransientErrors)
+{
+    SerialMock serial;
+    ATCommDeviceMock device(serial);
+
+    for (int i = 0; i < 10; i++) {
+        CHECK(device.error(ATCommDevice::retryCommand, ATCommDevice::reopenBearer)
+            <= ATCommDevice::reopenBearer);
+    }
+    CHECK_EQUAL(0, device.recoveryStats().attempts[ATCommDevice::softReset]);
+    CHECK_EQUAL(0, device.recoveryStats().attempts[ATCommDevice::hardReset]);
+
+    // Other errors still escalate
+    CHECK_EQUAL(ATCommDevice::softReset, device.error());
+}
+
+TEST(ATCommDeviceTest, ShouldTimeOutPerCommandClass)
+{
+    SerialMock serial;
+    ATCommDeviceMock device(serial);
+    device.setCommandTimeout(ATCommDevice::networkCommand, 1000);
+
+    // A reply in time doesn't count
+    device.issueCommand(ATCommDevice::shortCommand);
+    device.setLastRun(100);
+    CHECK_TRUE(device.waiting());
+    device.setLastRun(5000);
+    CHECK_TRUE(device.waiting());
+    device.replyReceived();
+    CHECK_FALSE(device.waiting());
+    CHECK_FALSE(device.resetPending());
+
+    // The deadline starts with the next command
+    device.issueCommand(ATCommDevice::networkCommand);
+    device.setLastRun(6000);
+    CHECK_TRUE(device.waiting());
+    device.setLastRun(6999);
+    CHECK_TRUE(device.waiting());
+    CHECK_FALSE(device.resetPending());
+    device.setLastRun(7000);
+    CHECK_TRUE(device.waiting());
+
+    // The reply isn't awaited anymore and the driver recovers
+    CHECK_TRUE(device.resetPending());
+    CHECK_FALSE(device.waiting());
+    CHECK_EQUAL(1, device.recoveryStats().timeouts[ATCommDevice::networkCommand]);
+    CHECK_EQUAL(0, device.recoveryStats().timeouts[ATCommDevice::shortCommand]);
+}
+
+TEST(ATCommDeviceTest, ShouldOnlyWaitForExpectedReplies)
+{
+    SerialMock serial;
+    ATCommDeviceMock device(serial);
+
+    // A parser state alone doesn't block the next command
+    device.setReplyState(1);
+    device.setLastRun(100);
+    CHECK_FALSE(device.waiting());
+    device.setLastRun(100000);
+    CHECK_FALSE(device.waiting());
+    CHECK_FALSE(device.resetPending());
+}
+
+TEST(ATCommDeviceTest, ShouldRestartDeadlineForChainedCommand)
+{
+    SerialMock serial;
+    ATCommDeviceMock device(serial);
+    device.setCommandTimeout(ATCommDevice::networkCommand, 1000);
+
+    device.issueCommand(ATCommDevice::networkCommand);
+    device.setLastRun(100);
+    CHECK_TRUE(device.waiting());
+
+    // The reply parser issues the next command before the wait ends
+    device.setLastRun(900);
+    device.issueCommand(ATCommDevice::networkCommand);
+    device.setLastRun(1000);
+    CHECK_TRUE(device.waiting());
+    device.setLastRun(1999);
+    CHECK_TRUE(device.waiting());
+    CHECK_FALSE(device.resetPending());
+    device.setLastRun(2000);
+    CHECK_TRUE(device.waiting());
+    CHECK_TRUE(device.resetPending());
+    CHECK_EQUAL(1, device.recoveryStats().timeouts[ATCommDevice::networkCommand]);
+}
+
+TEST(ATCommDeviceTest, ShouldRunCommandSteps)
+{
+    SerialMock serial;
+    ATCommDeviceMock device(serial);
+
+    // States without a step are left to the driver
+    CHECK_FALSE(device.step());
+
+    device.sendState() = 1;
+    CHECK_TRUE(device.step());
+    CHECK_EQUAL(2, device.sendState());
+    STRCMP_EQUAL("OK", device.expectedReply());
+    CHECK_TRUE(device.connecting());
+
+    CHECK_TRUE(device.waiting());
+    CHECK_TRUE(device.line("OK"));
+    CHECK_FALSE(device.waiting());
+
+    CHECK_TRUE(device.step());
+    CHECK_EQUAL(5, device.sendState());
+    STRCMP_EQUAL("+SECOND: 0", device.expectedReply());
+    CHECK_FALSE(device.step());
+
+    // Other lines don't complete the step
+    CHECK_TRUE(device.line("OK"));
+    CHECK_TRUE(device.waiting());
+    CHECK_TRUE(device.line("+SECOND: 0"));
+    CHECK_FALSE(device.waiting());
+}
+
+TEST(ATCommDeviceTest, ShouldBranchOffInCommandSteps)
+{
+    SerialMock serial;
+    ATCommDeviceMock device(serial);
+
+    // The writer may skip the command
+    device._skipThird = true;
+    device.sendState() = 3;
+    CHECK_TRUE(device.step());
+    CHECK_EQUAL(4, device.sendState());
+    CHECK_TRUE(device.expectedReply() == NULL);
+    CHECK_FALSE(device.waiting());
+
+    // Or continue with another state
+    device._skipThird = false;
+    device._branchThird = true;
+    device.sendState() = 3;
+    CHECK_TRUE(device.step());
+    CHECK_EQUAL(6, device.sendState());
+    STRCMP_EQUAL("OK", device.expectedReply());
+    CHECK_TRUE(device.waiting());
+}
+
+TEST(ATCommDeviceTest, ShouldParseCommandStepReplies)
+{
+    SerialMock serial;
+    ATCommDeviceMock device(serial);
+
+    // With an empty reply, the parser decides when the step is complete
+    device.sendState() = 4;
+    CHECK_TRUE(device.step());
+    CHECK_TRUE(device.line("+OTHER"));
+    CHECK_TRUE(device.waiting());
+    CHECK_TRUE(device.line("+FOURTH: 1"));
+    CHECK_FALSE(device.waiting());
+    CHECK_EQUAL(5, device.sendState());
+
+    // Lines before the final reply keep the step, so an error still leads to its failure state
+    device.sendState() = 8;
+    CHECK_TRUE(device.step());
+    CHECK_TRUE(device.line(""));
+    CHECK_TRUE(device.waiting());
+    device.fail();
+    CHECK_EQUAL(7, device.sendState());
+
+    // A failure reported by the parser leads to the failure state
+    device.sendState() = 4;
+    CHECK_TRUE(device.step());
+    CHECK_FALSE(device.line("+FOURTH: 0"));
+    CHECK_EQUAL(7, device.sendState());
+    CHECK_FALSE(device.waiting());
+    CHECK_FALSE(device.resetPending());
+
+    // So does an error reply
+    device.sendState() = 4;
+    CHECK_TRUE(device.step());
+    device.fail();
+    CHECK_EQUAL(7, device.sendState());
+    CHECK_FALSE(device.resetPending());
+}
+
+TEST(ATCommDeviceTest, ShouldRecoverFromFailedCommandSteps)
+{
+    SerialMock serial;
+    ATCommDeviceMock device(serial);
+
+    // Steps without a failure state go through the recovery ladder
+    device.sendState() = 1;
+    CHECK_TRUE(device.step());
+    device.fail();
+    CHECK_TRUE(device.resetPending());
+    CHECK_FALSE(device.waiting());
+
+    // The same applies to timeouts
+    device.sendState() = 4;
+    CHECK_TRUE(device.step());
+    device.setLastRun(100);
+    CHECK_TRUE(device.waiting());
+    device.setLastRun(5100);
+    CHECK_TRUE(device.waiting());
+    CHECK_EQUAL(7, device.sendState());
+    CHECK_FALSE(device.waiting());
+}
+
+TEST(ATCommDeviceTest, ShouldLimitChunksInFlight)
+{
+    SerialMock serial;
+    ATCommDeviceMock device(serial);
+    device.setQuickSend(2);
+    device.connectTcp();
+    device.write((const uint8_t*)"data", 4);
+
+    CHECK_TRUE(device.sendNextChunk());
+    CHECK_TRUE(device.sendNextChunk());
+    CHECK_FALSE(device.sendNextChunk());
+
+    // A confirmed chunk opens the window again
+    device.confirm(1, true);
+    CHECK_TRUE(device.sendNextChunk());
+    CHECK_FALSE(device.sendNextChunk());
+
+    device.confirm(2, false);
+    CHECK_EQUAL(2, device.sendStats().failures);
+    CHECK_TRUE(device.sendNextChunk());
+}
+
+TEST(ATCommDeviceTest, ShouldAdaptSendChunkSize)
+{
+    SerialMock serial;
+    ATCommDeviceMock device(serial);
+    device.connectTcp();
+    device.write((const uint8_t*)"data", 4);
+    CHECK_EQUAL(256, device.sendChunkSize());
+
+    // Each failed send halves the chunk size, down to the minimum
+    CHECK_TRUE(device.sendNextChunk());
+    device.chunkFailed();
+    CHECK_EQUAL(128, device.sendChunkSize());
+    CHECK_TRUE(device.sendNextChunk());
+    device.chunkFailed();
+    CHECK_EQUAL(64, device.sendChunkSize());
+    CHECK_TRUE(device.sendNextChunk());
+    device.chunkFailed();
+    CHECK_EQUAL(64, device.sendChunkSize());
+    CHECK_EQUAL(3, device.sendStats().failures);
+
+    // Failures without a chunk on its way don't count
+    device.chunkFailed();
+    CHECK_EQUAL(64, device.sendChunkSize());
+    CHECK_EQUAL(3, device.sendStats().failures);
+
+    // Each successful send doubles it again, up to the maximum
+    CHECK_TRUE(device.sendNextChunk());
+    CHECK_EQUAL(64, device.sendChunkSize());
+    CHECK_TRUE(device.sendNextChunk());
+    CHECK_EQUAL(128, device.sendChunkSize());
+    CHECK_TRUE(device.sendNextChunk());
+    CHECK_EQUAL(256, device.sendChunkSize());
+    for (int i = 0; i < 4; i++) {
+        CHECK_TRUE(device.sendNextChunk());
+    }
+    CHECK_EQUAL(1024, device.sendChunkSize());
+}
+
+TEST(ATCommDeviceTest, ShouldPassReceivedDataToSink)
+{
+    SerialMock serial;
+    ATCommDeviceMock device(serial);
+    device.connectTcp();
+
+    Sink sink = {};
+    device.setReceiveSink(collect, &sink);
+    CHECK(device.receiveSpace() > 64);
+
+    const char* data = "0123456789abcdefghijklmnopqrstuvwxyzABCD";
+    serial.receive(data);
+    CHECK_TRUE(device.receiveChunk(40));
+
+    // Data arrives in chunks and doesn't go through the read buffer
+    CHECK_EQUAL(40, sink.size);
+    CHECK_EQUAL(2, sink.calls);
+    MEMCMP_EQUAL(data, sink.data, 40);
+    CHECK_EQUAL(0, device.bytesAvailable());
+
+    device.setReceiveSink(NULL);
+    CHECK_EQUAL(64, device.receiveSpace());
+    serial.receive("more");
+    CHECK_TRUE(device.receiveChunk(4));
+    CHECK_EQUAL(4, device.bytesAvailable());
+    CHECK_EQUAL(40, sink.size);
+}
@@ -132,3 +132,119 @@ TEST(BufferedSerialTest, ShouldDetectLineBreaksAndReadIndividualLines)
     dataOut[outLen] = '\0';
     STRNCMP_EQUAL("Another line\n", dataOut, SIZE);
 }
+
+TEST_GROUP(BufferedSerialFlowControlTest)
+{
+    // Small read buffer, which runs full before the modem stops sending
+    class FlowControlSerialMock : public BufferedSerial
+    {
+      public:
+        FlowControlSerialMock() :
+            BufferedSerial(_rawReadBuffer, _rawWriteBuffer, 10),
+            _inBufferMock(_rawInBuffer, 120),
+            _flowControl(false)
+        {}
+
+        bool open()
+        {
+            return true;
+        }
+        void close() {}
+
+        bool isOpen()
+        {
+            return true;
+        }
+
+        bool setSerialConfig(uint32_t baudRate, uint8_t dataBits)
+        {
+            return true;
+        }
+
+        bool setFlowControl(bool enabled)
+        {
+            _flowControl = enabled;
+            return true;
+        }
+
+        bool flowControl() const
+        {
+            return _flowControl;
+        }
+
+        const char* portName() const
+        {
+            return NULL;
+        }
+
+        bool rawRead(uint8_t& data)
+        {
+            if (!_inBufferMock.isEmpty()) {
+                data = _inBufferMock.pull();
+                return true;
+            }
+
+            return false;
+        }
+
+        virtual bool rawWrite(uint8_t data)
+        {
+            return true;
+        }
+
+        virtual void startTransmit() {}
+
+        virtual bool writeBufferProcessed() const
+        {
+            return true;
+        }
+
+        char _rawReadBuffer[10];
+        char _rawWriteBuffer[10];
+        char _rawInBuffer[120];
+        CircularBuffer<char> _inBufferMock;
+        bool _flowControl;
+    };
+};
+
+TEST(BufferedSerialFlowControlTest, ShouldDropDataWhenReadBufferIsFull)
+{
+    FlowControlSerialMock bs;
+    const uint8_t SIZE = 20;
+    char dataIn[SIZE] = "123456789 987654321";
+
+    bs._inBufferMock.push(dataIn, SIZE);
+
+    for (int i = 0; i < 100; i++)
+        bs.transferToAndFromBuffer();
+
+    CHECK_EQUAL(10, bs.bytesAvailable());
+    CHECK_EQUAL(0, bs._inBufferMock.bytesAvailable());
+}
+
+TEST(BufferedSerialFlowControlTest, ShouldHoldBackDataWhenReadBufferIsFull)
+{
+    FlowControlSerialMock bs;
+    const uint8_t SIZE = 20;
+    char dataIn[SIZE] = "123456789 987654321";
+    char dataOut[SIZE];
+
+    bs.setFlowControl(true);
+    bs._inBufferMock.push(dataIn, SIZE);
+
+    for (int i = 0; i < 100; i++)
+        bs.transferToAndFromBuffer();
+
+    CHECK_EQUAL(10, bs.bytesAvailable());
+    CHECK_EQUAL(SIZE - 10, bs._inBufferMock.bytesAvailable());
+
+    Size readLen = bs.read((uint8_t*)dataOut, 10);
+
+    for (int i = 0; i < 100; i++)
+        bs.transferToAndFromBuffer();
+
+    readLen += bs.read((uint8_t*)dataOut + readLen, SIZE - readLen);
+
+    CHECK_EQUAL(SIZE, readLen);
+    STRNCMP_EQUAL(dataIn, dataOut, SIZE);
+}
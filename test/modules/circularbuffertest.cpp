@@ -196,3 +196,28 @@ TEST(CircularBufferTest, ReReadSameDataWithWrapAround)
     buffer.pull(dataOut, 7);
     STRNCMP_EQUAL("234567", dataOut, 7);
 }
+
+TEST(CircularBufferTest, ShouldPeekAndSkipDataWithWrapAround)
+{
+    const uint8_t MAX_BUFFER_SIZE = 10;
+    char rawBuffer[MAX_BUFFER_SIZE];
+    CircularBuffer<char> buffer(rawBuffer, MAX_BUFFER_SIZE);
+
+    char dataOut[MAX_BUFFER_SIZE];
+
+    buffer.push("123456", 6);
+    buffer.pull(dataOut, 6);
+    buffer.push("abcdefgh", 8);
+
+    CHECK_EQUAL(4, buffer.peek(dataOut, 4, 2));
+    STRNCMP_EQUAL("cdef", dataOut, 4);
+    CHECK_EQUAL(2, buffer.peek(dataOut, 5, 6));
+    STRNCMP_EQUAL("gh", dataOut, 2);
+    CHECK_EQUAL(0, buffer.peek(dataOut, 5, 8));
+    CHECK_EQUAL(8, buffer.bytesAvailable());
+
+    CHECK_EQUAL(5, buffer.skip(5));
+    CHECK_EQUAL(3, buffer.pull(dataOut, MAX_BUFFER_SIZE));
+    STRNCMP_EQUAL("fgh", dataOut, 3);
+    CHECK_EQUAL(0, buffer.skip(1));
+}
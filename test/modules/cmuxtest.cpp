@@ -0,0 +1,287 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/cmux.h"
+#include <cstring>
+
+using namespace Cicada;
+
+TEST_GROUP(CmuxTest)
+{
+    class SerialMock : public BufferedSerial
+    {
+      public:
+        SerialMock() :
+            BufferedSerial(_rawReadBuffer, _rawWriteBuffer, 512),
+            _inBufferMock(_rawInBuffer, 512),
+            _outBufferMock(_rawOutBuffer, 512)
+        {}
+
+        bool open()
+        {
+            return true;
+        }
+        void close() {}
+
+        bool isOpen()
+        {
+            return true;
+        }
+
+        bool setSerialConfig(uint32_t baudRate, uint8_t dataBits)
+        {
+            return true;
+        }
+
+        const char* portName() const
+        {
+            return NULL;
+        }
+
+        bool rawRead(uint8_t& data)
+        {
+            if (!_inBufferMock.isEmpty()) {
+                data = _inBufferMock.pull();
+                return true;
+            }
+
+            return false;
+        }
+
+        virtual bool rawWrite(uint8_t data)
+        {
+            if (!_outBufferMock.isFull()) {
+                _outBufferMock.push(data);
+                return true;
+            }
+
+            return false;
+        }
+
+        virtual void startTransmit() {}
+
+        virtual bool writeBufferProcessed() const
+        {
+            return true;
+        }
+
+        char _rawReadBuffer[512];
+        char _rawWriteBuffer[512];
+        char _rawInBuffer[512];
+        char _rawOutBuffer[512];
+        CircularBuffer<char> _inBufferMock;
+        CircularBuffer<char> _outBufferMock;
+    };
+
+    static uint8_t fcs(const uint8_t* data, uint8_t length)
+    {
+        uint8_t crc = 0xFF;
+        while (length--) {
+            crc ^= *data++;
+            for (uint8_t i = 0; i < 8; i++)
+                crc = (crc & 0x01) ? (crc >> 1) ^ 0xE0 : crc >> 1;
+        }
+
+        return 0xFF - crc;
+    }
+
+    // Sends a frame from the modem to the multiplexer, the checksum covers the
+    // first fcsLength bytes of header and information field
+    static void pushFrame(
+        SerialMock & serial, uint8_t address, uint8_t control, const char* info, uint8_t length,
+        uint8_t fcsLength)
+    {
+        uint8_t frame[64] = { address, control, (uint8_t)((length << 1) | 0x01) };
+        memcpy(frame + 3, info, length);
+        serial._inBufferMock.push((char)0xF9);
+        serial._inBufferMock.push((const char*)frame, length + 3);
+        serial._inBufferMock.push((char)fcs(frame, fcsLength));
+        serial._inBufferMock.push((char)0xF9);
+    }
+
+    static void pushFrame(
+        SerialMock & serial, uint8_t address, uint8_t control, const char* info = "",
+        uint8_t length = 0)
+    {
+        pushFrame(serial, address, control, info, length, 3);
+    }
+
+    // Collects the data the multiplexer sent to the modem
+    static Size pullOutput(SerialMock & serial, uint8_t * data, Size size)
+    {
+        return serial._outBufferMock.pull((char*)data, size);
+    }
+
+    static void runMux(SerialMock & serial, Cmux & mux)
+    {
+        for (int i = 0; i < 100; i++) {
+            serial.transferToAndFromBuffer();
+            mux.run();
+            serial.transferToAndFromBuffer();
+        }
+    }
+
+    static void startMux(SerialMock & serial, Cmux & mux)
+    {
+        uint8_t out[64];
+
+        mux.start();
+        runMux(serial, mux);
+        pullOutput(serial, out, sizeof(out));
+        serial._inBufferMock.push("\r\nOK\r\n", 6);
+        runMux(serial, mux);
+        pullOutput(serial, out, sizeof(out));
+        pushFrame(serial, 0x03, 0x73);
+        runMux(serial, mux);
+    }
+
+    static void openChannel(SerialMock & serial, Cmux & mux, CmuxChannel & channel)
+    {
+        uint8_t out[64];
+
+        channel.open();
+        runMux(serial, mux);
+        pullOutput(serial, out, sizeof(out));
+        pushFrame(serial, (channel.dlci() << 2) | 0x03, 0x73);
+        runMux(serial, mux);
+        pullOutput(serial, out, sizeof(out));
+    }
+};
+
+TEST(CmuxTest, ShouldSwitchToMuxModeAndOpenControlChannel)
+{
+    SerialMock serial;
+    Cmux mux(serial);
+    uint8_t out[64];
+
+    mux.start();
+    runMux(serial, mux);
+
+    Size length = pullOutput(serial, out, sizeof(out));
+    CHECK_EQUAL(11, length);
+    STRNCMP_EQUAL("AT+CMUX=0\r\n", (const char*)out, 11);
+
+    serial._inBufferMock.push("\r\nOK\r\n", 6);
+    runMux(serial, mux);
+
+    // SABM on DLCI 0, as given in 3GPP TS 27.010
+    const uint8_t sabm[] = { 0xF9, 0x03, 0x3F, 0x01, 0x1C, 0xF9 };
+    length = pullOutput(serial, out, sizeof(out));
+    CHECK_EQUAL(sizeof(sabm), length);
+    MEMCMP_EQUAL(sabm, out, sizeof(sabm));
+    CHECK_FALSE(mux.isStarted());
+
+    pushFrame(serial, 0x03, 0x73);
+    runMux(serial, mux);
+
+    CHECK_TRUE(mux.isStarted());
+    CHECK_FALSE(mux.hasError());
+}
+
+TEST(CmuxTest, ShouldFailWhenModemRejectsMuxMode)
+{
+    SerialMock serial;
+    Cmux mux(serial);
+
+    mux.start();
+    runMux(serial, mux);
+    serial._inBufferMock.push("\r\nERROR\r\n", 9);
+    runMux(serial, mux);
+
+    CHECK_FALSE(mux.isStarted());
+    CHECK_TRUE(mux.hasError());
+}
+
+TEST(CmuxTest, ShouldPassDataBetweenChannelsAndModem)
+{
+    SerialMock serial;
+    Cmux mux(serial);
+    char rb1[128], wb1[128], rb2[128], wb2[128];
+    CmuxChannel channel1(rb1, wb1, 128);
+    CmuxChannel channel2(rb2, wb2, 128);
+    uint8_t out[64];
+
+    CHECK_TRUE(mux.addChannel(channel1));
+    CHECK_TRUE(mux.addChannel(channel2));
+    CHECK_EQUAL(1, channel1.dlci());
+    CHECK_EQUAL(2, channel2.dlci());
+
+    startMux(serial, mux);
+    openChannel(serial, mux, channel1);
+    openChannel(serial, mux, channel2);
+    CHECK_TRUE(channel1.isOpen());
+    CHECK_TRUE(channel2.isOpen());
+
+    channel2.write((const uint8_t*)"hello");
+    runMux(serial, mux);
+
+    const uint8_t uih[] = { 0xF9, 0x0B, 0xEF, 0x0B, 'h', 'e', 'l', 'l', 'o', 0x00, 0xF9 };
+    Size length = pullOutput(serial, out, sizeof(out));
+    CHECK_EQUAL(sizeof(uih), length);
+    MEMCMP_EQUAL(uih, out, 9);
+    CHECK_EQUAL(fcs(uih + 1, 3), out[9]);
+
+    pushFrame(serial, 0x05, 0xEF, "first", 5);
+    pushFrame(serial, 0x09, 0xEF, "second", 6);
+    runMux(serial, mux);
+
+    char data[16] = {};
+    CHECK_EQUAL(5, channel1.read((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("first", data, 5);
+    CHECK_EQUAL(6, channel2.read((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("second", data, 6);
+}
+
+TEST(CmuxTest, ShouldStopModemWhenReadBufferRunsFull)
+{
+    SerialMock serial;
+    Cmux mux(serial);
+    char rb[64], wb[64];
+    CmuxChannel channel(rb, wb, 64);
+    uint8_t out[64];
+
+    mux.addChannel(channel);
+    startMux(serial, mux);
+    openChannel(serial, mux, channel);
+
+    for (int i = 0; i < 2; i++) {
+        pushFrame(serial, 0x05, 0xEF, "0123456789012345678901234", 25);
+    }
+    runMux(serial, mux);
+
+    // Modem status command with the flow control bit set
+    const uint8_t msc[] = { 0xF9, 0x03, 0xEF, 0x09, 0xE3, 0x05, 0x07, 0x8F };
+    Size length = pullOutput(serial, out, sizeof(out));
+    CHECK_EQUAL(sizeof(msc) + 2, length);
+    MEMCMP_EQUAL(msc, out, sizeof(msc));
+
+    channel.flushReceiveBuffers();
+    runMux(serial, mux);
+
+    length = pullOutput(serial, out, sizeof(out));
+    CHECK_EQUAL(sizeof(msc) + 2, length);
+    CHECK_EQUAL(0x8D, out[7]);
+}
+
+TEST(CmuxTest, ShouldCheckInformationFieldOfUiFrames)
+{
+    SerialMock serial;
+    Cmux mux(serial);
+    char rb[128], wb[128];
+    CmuxChannel channel(rb, wb, 128);
+    char data[16] = {};
+
+    CHECK_TRUE(mux.addChannel(channel));
+    startMux(serial, mux);
+    openChannel(serial, mux, channel);
+
+    // Unlike UIH, the checksum of UI frames covers the information field
+    pushFrame(serial, 0x05, 0x03, "first", 5, 8);
+    runMux(serial, mux);
+    CHECK_EQUAL(5, channel.read((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("first", data, 5);
+
+    // A checksum over the header only is rejected
+    pushFrame(serial, 0x05, 0x13, "second", 6, 3);
+    runMux(serial, mux);
+    CHECK_EQUAL(0, channel.read((uint8_t*)data, sizeof(data)));
+}
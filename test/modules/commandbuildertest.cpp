@@ -0,0 +1,90 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/commdevices/commandbuilder.h"
+#include "cicada/bufferedserial.h"
+#include <cstring>
+
+using namespace Cicada;
+
+TEST_GROUP(CommandBuilderTest)
+{
+    class SerialMock : public BufferedSerial
+    {
+      public:
+        SerialMock() : BufferedSerial(_rawReadBuffer, _rawWriteBuffer, 128) {}
+
+        bool open()
+        {
+            return true;
+        }
+        void close() {}
+
+        bool isOpen()
+        {
+            return true;
+        }
+
+        bool setSerialConfig(uint32_t baudRate, uint8_t dataBits)
+        {
+            return true;
+        }
+
+        const char* portName() const
+        {
+            return NULL;
+        }
+
+        bool rawRead(uint8_t & data)
+        {
+            return false;
+        }
+
+        virtual bool rawWrite(uint8_t data)
+        {
+            return true;
+        }
+
+        virtual void startTransmit() {}
+
+        virtual bool writeBufferProcessed() const
+        {
+            return true;
+        }
+
+        const char* written()
+        {
+            Size length = _writeBuffer.pull(_written, sizeof(_written) - 1);
+            _written[length] = '\0';
+            return _written;
+        }
+
+        char _rawReadBuffer[128];
+        char _rawWriteBuffer[128];
+        char _written[129];
+    };
+};
+
+TEST(CommandBuilderTest, ShouldFormatNumbers)
+{
+    SerialMock serial;
+
+    CommandBuilder(serial).appendNumber(0).append(',').appendNumber(4294967295u).send();
+    STRCMP_EQUAL("0,4294967295", serial.written());
+
+    CommandBuilder(serial).appendHex(0x00).appendHex(0x5a).appendHex(0xff).send();
+    STRCMP_EQUAL("005AFF", serial.written());
+}
+
+TEST(CommandBuilderTest, ShouldWriteLongCommands)
+{
+    SerialMock serial;
+    const char host[] = "a.rather.long.host.name.example.com";
+
+    CommandBuilder cmd(serial);
+    cmd.append("AT+CIPSTART=\"TCP\",\"").append(host).append("\",").appendNumber(8883);
+    Size length = cmd.append("\r\n").send();
+
+    const char* expected = "AT+CIPSTART=\"TCP\",\"a.rather.long.host.name.example.com\",8883\r\n";
+    CHECK_EQUAL(strlen(expected), length);
+    STRCMP_EQUAL(expected, serial.written());
+}
@@ -0,0 +1,113 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/commdevices/dnscache.h"
+#include <cstring>
+
+using namespace Cicada;
+
+TEST_GROUP(DnsCacheTest){};
+
+TEST(DnsCacheTest, ShouldReturnAddedEntry)
+{
+    DnsCache cache;
+
+    CHECK(cache.add("example.com", "93.184.216.34", 0));
+    STRCMP_EQUAL("93.184.216.34", cache.lookup("example.com", 100));
+    POINTERS_EQUAL(NULL, cache.lookup("example.org", 100));
+}
+
+TEST(DnsCacheTest, ShouldUpdateExistingEntry)
+{
+    DnsCache cache;
+
+    cache.add("example.com", "93.184.216.34", 0);
+    cache.add("example.com", "10.0.0.1", 10);
+
+    STRCMP_EQUAL("10.0.0.1", cache.lookup("example.com", 20));
+}
+
+TEST(DnsCacheTest, ShouldExpireEntriesAfterTtl)
+{
+    DnsCache cache(1000);
+
+    cache.add("example.com", "93.184.216.34", 500);
+
+    STRCMP_EQUAL("93.184.216.34", cache.lookup("example.com", 1499));
+    POINTERS_EQUAL(NULL, cache.lookup("example.com", 1500));
+}
+
+TEST(DnsCacheTest, ShouldExpireEntriesAcrossTickOverflow)
+{
+    DnsCache cache(1000);
+
+    cache.add("example.com", "93.184.216.34", UINT32_MAX - 100);
+
+    STRCMP_EQUAL("93.184.216.34", cache.lookup("example.com", 100));
+    POINTERS_EQUAL(NULL, cache.lookup("example.com", 900));
+}
+
+TEST(DnsCacheTest, ShouldKeepPreseededEntriesWithoutTtl)
+{
+    DnsCache cache(1000);
+
+    cache.add("example.com", "93.184.216.34", 0, 0);
+
+    STRCMP_EQUAL("93.184.216.34", cache.lookup("example.com", 1000000));
+}
+
+TEST(DnsCacheTest, ShouldReplaceOldestEntryWhenFull)
+{
+    DnsCache cache;
+    char host[] = "host0";
+
+    for (int i = 0; i < E_DNS_CACHE_ENTRIES; i++) {
+        host[4] = '0' + i;
+        cache.add(host, "10.0.0.1", i);
+    }
+    cache.add("newhost", "10.0.0.2", E_DNS_CACHE_ENTRIES);
+
+    POINTERS_EQUAL(NULL, cache.lookup("host0", E_DNS_CACHE_ENTRIES));
+    STRCMP_EQUAL("10.0.0.1", cache.lookup("host1", E_DNS_CACHE_ENTRIES));
+    STRCMP_EQUAL("10.0.0.2", cache.lookup("newhost", E_DNS_CACHE_ENTRIES));
+}
+
+TEST(DnsCacheTest, ShouldRemoveEntries)
+{
+    DnsCache cache;
+
+    cache.add("example.com", "93.184.216.34", 0);
+    cache.add("example.org", "93.184.216.35", 0);
+    cache.remove("example.com");
+
+    POINTERS_EQUAL(NULL, cache.lookup("example.com", 0));
+    STRCMP_EQUAL("93.184.216.35", cache.lookup("example.org", 0));
+
+    cache.clear();
+    POINTERS_EQUAL(NULL, cache.lookup("example.org", 0));
+}
+
+TEST(DnsCacheTest, ShouldRejectTooLongHostNames)
+{
+    DnsCache cache;
+    char host[E_DNS_HOST_MAX_LENGTH + 1];
+
+    memset(host, 'a', E_DNS_HOST_MAX_LENGTH);
+    host[E_DNS_HOST_MAX_LENGTH] = '\0';
+
+    CHECK_FALSE(cache.add(host, "10.0.0.1", 0));
+}
+
+TEST(DnsCacheTest, ShouldDetectIpLiterals)
+{
+    CHECK(DnsCache::isIpLiteral("192.168.1.1"));
+    CHECK(DnsCache::isIpLiteral("0.0.0.0"));
+    CHECK(DnsCache::isIpLiteral("255.255.255.255"));
+    CHECK_FALSE(DnsCache::isIpLiteral("256.1.1.1"));
+    CHECK_FALSE(DnsCache::isIpLiteral("1.2.3"));
+    CHECK_FALSE(DnsCache::isIpLiteral("1.2.3.4.5"));
+    CHECK_FALSE(DnsCache::isIpLiteral("1..2.3"));
+    CHECK_FALSE(DnsCache::isIpLiteral("1.2.3.4."));
+    CHECK_FALSE(DnsCache::isIpLiteral("1234.1.1.1"));
+    CHECK_FALSE(DnsCache::isIpLiteral("example.com"));
+    CHECK_FALSE(DnsCache::isIpLiteral(""));
+}
@@ -0,0 +1,237 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/commdevices/espressif.h"
+#include <cstring>
+
+using namespace Cicada;
+
+TEST_GROUP(EspressifTest)
+{
+    class SerialMock : public BufferedSerial
+    {
+      public:
+        SerialMock() : BufferedSerial(_rawReadBuffer, _rawWriteBuffer, 256), _flowControl(false)
+        {}
+
+        bool open()
+        {
+            return true;
+        }
+        void close() {}
+
+        bool isOpen()
+        {
+            return true;
+        }
+
+        bool setSerialConfig(uint32_t baudRate, uint8_t dataBits)
+        {
+            return true;
+        }
+
+        bool setFlowControl(bool enabled)
+        {
+            _flowControl = enabled;
+            return true;
+        }
+
+        bool flowControl() const
+        {
+            return _flowControl;
+        }
+
+        const char* portName() const
+        {
+            return NULL;
+        }
+
+        bool rawRead(uint8_t & data)
+        {
+            return false;
+        }
+
+        virtual bool rawWrite(uint8_t data)
+        {
+            return true;
+        }
+
+        virtual void startTransmit() {}
+
+        virtual bool writeBufferProcessed() const
+        {
+            return true;
+        }
+
+        // Data arriving from the modem
+        void receive(const char* data)
+        {
+            _readBuffer.push(data, strlen(data));
+        }
+
+        // Data the modem got since the last call
+        const char* sent()
+        {
+            Size size = _writeBuffer.pull(_sent, sizeof(_sent) - 1);
+            _sent[size] = '\0';
+            return _sent;
+        }
+
+        char _rawReadBuffer[256];
+        char _rawWriteBuffer[256];
+        char _sent[256];
+        bool _flowControl;
+    };
+
+    static void startConnect(EspressifDevice & device)
+    {
+        device.setSSID("ssid");
+        device.setPassword("secret");
+        device.setHostPort("192.168.1.1", 8000);
+        CHECK_TRUE(device.connect());
+    }
+
+    // Runs the device until it sends a command, at most a few times
+    static const char* nextCommand(EspressifDevice & device, SerialMock & serial)
+    {
+        for (int i = 0; i < 10; i++) {
+            device.run();
+            const char* command = serial.sent();
+            if (strlen(command) > 0)
+                return command;
+        }
+
+        return "";
+    }
+
+    // Answers the commands of the connection sequence with OK until the
+    // given command is sent
+    static void runUntil(EspressifDevice & device, SerialMock & serial, const char* command)
+    {
+        for (int i = 0; i < 20; i++) {
+            const char* sent = nextCommand(device, serial);
+            if (strncmp(sent, command, strlen(command)) == 0)
+                return;
+            serial.receive("\r\nOK\r\n");
+        }
+
+        FAIL(command);
+    }
+};
+
+TEST(EspressifTest, ShouldKeepUartCurReplyInOneLineWithPushReceive)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    EspressifDevice device(serial, rb, wb, 128);
+    serial.setFlowControl(true);
+    device.setPushReceive(true);
+    startConnect(device);
+
+    runUntil(device, serial, "AT+UART_CUR?");
+    serial.receive("+UART_CUR:115200,8,1,0,0\r\n\r\nOK\r\n");
+    STRCMP_EQUAL("AT+UART_CUR=115200,8,1,0,3\r\n", nextCommand(device, serial));
+}
+
+TEST(EspressifTest, ShouldRefuseUartRateOfZero)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    EspressifDevice device(serial, rb, wb, 128);
+    serial.setFlowControl(true);
+    startConnect(device);
+
+    runUntil(device, serial, "AT+UART_CUR?");
+    serial.receive("+UART_CUR:0,8,1,0,0\r\n\r\nOK\r\n");
+    STRNCMP_EQUAL("AT+UART_CUR?", nextCommand(device, serial), 12);
+}
+
+TEST(EspressifTest, ShouldLeaveDataModeForMacAndRssiRequests)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    EspressifDevice device(serial, rb, wb, 128);
+    device.setTransparentMode(true);
+    device.setEscapeGuardTime(500);
+    startConnect(device);
+
+    runUntil(device, serial, "AT+CIPSTART");
+    serial.receive("CONNECT\r\n\r\nOK\r\n");
+    STRCMP_EQUAL("AT+CIPSEND\r\n", nextCommand(device, serial));
+    serial.receive("\r\n>");
+    device.run();
+    device.run();
+    CHECK_TRUE(device.isConnected());
+
+    // The MAC address request escapes from data mode after the guard time
+    device.requestMac();
+    device.run();
+    STRCMP_EQUAL("", serial.sent());
+    CHECK_EQUAL(500, device.delay());
+    device.run();
+    STRCMP_EQUAL("+++", serial.sent());
+    CHECK_EQUAL(500, device.delay());
+
+    STRCMP_EQUAL("AT+CIPSTAMAC?\r\n", nextCommand(device, serial));
+    serial.receive("+CIPSTAMAC:\"12:34:56:78:9a:bc\"\r\nOK\r\n");
+
+    // Then it returns to data mode
+    STRCMP_EQUAL("AT+CIPSEND\r\n", nextCommand(device, serial));
+    serial.receive(">");
+    device.run();
+    device.run();
+    STRCMP_EQUAL("12:34:56:78:9a:bc", device.getMacString());
+
+    // The same for the signal strength
+    device.requestRSSI();
+    device.run();
+    CHECK_EQUAL(500, device.delay());
+    device.run();
+    STRCMP_EQUAL("+++", serial.sent());
+    STRCMP_EQUAL("AT+CWJAP?\r\n", nextCommand(device, serial));
+    serial.receive("+CWJAP:\"ssid\",\"00:11:22:33:44:55\",6,-60\r\nOK\r\n");
+    device.run();
+    device.run();
+    CHECK_EQUAL(-60, device.getRSSI());
+    STRCMP_EQUAL("AT+CIPSEND\r\n", nextCommand(device, serial));
+}
+
+TEST(EspressifTest, ShouldUploadCertificateAndOpenSslConnection)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    EspressifDevice device(serial, rb, wb, 128);
+    device.setCaCertificate("-----CERT-----", 14);
+    device.setSSID("ssid");
+    device.setPassword("secret");
+    device.setHostPort("example.com", 443, IIPCommDevice::SSL);
+    CHECK_TRUE(device.connect());
+
+    char commands[1024] = "";
+    for (int i = 0; i < 30 && !device.isConnected(); i++) {
+        const char* command = nextCommand(device, serial);
+        strcat(commands, command);
+        if (strncmp(command, "AT+SYSFLASH=1", 13) == 0) {
+            serial.receive("\r\n>");
+        } else if (strncmp(command, "AT+CIPSTART", 11) == 0) {
+            serial.receive("CONNECT\r\n\r\nOK\r\n");
+        } else {
+            serial.receive("\r\nOK\r\n");
+        }
+        device.run();
+    }
+    CHECK_TRUE(device.isConnected());
+
+    // The old certificate is erased before the new one is written and used
+    STRCMP_EQUAL("ATE0\r\n"
+                 "AT+CWMODE=1\r\n"
+                 "AT+CWJAP=\"ssid\",\"secret\"\r\n"
+                 "AT+CIPMUX=0\r\n"
+                 "AT+CIPRECVMODE=1\r\n"
+                 "AT+CIPMODE=0\r\n"
+                 "AT+SYSFLASH=0,\"client_ca\"\r\n"
+                 "AT+SYSFLASH=1,\"client_ca\",0,14\r\n"
+                 "-----CERT-----"
+                 "AT+CIPSSLCCONF=2,0,0\r\n"
+                 "AT+CIPSTART=\"SSL\",\"example.com\",443\r\n",
+        commands);
+}
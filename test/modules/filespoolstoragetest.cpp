@@ -0,0 +1,178 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/platform/linux/filespoolstorage.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace Cicada;
+
+TEST_GROUP(FileSpoolStorageTest)
+{
+    // Empty directory for the files of one test, removed again afterwards
+    class TempDirectory
+    {
+      public:
+        TempDirectory()
+        {
+            strcpy(_path, "/tmp/filespoolXXXXXX");
+            CHECK_TRUE(mkdtemp(_path) != NULL);
+        }
+
+        ~TempDirectory()
+        {
+            DIR* dir = opendir(_path);
+            struct dirent* entry;
+            while (dir && (entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] != '.') {
+                    unlink(file(entry->d_name));
+                }
+            }
+            if (dir) {
+                closedir(dir);
+            }
+            rmdir(_path);
+        }
+
+        const char* file(const char* name)
+        {
+            snprintf(_file, sizeof(_file), "%s/%s", _path, name);
+            return _file;
+        }
+
+        bool exists(const char* name)
+        {
+            return access(file(name), F_OK) == 0;
+        }
+
+        char _path[32];
+        char _file[64];
+    };
+
+    static bool append(FileSpoolStorage & storage, const char* head, const char* data)
+    {
+        return storage.append(
+            (const uint8_t*)head, strlen(head), (const uint8_t*)data, strlen(data));
+    }
+};
+
+TEST(FileSpoolStorageTest, ShouldContinueFromStoredHeadAfterReopen)
+{
+    TempDirectory dir;
+    char data[16];
+
+    {
+        FileSpoolStorage storage(dir._path);
+        CHECK_TRUE(storage.open());
+        CHECK_TRUE(storage.isEmpty());
+        CHECK_TRUE(append(storage, "a:", "first"));
+        CHECK_TRUE(append(storage, "b:", "second"));
+        CHECK_TRUE(append(storage, "c:", "third"));
+        CHECK_TRUE(storage.remove());
+    }
+
+    FileSpoolStorage storage(dir._path);
+    CHECK_TRUE(storage.open());
+    CHECK_EQUAL(8, storage.readNext((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("b:second", data, 8);
+    CHECK_EQUAL(7, storage.readNext((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("c:third", data, 7);
+    CHECK_EQUAL(0, storage.readNext((uint8_t*)data, sizeof(data)));
+
+    // New records go after the old ones
+    CHECK_TRUE(append(storage, "d:", "fourth"));
+    CHECK_EQUAL(8, storage.readNext((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("d:fourth", data, 8);
+}
+
+TEST(FileSpoolStorageTest, ShouldStartNewSegmentsAndDeleteFinishedOnes)
+{
+    TempDirectory dir;
+    char data[16];
+
+    // Two records of 2 + 8 bytes fit into a segment
+    FileSpoolStorage storage(dir._path, 24);
+    CHECK_TRUE(storage.open());
+    CHECK_TRUE(append(storage, "1", "2345678"));
+    CHECK_TRUE(append(storage, "a", "bcdefgh"));
+    CHECK_FALSE(dir.exists("00000001.seg"));
+    CHECK_TRUE(append(storage, "A", "BCDEFGH"));
+    CHECK_TRUE(dir.exists("00000000.seg"));
+    CHECK_TRUE(dir.exists("00000001.seg"));
+
+    // Reading crosses into the next segment
+    CHECK_EQUAL(8, storage.readNext((uint8_t*)data, sizeof(data)));
+    CHECK_EQUAL(8, storage.readNext((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("abcdefgh", data, 8);
+    CHECK_EQUAL(8, storage.readNext((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("ABCDEFGH", data, 8);
+
+    // The first segment goes with its last record
+    CHECK_TRUE(storage.remove());
+    CHECK_TRUE(dir.exists("00000000.seg"));
+    CHECK_TRUE(storage.remove());
+    CHECK_FALSE(dir.exists("00000000.seg"));
+
+    // The newest segment stays when it's empty
+    CHECK_TRUE(storage.remove());
+    CHECK_TRUE(storage.isEmpty());
+    CHECK_TRUE(dir.exists("00000001.seg"));
+}
+
+TEST(FileSpoolStorageTest, ShouldLimitNumberOfSegments)
+{
+    TempDirectory dir;
+    char data[16];
+
+    FileSpoolStorage storage(dir._path, 24, 2);
+    CHECK_TRUE(storage.open());
+    CHECK_TRUE(append(storage, "1", "2345678"));
+    CHECK_TRUE(append(storage, "2", "2345678"));
+    CHECK_TRUE(append(storage, "3", "2345678"));
+    CHECK_TRUE(append(storage, "4", "2345678"));
+    CHECK_FALSE(append(storage, "5", "2345678"));
+    CHECK_FALSE(dir.exists("00000002.seg"));
+
+    // Freeing the oldest segment makes room for another one
+    CHECK_TRUE(storage.remove());
+    CHECK_FALSE(append(storage, "5", "2345678"));
+    CHECK_TRUE(storage.remove());
+    CHECK_TRUE(append(storage, "5", "2345678"));
+
+    storage.rewind();
+    CHECK_EQUAL(8, storage.readNext((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("3", data, 1);
+}
+
+TEST(FileSpoolStorageTest, ShouldCutOffTruncatedTailRecord)
+{
+    TempDirectory dir;
+    char data[16];
+
+    {
+        FileSpoolStorage storage(dir._path);
+        CHECK_TRUE(storage.open());
+        CHECK_TRUE(append(storage, "a:", "first"));
+        CHECK_TRUE(append(storage, "b:", "second"));
+    }
+
+    // A crash left only the start of a record of 16 bytes
+    int fd = open(dir.file("00000000.seg"), O_WRONLY | O_APPEND);
+    CHECK_TRUE(fd != -1);
+    CHECK_EQUAL(5, write(fd, "\x00\x10" "c:t", 5));
+    close(fd);
+
+    FileSpoolStorage storage(dir._path);
+    CHECK_TRUE(storage.open());
+    CHECK_EQUAL(7, storage.readNext((uint8_t*)data, sizeof(data)));
+    CHECK_EQUAL(8, storage.readNext((uint8_t*)data, sizeof(data)));
+    CHECK_EQUAL(0, storage.readNext((uint8_t*)data, sizeof(data)));
+
+    // A new record isn't read as the rest of the broken one
+    CHECK_TRUE(append(storage, "c:", "third"));
+    CHECK_EQUAL(7, storage.readNext((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("c:third", data, 7);
+}
@@ -0,0 +1,310 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/httpclient.h"
+#include <cstring>
+
+using namespace Cicada;
+
+TEST_GROUP(HttpClientTest)
+{
+    // Connects right away and passes scripted server data in small pieces
+    class DeviceMock : public IIPCommDevice
+    {
+      public:
+        DeviceMock() :
+            _connected(false), _connects(0), _sentFill(0), _input(NULL), _readStep(7)
+        {
+            _sent[0] = '\0';
+        }
+
+        void setHostPort(const char* host, uint16_t port, ConnectionType type) {}
+
+        bool connect()
+        {
+            _connected = true;
+            _connects++;
+            return true;
+        }
+
+        void disconnect()
+        {
+            _connected = false;
+        }
+
+        bool isConnected()
+        {
+            return _connected;
+        }
+
+        bool isIdle()
+        {
+            return !_connected;
+        }
+
+        void resetStates() {}
+
+        Size bytesAvailable() const
+        {
+            return _input ? strlen(_input) : 0;
+        }
+
+        Size spaceAvailable() const
+        {
+            return _connected ? sizeof(_sent) - 1 - _sentFill : 0;
+        }
+
+        bool writeBufferProcessed() const
+        {
+            return true;
+        }
+
+        Size read(uint8_t* data, Size maxSize)
+        {
+            Size size = bytesAvailable();
+            if (size > maxSize)
+                size = maxSize;
+            if (size > _readStep)
+                size = _readStep;
+            if (size == 0)
+                return 0;
+            memcpy(data, _input, size);
+            _input += size;
+
+            return size;
+        }
+
+        Size write(const uint8_t* data, Size size)
+        {
+            if (size > spaceAvailable())
+                size = spaceAvailable();
+            memcpy(_sent + _sentFill, data, size);
+            _sentFill += size;
+            _sent[_sentFill] = '\0';
+
+            return size;
+        }
+
+        void clearSent()
+        {
+            _sentFill = 0;
+            _sent[0] = '\0';
+        }
+
+        bool _connected;
+        int _connects;
+        char _sent[512];
+        Size _sentFill;
+        const char* _input;
+        Size _readStep;
+    };
+
+    struct Result
+    {
+        char body[128];
+        Size bodySize;
+        char contentType[32];
+        uint16_t doneId[4];
+        uint16_t status[4];
+        bool complete[4];
+        int done;
+    };
+
+    static void onHeader(
+        uint16_t id, uint16_t status, const char* name, const char* value, void* userData)
+    {
+        Result* result = (Result*)userData;
+        if (strcmp(name, "Content-Type") == 0) {
+            strcpy(result->contentType, value);
+        }
+    }
+
+    static void onBody(uint16_t id, const uint8_t* data, Size size, void* userData)
+    {
+        Result* result = (Result*)userData;
+        if (size == 0)
+            return;
+        memcpy(result->body + result->bodySize, data, size);
+        result->bodySize += size;
+        result->body[result->bodySize] = '\0';
+    }
+
+    static void onDone(uint16_t id, uint16_t status, bool complete, void* userData)
+    {
+        Result* result = (Result*)userData;
+        result->doneId[result->done] = id;
+        result->status[result->done] = status;
+        result->complete[result->done] = complete;
+        result->done++;
+    }
+
+    static void runClient(HttpClient & client, int times)
+    {
+        while (times--) {
+            client.run();
+        }
+    }
+};
+
+TEST(HttpClientTest, ShouldDecodeChunkedResponse)
+{
+    DeviceMock device;
+    HttpClient client(device);
+    Result result = {};
+    client.setHost("example.com");
+    client.setCallbacks(onHeader, onBody, onDone, &result);
+
+    uint16_t id = client.get("/data");
+    CHECK(id != 0);
+    runClient(client, 3);
+    STRCMP_EQUAL("GET /data HTTP/1.1\r\nHost: example.com\r\n\r\n", device._sent);
+
+    device._input = "HTTP/1.1 200 OK\r\n"
+                    "Content-Type:  text/plain \r\n"
+                    "Transfer-Encoding: chunked\r\n"
+                    "\r\n"
+                    "5\r\nhello\r\n"
+                    "6;ext=1\r\n world\r\n"
+                    "0\r\n"
+                    "Trailer: x\r\n"
+                    "\r\n";
+    runClient(client, 20);
+
+    STRCMP_EQUAL("hello world", result.body);
+    STRCMP_EQUAL("text/plain", result.contentType);
+    CHECK_EQUAL(1, result.done);
+    CHECK_EQUAL(id, result.doneId[0]);
+    CHECK_EQUAL(200, result.status[0]);
+    CHECK_TRUE(result.complete[0]);
+
+    // The connection stays open for the next request
+    CHECK_TRUE(device._connected);
+    CHECK_EQUAL(0, client.pendingRequests());
+}
+
+TEST(HttpClientTest, ShouldPipelineOnPersistentConnection)
+{
+    DeviceMock device;
+    HttpClient client(device);
+    Result result = {};
+    client.setHost("example.com", 8080);
+    client.setCallbacks(NULL, onBody, onDone, &result);
+    client.setPipelineDepth(2);
+
+    uint16_t first = client.get("/a");
+    uint16_t second = client.get("/b", 100);
+    uint16_t third = client.get("/c");
+    runClient(client, 3);
+
+    // Both requests are sent before the first response
+    STRCMP_EQUAL("GET /a HTTP/1.1\r\nHost: example.com:8080\r\n\r\n"
+                 "GET /b HTTP/1.1\r\nHost: example.com:8080\r\nRange: bytes=100-\r\n\r\n",
+        device._sent);
+
+    device.clearSent();
+    device._input = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nabc"
+                    "HTTP/1.1 206 Partial Content\r\nContent-Length: 2\r\n\r\nde";
+    runClient(client, 20);
+
+    STRCMP_EQUAL("abcde", result.body);
+    CHECK_EQUAL(2, result.done);
+    CHECK_EQUAL(first, result.doneId[0]);
+    CHECK_EQUAL(second, result.doneId[1]);
+    CHECK_EQUAL(206, result.status[1]);
+    STRCMP_EQUAL("GET /c HTTP/1.1\r\nHost: example.com:8080\r\n\r\n", device._sent);
+
+    // The server closes after the response as announced
+    device._input = "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 1\r\n\r\nf";
+    runClient(client, 20);
+    CHECK_EQUAL(3, result.done);
+    CHECK_EQUAL(third, result.doneId[2]);
+    CHECK_FALSE(device._connected);
+    CHECK_EQUAL(1, device._connects);
+}
+
+TEST(HttpClientTest, ShouldResendAfterConnectionLoss)
+{
+    DeviceMock device;
+    HttpClient client(device);
+    Result result = {};
+    client.setHost("example.com");
+    client.setCallbacks(NULL, onBody, onDone, &result);
+
+    client.get("/a");
+    runClient(client, 3);
+    device._connected = false;
+    device.clearSent();
+
+    // Sent again on a new connection
+    runClient(client, 5);
+    CHECK_EQUAL(0, result.done);
+    CHECK_EQUAL(2, device._connects);
+    STRCMP_EQUAL("GET /a HTTP/1.1\r\nHost: example.com\r\n\r\n", device._sent);
+
+    // Without a length, the body ends with the connection
+    device._input = "HTTP/1.0 200 OK\r\n\r\nall of it";
+    runClient(client, 5);
+    CHECK_EQUAL(0, result.done);
+    device._connected = false;
+    client.run();
+    STRCMP_EQUAL("all of it", result.body);
+    CHECK_EQUAL(1, result.done);
+    CHECK_TRUE(result.complete[0]);
+}
+
+TEST(HttpClientTest, ShouldSendPostBodyAndNotRepeatIt)
+{
+    DeviceMock device;
+    HttpClient client(device);
+    Result result = {};
+    client.setHost("example.com", 443, IIPCommDevice::SSL);
+    client.setCallbacks(NULL, NULL, onDone, &result);
+    client.setPipelineDepth(2);
+
+    client.post("/log", "text/plain", (const uint8_t*)"12345", 5);
+    client.get("/a");
+    runClient(client, 3);
+
+    // The GET waits for the response to the POST
+    STRCMP_EQUAL("POST /log HTTP/1.1\r\nHost: example.com\r\n"
+                 "Content-Type: text/plain\r\nContent-Length: 5\r\n\r\n12345",
+        device._sent);
+
+    device._connected = false;
+    client.run();
+    CHECK_EQUAL(1, result.done);
+    CHECK_EQUAL(0, result.status[0]);
+    CHECK_FALSE(result.complete[0]);
+    CHECK_EQUAL(1, client.pendingRequests());
+}
+
+TEST(HttpClientTest, ShouldReadDataArrivingWithClose)
+{
+    DeviceMock device;
+    HttpClient client(device);
+    Result result = {};
+    client.setHost("example.com");
+    client.setCallbacks(NULL, onBody, onDone, &result);
+
+    client.get("/a");
+    runClient(client, 3);
+
+    // The whole response is still in the read buffer when the close is noticed
+    device._input = "HTTP/1.0 200 OK\r\n\r\nthe tail";
+    device._connected = false;
+    client.run();
+    STRCMP_EQUAL("the tail", result.body);
+    CHECK_EQUAL(1, result.done);
+    CHECK_TRUE(result.complete[0]);
+
+    // A response with a length isn't sent again
+    client.get("/b");
+    runClient(client, 4);
+    CHECK_EQUAL(2, device._connects);
+    device._input = "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nlast";
+    device._connected = false;
+    runClient(client, 5);
+    STRCMP_EQUAL("the taillast", result.body);
+    CHECK_EQUAL(2, result.done);
+    CHECK_TRUE(result.complete[1]);
+    CHECK_EQUAL(2, device._connects);
+}
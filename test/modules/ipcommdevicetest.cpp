@@ -0,0 +1,120 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/commdevices/ipcommdevice.h"
+#include <cstring>
+
+using namespace Cicada;
+
+TEST_GROUP(IPCommDeviceTest)
+{
+    // Exposes the buffers, like a driver passing data to and from the modem
+    class IPCommDeviceMock : public IPCommDevice
+    {
+      public:
+        IPCommDeviceMock() : IPCommDevice(_rawReadBuffer, _rawWriteBuffer, 64) {}
+
+        void run() {}
+        void resetStates() {}
+
+        void setConnected()
+        {
+            _connectState = connected;
+        }
+
+        void pushReceived(const char* data, Size size)
+        {
+            if (pushDatagramHeader(size)) {
+                _readBuffer.push((const uint8_t*)data, size);
+            }
+        }
+
+        Size sentDatagram(char* data)
+        {
+            Size size = datagramSize(_writeBuffer);
+            _writeBuffer.skip(DATAGRAM_HEADER_SIZE);
+            return _writeBuffer.pull((uint8_t*)data, size);
+        }
+
+        uint8_t _rawReadBuffer[64];
+        uint8_t _rawWriteBuffer[64];
+    };
+};
+
+TEST(IPCommDeviceTest, ShouldKeepDatagramBoundariesWhenSending)
+{
+    IPCommDeviceMock device;
+    device.setHostPort("localhost", 123, IIPCommDevice::UDP);
+    device.setConnected();
+    char data[64];
+
+    CHECK_EQUAL(62, device.spaceAvailable());
+    CHECK_TRUE(device.sendDatagram((const uint8_t*)"first", 5));
+    CHECK_EQUAL(6, device.write((const uint8_t*)"second", 6));
+    CHECK_EQUAL(47, device.spaceAvailable());
+
+    // Datagrams are queued as a whole or not at all
+    CHECK_FALSE(device.sendDatagram((const uint8_t*)data, 50));
+    CHECK_EQUAL(0, device.write((const uint8_t*)data, 50));
+
+    CHECK_EQUAL(5, device.sentDatagram(data));
+    STRNCMP_EQUAL("first", data, 5);
+    CHECK_EQUAL(6, device.sentDatagram(data));
+    STRNCMP_EQUAL("second", data, 6);
+}
+
+TEST(IPCommDeviceTest, ShouldKeepDatagramBoundariesWhenReceiving)
+{
+    IPCommDeviceMock device;
+    device.setHostPort("localhost", 123, IIPCommDevice::UDP);
+    device.setConnected();
+    uint8_t data[64];
+
+    device.pushReceived("one", 3);
+    device.pushReceived("three", 5);
+    device.pushReceived("truncated", 9);
+
+    CHECK_EQUAL(3, device.bytesAvailable());
+    CHECK_EQUAL(3, device.receiveDatagram(data, sizeof(data)));
+    STRNCMP_EQUAL("one", (const char*)data, 3);
+    CHECK_EQUAL(5, device.bytesAvailable());
+    CHECK_EQUAL(5, device.read(data, sizeof(data)));
+    STRNCMP_EQUAL("three", (const char*)data, 5);
+
+    // The rest of a datagram which doesn't fit is discarded
+    CHECK_EQUAL(5, device.receiveDatagram(data, 5));
+    STRNCMP_EQUAL("trunc", (const char*)data, 5);
+    CHECK_EQUAL(0, device.bytesAvailable());
+    CHECK_EQUAL(0, device.receiveDatagram(data, sizeof(data)));
+}
+
+TEST(IPCommDeviceTest, ShouldTreatTcpAsStream)
+{
+    IPCommDeviceMock device;
+    device.setHostPort("localhost", 80, IIPCommDevice::TCP);
+    device.setConnected();
+
+    CHECK_FALSE(device.sendDatagram((const uint8_t*)"data", 4));
+    CHECK_EQUAL(64, device.spaceAvailable());
+    CHECK_EQUAL(4, device.write((const uint8_t*)"data", 4));
+    CHECK_EQUAL(60, device.spaceAvailable());
+}
+
+TEST(IPCommDeviceTest, ShouldWritePartsAsOneBlock)
+{
+    IPCommDeviceMock device;
+    device.setHostPort("localhost", 123, IIPCommDevice::UDP);
+    device.setConnected();
+    char data[64];
+
+    const ICommDevice::DataPart parts[] = { { (const uint8_t*)"head", 4 },
+        { (const uint8_t*)"payload", 7 } };
+    CHECK_EQUAL(11, device.writeParts(parts, 2));
+    CHECK_EQUAL(11, device.sentDatagram(data));
+    STRNCMP_EQUAL("headpayload", data, 11);
+
+    // On TCP connections, the parts are copied as far as they fit
+    device.setHostPort("localhost", 80, IIPCommDevice::TCP);
+    CHECK_EQUAL(60, device.write((const uint8_t*)data, 60));
+    CHECK_EQUAL(4, device.writeParts(parts, 2));
+    CHECK_EQUAL(0, device.spaceAvailable());
+}
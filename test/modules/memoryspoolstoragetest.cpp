@@ -0,0 +1,91 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/memoryspoolstorage.h"
+#include <cstring>
+
+using namespace Cicada;
+
+TEST_GROUP(MemorySpoolStorageTest)
+{
+    static bool append(MemorySpoolStorage & storage, const char* head, const char* data)
+    {
+        return storage.append(
+            (const uint8_t*)head, strlen(head), (const uint8_t*)data, strlen(data));
+    }
+};
+
+TEST(MemorySpoolStorageTest, ShouldReadRecordsInOrder)
+{
+    uint8_t memory[12 + 32];
+    MemorySpoolStorage storage(memory, sizeof(memory));
+    char data[16];
+
+    CHECK_TRUE(storage.isEmpty());
+    CHECK_EQUAL(0, storage.readNext((uint8_t*)data, sizeof(data)));
+    CHECK_TRUE(append(storage, "a:", "first"));
+    CHECK_TRUE(append(storage, "b:", "second"));
+    CHECK_FALSE(storage.isEmpty());
+
+    CHECK_EQUAL(7, storage.readNext((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("a:first", data, 7);
+    CHECK_EQUAL(8, storage.readNext((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("b:second", data, 8);
+    CHECK_EQUAL(0, storage.readNext((uint8_t*)data, sizeof(data)));
+
+    // Reading doesn't remove anything
+    storage.rewind();
+    CHECK_EQUAL(7, storage.readNext((uint8_t*)data, sizeof(data)));
+    CHECK_TRUE(storage.remove());
+    storage.rewind();
+    CHECK_EQUAL(8, storage.readNext((uint8_t*)data, sizeof(data)));
+    CHECK_TRUE(storage.remove());
+    CHECK_FALSE(storage.remove());
+    CHECK_TRUE(storage.isEmpty());
+}
+
+TEST(MemorySpoolStorageTest, ShouldWrapAroundWhenFull)
+{
+    uint8_t memory[12 + 32];
+    MemorySpoolStorage storage(memory, sizeof(memory));
+    char data[16];
+
+    CHECK_TRUE(append(storage, "1", "234567890"));
+    CHECK_TRUE(append(storage, "a", "bcdefghij"));
+    CHECK_FALSE(append(storage, "x", "yz1234"));
+
+    CHECK_TRUE(storage.remove());
+    CHECK_TRUE(append(storage, "A", "BCDEFGHIJ"));
+    CHECK_EQUAL(10, storage.readNext((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("abcdefghij", data, 10);
+    CHECK_EQUAL(10, storage.readNext((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("ABCDEFGHIJ", data, 10);
+
+    // The rest of a record which doesn't fit is skipped
+    storage.rewind();
+    CHECK_EQUAL(4, storage.readNext((uint8_t*)data, 4));
+    CHECK_EQUAL(10, storage.readNext((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("ABCDEFGHIJ", data, 10);
+}
+
+TEST(MemorySpoolStorageTest, ShouldFindRecordsAfterRestart)
+{
+    uint8_t memory[12 + 32];
+    memset(memory, 0xA5, sizeof(memory));
+    char data[16];
+
+    {
+        MemorySpoolStorage storage(memory, sizeof(memory));
+        CHECK_TRUE(storage.isEmpty());
+        CHECK_TRUE(append(storage, "a:", "first"));
+        CHECK_TRUE(append(storage, "b:", "second"));
+        CHECK_TRUE(storage.remove());
+    }
+
+    MemorySpoolStorage storage(memory, sizeof(memory));
+    CHECK_EQUAL(8, storage.readNext((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("b:second", data, 8);
+    CHECK_EQUAL(0, storage.readNext((uint8_t*)data, sizeof(data)));
+
+    storage.clear();
+    CHECK_TRUE(storage.isEmpty());
+}
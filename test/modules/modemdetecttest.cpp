@@ -0,0 +1,148 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/commdevices/modemdetect.h"
+#include <cstring>
+
+using namespace Cicada;
+
+TEST_GROUP(ModemDetectTest)
+{
+    class SerialMock : public BufferedSerial
+    {
+      public:
+        SerialMock() : BufferedSerial(_rawReadBuffer, _rawWriteBuffer, 256), _baudRate(115200) {}
+
+        bool open()
+        {
+            return true;
+        }
+        void close() {}
+
+        bool isOpen()
+        {
+            return true;
+        }
+
+        bool setSerialConfig(uint32_t baudRate, uint8_t dataBits)
+        {
+            _baudRate = baudRate;
+            return true;
+        }
+
+        const char* portName() const
+        {
+            return NULL;
+        }
+
+        bool rawRead(uint8_t & data)
+        {
+            return false;
+        }
+
+        virtual bool rawWrite(uint8_t data)
+        {
+            return true;
+        }
+
+        virtual void startTransmit() {}
+
+        virtual bool writeBufferProcessed() const
+        {
+            return true;
+        }
+
+        // Data arriving from the modem
+        void receive(const char* data)
+        {
+            _readBuffer.push(data, strlen(data));
+        }
+
+        // Data the modem got since the last call
+        const char* sent()
+        {
+            Size size = _writeBuffer.pull(_sent, sizeof(_sent) - 1);
+            _sent[size] = '\0';
+            return _sent;
+        }
+
+        char _rawReadBuffer[256];
+        char _rawWriteBuffer[256];
+        char _sent[256];
+        uint32_t _baudRate;
+    };
+
+    // Detects a SIM7600 until the baud rate command is sent
+    static void detectSim7x00(ModemDetect & detect, SerialMock & serial)
+    {
+        detect.setBaudRate(921600, 115200);
+        detect.startDetection();
+        detect.run();
+        detect.run();
+        STRCMP_EQUAL("AT+CGMM\r\n", serial.sent());
+
+        serial.receive("SIMCOM_SIM7600E-H\r\n");
+        detect.run();
+        serial.receive("\r\nOK\r\n");
+        detect.run();
+        detect.run();
+        STRCMP_EQUAL("AT+IPR=921600\r\n", serial.sent());
+        CHECK_FALSE(detect.modemDetected());
+    }
+};
+
+TEST(ModemDetectTest, ShouldSwitchToNewBaudRate)
+{
+    SerialMock serial;
+    ModemDetect detect(serial);
+    detectSim7x00(detect, serial);
+
+    // The modem confirms with the old rate, then the serial device follows
+    detect.setLastRun(100);
+    serial.receive("OK\r\n");
+    detect.run();
+    CHECK_EQUAL(921600, serial._baudRate);
+
+    // The probe is answered with the new rate
+    detect.run();
+    STRCMP_EQUAL("AT\r\n", serial.sent());
+    serial.receive("OK\r\n");
+    detect.run();
+    CHECK_TRUE(detect.modemDetected());
+    CHECK_EQUAL(921600, detect.baudRate());
+}
+
+TEST(ModemDetectTest, ShouldRevertWhenProbeFails)
+{
+    SerialMock serial;
+    ModemDetect detect(serial);
+    detectSim7x00(detect, serial);
+
+    detect.setLastRun(100);
+    serial.receive("OK\r\n");
+    detect.run();
+    CHECK_EQUAL(921600, serial._baudRate);
+
+    // No reply to any of the probes
+    for (int i = 0; i < 3; i++) {
+        detect.run();
+        STRCMP_EQUAL("AT\r\n", serial.sent());
+        detect.run();
+        STRCMP_EQUAL("", serial.sent());
+        detect.setLastRun(detect.lastRun() + 301);
+    }
+
+    // The modem is told to switch back with the new rate, in case only its replies got lost
+    detect.run();
+    STRCMP_EQUAL("AT+IPR=115200\r\n", serial.sent());
+    detect.run();
+    CHECK_EQUAL(115200, serial._baudRate);
+
+    // The initial rate is verified as well
+    detect.run();
+    STRCMP_EQUAL("AT\r\n", serial.sent());
+    CHECK_FALSE(detect.modemDetected());
+    serial.receive("OK\r\n");
+    detect.run();
+    CHECK_TRUE(detect.modemDetected());
+    CHECK_EQUAL(115200, detect.baudRate());
+}
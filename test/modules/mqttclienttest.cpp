@@ -0,0 +1,381 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/mqttclient.h"
+#include <cstring>
+
+using namespace Cicada;
+
+TEST_GROUP(MqttClientTest)
+{
+    // Connects right away and passes scripted broker data in small pieces
+    class DeviceMock : public IIPCommDevice
+    {
+      public:
+        DeviceMock() :
+            _connected(false), _sentFill(0), _input(NULL), _inputSize(0), _readStep(3)
+        {}
+
+        void setHostPort(const char* host, uint16_t port, ConnectionType type) {}
+
+        bool connect()
+        {
+            _connected = true;
+            return true;
+        }
+
+        void disconnect()
+        {
+            _connected = false;
+        }
+
+        bool isConnected()
+        {
+            return _connected;
+        }
+
+        bool isIdle()
+        {
+            return !_connected;
+        }
+
+        void resetStates() {}
+
+        Size bytesAvailable() const
+        {
+            return _inputSize;
+        }
+
+        Size spaceAvailable() const
+        {
+            return _connected ? sizeof(_sent) - _sentFill : 0;
+        }
+
+        bool writeBufferProcessed() const
+        {
+            return true;
+        }
+
+        Size read(uint8_t* data, Size maxSize)
+        {
+            Size size = _inputSize < maxSize ? _inputSize : maxSize;
+            if (size > _readStep)
+                size = _readStep;
+            memcpy(data, _input, size);
+            _input += size;
+            _inputSize -= size;
+
+            return size;
+        }
+
+        Size write(const uint8_t* data, Size size)
+        {
+            if (size > spaceAvailable())
+                size = spaceAvailable();
+            memcpy(_sent + _sentFill, data, size);
+            _sentFill += size;
+
+            return size;
+        }
+
+        void receive(const uint8_t* data, Size size)
+        {
+            _input = data;
+            _inputSize = size;
+        }
+
+        bool _connected;
+        uint8_t _sent[256];
+        Size _sentFill;
+        const uint8_t* _input;
+        Size _inputSize;
+        Size _readStep;
+    };
+
+    struct Result
+    {
+        char topic[32];
+        char data[64];
+        Size size;
+        bool last;
+        uint16_t doneId[4];
+        bool success[4];
+        int done;
+    };
+
+    static void onMessage(
+        const char* topic, const uint8_t* data, Size size, bool last, void* userData)
+    {
+        Result* result = (Result*)userData;
+        strcpy(result->topic, topic);
+        memcpy(result->data + result->size, data, size);
+        result->size += size;
+        result->data[result->size] = '\0';
+        result->last = last;
+    }
+
+    static void onDone(uint16_t id, bool success, void* userData)
+    {
+        Result* result = (Result*)userData;
+        result->doneId[result->done] = id;
+        result->success[result->done] = success;
+        result->done++;
+    }
+
+    static void runClient(MqttClient & client, int times)
+    {
+        while (times--) {
+            client.run();
+        }
+    }
+
+    // Connects the client and clears what it has sent
+    static void connectClient(MqttClient & client, DeviceMock & device, Result & result)
+    {
+        static const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+        client.setBroker("broker.example");
+        client.setClientId("c");
+        client.setCallbacks(onMessage, onDone, &result);
+        client.connect();
+        runClient(client, 2);
+        device.receive(connack, sizeof(connack));
+        runClient(client, 2);
+        device._sentFill = 0;
+    }
+};
+
+TEST(MqttClientTest, ShouldConnect)
+{
+    DeviceMock device;
+    MqttClient client(device);
+    client.setBroker("broker.example");
+    client.setClientId("c", "u", "p");
+    client.connect();
+    runClient(client, 2);
+
+    const uint8_t connect[] = { 0x10, 0x13, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0xC2, 0x00, 0x3C,
+        0x00, 0x01, 'c', 0x00, 0x01, 'u', 0x00, 0x01, 'p' };
+    CHECK_EQUAL(sizeof(connect), device._sentFill);
+    MEMCMP_EQUAL(connect, device._sent, sizeof(connect));
+    CHECK_FALSE(client.isConnected());
+
+    const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    device.receive(connack, sizeof(connack));
+    runClient(client, 2);
+    CHECK_TRUE(client.isConnected());
+}
+
+TEST(MqttClientTest, ShouldPublishInOrder)
+{
+    DeviceMock device;
+    MqttClient client(device);
+    Result result = {};
+    connectClient(client, device, result);
+
+    uint16_t first = client.publish("t", (const uint8_t*)"hi", 2, 1);
+    uint16_t second = client.publish("t", (const uint8_t*)"ho", 2, 1);
+    client.run();
+
+    // The second message waits for the acknowledgement of the first one
+    const uint8_t publish[] = { 0x32, 0x07, 0x00, 0x01, 't', 0x00, 0x01, 'h', 'i' };
+    CHECK_EQUAL(sizeof(publish), device._sentFill);
+    MEMCMP_EQUAL(publish, device._sent, sizeof(publish));
+
+    device._sentFill = 0;
+    const uint8_t puback[] = { 0x40, 0x02, 0x00, 0x01 };
+    device.receive(puback, sizeof(puback));
+    runClient(client, 2);
+    CHECK_EQUAL(1, result.done);
+    CHECK_EQUAL(first, result.doneId[0]);
+    CHECK_TRUE(result.success[0]);
+    CHECK_EQUAL(9, device._sentFill);
+    CHECK_EQUAL(0x02, device._sent[6]);
+
+    // QoS 2 needs PUBREL before PUBCOMP
+    device._sentFill = 0;
+    const uint8_t pubrec[] = { 0x50, 0x02, 0x00, 0x02 };
+    device.receive(pubrec, sizeof(pubrec));
+    client.run();
+    CHECK_EQUAL(1, result.done);
+    const uint8_t pubcomp[] = { 0x70, 0x02, 0x00, 0x02 };
+    device.receive(pubcomp, sizeof(pubcomp));
+    client.run();
+    CHECK_EQUAL(1, result.done);
+    CHECK_EQUAL(0, device._sentFill);
+
+    // Wrong QoS for this flow, the message was sent with QoS 1
+    const uint8_t puback2[] = { 0x40, 0x02, 0x00, 0x02 };
+    device.receive(puback2, sizeof(puback2));
+    client.run();
+    CHECK_EQUAL(2, result.done);
+    CHECK_EQUAL(second, result.doneId[1]);
+    CHECK_EQUAL(0, client.pendingRequests());
+}
+
+TEST(MqttClientTest, ShouldCompleteQos2Publish)
+{
+    DeviceMock device;
+    MqttClient client(device);
+    Result result = {};
+    connectClient(client, device, result);
+
+    client.publish("t", (const uint8_t*)"x", 1, 2);
+    client.run();
+    device._sentFill = 0;
+
+    const uint8_t pubrec[] = { 0x50, 0x02, 0x00, 0x01 };
+    device.receive(pubrec, sizeof(pubrec));
+    runClient(client, 2);
+    const uint8_t pubrel[] = { 0x62, 0x02, 0x00, 0x01 };
+    CHECK_EQUAL(sizeof(pubrel), device._sentFill);
+    MEMCMP_EQUAL(pubrel, device._sent, sizeof(pubrel));
+    CHECK_EQUAL(0, result.done);
+
+    const uint8_t pubcomp[] = { 0x70, 0x02, 0x00, 0x01 };
+    device.receive(pubcomp, sizeof(pubcomp));
+    client.run();
+    CHECK_EQUAL(1, result.done);
+    CHECK_TRUE(result.success[0]);
+}
+
+TEST(MqttClientTest, ShouldReceiveMessageInPieces)
+{
+    DeviceMock device;
+    MqttClient client(device);
+    Result result = {};
+    connectClient(client, device, result);
+
+    uint16_t id = client.subscribe("a/#", 1);
+    client.run();
+    const uint8_t subscribe[] = { 0x82, 0x08, 0x00, 0x01, 0x00, 0x03, 'a', '/', '#', 0x01 };
+    CHECK_EQUAL(sizeof(subscribe), device._sentFill);
+    MEMCMP_EQUAL(subscribe, device._sent, sizeof(subscribe));
+    device._sentFill = 0;
+
+    const uint8_t packets[] = { 0x90, 0x03, 0x00, 0x01, 0x01, 0x32, 0x0E, 0x00, 0x03, 'a', '/',
+        'b', 0x00, 0x07, 'p', 'a', 'y', 'l', 'o', 'a', 'd' };
+    device.receive(packets, sizeof(packets));
+    runClient(client, 2);
+
+    CHECK_EQUAL(1, result.done);
+    CHECK_EQUAL(id, result.doneId[0]);
+    CHECK_TRUE(result.success[0]);
+    STRCMP_EQUAL("a/b", result.topic);
+    STRCMP_EQUAL("payload", result.data);
+    CHECK_TRUE(result.last);
+
+    const uint8_t puback[] = { 0x40, 0x02, 0x00, 0x07 };
+    CHECK_EQUAL(sizeof(puback), device._sentFill);
+    MEMCMP_EQUAL(puback, device._sent, sizeof(puback));
+}
+
+TEST(MqttClientTest, ShouldPingAndNoticeLostConnection)
+{
+    DeviceMock device;
+    MqttClient client(device);
+    Result result = {};
+    client.setSessionOptions(10);
+    connectClient(client, device, result);
+
+    client.setLastRun(9999);
+    client.run();
+    CHECK_EQUAL(0, device._sentFill);
+    client.setLastRun(10000);
+    client.run();
+    CHECK_EQUAL(2, device._sentFill);
+    CHECK_EQUAL(0xC0, device._sent[0]);
+
+    // No reply, the message waiting for PUBACK fails
+    client.publish("t", (const uint8_t*)"x", 1, 1);
+    client.setLastRun(20001);
+    client.run();
+    CHECK_FALSE(device._connected);
+    CHECK_FALSE(client.isConnected());
+    CHECK_EQUAL(1, result.done);
+    CHECK_FALSE(result.success[0]);
+
+    // Messages published meanwhile wait for the next connection
+    client.publish("t", (const uint8_t*)"y", 1, 1);
+    client.run();
+    CHECK_EQUAL(1, client.pendingRequests());
+}
+
+TEST(MqttClientTest, ShouldKeepWindowOfMessagesInFlight)
+{
+    DeviceMock device;
+    MqttClient client(device);
+    Result result = {};
+    client.setInFlightWindow(3);
+    connectClient(client, device, result);
+
+    for (int i = 0; i < 4; i++) {
+        client.publish("t", (const uint8_t*)"hi", 2, 1);
+    }
+    client.run();
+
+    // Three messages with their own packet IDs are sent right away
+    CHECK_EQUAL(27, device._sentFill);
+    CHECK_EQUAL(0x01, device._sent[6]);
+    CHECK_EQUAL(0x02, device._sent[15]);
+    CHECK_EQUAL(0x03, device._sent[24]);
+    device._sentFill = 0;
+
+    // Completion is reported in order
+    const uint8_t puback2[] = { 0x40, 0x02, 0x00, 0x02 };
+    device.receive(puback2, sizeof(puback2));
+    client.run();
+    CHECK_EQUAL(0, result.done);
+    CHECK_EQUAL(9, device._sentFill);
+    CHECK_EQUAL(0x04, device._sent[6]);
+
+    const uint8_t puback1[] = { 0x40, 0x02, 0x00, 0x01 };
+    device.receive(puback1, sizeof(puback1));
+    client.run();
+    CHECK_EQUAL(2, result.done);
+    CHECK_EQUAL(1, result.doneId[0]);
+    CHECK_EQUAL(2, result.doneId[1]);
+}
+
+TEST(MqttClientTest, ShouldSendAgainAfterReconnecting)
+{
+    DeviceMock device;
+    MqttClient client(device);
+    Result result = {};
+    client.setInFlightWindow(3);
+    client.setSessionOptions(60, false);
+    connectClient(client, device, result);
+
+    client.publish("t", (const uint8_t*)"hi", 2, 1);
+    client.publish("t", (const uint8_t*)"hi", 2, 2);
+    client.publish("t", (const uint8_t*)"hi", 2, 1);
+    client.run();
+    const uint8_t acks[] = { 0x50, 0x02, 0x00, 0x02, 0x40, 0x02, 0x00, 0x03 };
+    device.receive(acks, sizeof(acks));
+    runClient(client, 2);
+    CHECK_EQUAL(0, result.done);
+
+    device._connected = false;
+    runClient(client, 2);
+    CHECK_FALSE(client.isConnected());
+    CHECK_EQUAL(0, result.done);
+
+    client.setLastRun(5000);
+    runClient(client, 2);
+    device._sentFill = 0;
+    const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    device.receive(connack, sizeof(connack));
+    runClient(client, 2);
+    CHECK_TRUE(client.isConnected());
+
+    // The first message again with DUP, PUBREL for the second one, the third
+    // one has been acknowledged already
+    const uint8_t resent[] = { 0x3A, 0x07, 0x00, 0x01, 't', 0x00, 0x01, 'h', 'i', 0x62, 0x02,
+        0x00, 0x02 };
+    CHECK_EQUAL(sizeof(resent), device._sentFill);
+    MEMCMP_EQUAL(resent, device._sent, sizeof(resent));
+
+    const uint8_t completion[] = { 0x40, 0x02, 0x00, 0x01, 0x70, 0x02, 0x00, 0x02 };
+    device.receive(completion, sizeof(completion));
+    runClient(client, 3);
+    CHECK_EQUAL(3, result.done);
+    CHECK_TRUE(result.success[0] && result.success[1] && result.success[2]);
+}
@@ -0,0 +1,213 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/memoryspoolstorage.h"
+#include "cicada/mqttspool.h"
+#include <cstring>
+
+using namespace Cicada;
+
+TEST_GROUP(MqttSpoolTest)
+{
+    // Connects right away and passes scripted broker data in small pieces
+    class DeviceMock : public IIPCommDevice
+    {
+      public:
+        DeviceMock() :
+            _connected(false), _sentFill(0), _input(NULL), _inputSize(0), _readStep(3)
+        {}
+
+        void setHostPort(const char* host, uint16_t port, ConnectionType type) {}
+
+        bool connect()
+        {
+            _connected = true;
+            return true;
+        }
+
+        void disconnect()
+        {
+            _connected = false;
+        }
+
+        bool isConnected()
+        {
+            return _connected;
+        }
+
+        bool isIdle()
+        {
+            return !_connected;
+        }
+
+        void resetStates() {}
+
+        Size bytesAvailable() const
+        {
+            return _inputSize;
+        }
+
+        Size spaceAvailable() const
+        {
+            return _connected ? sizeof(_sent) - _sentFill : 0;
+        }
+
+        bool writeBufferProcessed() const
+        {
+            return true;
+        }
+
+        Size read(uint8_t* data, Size maxSize)
+        {
+            Size size = _inputSize < maxSize ? _inputSize : maxSize;
+            if (size > _readStep)
+                size = _readStep;
+            memcpy(data, _input, size);
+            _input += size;
+            _inputSize -= size;
+
+            return size;
+        }
+
+        Size write(const uint8_t* data, Size size)
+        {
+            if (size > spaceAvailable())
+                size = spaceAvailable();
+            memcpy(_sent + _sentFill, data, size);
+            _sentFill += size;
+
+            return size;
+        }
+
+        void receive(const uint8_t* data, Size size)
+        {
+            _input = data;
+            _inputSize = size;
+        }
+
+        bool _connected;
+        uint8_t _sent[256];
+        Size _sentFill;
+        const uint8_t* _input;
+        Size _inputSize;
+        Size _readStep;
+    };
+
+    static void onDone(uint16_t id, bool success, void* userData)
+    {
+        ((MqttSpool*)userData)->requestDone(id, success);
+    }
+
+    static void runBoth(MqttClient & client, MqttSpool & spool, int times)
+    {
+        while (times--) {
+            spool.run();
+            client.run();
+        }
+    }
+
+    static void connectClient(MqttClient & client, MqttSpool & spool, DeviceMock & device)
+    {
+        static const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+        client.setBroker("broker.example");
+        client.setClientId("c");
+        client.setCallbacks(NULL, onDone, &spool);
+        client.connect();
+        runBoth(client, spool, 2);
+        device._sentFill = 0;
+        device.receive(connack, sizeof(connack));
+        client.run();
+    }
+};
+
+TEST(MqttSpoolTest, ShouldForwardMessagesAfterConnecting)
+{
+    DeviceMock device;
+    MqttClient client(device);
+    uint8_t memory[128];
+    MemorySpoolStorage storage(memory, sizeof(memory));
+    MqttSpool spool(client, storage);
+    client.setInFlightWindow(2);
+
+    CHECK_TRUE(spool.publish("t", (const uint8_t*)"one", 3));
+    CHECK_TRUE(spool.publish("t", (const uint8_t*)"two", 3));
+    CHECK_TRUE(spool.publish("t", (const uint8_t*)"three", 5, 0));
+    spool.run();
+    CHECK_EQUAL(0, spool.messagesInFlight());
+    CHECK_EQUAL(0, client.pendingRequests());
+
+    // Stored messages go out as fast as the window of the client allows
+    connectClient(client, spool, device);
+    runBoth(client, spool, 1);
+    CHECK_EQUAL(3, spool.messagesInFlight());
+    const uint8_t sent[] = { 0x32, 0x08, 0x00, 0x01, 't', 0x00, 0x01, 'o', 'n', 'e', 0x32, 0x08,
+        0x00, 0x01, 't', 0x00, 0x02, 't', 'w', 'o', 0x30, 0x08, 0x00, 0x01, 't', 't', 'h', 'r',
+        'e', 'e' };
+    CHECK_EQUAL(sizeof(sent), device._sentFill);
+    MEMCMP_EQUAL(sent, device._sent, sizeof(sent));
+
+    const uint8_t pubacks[] = { 0x40, 0x02, 0x00, 0x02, 0x40, 0x02, 0x00, 0x01 };
+    device.receive(pubacks, sizeof(pubacks));
+    runBoth(client, spool, 3);
+    CHECK_EQUAL(0, spool.messagesInFlight());
+    CHECK_TRUE(storage.isEmpty());
+}
+
+TEST(MqttSpoolTest, ShouldSendAgainAfterFailure)
+{
+    DeviceMock device;
+    MqttClient client(device);
+    uint8_t memory[128];
+    MemorySpoolStorage storage(memory, sizeof(memory));
+    MqttSpool spool(client, storage);
+    connectClient(client, spool, device);
+
+    CHECK_TRUE(spool.publish("t", (const uint8_t*)"one", 3));
+    CHECK_TRUE(spool.publish("t", (const uint8_t*)"two", 3));
+    runBoth(client, spool, 1);
+    CHECK_EQUAL(2, spool.messagesInFlight());
+
+    // The first message fails, the second one is still queued in the client
+    device._connected = false;
+    runBoth(client, spool, 2);
+    CHECK_EQUAL(1, spool.messagesInFlight());
+    CHECK_FALSE(storage.isEmpty());
+
+    client.setLastRun(5000);
+    spool.setLastRun(5000);
+    device._sentFill = 0;
+    const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    runBoth(client, spool, 2);
+    device.receive(connack, sizeof(connack));
+    runBoth(client, spool, 1);
+    CHECK_TRUE(client.isConnected());
+
+    // Both messages are sent again once the second one is done
+    const uint8_t puback[] = { 0x40, 0x02, 0x00, 0x02 };
+    device.receive(puback, sizeof(puback));
+    runBoth(client, spool, 2);
+    CHECK_EQUAL(2, spool.messagesInFlight());
+    const uint8_t puback3[] = { 0x40, 0x02, 0x00, 0x03 };
+    device.receive(puback3, sizeof(puback3));
+    runBoth(client, spool, 2);
+    CHECK_EQUAL(1, spool.messagesInFlight());
+    const uint8_t puback4[] = { 0x40, 0x02, 0x00, 0x04 };
+    device.receive(puback4, sizeof(puback4));
+    runBoth(client, spool, 2);
+    CHECK_EQUAL(0, spool.messagesInFlight());
+    CHECK_TRUE(storage.isEmpty());
+}
+
+TEST(MqttSpoolTest, ShouldRefuseMessagesWhichDontFit)
+{
+    DeviceMock device;
+    MqttClient client(device);
+    uint8_t memory[12 + 16];
+    MemorySpoolStorage storage(memory, sizeof(memory));
+    MqttSpool spool(client, storage);
+    uint8_t payload[E_SPOOL_RECORD_SIZE] = {};
+
+    CHECK_FALSE(spool.publish("t", payload, sizeof(payload)));
+    CHECK_FALSE(spool.publish("t", payload, 16));
+    CHECK_TRUE(spool.publish("t", payload, 8));
+    CHECK_FALSE(spool.publish("t", payload, 1, 3));
+}
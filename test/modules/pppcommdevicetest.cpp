@@ -0,0 +1,405 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/commdevices/pppcommdevice.h"
+#include <cstring>
+
+using namespace Cicada;
+
+TEST_GROUP(PppCommDeviceTest)
+{
+    class SerialMock : public BufferedSerial
+    {
+      public:
+        SerialMock() :
+            BufferedSerial(_rawReadBuffer, _rawWriteBuffer, sizeof(_rawReadBuffer),
+                sizeof(_rawWriteBuffer))
+        {}
+
+        bool open()
+        {
+            return true;
+        }
+        void close() {}
+
+        bool isOpen()
+        {
+            return true;
+        }
+
+        bool setSerialConfig(uint32_t baudRate, uint8_t dataBits)
+        {
+            return true;
+        }
+
+        const char* portName() const
+        {
+            return NULL;
+        }
+
+        bool rawRead(uint8_t & data)
+        {
+            return false;
+        }
+
+        virtual bool rawWrite(uint8_t data)
+        {
+            return true;
+        }
+
+        virtual void startTransmit() {}
+
+        virtual bool writeBufferProcessed() const
+        {
+            return true;
+        }
+
+        // Bytes sent to the modem
+        Size sent()
+        {
+            Size size = _writeBuffer.bytesAvailable();
+            _writeBuffer.flush();
+            return size;
+        }
+
+        // Text sent to the modem in command mode
+        const char* command()
+        {
+            Size size = _writeBuffer.pull(_command, sizeof(_command) - 1);
+            _command[size] = '\0';
+            return _command;
+        }
+
+        bool pullSent(uint8_t & data)
+        {
+            return _writeBuffer.pull((char*)&data, 1) == 1;
+        }
+
+        // Data arriving from the modem
+        void receive(const char* data)
+        {
+            _readBuffer.push(data, strlen(data));
+        }
+
+        void receive(uint8_t data)
+        {
+            _readBuffer.push(data);
+        }
+
+        char _rawReadBuffer[1024];
+        char _rawWriteBuffer[2048];
+        char _command[64];
+    };
+
+    // The network side of the link. Decodes the frames sent by the device
+    // and encodes its own with a framer of its own.
+    class Peer
+    {
+      public:
+        Peer(SerialMock & serial) :
+            _serial(serial), _framer(_frameBuffer, sizeof(_frameBuffer)), _localPort(0), _isn(0)
+        {}
+
+        // Runs the device until it sends a frame
+        bool nextFrame(PppCommDevice & device)
+        {
+            for (int i = 0; i < 5; i++) {
+                uint8_t data;
+                while (_serial.pullSent(data)) {
+                    if (_framer.decode(data))
+                        return true;
+                }
+                device.run();
+            }
+
+            return false;
+        }
+
+        uint16_t protocol() const
+        {
+            return _framer.protocol();
+        }
+
+        uint8_t* information()
+        {
+            return _framer.information();
+        }
+
+        Size length() const
+        {
+            return _framer.informationLength();
+        }
+
+        void send(uint16_t protocol, const uint8_t* data, Size length)
+        {
+            _framer.encode(_wire, protocol, data, length);
+            uint8_t byte;
+            while (_wire.pullSent(byte)) {
+                _serial.receive(byte);
+            }
+        }
+
+        void sendControl(
+            uint16_t protocol, uint8_t code, uint8_t id, const uint8_t* options, Size length)
+        {
+            uint8_t packet[64] = { code, id, 0, (uint8_t)(length + 4) };
+            memcpy(packet + 4, options, length);
+            send(protocol, packet, length + 4);
+        }
+
+        // TCP segment from 10.0.0.2:8000 to the device at 10.0.0.1
+        void sendTcp(uint32_t seq, uint32_t ack, uint8_t flags, const char* data)
+        {
+            Size dataLength = strlen(data);
+            Size length = 40 + dataLength;
+            uint8_t packet[128] = { 0x45, 0, 0, (uint8_t)length, 0, 0, 0x40, 0, 64, 6, 0, 0,
+                10, 0, 0, 2, 10, 0, 0, 1 };
+            uint8_t* tcp = packet + 20;
+            put16(tcp, 8000);
+            put16(tcp + 2, _localPort);
+            put32(tcp + 4, seq);
+            put32(tcp + 8, ack);
+            tcp[12] = 5 << 4;
+            tcp[13] = flags;
+            put16(tcp + 14, 4096);
+            memcpy(tcp + 20, data, dataLength);
+
+            put16(packet + 10, checksum(0, packet, 20));
+            uint32_t pseudo = 0x0A00 + 0x0002 + 0x0A00 + 0x0001 + 6 + length - 20;
+            put16(tcp + 16, checksum(pseudo, tcp, length - 20));
+            send(0x0021, packet, length);
+        }
+
+        static void put16(uint8_t * data, uint16_t value)
+        {
+            data[0] = value >> 8;
+            data[1] = value;
+        }
+
+        static void put32(uint8_t * data, uint32_t value)
+        {
+            put16(data, value >> 16);
+            put16(data + 2, value);
+        }
+
+        static uint32_t get32(const uint8_t* data)
+        {
+            return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | (data[2] << 8)
+                | data[3];
+        }
+
+        static uint16_t checksum(uint32_t sum, const uint8_t* data, Size length)
+        {
+            for (Size i = 0; i < length; i += 2) {
+                sum += (data[i] << 8) | (i + 1 < length ? data[i + 1] : 0);
+            }
+            while (sum >> 16) {
+                sum = (sum & 0xFFFF) + (sum >> 16);
+            }
+            return ~sum;
+        }
+
+        SerialMock& _serial;
+        SerialMock _wire;
+        uint8_t _frameBuffer[E_PPP_MRU + 8];
+        PppFramer _framer;
+        uint16_t _localPort;
+        uint32_t _isn;
+    };
+
+    // Passes LCP packets in, like the framer after decoding a frame
+    class PppCommDeviceMock : public PppCommDevice
+    {
+      public:
+        PppCommDeviceMock(IBufferedSerial & serial) :
+            PppCommDevice(serial, _rawReadBuffer, _rawWriteBuffer, 64)
+        {}
+
+        void lcp(uint8_t * packet, Size length)
+        {
+            handleLcp(packet, length);
+        }
+
+        void openLcp()
+        {
+            uint8_t request[] = { 1, 1, 0, 4 };
+            handleLcp(request, sizeof(request));
+            _sendState = linkEstablish;
+            uint8_t ack[] = { 2, _cpId, 0, 4 };
+            handleLcp(ack, sizeof(ack));
+        }
+
+        uint8_t _rawReadBuffer[64];
+        uint8_t _rawWriteBuffer[64];
+    };
+
+    // Dials in and negotiates LCP and IPCP with the peer, up to the SYN
+    static void openLink(PppCommDevice & device, SerialMock & serial, Peer & peer)
+    {
+        device.setApn("internet");
+        device.setHostPort("10.0.0.2", 8000);
+        CHECK_TRUE(device.connect());
+
+        for (int i = 0; i < 20; i++) {
+            device.run();
+            const char* command = serial.command();
+            if (strcmp(command, "ATD*99#\r\n") == 0) {
+                serial.receive("\r\nCONNECT 150000000\r\n");
+                break;
+            } else if (strlen(command) > 0) {
+                serial.receive("\r\nOK\r\n");
+            }
+        }
+
+        // LCP: the device's options are acked, the peer only asks for a magic number
+        CHECK_TRUE(peer.nextFrame(device));
+        CHECK_EQUAL(0xC021, peer.protocol());
+        uint8_t* lcp = peer.information();
+        CHECK_EQUAL(1, lcp[0]);
+        const uint8_t lcpOptions[] = { 1, 4, E_PPP_MRU >> 8, E_PPP_MRU & 0xFF, 2, 6, 0, 0, 0, 0 };
+        MEMCMP_EQUAL(lcpOptions, lcp + 4, sizeof(lcpOptions));
+        peer.sendControl(0xC021, 2, lcp[1], lcp + 4, lcp[3] - 4);
+        const uint8_t magic[] = { 5, 6, 0x11, 0x22, 0x33, 0x44 };
+        peer.sendControl(0xC021, 1, 1, magic, sizeof(magic));
+
+        CHECK_TRUE(peer.nextFrame(device));
+        CHECK_EQUAL(0xC021, peer.protocol());
+        const uint8_t lcpAck[] = { 2, 1, 0, 10, 5, 6, 0x11, 0x22, 0x33, 0x44 };
+        CHECK_EQUAL(sizeof(lcpAck), peer.length());
+        MEMCMP_EQUAL(lcpAck, peer.information(), sizeof(lcpAck));
+
+        // IPCP: the address and DNS servers are assigned with a Configure-Nak
+        CHECK_TRUE(peer.nextFrame(device));
+        CHECK_EQUAL(0x8021, peer.protocol());
+        uint8_t* ipcp = peer.information();
+        const uint8_t ipcpRequest[] = { 1, ipcp[1], 0, 22, 3, 6, 0, 0, 0, 0, 129, 6, 0, 0, 0, 0,
+            131, 6, 0, 0, 0, 0 };
+        CHECK_EQUAL(sizeof(ipcpRequest), peer.length());
+        MEMCMP_EQUAL(ipcpRequest, ipcp, sizeof(ipcpRequest));
+        const uint8_t assigned[] = { 3, 6, 10, 0, 0, 1, 129, 6, 10, 0, 0, 53, 131, 6, 10, 0, 0,
+            54 };
+        peer.sendControl(0x8021, 3, ipcp[1], assigned, sizeof(assigned));
+        const uint8_t peerAddress[] = { 3, 6, 10, 0, 0, 254 };
+        peer.sendControl(0x8021, 1, 1, peerAddress, sizeof(peerAddress));
+
+        CHECK_TRUE(peer.nextFrame(device));
+        CHECK_EQUAL(0x8021, peer.protocol());
+        const uint8_t ipcpAck[] = { 2, 1, 0, 10, 3, 6, 10, 0, 0, 254 };
+        CHECK_EQUAL(sizeof(ipcpAck), peer.length());
+        MEMCMP_EQUAL(ipcpAck, peer.information(), sizeof(ipcpAck));
+
+        CHECK_TRUE(peer.nextFrame(device));
+        CHECK_EQUAL(0x8021, peer.protocol());
+        ipcp = peer.information();
+        CHECK_EQUAL(1, ipcp[0]);
+        CHECK_EQUAL(22, peer.length());
+        MEMCMP_EQUAL(assigned, ipcp + 4, sizeof(assigned));
+        peer.sendControl(0x8021, 2, ipcp[1], ipcp + 4, ipcp[3] - 4);
+
+        // The host is an IP address, so the SYN follows without a DNS query
+        CHECK_TRUE(peer.nextFrame(device));
+        CHECK_EQUAL(0x0021, peer.protocol());
+        uint8_t* ip = peer.information();
+        const uint8_t addresses[] = { 10, 0, 0, 1, 10, 0, 0, 2 };
+        MEMCMP_EQUAL(addresses, ip + 12, sizeof(addresses));
+        CHECK_EQUAL(6, ip[9]);
+        uint8_t* tcp = ip + 20;
+        CHECK_EQUAL(8000, (tcp[2] << 8) | tcp[3]);
+        CHECK_EQUAL(0x02, tcp[13]);
+        peer._localPort = (tcp[0] << 8) | tcp[1];
+        peer._isn = Peer::get32(tcp + 4);
+        CHECK_EQUAL(10 << 24 | 1, device.localIp());
+    }
+
+    // LCP packet with options filling it up to the given length
+    static void buildPacket(uint8_t * packet, uint8_t code, Size length)
+    {
+        memset(packet, 0, length);
+        packet[0] = code;
+        packet[1] = 7;
+        packet[2] = length >> 8;
+        packet[3] = length;
+        for (Size i = 4; i < length; i += 2) {
+            packet[i] = 7;
+            packet[i + 1] = 2;
+        }
+    }
+};
+
+TEST(PppCommDeviceTest, ShouldDropOversizedConfigureRequest)
+{
+    SerialMock serial;
+    PppCommDeviceMock device(serial);
+    uint8_t packet[E_PPP_MRU + 2];
+
+    // The largest information field the frame buffer takes
+    buildPacket(packet, 1, sizeof(packet));
+    device.lcp(packet, sizeof(packet));
+    CHECK_EQUAL(0, serial.sent());
+
+    buildPacket(packet, 1, E_PPP_MRU);
+    device.lcp(packet, E_PPP_MRU);
+    CHECK(serial.sent() > E_PPP_MRU);
+}
+
+TEST(PppCommDeviceTest, ShouldDropOversizedEchoRequest)
+{
+    SerialMock serial;
+    PppCommDeviceMock device(serial);
+    device.openLcp();
+    serial.sent();
+    uint8_t packet[E_PPP_MRU + 2];
+
+    buildPacket(packet, 9, sizeof(packet));
+    device.lcp(packet, sizeof(packet));
+    CHECK_EQUAL(0, serial.sent());
+
+    buildPacket(packet, 9, 8);
+    device.lcp(packet, 8);
+    CHECK(serial.sent() >= 8);
+}
+
+TEST(PppCommDeviceTest, ShouldNegotiateLinkWithPeer)
+{
+    SerialMock serial;
+    Peer peer(serial);
+    PppCommDeviceMock device(serial);
+    openLink(device, serial, peer);
+    CHECK_FALSE(device.isConnected());
+}
+
+TEST(PppCommDeviceTest, ShouldExchangeTcpData)
+{
+    SerialMock serial;
+    Peer peer(serial);
+    PppCommDeviceMock device(serial);
+    openLink(device, serial, peer);
+
+    // The handshake completes with the device's ACK
+    peer.sendTcp(1000, peer._isn + 1, 0x12, "");
+    CHECK_TRUE(peer.nextFrame(device));
+    CHECK_TRUE(device.isConnected());
+    uint8_t* tcp = peer.information() + 20;
+    CHECK_EQUAL(0x10, tcp[13]);
+    CHECK_EQUAL(1001, Peer::get32(tcp + 8));
+
+    // Data go out in a segment of their own
+    CHECK_EQUAL(5, device.write((const uint8_t*)"hello", 5));
+    CHECK_TRUE(peer.nextFrame(device));
+    CHECK_EQUAL(45, peer.length());
+    tcp = peer.information() + 20;
+    CHECK_EQUAL(peer._isn + 1, Peer::get32(tcp + 4));
+    CHECK_EQUAL(0x18, tcp[13]);
+    MEMCMP_EQUAL("hello", tcp + 20, 5);
+
+    // The peer's reply acknowledges them, and is acknowledged in turn
+    peer.sendTcp(1001, peer._isn + 6, 0x18, "world");
+    CHECK_TRUE(peer.nextFrame(device));
+    tcp = peer.information() + 20;
+    CHECK_EQUAL(0x10, tcp[13]);
+    CHECK_EQUAL(1006, Peer::get32(tcp + 8));
+
+    char data[16] = {};
+    CHECK_EQUAL(5, device.read((uint8_t*)data, sizeof(data)));
+    STRCMP_EQUAL("world", data);
+    CHECK_TRUE(device.isConnected());
+}
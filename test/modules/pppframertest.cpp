@@ -0,0 +1,217 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/commdevices/pppframer.h"
+#include "cicada/bufferedserial.h"
+#include <cstring>
+
+using namespace Cicada;
+
+TEST_GROUP(PppFramerTest)
+{
+    class SerialMock : public BufferedSerial
+    {
+      public:
+        SerialMock() :
+            BufferedSerial(_rawReadBuffer, _rawWriteBuffer, 512),
+            _inBufferMock(_rawInBuffer, 512),
+            _outBufferMock(_rawOutBuffer, 512)
+        {}
+
+        bool open()
+        {
+            return true;
+        }
+        void close() {}
+
+        bool isOpen()
+        {
+            return true;
+        }
+
+        bool setSerialConfig(uint32_t baudRate, uint8_t dataBits)
+        {
+            return true;
+        }
+
+        const char* portName() const
+        {
+            return NULL;
+        }
+
+        bool rawRead(uint8_t& data)
+        {
+            if (!_inBufferMock.isEmpty()) {
+                data = _inBufferMock.pull();
+                return true;
+            }
+
+            return false;
+        }
+
+        virtual bool rawWrite(uint8_t data)
+        {
+            if (!_outBufferMock.isFull()) {
+                _outBufferMock.push(data);
+                return true;
+            }
+
+            return false;
+        }
+
+        virtual void startTransmit() {}
+
+        virtual bool writeBufferProcessed() const
+        {
+            return true;
+        }
+
+        char _rawReadBuffer[512];
+        char _rawWriteBuffer[512];
+        char _rawInBuffer[512];
+        char _rawOutBuffer[512];
+        CircularBuffer<char> _inBufferMock;
+        CircularBuffer<char> _outBufferMock;
+    };
+
+    static void transmit(SerialMock & serial)
+    {
+        for (int i = 0; i < 100; i++) {
+            serial.transferToAndFromBuffer();
+        }
+    }
+
+    // Passes everything the framer wrote back into it
+    static bool loopBack(SerialMock & serial, PppFramer & framer)
+    {
+        bool complete = false;
+        transmit(serial);
+        while (!serial._outBufferMock.isEmpty()) {
+            complete = framer.decode(serial._outBufferMock.pull());
+        }
+
+        return complete;
+    }
+
+    static bool decode(PppFramer & framer, const uint8_t* data, Size length)
+    {
+        bool complete = false;
+        for (Size i = 0; i < length; i++) {
+            complete = framer.decode(data[i]);
+        }
+
+        return complete;
+    }
+};
+
+TEST(PppFramerTest, ShouldCalculateFcs)
+{
+    // Check value of the CRC-16/X-25 for "123456789"
+    const char* check = "123456789";
+    uint16_t fcs = PppFramer::fcs16(PPP_INITIAL_FCS, (const uint8_t*)check, 9);
+    CHECK_EQUAL(0x906E, (uint16_t)~fcs);
+
+    // The FCS over data and its own complement yields the good FCS
+    uint8_t data[] = { 0xFF, 0x03, 0xC0, 0x21, 0x00, 0x00 };
+    fcs = ~PppFramer::fcs16(PPP_INITIAL_FCS, data, 4);
+    data[4] = fcs;
+    data[5] = fcs >> 8;
+    CHECK_EQUAL(PPP_GOOD_FCS, PppFramer::fcs16(PPP_INITIAL_FCS, data, sizeof(data)));
+}
+
+TEST(PppFramerTest, ShouldEncodeAndDecodeFrame)
+{
+    SerialMock serial;
+    uint8_t encodeBuffer[64], decodeBuffer[64];
+    PppFramer encoder(encodeBuffer, sizeof(encodeBuffer));
+    PppFramer decoder(decodeBuffer, sizeof(decodeBuffer));
+    const uint8_t data[] = { 0x45, 0x00, 0x7E, 0x7D, 0x01, 0x11, 0x20, 0xFF };
+
+    Size size = encoder.encodedSize(0x0021, data, sizeof(data));
+    encoder.encode(serial, 0x0021, data, sizeof(data));
+    transmit(serial);
+    CHECK_EQUAL(size, serial._outBufferMock.bytesAvailable());
+
+    CHECK_TRUE(loopBack(serial, decoder));
+    CHECK_EQUAL(0x0021, decoder.protocol());
+    CHECK_EQUAL(sizeof(data), decoder.informationLength());
+    MEMCMP_EQUAL(data, decoder.information(), sizeof(data));
+    CHECK_EQUAL(0, decoder.errors());
+}
+
+TEST(PppFramerTest, ShouldEscapeControlCharactersByAccm)
+{
+    SerialMock serial;
+    uint8_t buffer[64];
+    PppFramer framer(buffer, sizeof(buffer));
+    const uint8_t data[] = { 0x01, 0x11, 0x7E };
+
+    // By default, all control characters are escaped, also 0x03 and 0x00 in the header
+    Size escaped = framer.encodedSize(0x0021, data, sizeof(data));
+    framer.setTransmitAccm(0);
+    Size unescaped = framer.encodedSize(0x0021, data, sizeof(data));
+    CHECK_EQUAL(4, escaped - unescaped);
+
+    framer.encode(serial, 0x0021, data, sizeof(data));
+    transmit(serial);
+    char out[32];
+    Size length = serial._outBufferMock.pull(out, sizeof(out));
+    CHECK_EQUAL(unescaped, length);
+    CHECK_EQUAL(0x7E, (uint8_t)out[0]);
+    CHECK_EQUAL(0x7E, (uint8_t)out[length - 1]);
+    CHECK_EQUAL(0x7D, (uint8_t)out[7]);
+    CHECK_EQUAL(0x5E, (uint8_t)out[8]);
+
+    // LCP frames always use the default map
+    framer.encode(serial, 0xC021, data, sizeof(data));
+    transmit(serial);
+    length = serial._outBufferMock.pull(out, sizeof(out));
+    CHECK_EQUAL(0x7D, (uint8_t)out[6]);
+    CHECK_EQUAL(0x21, (uint8_t)out[7]);
+}
+
+TEST(PppFramerTest, ShouldDropFrameWithBadFcs)
+{
+    uint8_t buffer[64];
+    PppFramer framer(buffer, sizeof(buffer));
+    const uint8_t frame[] = { 0x7E, 0xFF, 0x7D, 0x23, 0x00, 0x21, 0x45, 0x12, 0x34, 0x7E };
+
+    CHECK_FALSE(decode(framer, frame, sizeof(frame)));
+    CHECK_EQUAL(1, framer.errors());
+}
+
+TEST(PppFramerTest, ShouldDecodeCompressedFields)
+{
+    uint8_t buffer[64];
+    PppFramer framer(buffer, sizeof(buffer));
+
+    // No address and control field, protocol compressed to one byte
+    uint8_t frame[] = { 0x21, 0x45, 0x00, 0x00, 0x00 };
+    uint16_t fcs = ~PppFramer::fcs16(PPP_INITIAL_FCS, frame, 3);
+    frame[3] = fcs;
+    frame[4] = fcs >> 8;
+
+    framer.setReceiveAccm(0);
+    framer.decode(0x7E);
+    decode(framer, frame, sizeof(frame));
+    CHECK_TRUE(framer.decode(0x7E));
+    CHECK_EQUAL(0x0021, framer.protocol());
+    CHECK_EQUAL(2, framer.informationLength());
+    CHECK_EQUAL(0x45, framer.information()[0]);
+}
+
+TEST(PppFramerTest, ShouldDropOversizedFrame)
+{
+    SerialMock serial;
+    uint8_t encodeBuffer[8], decodeBuffer[8];
+    PppFramer encoder(encodeBuffer, sizeof(encodeBuffer));
+    PppFramer decoder(decodeBuffer, sizeof(decodeBuffer));
+    const uint8_t data[16] = { 0 };
+
+    encoder.encode(serial, 0x0021, data, sizeof(data));
+    CHECK_FALSE(loopBack(serial, decoder));
+    CHECK_EQUAL(1, decoder.errors());
+
+    // The next frame is received again
+    encoder.encode(serial, 0x0021, data, 2);
+    CHECK_TRUE(loopBack(serial, decoder));
+}
@@ -0,0 +1,217 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/commdevices/sim7x00offload.h"
+#include "cicada/bufferedserial.h"
+#include <cstring>
+
+using namespace Cicada;
+
+TEST_GROUP(Sim7x00OffloadTest)
+{
+    class SerialMock : public BufferedSerial
+    {
+      public:
+        SerialMock() : BufferedSerial(_rawReadBuffer, _rawWriteBuffer, 256) {}
+
+        bool open()
+        {
+            return true;
+        }
+        void close() {}
+
+        bool isOpen()
+        {
+            return true;
+        }
+
+        bool setSerialConfig(uint32_t baudRate, uint8_t dataBits)
+        {
+            return true;
+        }
+
+        const char* portName() const
+        {
+            return NULL;
+        }
+
+        bool rawRead(uint8_t & data)
+        {
+            return false;
+        }
+
+        virtual bool rawWrite(uint8_t data)
+        {
+            return true;
+        }
+
+        virtual void startTransmit() {}
+
+        virtual bool writeBufferProcessed() const
+        {
+            return true;
+        }
+
+        // Data arriving from the modem
+        void receive(const char* data)
+        {
+            _readBuffer.push(data, strlen(data));
+        }
+
+        // Data the modem got since the last call
+        const char* sent()
+        {
+            Size size = _writeBuffer.pull(_sent, sizeof(_sent) - 1);
+            _sent[size] = '\0';
+            return _sent;
+        }
+
+        char _rawReadBuffer[256];
+        char _rawWriteBuffer[256];
+        char _sent[256];
+    };
+
+    struct Result
+    {
+        char topic[32];
+        char data[64];
+        Size size;
+        bool last;
+        uint16_t doneId;
+        uint16_t status;
+        bool success;
+        int done;
+    };
+
+    static void onMessage(
+        const char* topic, const uint8_t* data, Size size, bool last, void* userData)
+    {
+        Result* result = (Result*)userData;
+        strcpy(result->topic, topic);
+        memcpy(result->data + result->size, data, size);
+        result->size += size;
+        result->data[result->size] = '\0';
+        result->last = last;
+    }
+
+    // Bodies are only counted
+    static void onBody(uint16_t id, const uint8_t* data, Size size, void* userData)
+    {
+        Result* result = (Result*)userData;
+        result->size += size;
+    }
+
+    static void onDone(uint16_t id, uint16_t status, bool success, void* userData)
+    {
+        Result* result = (Result*)userData;
+        result->doneId = id;
+        result->status = status;
+        result->success = success;
+        result->done++;
+    }
+
+    // Lets the offload send its next command and checks it
+    static void expectCommand(Sim7x00Offload & offload, SerialMock & serial, const char* command)
+    {
+        offload.run();
+        offload.run();
+        STRCMP_EQUAL(command, serial.sent());
+    }
+};
+
+TEST(Sim7x00OffloadTest, ShouldPublishAndReceive)
+{
+    SerialMock serial;
+    Sim7x00Offload offload(serial);
+    Result result = {};
+    offload.setCallbacks(onMessage, NULL, onDone, &result);
+    offload.setBroker("broker.example", 1883, "cicada");
+
+    uint16_t id = offload.publish("a/b", (const uint8_t*)"hello", 5, 1);
+    offload.mqttConnect();
+
+    expectCommand(offload, serial, "AT+CMQTTSTART\r\n");
+    serial.receive("OK\r\n\r\n+CMQTTSTART: 0\r\n");
+    expectCommand(offload, serial, "AT+CMQTTACCQ=0,\"cicada\",0\r\n");
+    serial.receive("OK\r\n");
+    expectCommand(offload, serial, "AT+CMQTTCONNECT=0,\"tcp://broker.example:1883\",60,1\r\n");
+    serial.receive("OK\r\n");
+    offload.run();
+    CHECK_FALSE(offload.mqttConnected());
+    serial.receive("+CMQTTCONNECT: 0,0\r\n");
+    offload.run();
+    CHECK_TRUE(offload.mqttConnected());
+
+    // Topic and payload are sent after the prompts
+    expectCommand(offload, serial, "AT+CMQTTTOPIC=0,3\r\n");
+    serial.receive("\r\n>");
+    offload.run();
+    STRCMP_EQUAL("a/b", serial.sent());
+    serial.receive("OK\r\n");
+    expectCommand(offload, serial, "AT+CMQTTPAYLOAD=0,5\r\n");
+    serial.receive("\r\n>");
+    offload.run();
+    STRCMP_EQUAL("hello", serial.sent());
+    serial.receive("OK\r\n");
+    expectCommand(offload, serial, "AT+CMQTTPUB=0,1,60\r\n");
+    serial.receive("OK\r\n\r\n+CMQTTPUB: 0,0\r\n");
+    offload.run();
+    CHECK_EQUAL(1, result.done);
+    CHECK_EQUAL(id, result.doneId);
+    CHECK_TRUE(result.success);
+    CHECK_TRUE(offload.isIdle());
+
+    // Payloads may contain line ends
+    serial.receive("\r\n+CMQTTRXSTART: 0,3,6\r\n"
+                   "+CMQTTRXTOPIC: 0,3\r\nc/d\r\n"
+                   "+CMQTTRXPAYLOAD: 0,6\r\nab\r\ncd\r\n"
+                   "+CMQTTRXEND: 0\r\n");
+    offload.run();
+    STRCMP_EQUAL("c/d", result.topic);
+    STRCMP_EQUAL("ab\r\ncd", result.data);
+    CHECK_TRUE(result.last);
+}
+
+TEST(Sim7x00OffloadTest, ShouldReadHttpBodyInPieces)
+{
+    SerialMock serial;
+    Sim7x00Offload offload(serial);
+    Result result = {};
+    offload.setCallbacks(NULL, onBody, onDone, &result);
+
+    uint16_t id = offload.httpGet("http://example.com/");
+    expectCommand(offload, serial, "AT+HTTPINIT\r\n");
+    serial.receive("OK\r\n");
+    expectCommand(offload, serial, "AT+HTTPPARA=\"URL\",\"http://example.com/\"\r\n");
+    serial.receive("OK\r\n");
+    expectCommand(offload, serial, "AT+HTTPACTION=0\r\n");
+    serial.receive("OK\r\n\r\n+HTTPACTION: 0,200,600\r\n");
+    expectCommand(offload, serial, "AT+HTTPREAD=0,512\r\n");
+
+    char body[520];
+    memset(body, 'x', 512);
+    body[512] = '\0';
+    serial.receive("OK\r\n\r\n+HTTPREAD: DATA,512\r\n");
+    // More than fits into the serial buffer, passed on while it arrives
+    for (int i = 0; i < 4; i++) {
+        serial.receive(body + 384);
+        offload.run();
+    }
+    serial.receive("\r\n+HTTPREAD: 0\r\n");
+    expectCommand(offload, serial, "AT+HTTPREAD=512,88\r\n");
+    CHECK_EQUAL(512, result.size);
+
+    memset(body, 'y', 88);
+    body[88] = '\0';
+    serial.receive("OK\r\n\r\n+HTTPREAD: DATA,88\r\n");
+    serial.receive(body);
+    serial.receive("\r\n+HTTPREAD: 0\r\n");
+    expectCommand(offload, serial, "AT+HTTPTERM\r\n");
+    serial.receive("OK\r\n");
+    offload.run();
+
+    CHECK_EQUAL(600, result.size);
+    CHECK_EQUAL(1, result.done);
+    CHECK_EQUAL(id, result.doneId);
+    CHECK_EQUAL(200, result.status);
+    CHECK_TRUE(result.success);
+}
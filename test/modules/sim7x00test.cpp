@@ -0,0 +1,515 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/commdevices/sim7x00.h"
+#include <cstring>
+
+using namespace Cicada;
+
+TEST_GROUP(Sim7x00Test)
+{
+    class SerialMock : public BufferedSerial
+    {
+      public:
+        SerialMock() :
+            BufferedSerial(_rawReadBuffer, _rawWriteBuffer, 256), _isOpen(true), _canOpen(true)
+        {}
+
+        bool open()
+        {
+            _isOpen = _canOpen;
+            return _isOpen;
+        }
+        void close()
+        {
+            _isOpen = false;
+        }
+
+        bool isOpen()
+        {
+            return _isOpen;
+        }
+
+        bool setSerialConfig(uint32_t baudRate, uint8_t dataBits)
+        {
+            return true;
+        }
+
+        const char* portName() const
+        {
+            return NULL;
+        }
+
+        bool rawRead(uint8_t & data)
+        {
+            return false;
+        }
+
+        virtual bool rawWrite(uint8_t data)
+        {
+            return true;
+        }
+
+        virtual void startTransmit() {}
+
+        virtual bool writeBufferProcessed() const
+        {
+            return true;
+        }
+
+        // Data arriving from the modem
+        void receive(const char* data)
+        {
+            _readBuffer.push(data, strlen(data));
+        }
+
+        // Data the modem got since the last call
+        const char* sent()
+        {
+            Size size = _writeBuffer.pull(_sent, sizeof(_sent) - 1);
+            _sent[size] = '\0';
+            return _sent;
+        }
+
+        char _rawReadBuffer[256];
+        char _rawWriteBuffer[256];
+        char _sent[256];
+        bool _isOpen;
+        bool _canOpen;
+    };
+
+    // Answers the commands of the connection sequence until the socket is open
+    static void connectSocket(Sim7x00CommDevice & device, SerialMock & serial)
+    {
+        device.setApn("internet");
+        device.setHostPort("192.168.1.1", 8000);
+        CHECK_TRUE(device.connect());
+
+        for (int i = 0; i < 100 && !device.isConnected(); i++) {
+            device.run();
+            const char* command = serial.sent();
+            if (strncmp(command, "AT+NETOPEN", 10) == 0) {
+                serial.receive("OK\r\n\r\n+NETOPEN: 0\r\n");
+            } else if (strncmp(command, "AT+CDNSGIP", 10) == 0) {
+                serial.receive("\r\n+CDNSGIP: 1,\"192.168.1.1\",\"192.168.1.1\"\r\n\r\nOK\r\n");
+            } else if (strncmp(command, "AT+CIPOPEN", 10) == 0) {
+                serial.receive("\r\nOK\r\n\r\n+CIPOPEN: 0,0\r\n");
+            } else if (strlen(command) > 0) {
+                serial.receive("\r\nOK\r\n");
+            }
+        }
+        CHECK_TRUE(device.isConnected());
+    }
+
+    // Runs the device until it sends a command, at most a few times
+    static const char* nextCommand(Sim7x00CommDevice & device, SerialMock & serial)
+    {
+        for (int i = 0; i < 10; i++) {
+            device.run();
+            const char* command = serial.sent();
+            if (strlen(command) > 0)
+                return command;
+        }
+
+        return "";
+    }
+
+    // Answers the commands of the connection sequence until the modem
+    // switched to transparent data mode
+    static void connectDataMode(Sim7x00CommDevice & device, SerialMock & serial)
+    {
+        device.setApn("internet");
+        device.setTransparentMode(true);
+        device.setEscapeGuardTime(500);
+        device.setHostPort("192.168.1.1", 8000);
+        CHECK_TRUE(device.connect());
+
+        for (int i = 0; i < 100 && !device.isConnected(); i++) {
+            device.run();
+            const char* command = serial.sent();
+            if (strncmp(command, "AT+NETOPEN", 10) == 0) {
+                serial.receive("OK\r\n\r\n+NETOPEN: 0\r\n");
+            } else if (strncmp(command, "AT+CDNSGIP", 10) == 0) {
+                serial.receive("\r\n+CDNSGIP: 1,\"192.168.1.1\",\"192.168.1.1\"\r\n\r\nOK\r\n");
+            } else if (strncmp(command, "AT+CIPOPEN", 10) == 0) {
+                STRCMP_EQUAL("AT+CIPOPEN=0,\"TCP\",\"192.168.1.1\",8000\r\n", command);
+                serial.receive("\r\nCONNECT 115200\r\n");
+            } else if (strlen(command) > 0) {
+                serial.receive("\r\nOK\r\n");
+            }
+        }
+        CHECK_TRUE(device.isConnected());
+        device.run();
+    }
+};
+
+TEST(Sim7x00Test, ShouldPassRawDataInDataMode)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    Sim7x00CommDevice device(serial, rb, wb, 128);
+    connectDataMode(device, serial);
+
+    // No AT+CIPSEND or AT+CIPRXGET framing around the payload
+    device.write((const uint8_t*)"hello\r\nOK\r\n", 11);
+    device.run();
+    STRCMP_EQUAL("hello\r\nOK\r\n", serial.sent());
+
+    serial.receive("world\r\nERROR\r\n");
+    device.run();
+    char data[32] = {};
+    CHECK_EQUAL(12, device.read((uint8_t*)data, sizeof(data)));
+    STRCMP_EQUAL("world\r\nERROR", data);
+
+    // A line end could start the close notification, it's passed on a bit later
+    device.setLastRun(device.lastRun() + 51);
+    device.run();
+    CHECK_EQUAL(2, device.read((uint8_t*)data, sizeof(data)));
+    CHECK_TRUE(device.isConnected());
+}
+
+TEST(Sim7x00Test, ShouldEscapeDataModeWithGuardTimes)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    Sim7x00CommDevice device(serial, rb, wb, 128);
+    connectDataMode(device, serial);
+
+    // The line stays idle for the guard time before the escape sequence
+    device.requestRSSI();
+    device.run();
+    STRCMP_EQUAL("", serial.sent());
+    CHECK_EQUAL(500, device.delay());
+
+    // And after it, before the modem acknowledges it
+    device.run();
+    STRCMP_EQUAL("+++", serial.sent());
+    CHECK_EQUAL(500, device.delay());
+    device.run();
+    STRCMP_EQUAL("", serial.sent());
+
+    // Commands are possible in command mode
+    serial.receive("OK\r\n");
+    device.run();
+    STRCMP_EQUAL("AT+CSQ\r\n", serial.sent());
+    serial.receive("+CSQ: 20,99\r\nOK\r\n");
+    device.run();
+    device.run();
+    CHECK_EQUAL(-73, device.getRSSI());
+
+    // Then the modem returns to data mode
+    device.run();
+    STRCMP_EQUAL("ATO\r\n", serial.sent());
+    serial.receive("CONNECT 115200\r\n");
+    device.run();
+    device.run();
+    device.write((const uint8_t*)"more", 4);
+    device.run();
+    STRCMP_EQUAL("more", serial.sent());
+}
+
+TEST(Sim7x00Test, ShouldMistakeClosedNotificationInPayloadForClose)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    Sim7x00CommDevice device(serial, rb, wb, 128);
+    connectDataMode(device, serial);
+
+    // Known limitation: the close notification can't be told apart from payload
+    serial.receive("data\r\nCLOSED\r\nlost");
+    device.run();
+    device.run();
+    CHECK_FALSE(device.isConnected());
+
+    char data[32] = {};
+    CHECK_EQUAL(4, device.read((uint8_t*)data, sizeof(data)));
+    STRCMP_EQUAL("data", data);
+}
+
+TEST(Sim7x00Test, ShouldParseControlPortWhileMainPortIsInLine)
+{
+    SerialMock serial;
+    SerialMock control;
+    uint8_t rb[128], wb[128];
+    Sim7x00CommDevice device(serial, rb, wb, 128);
+    device.setControlSerial(&control);
+    device.setApn("internet");
+    device.setHostPort("192.168.1.1", 8000);
+    CHECK_TRUE(device.connect());
+
+    device.requestRSSI();
+    device.run();
+    device.run();
+    STRCMP_EQUAL("ATE0\r\n", serial.sent());
+    STRCMP_EQUAL("AT+CSQ\r\n", control.sent());
+
+    // The reply on the control port doesn't touch the partial line of the main port
+    serial.receive("O");
+    device.run();
+    control.receive("+CSQ: 20,99\r\nOK\r\n");
+    device.run();
+    CHECK_EQUAL(-73, device.getRSSI());
+
+    serial.receive("K\r\n");
+    device.run();
+    device.run();
+    STRNCMP_EQUAL("AT+CGSOCKCONT", serial.sent(), 13);
+}
+
+TEST(Sim7x00Test, ShouldTimeOutOnControlPort)
+{
+    SerialMock serial;
+    SerialMock control;
+    uint8_t rb[128], wb[128];
+    Sim7x00CommDevice device(serial, rb, wb, 128);
+    device.setControlSerial(&control);
+
+    device.requestRSSI();
+    device.setLastRun(100);
+    device.run();
+    STRCMP_EQUAL("AT+CSQ\r\n", control.sent());
+
+    device.setLastRun(1099);
+    device.run();
+    CHECK_EQUAL(INT16_MAX, device.getRSSI());
+
+    // The main port's longer command timeout doesn't apply
+    device.setLastRun(1100);
+    device.run();
+    CHECK_EQUAL(0, device.getRSSI());
+}
+
+TEST(Sim7x00Test, ShouldOpenControlPortWithMainPort)
+{
+    SerialMock serial;
+    SerialMock control;
+    uint8_t rb[128], wb[128];
+    Sim7x00CommDevice device(serial, rb, wb, 128);
+    device.setControlSerial(&control);
+
+    // While the control port fails to open, the request goes to the main port
+    control.close();
+    control._canOpen = false;
+    device.requestRSSI();
+    device.run();
+    CHECK_FALSE(control.isOpen());
+    STRCMP_EQUAL("AT+CSQ\r\n", serial.sent());
+    serial.receive("+CSQ: 20,99\r\nOK\r\n");
+    device.run();
+    device.run();
+    CHECK_EQUAL(-73, device.getRSSI());
+
+    // Once it opens, the next request uses it
+    control._canOpen = true;
+    device.requestRSSI();
+    device.run();
+    CHECK_TRUE(control.isOpen());
+    STRCMP_EQUAL("AT+CSQ\r\n", control.sent());
+    STRCMP_EQUAL("", serial.sent());
+}
+
+TEST(Sim7x00Test, ShouldPrefetchNextChunkWhileReceiving)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    Sim7x00CommDevice device(serial, rb, wb, 128);
+    connectSocket(device, serial);
+
+    serial.receive("\r\n+CIPRXGET: 1,0\r\n");
+    STRCMP_EQUAL("AT+CIPRXGET=4,0\r\n", nextCommand(device, serial));
+    serial.receive("\r\n+CIPRXGET: 4,0,100\r\n\r\nOK\r\n");
+    STRCMP_EQUAL("AT+CIPRXGET=2,0,100\r\n", nextCommand(device, serial));
+
+    // The modem returns less than requested, and the first part of it
+    serial.receive("\r\n+CIPRXGET: 2,0,40,60\r\n01234567890123456789");
+    device.run();
+    device.run();
+    device.run();
+
+    // The next chunk is requested before the rest arrived and anything was read
+    STRCMP_EQUAL("AT+CIPRXGET=2,0,60\r\n", serial.sent());
+    CHECK_EQUAL(20, device.bytesAvailable());
+
+    serial.receive("abcdefghijabcdefghij\r\nOK\r\n");
+    serial.receive("\r\n+CIPRXGET: 2,0,60,0\r\n");
+    for (int i = 0; i < 6; i++) {
+        serial.receive("ABCDEFGHIJ");
+    }
+    serial.receive("\r\nOK\r\n");
+    for (int i = 0; i < 10; i++) {
+        device.run();
+    }
+    STRCMP_EQUAL("", serial.sent());
+    CHECK_EQUAL(100, device.bytesAvailable());
+}
+
+TEST(Sim7x00Test, ShouldStopPrefetchWhenReadBufferIsFull)
+{
+    SerialMock serial;
+    uint8_t rb[64], wb[64];
+    Sim7x00CommDevice device(serial, rb, wb, 64);
+    connectSocket(device, serial);
+
+    serial.receive("\r\n+CIPRXGET: 1,0\r\n");
+    STRCMP_EQUAL("AT+CIPRXGET=4,0\r\n", nextCommand(device, serial));
+    serial.receive("\r\n+CIPRXGET: 4,0,100\r\n\r\nOK\r\n");
+    STRCMP_EQUAL("AT+CIPRXGET=2,0,64\r\n", nextCommand(device, serial));
+
+    // Only the space left behind the current chunk is requested
+    serial.receive("\r\n+CIPRXGET: 2,0,40,60\r\n01234567890123456789");
+    STRCMP_EQUAL("AT+CIPRXGET=2,0,24\r\n", nextCommand(device, serial));
+
+    serial.receive("abcdefghijabcdefghij\r\nOK\r\n");
+    serial.receive("\r\n+CIPRXGET: 2,0,24,36\r\nABCDEFGHIJ");
+    for (int i = 0; i < 10; i++) {
+        device.run();
+    }
+    serial.receive("ABCDEFGHIJKLMN\r\nOK\r\n");
+
+    // No more requests while the read buffer is full
+    for (int i = 0; i < 10; i++) {
+        device.run();
+        STRCMP_EQUAL("", serial.sent());
+    }
+    CHECK_EQUAL(64, device.bytesAvailable());
+
+    // Reading makes room for the rest
+    uint8_t data[64];
+    CHECK_EQUAL(64, device.read(data, sizeof(data)));
+    STRCMP_EQUAL("AT+CIPRXGET=2,0,36\r\n", nextCommand(device, serial));
+}
+
+TEST(Sim7x00Test, ShouldJoinPushHeaderSplitAcrossReads)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    Sim7x00CommDevice device(serial, rb, wb, 128);
+    device.setPushReceive(true);
+    connectSocket(device, serial);
+
+    serial.receive("\r\nRECV FROM:192.168.1.1:8000\r\n+IP");
+    device.run();
+    device.run();
+    serial.receive("D11\r\nhello");
+    device.run();
+    serial.receive(" world\r\n+IPD3\r\nabc");
+    device.run();
+    device.run();
+    device.run();
+
+    char data[16] = {};
+    CHECK_EQUAL(14, device.read((uint8_t*)data, sizeof(data)));
+    STRCMP_EQUAL("hello worldabc", data);
+    STRCMP_EQUAL("", serial.sent());
+}
+
+TEST(Sim7x00Test, ShouldUploadCertificateAndOpenSslConnection)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    Sim7x00CommDevice device(serial, rb, wb, 128);
+    device.setCaCertificate("-----CERT-----", 14);
+    device.setApn("internet");
+    device.setHostPort("example.com", 443, IIPCommDevice::SSL);
+    CHECK_TRUE(device.connect());
+
+    char commands[1024] = "";
+    for (int i = 0; i < 30 && !device.isConnected(); i++) {
+        const char* command = nextCommand(device, serial);
+        strcat(commands, command);
+        if (strncmp(command, "AT+CCERTDOWN", 12) == 0) {
+            serial.receive("\r\n>");
+        } else if (strcmp(command, "AT+CCHSTART\r\n") == 0) {
+            serial.receive("\r\nOK\r\n\r\n+CCHSTART: 0\r\n");
+        } else if (strncmp(command, "AT+CCHOPEN", 10) == 0) {
+            serial.receive("\r\nOK\r\n\r\n+CCHOPEN: 0,0\r\n");
+        } else {
+            serial.receive("\r\nOK\r\n");
+        }
+        device.run();
+    }
+    CHECK_TRUE(device.isConnected());
+
+    // The certificate follows the prompt of AT+CCERTDOWN
+    STRCMP_EQUAL("ATE0\r\n"
+                 "AT+CGSOCKCONT=1,\"IP\",\"internet\"\r\n"
+                 "AT+CSOCKSETPN=1\r\n"
+                 "AT+CIPMODE=0\r\n"
+                 "AT+CCERTDOWN=\"cicada_ca.pem\",14\r\n"
+                 "-----CERT-----"
+                 "AT+CSSLCFG=\"sslversion\",0,4\r\n"
+                 "AT+CSSLCFG=\"authmode\",0,1\r\n"
+                 "AT+CSSLCFG=\"cacert\",0,\"cicada_ca.pem\"\r\n"
+                 "AT+CSSLCFG=\"enableSNI\",0,1\r\n"
+                 "AT+CCHSET=0,1\r\n"
+                 "AT+CCHSTART\r\n"
+                 "AT+CCHSSLCFG=0,0\r\n"
+                 "AT+CCHOPEN=0,\"example.com\",443,2\r\n",
+        commands);
+}
+
+TEST(Sim7x00Test, ShouldReconnectWithoutBearerSetup)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    Sim7x00CommDevice device(serial, rb, wb, 128);
+    device.setKeepBearer(true);
+    connectSocket(device, serial);
+
+    // Only the socket is closed, the network stays open
+    device.disconnect();
+    STRCMP_EQUAL("AT+CIPCLOSE=0\r\n", nextCommand(device, serial));
+    serial.receive("\r\nOK\r\n\r\n+CIPCLOSE: 0,0\r\n");
+    STRCMP_EQUAL("", nextCommand(device, serial));
+    CHECK_TRUE(device.isIdle());
+
+    // The host address is cached, so the socket is opened right away
+    CHECK_TRUE(device.connect());
+    STRCMP_EQUAL("AT+CIPOPEN=0,\"TCP\",\"192.168.1.1\",8000\r\n", nextCommand(device, serial));
+    serial.receive("\r\nOK\r\n\r\n+CIPOPEN: 0,0\r\n");
+    STRCMP_EQUAL("", nextCommand(device, serial));
+    CHECK_TRUE(device.isConnected());
+}
+
+TEST(Sim7x00Test, ShouldSetUpBearerAgainAfterNetworkClosed)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    Sim7x00CommDevice device(serial, rb, wb, 128);
+    device.setKeepBearer(true);
+    connectSocket(device, serial);
+
+    device.disconnect();
+    STRCMP_EQUAL("AT+CIPCLOSE=0\r\n", nextCommand(device, serial));
+    serial.receive("\r\nOK\r\n\r\n+CIPCLOSE: 0,0\r\n");
+    STRCMP_EQUAL("", nextCommand(device, serial));
+
+    // The network released the bearer
+    serial.receive("\r\n+CIPEVENT: NETWORK CLOSED UNEXPECTEDLY\r\n");
+    STRCMP_EQUAL("", nextCommand(device, serial));
+    CHECK_TRUE(device.isIdle());
+
+    // So the next connection sets it up again
+    CHECK_TRUE(device.connect());
+    char commands[512] = "";
+    for (int i = 0; i < 20 && !device.isConnected(); i++) {
+        const char* command = nextCommand(device, serial);
+        strcat(commands, command);
+        if (strncmp(command, "AT+NETOPEN", 10) == 0) {
+            serial.receive("OK\r\n\r\n+NETOPEN: 0\r\n");
+        } else if (strncmp(command, "AT+CIPOPEN", 10) == 0) {
+            serial.receive("\r\nOK\r\n\r\n+CIPOPEN: 0,0\r\n");
+        } else {
+            serial.receive("\r\nOK\r\n");
+        }
+        device.run();
+    }
+    CHECK_TRUE(device.isConnected());
+    STRCMP_EQUAL("ATE0\r\n"
+                 "AT+CGSOCKCONT=1,\"IP\",\"internet\"\r\n"
+                 "AT+CSOCKSETPN=1\r\n"
+                 "AT+CIPMODE=0\r\n"
+                 "AT+NETOPEN\r\n"
+                 "AT+CIPRXGET=1\r\n"
+                 "AT+CIPOPEN=0,\"TCP\",\"192.168.1.1\",8000\r\n",
+        commands);
+}
@@ -0,0 +1,276 @@
+#include "CppUTest/TestHarness.h"
+
+#include "cicada/commdevices/sim800.h"
+#include <cstring>
+
+using namespace Cicada;
+
+TEST_GROUP(Sim800Test)
+{
+    class SerialMock : public BufferedSerial
+    {
+      public:
+        SerialMock() : BufferedSerial(_rawReadBuffer, _rawWriteBuffer, 256) {}
+
+        bool open()
+        {
+            return true;
+        }
+        void close() {}
+
+        bool isOpen()
+        {
+            return true;
+        }
+
+        bool setSerialConfig(uint32_t baudRate, uint8_t dataBits)
+        {
+            return true;
+        }
+
+        const char* portName() const
+        {
+            return NULL;
+        }
+
+        bool rawRead(uint8_t & data)
+        {
+            return false;
+        }
+
+        virtual bool rawWrite(uint8_t data)
+        {
+            return true;
+        }
+
+        virtual void startTransmit() {}
+
+        virtual bool writeBufferProcessed() const
+        {
+            return true;
+        }
+
+        // Data arriving from the modem
+        void receive(const char* data)
+        {
+            _readBuffer.push(data, strlen(data));
+        }
+
+        // Data the modem got since the last call
+        const char* sent()
+        {
+            Size size = _writeBuffer.pull(_sent, sizeof(_sent) - 1);
+            _sent[size] = '\0';
+            return _sent;
+        }
+
+        char _rawReadBuffer[256];
+        char _rawWriteBuffer[256];
+        char _sent[256];
+    };
+
+    // Runs the device until it sends a command, at most a few times
+    static const char* nextCommand(Sim800CommDevice & device, SerialMock & serial)
+    {
+        for (int i = 0; i < 10; i++) {
+            device.run();
+            const char* command = serial.sent();
+            if (strlen(command) > 0)
+                return command;
+        }
+
+        return "";
+    }
+
+    // Answers the commands of the connection sequence until the socket is open
+    static void connectSocket(Sim800CommDevice & device, SerialMock & serial)
+    {
+        device.setApn("internet");
+        device.setHostPort("192.168.1.1", 8000);
+        CHECK_TRUE(device.connect());
+
+        for (int i = 0; i < 100 && !device.isConnected(); i++) {
+            device.run();
+            const char* command = serial.sent();
+            if (strncmp(command, "AT+CIFSR", 8) == 0) {
+                serial.receive("\r\n10.0.0.5\r\n");
+            } else if (strncmp(command, "AT+CIPSTART", 11) == 0) {
+                STRCMP_EQUAL("AT+CIPSTART=0,\"TCP\",\"192.168.1.1\",8000\r\n", command);
+                serial.receive("\r\nOK\r\n\r\n0, CONNECT OK\r\n");
+            } else if (strlen(command) > 0) {
+                serial.receive("\r\nOK\r\n");
+            }
+        }
+        CHECK_TRUE(device.isConnected());
+    }
+};
+
+TEST(Sim800Test, ShouldPassPushedDataOn)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    Sim800CommDevice device(serial, rb, wb, 128);
+    device.setPushReceive(true);
+    connectSocket(device, serial);
+
+    serial.receive("\r\n+RECEIVE,0,5:\r\nhello");
+    device.run();
+    device.run();
+    char data[16] = {};
+    CHECK_EQUAL(5, device.read((uint8_t*)data, sizeof(data)));
+    STRCMP_EQUAL("hello", data);
+
+    // The next header is parsed again
+    serial.receive("\r\n+RECEIVE,0,3:\r\nabc");
+    device.run();
+    device.run();
+    CHECK_EQUAL(3, device.read((uint8_t*)data, sizeof(data)));
+    STRNCMP_EQUAL("abc", data, 3);
+}
+
+TEST(Sim800Test, ShouldJoinPushHeaderSplitAcrossReads)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    Sim800CommDevice device(serial, rb, wb, 128);
+    device.setPushReceive(true);
+    connectSocket(device, serial);
+
+    serial.receive("\r\n+RECEIVE,0,");
+    device.run();
+    device.run();
+    serial.receive("11:\r\nhello");
+    device.run();
+    serial.receive(" world");
+    device.run();
+
+    char data[16] = {};
+    CHECK_EQUAL(11, device.read((uint8_t*)data, sizeof(data)));
+    STRCMP_EQUAL("hello world", data);
+    STRCMP_EQUAL("", serial.sent());
+}
+
+TEST(Sim800Test, ShouldUploadCertificateAndOpenSslConnection)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    Sim800CommDevice device(serial, rb, wb, 128);
+    device.setCaCertificate("-----CERT-----", 14);
+    device.setApn("internet");
+    device.setHostPort("example.com", 443, IIPCommDevice::SSL);
+    CHECK_TRUE(device.connect());
+
+    char commands[1024] = "";
+    for (int i = 0; i < 30 && !device.isConnected(); i++) {
+        const char* command = nextCommand(device, serial);
+        strcat(commands, command);
+        if (strncmp(command, "AT+FSDEL", 8) == 0) {
+            // The file doesn't exist yet
+            serial.receive("\r\nERROR\r\n");
+        } else if (strncmp(command, "AT+FSWRITE", 10) == 0) {
+            serial.receive("\r\n>");
+        } else if (strncmp(command, "AT+SSLSETCERT", 13) == 0) {
+            serial.receive("\r\nOK\r\n\r\n+SSLSETCERT: 0\r\n");
+        } else if (strcmp(command, "AT+CIFSR\r\n") == 0) {
+            serial.receive("\r\n10.0.0.5\r\n");
+        } else if (strncmp(command, "AT+CDNSGIP", 10) == 0) {
+            serial.receive("\r\nOK\r\n\r\n+CDNSGIP: 1,\"example.com\",\"192.168.1.1\"\r\n");
+        } else if (strncmp(command, "AT+CIPSTART", 11) == 0) {
+            serial.receive("\r\nOK\r\n\r\nCONNECT OK\r\n");
+        } else {
+            serial.receive("\r\nOK\r\n");
+        }
+        device.run();
+    }
+    CHECK_TRUE(device.isConnected());
+
+    // SSL is set up before the file is written, which is then set as the CA certificate
+    STRCMP_EQUAL("ATE0\r\n"
+                 "AT+CIPRXGET=1\r\n"
+                 "AT+CIPMUX=0\r\n"
+                 "AT+CIPQSEND=0\r\n"
+                 "AT+CIPMODE=0\r\n"
+                 "AT+CIPSSL=1\r\n"
+                 "AT+FSDEL=C:\\USER\\cicada_ca.crt\r\n"
+                 "AT+FSCREATE=C:\\USER\\cicada_ca.crt\r\n"
+                 "AT+FSWRITE=C:\\USER\\cicada_ca.crt,0,14,10\r\n"
+                 "-----CERT-----"
+                 "AT+SSLSETCERT=\"C:\\USER\\cicada_ca.crt\"\r\n"
+                 "AT+CSTT=\"internet\"\r\n"
+                 "AT+CIICR\r\n"
+                 "AT+CIFSR\r\n"
+                 "AT+CDNSGIP=\"example.com\"\r\n"
+                 "AT+CIPSTART=\"TCP\",\"192.168.1.1\",443\r\n",
+        commands);
+}
+
+TEST(Sim800Test, ShouldReconnectWithoutBearerSetup)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    Sim800CommDevice device(serial, rb, wb, 128);
+    device.setKeepBearer(true);
+    connectSocket(device, serial);
+
+    // Only the socket is closed
+    device.disconnect();
+    STRCMP_EQUAL("AT+CIPCLOSE=0\r\n", nextCommand(device, serial));
+    serial.receive("\r\n0, CLOSE OK\r\n");
+    STRCMP_EQUAL("", nextCommand(device, serial));
+    CHECK_TRUE(device.isIdle());
+
+    // The next connection starts with opening the socket
+    CHECK_TRUE(device.connect());
+    STRCMP_EQUAL("AT+CIPSTART=0,\"TCP\",\"192.168.1.1\",8000\r\n", nextCommand(device, serial));
+    serial.receive("\r\nOK\r\n\r\n0, CONNECT OK\r\n");
+    STRCMP_EQUAL("", nextCommand(device, serial));
+    CHECK_TRUE(device.isConnected());
+}
+
+TEST(Sim800Test, ShouldSetUpBearerAgainAfterDeactivation)
+{
+    SerialMock serial;
+    uint8_t rb[128], wb[128];
+    Sim800CommDevice device(serial, rb, wb, 128);
+    device.setKeepBearer(true);
+    connectSocket(device, serial);
+
+    device.disconnect();
+    STRCMP_EQUAL("AT+CIPCLOSE=0\r\n", nextCommand(device, serial));
+    serial.receive("\r\n0, CLOSE OK\r\n");
+    STRCMP_EQUAL("", nextCommand(device, serial));
+
+    // The network released the bearer
+    serial.receive("\r\n+PDP: DEACT\r\n");
+    STRCMP_EQUAL("AT+CIPSHUT\r\n", nextCommand(device, serial));
+    serial.receive("\r\nSHUT OK\r\n");
+    STRCMP_EQUAL("", nextCommand(device, serial));
+    CHECK_TRUE(device.isIdle());
+
+    // So the next connection sets it up again
+    CHECK_TRUE(device.connect());
+    char commands[512] = "";
+    for (int i = 0; i < 20 && !device.isConnected(); i++) {
+        const char* command = nextCommand(device, serial);
+        strcat(commands, command);
+        if (strcmp(command, "AT+CIFSR\r\n") == 0) {
+            serial.receive("\r\n10.0.0.5\r\n");
+        } else if (strncmp(command, "AT+CIPSTART", 11) == 0) {
+            serial.receive("\r\nOK\r\n\r\n0, CONNECT OK\r\n");
+        } else {
+            serial.receive("\r\nOK\r\n");
+        }
+        device.run();
+    }
+    CHECK_TRUE(device.isConnected());
+    STRCMP_EQUAL("ATE0\r\n"
+                 "AT+CIPRXGET=1\r\n"
+                 "AT+CIPMUX=1\r\n"
+                 "AT+CIPQSEND=0\r\n"
+                 "AT+CIPMODE=0\r\n"
+                 "AT+CSTT=\"internet\"\r\n"
+                 "AT+CIICR\r\n"
+                 "AT+CIFSR\r\n"
+                 "AT+CIPSTART=0,\"TCP\",\"192.168.1.1\",8000\r\n",
+        commands);
+}